@@ -22,6 +22,7 @@ uniform vec2 windowSize;
 uniform vec2 tilemapSize;
 uniform vec2 lightmapSize;
 uniform float pitch;
+uniform int rowCount; // how many of lValues/rValues are filled in, <= RES_Y / 2
 
 uniform vec2 lValues[RES_Y];
 uniform vec2 rValues[RES_Y];
@@ -45,12 +46,7 @@ vec3 get_tile(vec2 pos) {
 
 void main(void) {
 
-    int yIdx = int(texCoord.y * RES_Y / 2.0);
-
-    if (yIdx == RES_Y) {
-        fragColor = vec4(1.0, 1.0, 0.0, 1.0);
-        return;
-    }
+    int yIdx = min(int(texCoord.y * float(rowCount)), rowCount - 1);
 
     vec2 currentPixelPos = lerp_vec2(lValues[yIdx], rValues[yIdx], texCoord.x);
 
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "asset_loader.c"
+
+// A manifest of made up assets whose decode takes a few ms, like a PNG does. Every one has to get decoded once and
+// finished once, the finishing all on the thread that called Assets_finish(), and with workers it has to take a good
+// deal less than the decoding adds up to. With 0 workers they go through one at a time, in manifest order.
+
+#define ASSETS 60
+#define DECODE_MS 4
+
+typedef struct FakeTarget {
+    int value;
+    int decodes;
+    int finishes;
+    int finish_order;
+} FakeTarget;
+
+FakeTarget targets[ASSETS];
+atomic_int decodes_running = 0;
+int finished_so_far = 0;
+pthread_t loading_thread;
+int wrong_thread = 0;
+
+void fake_decode(Asset *asset) {
+    atomic_fetch_add(&decodes_running, 1);
+
+    FakeTarget *target = asset->target;
+    target->decodes++;
+
+    int *value = malloc(sizeof(int));
+    *value = atoi(asset->path + 6) * 3; // "asset_N"
+    asset->decoded = value;
+    asset->decoded_size = sizeof(int);
+
+    MP_sleep(DECODE_MS);
+    atomic_fetch_sub(&decodes_running, 1);
+}
+
+void fake_finish(Asset *asset) {
+    if (!pthread_equal(pthread_self(), loading_thread)) wrong_thread++;
+
+    FakeTarget *target = asset->target;
+    target->finishes++;
+    target->finish_order = finished_so_far++;
+
+    if (asset->decoded == NULL) {
+        asset->failed = true;
+        return;
+    }
+    target->value = *(int *)asset->decoded;
+    free(asset->decoded);
+    asset->decoded = NULL;
+}
+
+// Loads the manifest with 'workers', fills 'seconds' with how long it took. Returns the failures.
+int load(int workers, double *seconds) {
+    memset(targets, 0, sizeof(targets));
+    finished_so_far = 0;
+    wrong_thread = 0;
+    loading_thread = pthread_self();
+
+    AssetLoader loader = Assets_new();
+    for (int i = 0; i < ASSETS; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "asset_%d", i);
+        Assets_add(&loader, path, fake_decode, fake_finish, &targets[i]);
+    }
+
+    Assets_start(&loader, workers);
+    Assets_finish(&loader);
+    *seconds = loader.total_time;
+
+    int failures = 0;
+    for (int i = 0; i < ASSETS; i++) {
+        FakeTarget *target = &targets[i];
+        if (target->decodes != 1 || target->finishes != 1 || target->value != i * 3) {
+            printf("%d workers: asset %d decoded %d times, finished %d times, came out %d \n", workers, i,
+                target->decodes, target->finishes, target->value);
+            failures++;
+            break;
+        }
+        if (workers == 0 && target->finish_order != i) {
+            printf("No workers, asset %d finished %dth \n", i, target->finish_order);
+            failures++;
+            break;
+        }
+    }
+
+    if (wrong_thread > 0) {
+        printf("%d workers: %d finished on another thread \n", workers, wrong_thread);
+        failures++;
+    }
+    if (atomic_load(&decodes_running) != 0 || atomic_load(&loader.workers_running) != 0) {
+        printf("%d workers: still decoding after Assets_finish() \n", workers);
+        failures++;
+    }
+
+    if (workers == 4) Assets_report(&loader, stdout);
+
+    Assets_free(&loader);
+    return failures;
+}
+
+int check_empty() {
+    AssetLoader loader = Assets_new();
+    Assets_start(&loader, 4);
+    Assets_finish(&loader);
+    Assets_free(&loader);
+    return 0; // it just has to come back
+}
+
+int main() {
+    double serial, parallel;
+
+    int failures = load(0, &serial);
+    failures += load(4, &parallel);
+    failures += check_empty();
+
+    printf("0 workers %.1f ms, 4 workers %.1f ms \n", serial * 1000, parallel * 1000);
+
+    // 5 threads decoding, a generous margin for a busy machine
+    if (parallel > serial * 0.6) {
+        printf("4 workers weren't any faster \n");
+        failures++;
+    }
+
+    if (failures > 0) {
+        printf("FAILED \n");
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}
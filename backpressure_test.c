@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "multiplayer.c"
+
+// Runs a server and a client in this process over loopback with received packets queued, has the client send way
+// more reliable packets than the queue holds while nobody dispatches, and checks the I/O thread stops reading
+// instead of blocking or dropping: every packet arrives once, in order, and it still accepts another client meanwhile.
+
+#define PORT 21156
+#define PACKETS (MP_MESSAGE_QUEUE_SIZE * 8)
+#define STALL_MS 2500 // how long the game "hangs" before it starts dispatching
+
+enum {
+    TEST_EVENT
+};
+
+volatile int received = 0;
+volatile int out_of_order = 0;
+volatile int connected = 0;
+
+void on_connect(SOCKET socket) {
+    connected++;
+}
+
+void on_server_recv(SOCKET socket, MPPacket packet, void *data) {
+    int counter = *(int *)data;
+
+    if (counter != received) {
+        if (out_of_order < 5) printf("Event %d arrived, expected %d \n", counter, received);
+        out_of_order++;
+    }
+    received = counter + 1;
+}
+
+void on_client_recv(MPPacket packet, void *data) {}
+
+bool wait_for(volatile bool *flag, int timeout_ms) {
+    for (int waited = 0; waited < timeout_ms && !*flag; waited += 5) MP_sleep(5);
+    return *flag;
+}
+
+int main(int argc, char *argv[]) {
+    MP_init(PORT);
+    _MP_client_handle_recv = on_client_recv;
+    _MP_server_handle_recv = on_server_recv;
+    _MP_on_client_connected = on_connect;
+    MP_queue_messages();
+
+    MPServer();
+    if (!wait_for(&MP_is_server, 2000)) {
+        printf("Server didn't start \n");
+        return 1;
+    }
+
+    MPClient("127.0.0.1");
+    MP_sleep(200);
+
+    for (int i = 0; i < PACKETS; i++) {
+        MPClient_send((MPPacket){.type = TEST_EVENT, .len = sizeof(int)}, &i);
+    }
+
+    // nobody dispatches, the queue fills up and the server stops reading the client
+    MP_sleep(STALL_MS / 2);
+
+    // the I/O thread should be free to do everything else meanwhile
+    SOCKET other = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    connect(other, (struct sockaddr *)&addr, sizeof(addr));
+
+    double connect_started = MP_time();
+    while (connected < 2 && MP_time() - connect_started < 1) MP_sleep(1);
+    double accept_time = MP_time() - connect_started;
+
+    closesocket(other);
+    MP_sleep(STALL_MS / 2);
+
+    MPIOStats stalled = MP_get_io_stats();
+    printf("Queue holds %d of %d while stalled, another client got accepted in %.1f ms \n", stalled.message_queue_depth, PACKETS, accept_time * 1000);
+
+    double started = MP_time();
+    while (received < PACKETS && MP_time() - started < 10) {
+        if (MP_dispatch_messages() == 0) MP_sleep(1);
+    }
+    printf("Got %d/%d after %.2f s of dispatching \n", received, PACKETS, MP_time() - started);
+
+    MPIOStats stats = MP_get_io_stats();
+    int failures = out_of_order;
+
+    if (received != PACKETS) {
+        printf("Not everything arrived \n");
+        failures++;
+    }
+    if (stats.dropped_queue_full > 0) {
+        printf("%lld packets dropped on a full queue \n", stats.dropped_queue_full);
+        failures++;
+    }
+    if (stalled.message_queue_depth != MP_MESSAGE_QUEUE_SIZE) {
+        printf("The queue never filled up, the test isn't testing anything \n");
+        failures++;
+    }
+    if (connected < 2 || accept_time > 0.1) {
+        printf("Didn't accept a client while the queue was full \n");
+        failures++;
+    }
+
+    if (failures > 0) {
+        printf("FAILED \n");
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "multiplayer.c"
+#include "packets.h"
+#include "globals.h"
+
+// A headless player for load testing: joins a match like the game does and then sends scripted traffic, positions
+// while running circles somewhere in the dungeon, shots and bombs. Builds like the dedicated server:
+//
+//     gcc bot_client.c -o bot_client -I. -ImyLibs -ImyLibs/include/SDL2 -lm -lpthread        (Linux)
+//     gcc bot_client.c -o bot_client.exe -I. -ImyLibs -ImyLibs/include/SDL2 -lws2_32         (Windows)
+//
+//     bot_client [port] [seconds] [positions/s] [shots/s] [bombs/s] [match]
+//
+// Usually started by load_test.c. When it's done it prints what it measured for the driver to pick up:
+//
+//     bot <id> <packets sent> <packets received>
+//     lat <ms> <count>             one per non-empty millisecond bucket, position updates from the other bots
+//     end
+//
+// Positions carry MP_time() as their time, which on one machine is the same clock in every process, so the
+// receiving bot can tell how long the update took through the server.
+
+#define BOT_TPS 60
+#define BOT_SPEED 300.0
+#define BOT_RADIUS 200.0
+#define BOT_CONNECT_TIMEOUT 5.0
+#define BOT_LATENCY_BUCKETS 1000 // 1 ms each, anything slower goes in the last one
+#define BOT_LEASE_LOW 16 // ask for more sync ids when down to this many, a new lease replaces what is left
+
+int bot_id = -1;
+long bot_seed = -1;
+int bot_lease_first = 0, bot_lease_left = 0;
+bool bot_asked_for_lease = false;
+long long bot_sent = 0, bot_received = 0;
+long long bot_latency[BOT_LATENCY_BUCKETS] = {0};
+
+double randf(double min, double max) {
+    return min + ((double)rand() / RAND_MAX) * (max - min);
+}
+
+void bot_on_recv(MPPacket packet, void *data) {
+    bot_received++;
+
+    switch (packet.type) {
+        case PACKET_UPDATE_PLAYER_ID:
+            bot_id = ((struct update_player_id_packet *)data)->id;
+            break;
+        case PACKET_DUNGEON_SEED:
+            bot_seed = ((struct dungeon_seed_packet *)data)->seed;
+            break;
+        case PACKET_SYNC_ID_LEASE: {
+            struct sync_id_lease_packet *lease = data;
+            bot_lease_first = lease->first;
+            bot_lease_left = lease->count;
+            bot_asked_for_lease = false;
+            break;
+        }
+        case PACKET_PLAYER_POS: {
+            struct player_pos_packet *pos = data;
+            if (pos->id == bot_id) break;
+
+            int ms = (int)((MP_time() - pos->time) * 1000);
+            if (ms < 0) ms = 0;
+            if (ms >= BOT_LATENCY_BUCKETS) ms = BOT_LATENCY_BUCKETS - 1;
+            bot_latency[ms]++;
+            break;
+        }
+        case PACKET_HOST_LEFT:
+            fprintf(stderr, "Bot %d: server closed the match \n", bot_id);
+            break;
+    }
+}
+
+void bot_send(MPPacket packet, void *data, bool reliable) {
+    if (reliable) MPClient_send(packet, data);
+    else MPClient_send_unreliable(packet, data);
+    bot_sent++;
+}
+
+int bot_take_sync_id() {
+    if (bot_lease_left <= BOT_LEASE_LOW && !bot_asked_for_lease) {
+        bot_send((MPPacket){.type = PACKET_REQUEST_SYNC_IDS, .len = 0, .is_broadcast = false}, NULL, true);
+        bot_asked_for_lease = true;
+    }
+    if (bot_lease_left == 0) return -1;
+
+    bot_lease_left--;
+    return bot_lease_first++;
+}
+
+int main(int argc, char *argv[]) {
+    int port = argc > 1 ? atoi(argv[1]) : 1155;
+    double seconds = argc > 2 ? atof(argv[2]) : 10;
+    double pos_rate = argc > 3 ? atof(argv[3]) : 10;
+    double shoot_rate = argc > 4 ? atof(argv[4]) : 1;
+    double bomb_rate = argc > 5 ? atof(argv[5]) : 0.2;
+    int match_id = argc > 6 ? atoi(argv[6]) : 0;
+
+    if (port <= 0 || port > 65535 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s [port] [seconds] [positions/s] [shots/s] [bombs/s] [match] \n", argv[0]);
+        return 1;
+    }
+
+    MP_init(port);
+    MP_queue_messages();
+    _MP_client_handle_recv = bot_on_recv;
+    _MP_encode_payload = encode_packet_payload;
+    _MP_decode_payload = decode_packet_payload;
+
+    v2 world_size = {DUNGEON_SIZE * ROOM_WIDTH * TILE_SIZE, DUNGEON_SIZE * ROOM_HEIGHT * TILE_SIZE};
+    Wire_set_world_bounds(v2_mul(world_size, to_vec(-0.5)), v2_mul(world_size, to_vec(1.5)));
+
+    MPClient("127.0.0.1");
+
+    struct join_match_packet join = {.match_id = match_id};
+    bot_send((MPPacket){.type = PACKET_JOIN_MATCH, .len = sizeof(join), .is_broadcast = false}, &join, true);
+
+    double started = MP_time();
+    while (bot_id == -1 || bot_seed == -1) {
+        if (MP_time() - started > BOT_CONNECT_TIMEOUT) {
+            fprintf(stderr, "Bot couldn't join on port %d \n", port);
+            return 1;
+        }
+        MP_dispatch_messages();
+        MP_sleep(1);
+    }
+
+    srand((unsigned)bot_id * 7919 + (unsigned)(MP_time() * 1000));
+    v2 center = {randf(BOT_RADIUS, world_size.x - BOT_RADIUS), randf(BOT_RADIUS, world_size.y - BOT_RADIUS)};
+    double angle = randf(-PI, PI);
+
+    double tick_delta = 1.0 / BOT_TPS;
+    double pos_timer = pos_rate > 0 ? randf(0, 1.0 / pos_rate) : 0; // spread the bots out a bit
+    double shoot_timer = shoot_rate > 0 ? randf(0, 1.0 / shoot_rate) : 0;
+    double bomb_timer = bomb_rate > 0 ? randf(0, 1.0 / bomb_rate) : 0;
+
+    double next_tick = MP_time();
+    double stop_at = next_tick + seconds;
+
+    while (MP_time() < stop_at) {
+        double now = MP_time();
+        if (now < next_tick) {
+            MP_sleep((int)((next_tick - now) * 1000));
+            continue;
+        }
+        next_tick += tick_delta;
+
+        MP_begin_batch();
+        MP_dispatch_messages();
+
+        angle += BOT_SPEED / BOT_RADIUS * tick_delta;
+        v2 pos = {center.x + cos(angle) * BOT_RADIUS, center.y + sin(angle) * BOT_RADIUS};
+        v2 dir = {-sin(angle), cos(angle)};
+
+        pos_timer -= tick_delta;
+        if (pos_rate > 0 && pos_timer <= 0) {
+            pos_timer += 1.0 / pos_rate;
+
+            struct player_pos_packet packet_data = {
+                .time = MP_time(),
+                .color = {255, 255, 255, 255},
+                .pos = pos,
+                .height = 5000,
+                .dir = dir,
+                .id = bot_id
+            };
+            bot_send((MPPacket){.type = PACKET_PLAYER_POS, .len = sizeof(packet_data), .is_broadcast = true}, &packet_data, false);
+        }
+
+        shoot_timer -= tick_delta;
+        if (shoot_rate > 0 && shoot_timer <= 0) {
+            shoot_timer += 1.0 / shoot_rate;
+
+            struct ability_shoot_packet packet_data = {
+                .shooter_id = bot_id,
+                .hit_id = -1,
+                .hit_pos = v2_add(pos, v2_mul(dir, to_vec(500))),
+                .hit_height = 5000,
+                .origin = pos,
+                .dir = dir
+            };
+            bot_send((MPPacket){.type = PACKET_ABILITY_SHOOT, .len = sizeof(packet_data), .is_broadcast = true}, &packet_data, true);
+        }
+
+        bomb_timer -= tick_delta;
+        if (bomb_rate > 0 && bomb_timer <= 0) {
+            bomb_timer += 1.0 / bomb_rate;
+
+            int sync_id = bot_take_sync_id();
+            if (sync_id != -1) {
+                struct ability_bomb_packet packet_data = {
+                    .sync_id = sync_id,
+                    .pos = v2_add(pos, v2_mul(dir, to_vec(15))),
+                    .height = 5000,
+                    .vel = v2_mul(dir, to_vec(1.4)),
+                    .height_vel = 0,
+                    .sender_id = bot_id
+                };
+                bot_send((MPPacket){.type = PACKET_ABILITY_BOMB, .len = sizeof(packet_data), .is_broadcast = true}, &packet_data, true);
+            }
+        }
+
+        MP_end_batch();
+    }
+
+    printf("bot %d %lld %lld \n", bot_id, bot_sent, bot_received);
+    for (int i = 0; i < BOT_LATENCY_BUCKETS; i++) {
+        if (bot_latency[i] > 0) printf("lat %d %lld \n", i, bot_latency[i]);
+    }
+    printf("end \n");
+    fflush(stdout);
+
+    MP_close();
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "server.c"
+
+// Runs matches without playing in them: no window, no GPU, no sound, only the server side of the game.
+// Builds like the tests, no SDL libraries needed:
+//
+//     gcc dedicated_server.c -o dedicated_server -ImyLibs -ImyLibs/include/SDL2 -lm -lpthread      (Linux)
+//     gcc dedicated_server.c -o dedicated_server.exe -ImyLibs -ImyLibs/include/SDL2 -lws2_32       (Windows)
+//
+//     dedicated_server [port] [seed] [workers] [stats.jsonl]
+//
+// One process runs up to SERVER_MAX_MATCHES matches of DEDICATED_PLAYERS_PER_MATCH, opening one whenever everything
+// running is full and closing it when the last player leaves. The seed picks the first match's dungeon, the ones
+// after count up from it, random if it's left out. 'workers' threads tick matches next to the main one, 0 ticks
+// them all on it. The status lines show what each match costs. With a stats file, every status line also appends
+// MP_write_stats_json() to it: traffic per packet type and per connection, round trips, drops.
+//
+// The host's game sends projectile snapshots from its own simulation. That needs the level geometry, which only
+// loads along with the renderer, so here projectiles are left to the clients like before snapshots existed.
+
+#define DEDICATED_TPS 60 // TPS in the game, relays go out at most a tick late
+#define DEDICATED_STATS_INTERVAL 10.0 // seconds between status lines
+#define DEDICATED_PLAYERS_PER_MATCH 8
+
+volatile sig_atomic_t dedicated_running = true;
+
+void on_interrupt(int sig) {
+    dedicated_running = false;
+}
+
+int main(int argc, char *argv[]) {
+    int port = argc > 1 ? atoi(argv[1]) : 1155;
+    long seed = argc > 2 ? atol(argv[2]) : -1;
+    int workers = argc > 3 ? atoi(argv[3]) : 0;
+    const char *stats_path = argc > 4 ? argv[4] : NULL;
+
+    if (port <= 0 || port > 65535 || workers < 0 || workers > SERVER_MAX_WORKERS) {
+        fprintf(stderr, "Usage: %s [port] [seed] [workers (0-%d)] [stats.jsonl] \n", argv[0], SERVER_MAX_WORKERS);
+        return 1;
+    }
+
+    FILE *stats_file = NULL;
+    if (stats_path != NULL) {
+        stats_file = fopen(stats_path, "a");
+        if (stats_file == NULL) {
+            fprintf(stderr, "Couldn't open %s \n", stats_path);
+            return 1;
+        }
+    }
+
+    srand((unsigned)(MP_time() * 1000));
+
+    double tick_delta = 1.0 / DEDICATED_TPS;
+
+    MP_init(port);
+    MP_queue_messages();
+    _MP_encode_payload = encode_packet_payload;
+    _MP_decode_payload = decode_packet_payload;
+    server_init(tick_delta);
+    server_dungeon_seed = seed;
+    server_max_matches = SERVER_MAX_MATCHES;
+    server_players_per_match = DEDICATED_PLAYERS_PER_MATCH;
+    server_start_workers(workers);
+
+    v2 world_size = {TILEMAP_WIDTH * TILE_SIZE, TILEMAP_HEIGHT * TILE_SIZE};
+    Wire_set_world_bounds(v2_mul(world_size, to_vec(-0.5)), v2_mul(world_size, to_vec(1.5)));
+
+    MPServer();
+
+    double started = MP_time();
+    while (!MP_is_server) {
+        if (MP_time() - started > 5) {
+            fprintf(stderr, "Couldn't start the server on port %d \n", port);
+            return 1;
+        }
+        MP_sleep(1);
+    }
+
+    printf("Dedicated server on port %d, %d workers \n", port, workers);
+
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
+
+    double next_tick = MP_time();
+    double next_stats = next_tick + DEDICATED_STATS_INTERVAL;
+    MPIOStats last_stats = MP_get_io_stats();
+    MatchStats last_match_stats[SERVER_MAX_MATCHES] = {0};
+    int last_match_ids[SERVER_MAX_MATCHES] = {0};
+
+    while (dedicated_running) {
+        double now = MP_time();
+
+        if (now < next_tick) {
+            MP_sleep((int)((next_tick - now) * 1000));
+            continue;
+        }
+
+        next_tick += tick_delta;
+        if (now - next_tick > 1) next_tick = now; // stalled, don't try to catch up on all of it
+
+        MP_begin_batch();
+        MP_dispatch_messages();
+        server_tick(tick_delta, NULL);
+        MP_end_batch();
+
+        if (now >= next_stats) {
+            MPIOStats stats = MP_get_io_stats();
+            double elapsed = DEDICATED_STATS_INTERVAL + (now - next_stats);
+
+            printf("%d players in %d matches, %.1f KB/s out, %.1f KB/s in \n",
+                MP_clients_amount,
+                server_matches_amount(),
+                (stats.bytes_sent - last_stats.bytes_sent) / elapsed / 1024,
+                (stats.bytes_received - last_stats.bytes_received) / elapsed / 1024
+            );
+
+            // between ticks, so no worker is in a match right now
+            for (int i = 0; i < SERVER_MAX_MATCHES; i++) {
+                Match *match = &server_matches[i];
+                if (match->id == 0) continue;
+
+                MatchStats last = last_match_ids[i] == match->id ? last_match_stats[i] : (MatchStats){0};
+
+                printf("    match %d: %d players, %.2f%% cpu, %.0f packets/s in, %.0f out, %.0f KB, %lld hits rejected \n",
+                    match->id,
+                    match->players_amount,
+                    100 * (match->stats.cpu_time - last.cpu_time) / elapsed,
+                    (match->stats.packets_in - last.packets_in) / elapsed,
+                    (match->stats.packets_out - last.packets_out) / elapsed,
+                    match_memory_usage(match) / 1024.0,
+                    match->stats.hits_rejected
+                );
+
+                last_match_stats[i] = match->stats;
+                last_match_ids[i] = match->id;
+            }
+
+            if (stats_file != NULL) MP_write_stats_json(stats_file, packet_names, PACKETS_END);
+
+            last_stats = stats;
+            next_stats = now + DEDICATED_STATS_INTERVAL;
+        }
+    }
+
+    printf("Shutting down \n");
+
+    MPServer_send((MPPacket){.type = PACKET_HOST_LEFT, .len = 0, .is_broadcast = true}, NULL);
+    MP_sleep(100); // give the I/O thread a moment to get it out
+    MP_close();
+
+    if (stats_file != NULL) fclose(stats_file);
+
+    return 0;
+}
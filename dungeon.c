@@ -0,0 +1,156 @@
+#ifndef DUNGEON_C
+#define DUNGEON_C
+
+#include <stdbool.h>
+#include "core_utils.c"
+#include "globals.h"
+#include "mystring.c"
+#include "vec2.c"
+
+// The room layout of a dungeon: which rooms there are and which ones have a way between them.
+// Only needs the seed, so the dedicated server gets the same layout as the clients without loading anything.
+// Filling the tilemap from the room files is build_level() in the game.
+
+typedef struct Room {
+    v2 room_idx; // 0, 0 -> 3, 3
+    String room_file_name;
+    bool is_start, is_boss;
+
+    struct Room *left, *right, *up, *down;
+    v2 left_entrance_pos, right_entrance_pos, top_entrance_pos, bottom_entrance_pos;
+
+    bool initialized;
+} Room;
+
+// #ROOMGEN
+
+Room Room_new(v2 pos) {
+    Room room;
+    room.room_idx = pos;
+    room.left = NULL;
+    room.right = NULL;
+    room.down = NULL;
+    room.up = NULL;
+    room.is_start = false;
+    room.is_boss = false;
+    room.room_file_name = StringRef("test_room.hcroom"); // load_room() picks the real one
+    room.initialized = true;
+
+
+    return room;
+}
+
+void generate_room_recursive(Room rooms[DUNGEON_SIZE][DUNGEON_SIZE], Room *room_ptr, bool visited[DUNGEON_SIZE][DUNGEON_SIZE]) {
+    visited[(int)room_ptr->room_idx.y][(int)room_ptr->room_idx.x] = true;
+    // generated_count++;
+
+    v2 current = room_ptr->room_idx;
+
+    v2 dirs[4] = {V2_LEFT, V2_RIGHT, V2_UP, V2_DOWN};
+    const int LEFT = 0;
+    const int RIGHT = 1;
+    const int UP = 2;
+    const int DOWN = 3;
+    int dir_indicies[4] = {LEFT, RIGHT, UP, DOWN};
+
+    shuffle_array(dir_indicies, 4);
+
+
+    for (int i = 0; i < 4; i++) {
+        int dir_idx = dir_indicies[i];
+        v2 dir = dirs[dir_idx];
+
+
+        v2 pos = v2_add(current, dir);
+        if (!in_range(pos.x, 0, DUNGEON_SIZE - 1) || !in_range(pos.y, 0, DUNGEON_SIZE - 1)) continue;
+        if (visited[(int)pos.y][(int)pos.x]) {
+            return;
+        }
+
+        rooms[(int)pos.y][(int)pos.x] = Room_new(pos);
+        visited[(int)pos.y][(int)pos.x] = true;
+
+        Room *new_ref = &rooms[(int)pos.y][(int)pos.x];
+        
+        switch (dir_idx) {
+            case 0:
+                room_ptr->left = new_ref;
+                new_ref->right = room_ptr;
+                break;
+            case 1:
+                room_ptr->right = new_ref;
+                new_ref->left = room_ptr;
+                break;
+            case 2:
+                room_ptr->up = new_ref;
+                new_ref->down = room_ptr;
+                break;
+            case 3:
+                room_ptr->down = new_ref;
+                new_ref->up = room_ptr;
+                break;
+            default:
+                printf("Uh oh \n");
+                break;
+        }
+
+        generate_room_recursive(rooms, new_ref, visited);
+    }
+}
+
+// Into the caller's 'rooms', seeding 'rng' and drawing from it. The caller owns both, so the dedicated server's matches
+// and the game's level build can each generate one at the same time. build_level() carries on with the same stream,
+// so the rooms it picks match too.
+void generate_dungeon(Room rooms[DUNGEON_SIZE][DUNGEON_SIZE], RNG *rng, long seed) {
+    
+    Room empty_room = {0};
+    memset(rooms, 0, sizeof(Room) * DUNGEON_SIZE * DUNGEON_SIZE);
+
+    RNG_seed(rng, seed);
+    RNG *previous_rng = RNG_use(rng);
+
+    bool visited[DUNGEON_SIZE][DUNGEON_SIZE] = {0};
+
+
+    // for multiplayer testing
+    Room start_room = Room_new(V2_ZERO);//Room_new((v2){randi_range(0, DUNGEON_SIZE - 1), randi_range(0, DUNGEON_SIZE - 1)});
+
+    start_room.is_start = true;
+
+    rooms[(int)start_room.room_idx.y][(int)start_room.room_idx.x] = start_room;
+
+    Room *start_room_ptr = &rooms[(int)start_room.room_idx.y][(int)start_room.room_idx.x];
+    
+    generate_room_recursive(rooms, start_room_ptr, visited);
+
+
+    v2 dirs[4] = {V2_LEFT, V2_RIGHT, V2_UP, V2_DOWN};
+
+    for (int i = 0; i < 4; i++) {
+        v2 pos = v2_add(start_room.room_idx, dirs[i]);
+        if (in_range(pos.x, 0, DUNGEON_SIZE - 1) && in_range(pos.y, 0, DUNGEON_SIZE - 1)) {
+            if (!struct_equal(Room, rooms[(int)pos.y][(int)pos.x], empty_room)) {
+
+                Room *room = &rooms[(int)pos.y][(int)pos.x];
+
+                if (v2_equal(dirs[i], V2_LEFT)) {
+                    start_room_ptr->left = room;
+                    room->right = start_room_ptr;
+                } else if (v2_equal(dirs[i], V2_RIGHT)) {
+                    start_room_ptr->right = room;
+                    room->left = start_room_ptr;
+                } else if (v2_equal(dirs[i], V2_UP)) {
+                    start_room_ptr->up = room;
+                    room->down = start_room_ptr;
+                } else {
+                    start_room_ptr->down = room;
+                    room->up = start_room_ptr;
+                }
+            }
+        }
+    }
+
+    RNG_use(previous_rng);
+}
+
+#endif
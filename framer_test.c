@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "multiplayer.c"
+
+// Replays one recorded packet stream through MP_deframe() cut into random TCP-like segments
+// and checks every frame comes out whole, in order and unchanged.
+
+#define PACKET_COUNT 3000
+#define ITERATIONS 500
+#define MAX_PAYLOAD MP_MAX_PAYLOAD
+
+typedef struct Recorded {
+    MPPacket header;
+    int offset; // payload position in the stream
+} Recorded;
+
+char *stream;
+int stream_len;
+Recorded recorded[PACKET_COUNT];
+
+typedef struct Expect {
+    int next;
+    bool failed;
+} Expect;
+
+// sizes the game actually sends, plus the odd big one
+int payload_size() {
+    int common[] = {0, 4, 8, 12, 16, 24, 32, 40, 48};
+    if (rand() % 20 == 0) return rand() % (MAX_PAYLOAD + 1);
+    if (rand() % 50 == 0) return MAX_PAYLOAD;
+    return common[rand() % (sizeof(common) / sizeof(int))];
+}
+
+void record_stream() {
+    stream = malloc(PACKET_COUNT * MP_DEFAULT_BUFFER_SIZE);
+    stream_len = 0;
+
+    for (int i = 0; i < PACKET_COUNT; i++) {
+        // a few big and negative types so the varints get longer than a byte
+        int type = rand() % 10 == 0 ? rand() - RAND_MAX / 2 : rand() % 64;
+        MPPacket header = {.len = payload_size(), .type = type, .is_broadcast = rand() % 2};
+
+        stream_len += MP_encode_header(header, (unsigned char *)stream + stream_len);
+
+        recorded[i].header = header;
+        recorded[i].offset = stream_len;
+
+        for (int j = 0; j < header.len; j++) {
+            stream[stream_len++] = (char)(i * 31 + j * 7);
+        }
+    }
+}
+
+bool check_frame(MPPacket packet, void *data, void *ctx) {
+    Expect *expect = ctx;
+
+    if (expect->next >= PACKET_COUNT) {
+        printf("Got more frames than were sent \n");
+        expect->failed = true;
+        return false;
+    }
+
+    Recorded *r = &recorded[expect->next];
+
+    if (packet.len != r->header.len || packet.type != r->header.type || packet.is_broadcast != r->header.is_broadcast) {
+        printf("Frame %d header mismatch: len %d type %d, expected len %d type %d \n", expect->next, packet.len, packet.type, r->header.len, r->header.type);
+        expect->failed = true;
+        return false;
+    }
+    if (memcmp(data, stream + r->offset, packet.len) != 0) {
+        printf("Frame %d payload mismatch \n", expect->next);
+        expect->failed = true;
+        return false;
+    }
+
+    expect->next++;
+    return true;
+}
+
+bool replay(int capacity) {
+    RingBuffer rb = RB_new(capacity, MP_DEFAULT_BUFFER_SIZE);
+    Expect expect = {0};
+
+    int fed = 0;
+    while (fed < stream_len && !expect.failed) {
+        // anything from a single byte to a few coalesced packets
+        int segment = rand() % 4 == 0 ? 1 + rand() % 16 : 1 + rand() % (MP_DEFAULT_BUFFER_SIZE * 2);
+        if (segment > stream_len - fed) segment = stream_len - fed;
+
+        int written = 0;
+        while (written < segment && !expect.failed) {
+            written += RB_write(&rb, stream + fed + written, segment - written);
+
+            if (MP_deframe(&rb, check_frame, &expect) == MP_DEFRAME_CORRUPT) {
+                printf("Stream reported corrupt at frame %d \n", expect.next);
+                expect.failed = true;
+            }
+        }
+        fed += segment;
+    }
+
+    if (!expect.failed && (expect.next != PACKET_COUNT || RB_length(&rb) != 0)) {
+        printf("Only got %d/%d frames, %d bytes left over \n", expect.next, PACKET_COUNT, RB_length(&rb));
+        expect.failed = true;
+    }
+
+    RB_free(&rb);
+    return !expect.failed;
+}
+
+bool nop_frame(MPPacket packet, void *data, void *ctx) {
+    return true;
+}
+
+bool corrupt_is_rejected(int len) {
+    RingBuffer rb = RB_new(MP_READ_BUFFER_SIZE, MP_DEFAULT_BUFFER_SIZE);
+    MPPacket header = {.len = len, .type = 1};
+    unsigned char encoded[MP_MAX_HEADER_SIZE];
+    RB_write(&rb, encoded, MP_encode_header(header, encoded));
+
+    bool rejected = MP_deframe(&rb, nop_frame, NULL) == MP_DEFRAME_CORRUPT;
+
+    RB_free(&rb);
+    return rejected;
+}
+
+int main(int argc, char *argv[]) {
+    srand(argc > 1 ? atoi(argv[1]) : 42);
+
+    record_stream();
+    printf("Recorded %d packets, %d bytes \n", PACKET_COUNT, stream_len);
+
+    int failures = 0;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        // small rings wrap all the time, which is the interesting part
+        int capacity = MP_DEFAULT_BUFFER_SIZE + rand() % (MP_READ_BUFFER_SIZE - MP_DEFAULT_BUFFER_SIZE + 1);
+        if (!replay(capacity)) {
+            printf("Iteration %d failed (capacity %d) \n", i, capacity);
+            failures++;
+        }
+    }
+
+    if (!corrupt_is_rejected(-1)) { printf("Negative length accepted \n"); failures++; }
+    if (!corrupt_is_rejected(MAX_PAYLOAD + 1)) { printf("Oversized length accepted \n"); failures++; }
+    if (corrupt_is_rejected(MAX_PAYLOAD)) { printf("Max size frame rejected \n"); failures++; }
+
+    // a varint that never ends
+    RingBuffer rb = RB_new(MP_READ_BUFFER_SIZE, MP_DEFAULT_BUFFER_SIZE);
+    unsigned char garbage[MP_MAX_HEADER_SIZE];
+    memset(garbage, 0xFF, sizeof(garbage));
+    RB_write(&rb, garbage, sizeof(garbage));
+    if (MP_deframe(&rb, nop_frame, NULL) != MP_DEFRAME_CORRUPT) { printf("Endless varint accepted \n"); failures++; }
+    RB_free(&rb);
+
+    if (failures > 0) {
+        printf("FAILED \n");
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}
@@ -1,8 +1,14 @@
+#ifndef GLOBALS_H
+#define GLOBALS_H
+
+#include "vec2.c"
 
 
 // #define TILEMAP_WIDTH 60
 // #define TILEMAP_HEIGHT 40
 
+#define REFERENCE_TPS 144 // gameplay constants were tuned per-frame at this rate
+
 #define ROOM_WIDTH 30
 #define ROOM_HEIGHT 20
 
@@ -11,6 +17,10 @@
 #define TILEMAP_WIDTH 60
 #define TILEMAP_HEIGHT 40
 
+#define TILE_SIZE (1024 / 30) // world units per tile, WINDOW_WIDTH / 30 in the game
+
+#define PLAYER_COLLIDER_RADIUS 8
+
 typedef enum Placeable {
     P_IDK = -1,
     P_WALL_START,
@@ -49,3 +59,4 @@ typedef struct SaveData {
     SaveType type;
 } SaveData;
 
+#endif
@@ -5,25 +5,48 @@
 
 #include "game_utils.c"
 #include "globals.h"
+#include "dungeon.c"
 #include "ui.c"
 #include "mystring.c"
 #include "multiplayer.c"
 #include <iphlpapi.h>
 #include "reusable_threads.c"
 #include "input.c"
+#include "frame_pacer.c"
+#include "camera.c"
+#include "wire.c"
+#include "snapshot.c"
+#include "interp_buffer.c"
+#include "relevance.c"
+#include "replay.c"
+#include "asset_loader.c"
+#include "packets.h"
+#include "server.c"
 
 // #DEFINITIONS
 
 #define DEBUG_FLAG true
-#define TPS 300
+#define TPS 60
 #define FPS 300
 #define WINDOW_WIDTH 1024
 #define WINDOW_HEIGHT 580
 
 // ^^^ The two most OG lines of the project ^^^
 
-#define RESOLUTION_X 720
-#define RESOLUTION_Y 360
+#define MAX_TICKS_PER_FRAME 8 // past this the simulation drops time instead of spiraling
+#define MENU_FPS 60 // render rate while nothing in the world needs to look smooth
+#define FRAME_PACING_HYBRID false // spin the last ~1ms before a deadline for lower jitter, costs a core, --spin-pacing
+
+// dynamic resolution
+#define TARGET_FRAME_TIME (1.0 / 120) // render() time we try to stay under
+#define MIN_RENDER_SCALE 0.4
+#define RENDER_SCALE_DOWN_STEP 0.1
+#define RENDER_SCALE_UP_STEP 0.05
+#define RENDER_SCALE_DOWN_AFTER 0.5 // seconds over budget before dropping
+#define RENDER_SCALE_UP_AFTER 2.0 // seconds well under budget before raising
+
+#define RESOLUTION_X 720 // max, the actual amount of columns is render_resolution_x
+#define RESOLUTION_Y 360 // max, the actual amount is render_resolution_y
 #define X_SENSITIVITY .1
 #define Y_SENSITIVITY .8
 #define COLOR_BLACK \
@@ -35,9 +58,16 @@
 #define MAX_LIGHT 9
 #define BAKED_LIGHT_RESOLUTION 36
 #define BAKED_LIGHT_CALC_RESOLUTION 8
-#define CLIENT_UPDATE_RATE 20
-#define SERVER_TICK_RATE 40
-#define PLAYER_COLLIDER_RADIUS 8
+#define CLIENT_UPDATE_RATE 10 // player_pos_packets per second, remote players are interpolated so this can be low
+#define SYNC_ID_LEASE_LOW 16 // ask for the next block when we're down to this many
+#define NET_STATS_INTERVAL 1.0 // seconds between net overlay updates, and lines in the stats file
+#define NET_STATS_FILE "net_stats.jsonl"
+#define REPLAY_REPORT_EVERY 600 // ticks between progress lines while replaying
+#define ASSET_REPORT_FILE "asset_load.txt" // every asset's load time, from the last start
+#define MAX_ASSET_WORKERS 8
+#define LEVEL_BUILD_BAKE_START 350 // permille of the level build, the bake's most of it
+#define LEVEL_BUILD_BAKE_END 900
+#define LEVEL_MAX_LIGHTS (TILEMAP_WIDTH * TILEMAP_HEIGHT * 2) // a floor and a ceiling light on every tile
 #define NODE_MAX_SIZE 512
 #define MAX_PACKET_SIZE 1024
 
@@ -66,109 +96,6 @@
 #define instanceof(type, parent_type) (type >= parent_type && type <= parent_type##_END)
 #define node(thing) ((Node *)thing)
 #define await(cond) while (!cond) { }
-#define struct_equal(type, s1, s2) (!strncmp(&s1, &s2, sizeof(type)))
-
-// #PACKETS
-enum PacketTypes {
-    PACKET_UPDATE_PLAYER_ID,
-    PACKET_PLAYER_POS,
-    PACKET_PLAYER_JOINED,
-    PACKET_DUNGEON_SEED,
-    PACKET_REQUEST_DUNGEON_SEED,
-    PACKET_ABILITY_SHOOT,
-    PACKET_HOST_LEFT,
-    PACKET_PLAYER_LEFT,
-    PACKET_PLAYER_TOOK_DAMAGE,
-    PACKET_REQUEST_CREATE_NODE,
-    PACKET_SEND_SYNC_ID,
-    PACKET_SYNC_PROJECTILE,
-
-    PACKETS_TO_SYNC,
-
-        PACKET_ABILITY_BOMB,
-        PACKET_ABILITY_FORCEFIELD,
-        PACKET_ABILITY_SWITCHSHOT,
-
-    PACKETS_TO_SYNC_END,
-    PACKET_SWITCH_POSITIONS,
-    PACKETS_END
-};
-
-struct switch_positions_packet {
-    int id1;
-    v2 pos1;
-    double h1;
-    int id2;
-    v2 pos2;
-    double h2;
-};
-
-struct ability_switchshot_packet {
-    int sync_id;
-    v2 pos;
-    double height;
-    v2 vel;
-    double h_vel;
-    int sender_id;
-};
-
-struct ability_forcefield_packet {
-    int sync_id;
-    v2 pos;
-    double height;
-    v2 vel;
-    double h_vel;
-    int sender_id;
-};
-
-struct sync_projectile_packet {
-    v2 pos, vel;
-    double height, h_vel;
-    int sync_id;
-};
-
-struct send_sync_id_packet {
-    int sync_id;
-};
-
-struct ability_bomb_packet {
-    int sync_id;
-    v2 pos;
-    double height;
-    v2 vel;
-    double height_vel;
-    int sender_id;
-};
-
-struct player_left_packet {
-    int id;
-};
-
-struct ability_shoot_packet {
-    int shooter_id;
-    int hit_id;
-    v2 hit_pos;
-    double hit_height;
-};
-
-struct dungeon_seed_packet {
-    long seed;
-};
-
-struct player_pos_packet {
-    SDL_Color color;
-    v2 pos; // 16
-    double height; // 8
-    v2 dir;
-    int id; // 4
-    bool crouching;
-    // 4 padding
-};
-
-struct player_joined_packet {
-    int id;
-    // ... more stuff later, maybe?
-};
 
 enum Tiles { WALL1 = 1, WALL2 = 2 };
 
@@ -303,6 +230,14 @@ DEF_STRUCT(Node, NODE, {
         v2 pos;
         v2 size;
         double height;
+
+        // transform at the start of the current tick, render lerps from it
+        v2 prev_pos;
+        double prev_height;
+        // the real (simulated) transform, stashed while rendering interpolated
+        v2 tick_pos;
+        double tick_height;
+        bool has_prev_transform;
     });
 
 
@@ -344,8 +279,7 @@ DEF_STRUCT(Node, NODE, {
 
             DEF_STRUCT(PlayerEntity, PLAYER_ENTITY, {
                 Entity entity;
-                v2 desired_pos;
-                double desired_height;
+                InterpBuffer interp; // player_pos_packets, played back a bit behind
                 v2 dir;
                 int id;
                 bool crouching;
@@ -367,6 +301,7 @@ DEF_STRUCT(Node, NODE, {
                 void (*on_destruction)(struct Projectile *);
 
                 int shooter_id;
+                unsigned int snap_stamp; // of the last snapshot applied to it, 0 = none yet
             });
 
             END_STRUCT(PROJECTILE);
@@ -527,23 +462,79 @@ typedef struct RenderObject {
     bool isnull;
 } RenderObject;
 
+// what the last frame was rendered from, so identical frames can skip raycasting
+typedef struct CameraPose {
+    v2 pos;
+    double angle;
+    double tan_half_fov;
+    double player_height;
+    double pitch;
+    v2 offset;
+    int columns;
+    int rows;
+    int tilemap_version;
+} CameraPose;
+
+// a block of sync ids from the server, used up from 'next'
+typedef struct SyncIdLease {
+    int next;
+    int end;
+} SyncIdLease;
+
+// a player the server stopped telling us about, see player_hidden_packet
+typedef struct HiddenPlayer {
+    int id;
+    double time;
+} HiddenPlayer;
+
 typedef struct BakedLightColor {
     float r, g, b;
 } BakedLightColor;
 
+// a light as build_level() decides it, spawn_light() makes the node
+typedef struct LevelLight {
+    v2 pos;
+    double strength;
+    double radius;
+    SDL_Color color;
+} LevelLight;
 
+// Everything that goes into a level that isn't nodes or GPU work, built off the tick thread by build_level() and
+// swapped in by finish_level_build().
+typedef struct LevelBuild {
+    long seed;
+    Room rooms[DUNGEON_SIZE][DUNGEON_SIZE];
+    RNG rng; // the dungeon's stream, generate_dungeon() seeds it and the room picks and lights carry on with it
+    int level_tilemap[TILEMAP_HEIGHT][TILEMAP_WIDTH];
+    int floor_tilemap[TILEMAP_HEIGHT][TILEMAP_WIDTH];
+    int ceiling_tilemap[TILEMAP_HEIGHT][TILEMAP_WIDTH];
+    LevelLight lights[LEVEL_MAX_LIGHTS];
+    int lights_amount;
+    v2 spawn_point;
+    bool has_spawn_point;
+
+    BakedLightColor (*light_grid)[TILEMAP_WIDTH * BAKED_LIGHT_RESOLUTION]; // baked_light_storage or the world cache's
+    SharedMem cache; // the world cache it's in, if it's shared
+    unsigned char *lightmap_bytes; // RGBA, ready for upload_lightmap()
+
+    atomic_int progress; // permille, for the loading screen
+    atomic_bool done;
+    double started;
+    double build_time; // seconds on the worker
+} LevelBuild;
+
+// a join state coming in chunk by chunk, see client_handle_join_state()
+typedef struct JoinStateAssembly {
+    int snapshot_id;
+    int chunks, received;
+    bool applied;
+    bool have[JOIN_STATE_MAX_CHUNKS];
+    int len[JOIN_STATE_MAX_CHUNKS];
+    unsigned char bytes[JOIN_STATE_MAX_CHUNKS][JOIN_STATE_CHUNK_SIZE];
+} JoinStateAssembly;
 
 
-typedef struct Room {
-    v2 room_idx; // 0, 0 -> 3, 3
-    String room_file_name;
-    bool is_start, is_boss;
-
-    struct Room *left, *right, *up, *down;
-    v2 left_entrance_pos, right_entrance_pos, top_entrance_pos, bottom_entrance_pos;
 
-    bool initialized;
-} Room;
 
 // #FUNC
 
@@ -551,6 +542,16 @@ void mouse_pressed(int button_index, bool pressed);
 
 void mouse_moved(SDL_MouseMotionEvent);
 
+void toggle_net_stats_file();
+
+void update_net_stats(double delta);
+
+void record_input_event(SDL_Event event);
+
+void dispatch_replay_packets();
+
+int run_replay(const char *path, double budget_ms);
+
 Ability create_ability(
     void (*activate)(struct Ability *),
     void (*tick)(struct Ability *, double),
@@ -577,8 +578,6 @@ String scramble_ip_and_port(String ip, String port);
 
 String unscramble_ip_and_port(StringRef scrambled_ip, int *port);
 
-bool is_sync_id_valid(int sync_id);
-
 void Node_ready(Node *node);
 
 Sprite *ParticleSpawner_get_sprite(ParticleSpawner *spawner);
@@ -601,9 +600,10 @@ Ability create_switchshot_ability();
 
 Node *find_node_by_sync_id(int sync_id);
 
-void add_to_sync_queue(Node *node);
 
-Node *use_sync_id(int sync_id);
+int take_sync_id();
+
+int sync_ids_left();
 
 void Line_tick(Node *node, double delta);
 
@@ -663,6 +663,16 @@ Particle Particle_new(double life_time);
 
 WorldNode WorldNode_new();
 
+void WorldNode_reset_interpolation(WorldNode *world_node);
+
+void save_world_transforms();
+
+void interpolate_world_transforms(double alpha);
+
+void restore_world_transforms();
+
+double tick_lerp_weight(double weight, double delta);
+
 void Sprite_delete(Node *node);
 
 void Sprite_render(Node *node);
@@ -743,11 +753,17 @@ void init_player(v2 pos);
 
 void on_client_recv(MPPacket packet, void *data);
 
-void on_server_recv(SOCKET socket, MPPacket packet, void *data);
+int collect_projectile_states(SnapState *states, int capacity);
+
+void send_join_state(int for_id);
 
-void on_player_connect(SOCKET player_socket);
+void apply_join_state();
 
-void on_player_disconnect(SOCKET player_socket);
+void client_handle_ability_bomb(MPPacket packet, void *data);
+
+void client_handle_ability_forcefield(MPPacket packet, void *data);
+
+void client_handle_ability_switchshot(MPPacket packet, void *data);
 
 void write_to_debug_label(String string);
 
@@ -757,11 +773,13 @@ double set_time_scale_for_duration(double time_scale, double duration);
 
 double get_player_height();
 
-void load_dungeon();
+void spawn_light(LevelLight level_light);
 
-Room Room_new(v2 pos);
+LevelLight floor_light(v2 pos);
 
-void generate_dungeon();
+LevelLight ceiling_light(v2 pos);
+
+void upload_tilemap_image();
 
 void particle_spawner_explode(ParticleSpawner *spawner);
 
@@ -820,18 +838,37 @@ void player_die();
 
 void player_take_dmg(double dmg);
 
-void reset_level();
 
 double get_max_height();
 
 v2 worldToScreen(v2 pos, double height, bool allow_out_of_screen);
 
+void update_camera();
+
 void clampColors(int rgb[3]);
 
 BakedLightColor get_light_color_by_pos(v2 pos, int row_offset, int col_offset);
 
 void bake_lights();
 
+void start_level_build(long seed);
+
+void build_level(LevelBuild *build);
+
+void finish_level_build();
+
+bool attach_baked_lights(LevelBuild *build);
+
+void compute_baked_lights(LevelBuild *build);
+
+void prepare_lightmap(LevelBuild *build);
+
+void upload_lightmap(const unsigned char *bytes);
+
+void draw_loading_bar(double progress);
+
+RayCollisionData castRayOn(int level_tilemap[TILEMAP_HEIGHT][TILEMAP_WIDTH], v2 pos, v2 dir);
+
 void update_fullscreen();
 
 void drawSkybox();
@@ -862,6 +899,24 @@ void key_pressed(SDL_Scancode key, bool pressed);
 
 void tick(double delta);
 
+void handle_event(SDL_Event event);
+
+void set_render_scale(double scale);
+
+double get_render_scale();
+
+void set_dynamic_resolution(bool enabled);
+
+void update_render_scale(double render_time, double delta);
+
+CameraPose get_camera_pose();
+
+bool CameraPose_equal(CameraPose a, CameraPose b);
+
+v2 screen_row_to_floor(v2 ray_dir, double cos_angle_to_forward, double screen_y);
+
+void update_floor_rows(CameraPose pose, int row_count, float *l_positions, float *r_positions);
+
 double mili_to_sec(u64 mili);
 
 v2 get_player_forward();
@@ -902,6 +957,14 @@ bool isValidLevel(char *file);
 
 GPU_Image **get_texture_files(char *file_name, int file_count);
 
+void add_texture(AssetLoader *loader, char *file, GPU_Image **target);
+
+GPU_Image **add_texture_files(AssetLoader *loader, char *file_name, int file_count);
+
+void add_sound(AssetLoader *loader, char *file, Sound **target);
+
+void add_shader(AssetLoader *loader, char *file, GPU_ShaderEnum type, Uint32 *target);
+
 // #FUNC END
 
 GPU_Target *screen;
@@ -917,6 +980,7 @@ UIComponent *main_menu, *join_menu, *host_menu;
 UITextLine *port_line, *ip_code_line;
 UILabel *public_code_label = NULL, *local_code_label = NULL;
 UILabel *fps_label = NULL;
+UILabel *net_label = NULL;
 
 // #TEXTURES
 
@@ -988,8 +1052,6 @@ GPU_ShaderBlock floor_shader_block;
 int bloom_shader;
 GPU_ShaderBlock bloom_shader_block;
 
-// #ROOMGEN
-Room rooms[DUNGEON_SIZE][DUNGEON_SIZE] = {0};
 
 
 // #VAR
@@ -1006,7 +1068,6 @@ Node *root_node;
 
 Node *game_node;
 
-Node **sync_id_queue;
 Node **deletion_queue;
 Node **add_queue;
 
@@ -1022,17 +1083,46 @@ bool loading_map = false;
 
 bool started_game = false;
 
-long server_dungeon_seed = -1;
 long client_dungeon_seed = -1;
 
-int server_client_id_list[MP_MAX_CLIENTS] = {0};
-
 int client_self_id = -1;
-int next_id = 1234;
 
-int server_next_sync_id = 42;
 int client_last_seen_sync_id = -1;
 
+// the server hands out sync ids in blocks so clients can give their projectiles one right away.
+// 'client_spare_sync_ids' is the next block, asked for before the current one runs out
+SyncIdLease client_sync_ids = {0};
+SyncIdLease client_spare_sync_ids = {0};
+double client_sync_id_request_timer = 0;
+
+// out of view, their PlayerEntities are gone until a position newer than 'time' shows up
+HiddenPlayer client_hidden_players[MP_MAX_CLIENTS];
+int client_hidden_players_amount = 0;
+
+JoinStateAssembly client_join_state = {0};
+
+double player_pos_send_rate = CLIENT_UPDATE_RATE; // can be changed at runtime, receivers adapt to it
+double net_clock_start = 0; // player_pos_packet times count from here
+
+FramePacer frame_pacer;
+
+// MP_time() when the current tick started, the recorded one when replaying. The simulation goes by this instead of
+// the clock so a replay does the same thing
+double tick_clock = 0;
+bool replaying = false; // --replay, ticks and packets come from the file, see run_replay()
+
+// network I/O since the last tick, for the debug overlay
+MPIOStats tick_io_stats;
+MPIOStats last_io_stats;
+
+// the net line of the debug overlay, and the F10 stats file. Rates over the last NET_STATS_INTERVAL
+MPIOStats net_window_stats;
+double net_stats_timer = 0;
+FILE *net_stats_file = NULL;
+
+int tick_rate = TPS;
+double tick_alpha = 1; // how far we are between the last tick and the next one, for rendering
+
 double game_speed_duration_timer = 0;
 double game_speed = 1;
 bool paused = false;
@@ -1046,7 +1136,12 @@ double screen_modulate_b = 1;
 SDL_Color vignette_color = {0, 0, 0};
 bool is_loading = false;
 double loading_progress = 0;
-BakedLightColor baked_light_grid[TILEMAP_HEIGHT * BAKED_LIGHT_RESOLUTION][TILEMAP_WIDTH * BAKED_LIGHT_RESOLUTION] = {0};
+BakedLightColor baked_light_storage[TILEMAP_HEIGHT * BAKED_LIGHT_RESOLUTION][TILEMAP_WIDTH * BAKED_LIGHT_RESOLUTION] = {0}; // untouched if it's shared
+BakedLightColor (*baked_light_grid)[TILEMAP_WIDTH * BAKED_LIGHT_RESOLUTION] = baked_light_storage; // ours or the world cache's
+SharedMem world_cache = {0}; // the level's baked lights, shared with other instances on this machine
+
+LevelBuild level_build = {0};
+bool level_building = false; // level_build is the worker's until it's done, see start_level_build()
 bool fullscreen = false;
 bool running = true;
 
@@ -1067,7 +1162,7 @@ double tanHalfFOV;
 double tanHalfStartFOV;
 double ambient_light = 0.6;
 int floorRenderStart;
-const int tileSize = WINDOW_WIDTH / 30;
+const int tileSize = TILE_SIZE;
 double HEIGHT_TO_XY;
 double XY_TO_HEIGHT;
 double real_fps;
@@ -1079,6 +1174,19 @@ double cameraShakeTimeToNextTick = 0.02;
 double cameraShakeCurrentStrength = 0;
 bool cameraShakeFadeActive = false;
 RenderObject wallStripesToRender[RESOLUTION_X];
+double render_scale = 1;
+int render_resolution_x = RESOLUTION_X; // amount of cast columns
+int render_resolution_y = RESOLUTION_Y; // floor/ceiling rows are half of this
+bool dynamic_resolution = true;
+double smoothed_render_time = 0;
+int tilemap_version = 0; // bumped whenever the level tilemap changes, invalidates cached wall stripes
+
+
+Camera camera; // updated at the start of every frame, see update_camera()
+CameraPose wall_cache_pose;
+bool wall_cache_valid = false;
+CameraPose floor_cache_pose;
+bool floor_cache_valid = false;
 v2 cameraOffset = {0, 0};
 v2 playerForward;
 const double PLAYER_SHOOT_COOLDOWN = 0.5;
@@ -1090,13 +1198,41 @@ void _quit_callback() {
     running = false;
 }
 
+void handle_event(SDL_Event event) {
+    UI_handle_event(event);
+    if (started_game) {
+        record_input_event(event);
+        IN_handle_input(event);
+    }
+}
+
 // #MAIN
+//     handcannon_multiplayer [--record session.hcrp] [--replay session.hcrp [max p99 tick ms]]
 int main(int argc, char *argv[]) {
+    const char *record_path = NULL, *replay_path = NULL;
+    double replay_budget = 0;
+    bool spin_pacing = FRAME_PACING_HYBRID;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-') replay_budget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--spin-pacing") == 0) {
+            spin_pacing = true;
+        } else {
+            printf("Usage: %s [--record file] [--replay file [max p99 tick ms]] [--spin-pacing] \n", argv[0]);
+            return 1;
+        }
+    }
+
     if (SDL_Init(SDL_INIT_EVERYTHING) < 0) printf("Shit. \n");
 
 
     actual_screen = GPU_Init(WINDOW_WIDTH, WINDOW_HEIGHT, GPU_INIT_DISABLE_VSYNC);
     SDL_SetWindowTitle(SDL_GetWindowFromID(actual_screen->context->windowID), "90s shooter game with multiplayer");
+    if (replay_path != NULL) SDL_HideWindow(get_window()); // textures still need the GPU context, nothing gets drawn
 
     GPU_BlendPresetEnum blend_mode = GPU_BLEND_NORMAL;
 
@@ -1113,20 +1249,26 @@ int main(int argc, char *argv[]) {
     IN_init(key_pressed, mouse_pressed, mouse_moved, _quit_callback);
 
     BS_init();
+    if (replay_path != NULL) SDL_PauseAudioDevice(BS_device, 1);
 
     UI_init(get_window(), (v2){WINDOW_WIDTH, WINDOW_HEIGHT}, String_null);
 
     MP_init(1155); // default port
+    MP_queue_messages(); // recv handlers touch the scene, so they run in tick() instead of on the network thread
     _MP_client_handle_recv = on_client_recv;
-    _MP_on_client_connected = on_player_connect;
-    _MP_on_client_disconnected = on_player_disconnect;
-    _MP_server_handle_recv = on_server_recv;
+    _MP_encode_payload = encode_packet_payload;
+    _MP_decode_payload = decode_packet_payload;
+    server_init(1.0 / tick_rate); // in case we host
+    net_clock_start = MP_time();
+
+    // positions get quantized against these, with a margin for things that end up outside the map
+    v2 world_size = {TILEMAP_WIDTH * tileSize, TILEMAP_HEIGHT * tileSize};
+    Wire_set_world_bounds(v2_mul(world_size, to_vec(-0.5)), v2_mul(world_size, to_vec(1.5)));
 
     make_ui();
 
     deletion_queue = array(Node *, 100);
     add_queue = array(Node *, 10);
-    sync_id_queue = array(Node *, 10);
 
     
 
@@ -1134,7 +1276,9 @@ int main(int argc, char *argv[]) {
 
     root_node = alloc(Node, NODE);
 
+    texture_cache_open();
     init_textures();
+    texture_cache_close();
 
     init_player(to_vec(500));
 
@@ -1160,30 +1304,58 @@ int main(int argc, char *argv[]) {
     reset_tilemap(tilemap->ceiling_tilemap);
 
 
+    if (replay_path != NULL) return run_replay(replay_path, replay_budget);
+
+    // the random state init() left, everything after it is in the recording
+    if (record_path != NULL) {
+        ReplayHeader header = {.tick_rate = tick_rate, .dungeon_seed = -1, .rng_state = rng_game.state};
+        if (Replay_record(record_path, header)) printf("Recording to %s \n", record_path);
+    }
+
+    frame_pacer = FP_new(handle_event);
+    FP_set_hybrid(&frame_pacer, spin_pacing);
+
     bool ran_first_tick = false;
-    u64 tick_timer = 0, render_timer = 0;
-    u64 last_time = SDL_GetTicks64();
+    double tick_accumulator = 0, render_timer = 0;
+    double last_time = FP_now(&frame_pacer);
     while (running) {  // #GAME LOOP
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            UI_handle_event(event);
-            if (started_game) IN_handle_input(event);
-        }
+        double tick_delta = 1.0 / tick_rate;
+        bool in_menu = !started_game || paused;
+        double frame_interval = 1.0 / (in_menu ? MENU_FPS : FPS);
 
-        u64 now = SDL_GetTicks64();
-        u64 delta = now - last_time;
+        // sleep until whichever of the next tick / next frame comes first, input is handled while waiting
+        double until_tick = game_speed > 0 ? (tick_delta - tick_accumulator) / game_speed : frame_interval;
+        double until_render = ran_first_tick ? frame_interval - render_timer : until_tick;
+        FP_wait_until(&frame_pacer, last_time + SDL_min(until_tick, until_render), !in_menu);
+
+        double now = FP_now(&frame_pacer);
+        double delta = now - last_time;
         last_time = now;
-        tick_timer += delta;
+
+        // fixed step: the simulation always advances by tick_delta, game_speed only changes how fast we feed it
+        tick_accumulator += delta * game_speed;
         render_timer += delta;
-        if (tick_timer >= 1000 / TPS) {
-            if (started_game) tick(mili_to_sec(tick_timer) * game_speed);
+
+        int ticks_this_frame = 0;
+        while (tick_accumulator >= tick_delta) {
+            if (ticks_this_frame >= MAX_TICKS_PER_FRAME) {
+                tick_accumulator = 0;
+                break;
+            }
+            if (started_game) {
+                save_world_transforms();
+                tick(tick_delta);
+            }
             ran_first_tick = true;
-            tick_timer = 0;
+            tick_accumulator -= tick_delta;
+            ticks_this_frame++;
         }
 
-        if (render_timer >= 1000 / FPS && ran_first_tick) {
-            real_fps = lerp(real_fps, 1000.0 / render_timer, 0.1);
-            render(mili_to_sec(render_timer) * game_speed);
+        if (render_timer >= frame_interval && ran_first_tick) {
+            real_fps = lerp(real_fps, 1.0 / render_timer, 0.1);
+            tick_alpha = tick_accumulator / tick_delta;
+            render(render_timer * game_speed);
+            FP_mark_frame(&frame_pacer, frame_interval);
             render_timer = 0;
         }
     }
@@ -1199,6 +1371,8 @@ int main(int argc, char *argv[]) {
         MPClient_send(packet, &packet_data);
     }
 
+    Replay_stop();
+
     GPU_FreeImage(screen_image);
 
     GPU_Quit();
@@ -1208,14 +1382,12 @@ int main(int argc, char *argv[]) {
 
 void init() {  // #INIT
 
+    camera = Camera_new(RESOLUTION_X);
+
     for (int i = 0; i < NUM_WALL_THREADS; i++) {
         wall_threads[i] = RT_alloc_thread();
     }
 
-    ff_block = create_sound("Sounds/ff_block.wav");
-
-    bomb_explosion = create_sound("Sounds/explosion.wav");
-
     randomize();
 
     hsv_to_rgb(randf_range(0, 360), 1, 1, &client_self_color.r, &client_self_color.g, &client_self_color.b);
@@ -1229,12 +1401,6 @@ void init() {  // #INIT
     //exit(1);
     
 
-    rapidfire_sound = create_sound("Sounds/shotgun_ability.wav");
-
-    exploder_explosion = create_sound("Sounds/exploder_explosion.wav");
-
-    
-
     init_cd_print();
 
     tanHalfFOV = tan(deg_to_rad(fov / 2));
@@ -1278,6 +1444,21 @@ void key_pressed(SDL_Scancode key, bool pressed) {
             render_debug = !render_debug;
             return;
         }
+        if (render_debug) {
+            if (key == INPUT(F10)) {
+                toggle_net_stats_file();
+                return;
+            }
+            if (key == INPUT(F9)) {
+                set_dynamic_resolution(!dynamic_resolution);
+                return;
+            }
+            if (key == INPUT(LEFTBRACKET) || key == INPUT(RIGHTBRACKET)) {
+                set_dynamic_resolution(false);
+                set_render_scale(get_render_scale() + (key == INPUT(LEFTBRACKET) ? -0.1 : 0.1));
+                return;
+            }
+        }
 
         if (key == INPUT(R)) {
             if (player->special != NULL) {
@@ -1325,7 +1506,7 @@ void player_tick(Node *node, double delta) {
 
     // why use the node when the player is global :p
 
-    static double update_pos_timer = 1.0 / CLIENT_UPDATE_RATE;
+    static double update_pos_timer = 0;
 
     //String height_str = String_from_double(player->world_node.height, 2);
 
@@ -1337,7 +1518,7 @@ void player_tick(Node *node, double delta) {
 
 
     player->height_vel -= 750 * delta;
-    player->world_node.height += player->height_vel * (delta * 144);
+    player->world_node.height += player->height_vel * (delta * REFERENCE_TPS);
     if (player->world_node.height > get_max_height() - player->tallness * 0.2) {
         player->height_vel = 0;
     }
@@ -1367,10 +1548,10 @@ void player_tick(Node *node, double delta) {
     v2 keyVec = get_key_vector(INPUT(S), INPUT(W), INPUT(A), INPUT(D));
 
     if (!v2_equal(keyVec, to_vec(0))) {
-        double t = sin(mili_to_sec(SDL_GetTicks64()) * (15)) * 3;
+        double t = sin(tick_clock * (15)) * 3;
         player->handOffset.y = t * 2.5;
     } else {
-        player->handOffset.y = lerp(player->handOffset.y, 0, 0.1);
+        player->handOffset.y = lerp(player->handOffset.y, 0, tick_lerp_weight(0.2, delta)); // 0.1 a tick back at 300 TPS
     }
 
     v2 movement_vec = v2_add(v2_mul(move_dir, to_vec(keyVec.x)), v2_mul(move_dir_rotated, to_vec(keyVec.y)));
@@ -1400,12 +1581,12 @@ void player_tick(Node *node, double delta) {
         double current_speed = v2_length(player->vel);
 
         if (current_speed > air_max_speed) {
-            player->vel = v2_limit_length(v2_add(player->vel, v2_mul(final_vel, to_vec(0.1 * delta * 144))), current_speed);
+            player->vel = v2_limit_length(v2_add(player->vel, v2_mul(final_vel, to_vec(0.1 * delta * REFERENCE_TPS))), current_speed);
         } else {
             if (v2_equal(final_vel, V2_ZERO)) {
-                player->vel = v2_lerp(player->vel, final_vel, drag * delta * 144);
+                player->vel = v2_lerp(player->vel, final_vel, tick_lerp_weight(drag, delta));
             } else {
-                player->vel = v2_lerp(player->vel, final_vel, 0.1 * delta * 144);
+                player->vel = v2_lerp(player->vel, final_vel, tick_lerp_weight(0.1, delta));
             }
         }
         if (player->crouching) {
@@ -1413,9 +1594,9 @@ void player_tick(Node *node, double delta) {
         }
     } else {
         if (v2_equal(final_vel, V2_ZERO)) {
-            player->vel = v2_lerp(player->vel, final_vel, drag * delta * 144);
+            player->vel = v2_lerp(player->vel, final_vel, tick_lerp_weight(drag, delta));
         } else {
-            player->vel = v2_lerp(player->vel, final_vel, 0.1 * delta * 144);
+            player->vel = v2_lerp(player->vel, final_vel, tick_lerp_weight(0.1, delta));
         }
     }
     
@@ -1437,8 +1618,9 @@ void player_tick(Node *node, double delta) {
 
     update_pos_timer -= delta;
     if (update_pos_timer <= 0) {
-        update_pos_timer = 1.0 / CLIENT_UPDATE_RATE;
+        update_pos_timer = 1.0 / player_pos_send_rate;
         struct player_pos_packet packet_data = {
+            .time = tick_clock - net_clock_start,
             .pos = player->world_node.pos,
             .height = player->world_node.height,
             .dir = playerForward,
@@ -1453,7 +1635,7 @@ void player_tick(Node *node, double delta) {
             .is_broadcast = true
         };
 
-        MPClient_send(packet, &packet_data);
+        MPClient_send_unreliable(packet, &packet_data);
     }
 
 }
@@ -1466,59 +1648,332 @@ void spriteTick(Sprite *sprite, double delta) {
     animation_tick(&sprite->animations[sprite->current_anim_idx], delta);
 }
 
-// #TICK
-void tick(double delta) {
-    
-    UILabel_set_text(fps_label, String_concatf(String("FPS: "), String_from_double(real_fps, 2)));
-    UILabel_update(fps_label);
+// Appends MP_write_stats_json() lines to NET_STATS_FILE every NET_STATS_INTERVAL while it's on.
+void toggle_net_stats_file() {
+    if (net_stats_file != NULL) {
+        fclose(net_stats_file);
+        net_stats_file = NULL;
+        printf("Stopped writing %s \n", NET_STATS_FILE);
+        return;
+    }
 
+    net_stats_file = fopen(NET_STATS_FILE, "a");
+    if (net_stats_file == NULL) {
+        printf("Couldn't open %s \n", NET_STATS_FILE);
+        return;
+    }
+    printf("Writing net stats to %s \n", NET_STATS_FILE);
+}
+
+// What the netcode costs: round trips, bandwidth, queue depth, drops and which packet types take the most bytes.
+void update_net_stats(double delta) {
+    if (net_label->component.visible != render_debug) UI_set_visible(net_label, render_debug);
+
+    net_stats_timer -= delta;
+    if (net_stats_timer > 0) return;
+    net_stats_timer = NET_STATS_INTERVAL;
 
-    if (loading_map) {
-        init_loading_screen();
-        generate_dungeon();
-        update_loading_progress(0.1);
-        load_dungeon();
-        loading_map = false;
-        ready_to_render = true;
+    if (net_stats_file != NULL) MP_write_stats_json(net_stats_file, packet_names, PACKETS_END);
+    if (!render_debug) return;
+
+    MPIOStats stats = MP_get_io_stats();
+    MPIOStats last = net_window_stats;
+    net_window_stats = stats;
+
+    MPConnectionStats connections[MP_MAX_CONNECTIONS];
+    int connections_amount = MP_get_connection_stats(connections, MP_MAX_CONNECTIONS);
+
+    double rtt = 0, udp_rtt = 0, worst_client_rtt = 0;
+    int clients = 0;
+    for (int i = 0; i < connections_amount; i++) {
+        if (connections[i].is_client) {
+            rtt = connections[i].rtt;
+            udp_rtt = connections[i].udp_rtt;
+        } else {
+            clients++;
+            worst_client_rtt = fmax(worst_client_rtt, connections[i].rtt);
+        }
     }
 
-    SDL_SetRelativeMouseMode(lock_and_hide_mouse);
+    long long dropped = (stats.dropped_queue_full + stats.dropped_stale + stats.codec_errors + stats.oversized
+        + stats.corrupt_frames + stats.dropped_backlog)
+        - (last.dropped_queue_full + last.dropped_stale + last.codec_errors + last.oversized
+        + last.corrupt_frames + last.dropped_backlog);
 
-    Node_tick(root_node, delta);
+    // the three packet types with the most bytes either way
+    long long type_bytes[PACKETS_END];
+    long long total_bytes = 0;
+    for (int i = 0; i < PACKETS_END; i++) {
+        type_bytes[i] = (stats.types[i].bytes_sent + stats.types[i].bytes_received)
+            - (last.types[i].bytes_sent + last.types[i].bytes_received);
+        total_bytes += type_bytes[i];
+    }
 
-    // sync nodes
+    char top_text[128] = "";
+    for (int n = 0; n < 3; n++) {
+        int best = -1;
+        for (int i = 0; i < PACKETS_END; i++) {
+            if (type_bytes[i] > 0 && (best == -1 || type_bytes[i] > type_bytes[best])) best = i;
+        }
+        if (best == -1) break;
+
+        int len = strlen(top_text);
+        snprintf(top_text + len, sizeof(top_text) - len, "%s%s %.0f%%", n == 0 ? "" : ", ",
+            packet_names[best] != NULL ? packet_names[best] : "?", 100.0 * type_bytes[best] / total_bytes);
+        type_bytes[best] = 0;
+    }
+
+    char net_text[320];
+    int len = snprintf(net_text, sizeof(net_text), "net: rtt %.1fms (udp %.1fms) | out %.1f KB/s, in %.1f KB/s | queue %d | dropped %lld | top: %s",
+        rtt * 1000,
+        udp_rtt * 1000,
+        (stats.bytes_sent - last.bytes_sent) / NET_STATS_INTERVAL / 1024,
+        (stats.bytes_received - last.bytes_received) / NET_STATS_INTERVAL / 1024,
+        stats.message_queue_depth,
+        dropped,
+        top_text
+    );
+    if (clients > 0 && len < (int)sizeof(net_text)) {
+        len += snprintf(net_text + len, sizeof(net_text) - len, " | %d clients, worst rtt %.1fms", clients, worst_client_rtt * 1000);
+    }
+    if (net_stats_file != NULL && len < (int)sizeof(net_text)) {
+        snprintf(net_text + len, sizeof(net_text) - len, " | writing %s", NET_STATS_FILE);
+    }
+
+    UILabel_set_text(net_label, String(net_text));
+    UILabel_update(net_label);
+}
+
+// Input events that reach the game, in a form replay.c can store.
+enum {
+    REPLAY_EVENT_KEY_DOWN,
+    REPLAY_EVENT_KEY_UP,
+    REPLAY_EVENT_MOUSE_DOWN,
+    REPLAY_EVENT_MOUSE_UP,
+    REPLAY_EVENT_MOUSE_MOTION
+};
+
+void record_input_event(SDL_Event event) {
+    if (!Replay_is_recording()) return;
+
+    ReplayInput input;
+    switch (event.type) {
+        case SDL_KEYDOWN:
+            if (event.key.repeat) return;
+            input = (ReplayInput){REPLAY_EVENT_KEY_DOWN, event.key.keysym.scancode, 0};
+            break;
+        case SDL_KEYUP:
+            input = (ReplayInput){REPLAY_EVENT_KEY_UP, event.key.keysym.scancode, 0};
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+            input = (ReplayInput){REPLAY_EVENT_MOUSE_DOWN, event.button.button, 0};
+            break;
+        case SDL_MOUSEBUTTONUP:
+            input = (ReplayInput){REPLAY_EVENT_MOUSE_UP, event.button.button, 0};
+            break;
+        case SDL_MOUSEMOTION:
+            input = (ReplayInput){REPLAY_EVENT_MOUSE_MOTION, event.motion.xrel, event.motion.yrel};
+            break;
+        default:
+            return;
+    }
+
+    Replay_record_input(input);
+}
+
+SDL_Event replay_input_event(ReplayInput input) {
+    SDL_Event event = {0};
+
+    switch (input.event) {
+        case REPLAY_EVENT_KEY_DOWN:
+        case REPLAY_EVENT_KEY_UP:
+            event.type = input.event == REPLAY_EVENT_KEY_DOWN ? SDL_KEYDOWN : SDL_KEYUP;
+            event.key.keysym.scancode = input.a;
+            break;
+        case REPLAY_EVENT_MOUSE_DOWN:
+        case REPLAY_EVENT_MOUSE_UP:
+            event.type = input.event == REPLAY_EVENT_MOUSE_DOWN ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+            event.button.button = input.a;
+            break;
+        case REPLAY_EVENT_MOUSE_MOTION:
+            event.type = SDL_MOUSEMOTION;
+            event.motion.xrel = input.a;
+            event.motion.yrel = input.b;
+            break;
+    }
+
+    return event;
+}
+
+// In place of MP_dispatch_messages() while replaying: the packets recorded during this tick.
+void dispatch_replay_packets() {
+    const ReplayRecord *record;
+    while ((record = Replay_peek()) != NULL && record->kind == REPLAY_PACKET) {
+        on_client_recv(record->packet, (void *)record->data);
+        Replay_advance();
+    }
+}
+
+int _compare_tick_times(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Plays a --record file back with no window or sound, each tick right after the last, and prints how long the ticks
+// took plus where the player ended up (two runs of the same file should agree on that). With a budget it returns 1
+// when the 99th percentile tick is over it, for regression checks.
+//
+// Only the client side is in the file: when the recording was made while hosting, server_tick() isn't replayed.
+int run_replay(const char *path, double budget_ms) {
+    ReplayHeader header;
+    if (!Replay_open(path, &header)) return 1;
+
+    replaying = true;
+    started_game = true;
+    main_menu->visible = false;
+    join_menu->visible = false;
+    host_menu->visible = false;
+    RNG_seed(&rng_game, header.rng_state);
+    if (header.tick_rate > 0) tick_rate = header.tick_rate;
+
+    printf("Replaying %s: %d ticks at %d TPS, dungeon seed %lld \n", path, header.tick_count, tick_rate, header.dungeon_seed);
+
+    double tick_delta = 1.0 / tick_rate;
+    int capacity = header.tick_count > 0 ? header.tick_count : 1024;
+    double *tick_times = malloc(capacity * sizeof(double));
+    int ticks = 0;
+
+    double started = MP_time();
+    const ReplayRecord *record;
+
+    while ((record = Replay_peek()) != NULL) {
+        if (record->kind == REPLAY_INPUT) {
+            IN_handle_input(replay_input_event(record->input));
+            Replay_advance();
+            continue;
+        }
+        if (record->kind != REPLAY_TICK) { // packets come right after their tick, dispatch_replay_packets() reads them
+            Replay_advance();
+            continue;
+        }
+
+        tick_clock = record->time;
+        if (record->paused != paused) toggle_pause(); // the pause menu's button doesn't go through the input
+        Replay_advance();
+
+        double tick_start = MP_time();
+        save_world_transforms();
+        tick(tick_delta);
+
+        if (ticks == capacity) {
+            capacity *= 2;
+            tick_times = realloc(tick_times, capacity * sizeof(double));
+        }
+        tick_times[ticks++] = (MP_time() - tick_start) * 1000;
+
+        if (ticks % REPLAY_REPORT_EVERY == 0) printf("%d ticks \n", ticks);
+    }
+
+    double elapsed = MP_time() - started;
+    Replay_close();
+
+    double total = 0;
+    for (int i = 0; i < ticks; i++) total += tick_times[i];
+    qsort(tick_times, ticks, sizeof(double), _compare_tick_times);
+
+    double p50 = ticks > 0 ? tick_times[(int)(0.5 * (ticks - 1))] : 0;
+    double p99 = ticks > 0 ? tick_times[(int)(0.99 * (ticks - 1))] : 0;
+    double max = ticks > 0 ? tick_times[ticks - 1] : 0;
+
+    printf("%d ticks in %.2f s (%.0f ticks/s, %.1fx real time) \n", ticks, elapsed, ticks / fmax(elapsed, 1e-9),
+        ticks * tick_delta / fmax(elapsed, 1e-9));
+    printf("tick mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms \n", ticks > 0 ? total / ticks : 0, p50, p99, max);
+    printf("end state: player %.3f %.3f height %.3f angle %.3f, rng %016llx \n", player->world_node.pos.x,
+        player->world_node.pos.y, player->world_node.height, player->angle, rng_game.state);
+
+    free(tick_times);
+
+    GPU_FreeImage(screen_image);
+    GPU_Quit();
+    SDL_Quit();
+
+    if (budget_ms > 0 && p99 > budget_ms) {
+        printf("p99 tick %.3f ms is over the %.3f ms budget \n", p99, budget_ms);
+        return 1;
+    }
+    return 0;
+}
+
+// #TICK
+void tick(double delta) {
+
+    if (!replaying) {
+        tick_clock = MP_time();
+        Replay_record_tick(tick_clock, paused);
+    }
     
-    if (MP_is_server) {
-        
-        static double server_tick_timer = 1 / SERVER_TICK_RATE;
+    if (render_debug) {
+        char pacing_text[192];
+        snprintf(pacing_text, sizeof(pacing_text), "FPS: %.2f | frame %.2fms, jitter %.2fms, max %.2fms, idle %.0f%% | res %d%%%s | net %lld sends for %lld packets, %lld B out per tick",
+            real_fps,
+            frame_pacer.mean_frame_time * 1000,
+            frame_pacer.jitter * 1000,
+            frame_pacer.max_frame_time * 1000,
+            frame_pacer.idle * 100,
+            (int)round(render_scale * 100),
+            dynamic_resolution ? "" : " (fixed)",
+            tick_io_stats.send_calls,
+            tick_io_stats.packets_sent,
+            tick_io_stats.bytes_sent
+        );
+        UILabel_set_text(fps_label, String(pacing_text));
+    } else if (render_scale < 1) {
+        char fps_text[64];
+        snprintf(fps_text, sizeof(fps_text), "FPS: %.2f (res %d%%)", real_fps, (int)round(render_scale * 100));
+        UILabel_set_text(fps_label, String(fps_text));
+    } else {
+        UILabel_set_text(fps_label, String_concatf(String("FPS: "), String_from_double(real_fps, 2)));
+    }
+    UILabel_update(fps_label);
+    update_net_stats(delta);
 
-        server_tick_timer -= delta;
-        if (server_tick_timer <= 0) {
-            server_tick_timer = 1 / SERVER_TICK_RATE;
-            iter_over_all_nodes(node, {
-                if (node->sync_id == -1 || !is_sync_id_valid(node->sync_id)) continue;
+    // everything sent this tick goes out in one write per connection at the end
+    MP_begin_batch();
 
-                if (instanceof(node->type, PROJECTILE)) {
+    // everything received since the last tick, the handlers' replies and relays are part of the batch
+    if (replaying) dispatch_replay_packets();
+    else MP_dispatch_messages();
 
-                    Projectile *proj = node;
+    if (loading_map && !level_building) {
+        Replay_set_dungeon_seed(client_dungeon_seed);
+        start_level_build(client_dungeon_seed);
+    }
 
-                    MPPacket packet = {.type = PACKET_SYNC_PROJECTILE, .len = sizeof(struct sync_projectile_packet), .is_broadcast = true};
+    if (level_building && atomic_load(&level_build.done)) {
+        finish_level_build();
+    }
 
-                    struct sync_projectile_packet packet_data = {
-                        .sync_id = node->sync_id,
-                        .pos = proj->entity.world_node.pos,
-                        .height = proj->entity.world_node.height,
-                        .vel = proj->vel,
-                        .h_vel = proj->height_vel
-                    };
+    // only once the level is there, loading it clears everything
+    if (client_join_state.chunks > 0 && client_join_state.received == client_join_state.chunks && !client_join_state.applied
+        && client_dungeon_seed != -1 && !loading_map) {
+        apply_join_state();
+    }
 
-                    MPClient_send(packet, &packet_data);
-                }
-                
-            });
+    SDL_SetRelativeMouseMode(lock_and_hide_mouse);
+
+    // nothing in the world to tick until the level's in, the menus and the rest still get theirs
+    if (!level_building) {
+        Node_tick(root_node, delta);
+    } else {
+        for (int i = 0; i < array_length(root_node->children); i++) {
+            if (root_node->children[i] != game_node) Node_tick(root_node->children[i], delta);
         }
+    }
 
-        
+    // sync nodes
+    
+    if (MP_is_server) {
+        server_tick(delta, collect_projectile_states);
     }
 
 
@@ -1537,7 +1992,16 @@ void tick(double delta) {
             }
         }
     }
-    cameraOffset = v2_lerp(cameraOffset, to_vec(0), 0.2);
+    cameraOffset = v2_lerp(cameraOffset, to_vec(0), tick_lerp_weight(0.37, delta)); // 0.2 a tick back at 300 TPS
+
+    // keep a spare block of sync ids so firing never waits on the server
+    if (sync_ids_left() <= SYNC_ID_LEASE_LOW && client_spare_sync_ids.next >= client_spare_sync_ids.end) {
+        client_sync_id_request_timer -= delta;
+        if (client_sync_id_request_timer <= 0) {
+            MPClient_send((MPPacket){.type = PACKET_REQUEST_SYNC_IDS, .len = 0, .is_broadcast = false}, NULL);
+            client_sync_id_request_timer = 0.5;
+        }
+    }
 
     if (client_dungeon_seed == -1) {
         client_dungeon_seed_request_timer -= delta;
@@ -1587,6 +2051,23 @@ void tick(double delta) {
     //     queued_player_death = false;
     //     _player_die();
     // }
+
+    MP_end_batch();
+
+    MPIOStats io_stats = MP_get_io_stats();
+    tick_io_stats = (MPIOStats){
+        .send_calls = io_stats.send_calls - last_io_stats.send_calls,
+        .recv_calls = io_stats.recv_calls - last_io_stats.recv_calls,
+        .bytes_sent = io_stats.bytes_sent - last_io_stats.bytes_sent,
+        .bytes_received = io_stats.bytes_received - last_io_stats.bytes_received,
+        .packets_sent = io_stats.packets_sent - last_io_stats.packets_sent
+    };
+    last_io_stats = io_stats;
+}
+
+// Turns a "lerp by this much every REFERENCE_TPS frame" weight into one that's correct for any delta.
+double tick_lerp_weight(double weight, double delta) {
+    return 1 - pow(1 - SDL_clamp(weight, 0, 1), delta * REFERENCE_TPS);
 }
 
 // for slower decay, make 'a' smaller.
@@ -1594,76 +2075,50 @@ double distance_to_color(double distance, double a) {
     return exp(-a * distance);
 }
 
+// Only for use outside of rendering, the renderer reads camera.ray_dirs instead.
 v2 getRayDirByIdx(int i) {
-    double x = tanHalfFOV;
-    double idx = lerp(-x, x, ((double)(i + 1)) / RESOLUTION_X);
+    double slope = lerp(-tanHalfFOV, tanHalfFOV, ((double)(i + 1)) / render_resolution_x);
 
-    v2 temp = (v2){1, idx};
+    v2 right = (v2){-playerForward.y, playerForward.x};
 
-    temp = v2_normalize(temp);
-    Player *pref = player;
-    v2 rayDir = v2_dir((v2){0, 0}, v2_rotate(temp, deg_to_rad(pref->angle)));
-    return rayDir;
+    return v2_normalize(v2_add(playerForward, v2_mul(right, to_vec(slope))));
 }
 
-v2 worldToScreen(v2 pos, double height, bool allow_out_of_screen) { // gotta refactor this.
-    
-    if (v2_equal(pos, player->world_node.pos)) {
-        return (v2){WINDOW_WIDTH / 2, WINDOW_HEIGHT};
-    }
-
-    double signed_angle_to_forward = v2_signed_angle_between(playerForward, v2_sub(pos, player->world_node.pos));
+void update_camera() {
+    Camera_update(
+        &camera,
+        player->world_node.pos,
+        player->angle,
+        tanHalfFOV,
+        tanHalfStartFOV,
+        get_player_height(),
+        player->pitch,
+        cameraOffset,
+        V2(WINDOW_WIDTH, WINDOW_HEIGHT),
+        render_resolution_x
+    );
+}
 
-    double signed_angle_degrees = rad_to_deg(signed_angle_to_forward);
+v2 worldToScreen(v2 pos, double height, bool allow_out_of_screen) {
+    v2 screen_pos;
 
-    if (!allow_out_of_screen && !in_range(signed_angle_degrees, -0.5 * fov, 0.5 * fov)) {
+    if (!Camera_project(&camera, pos, height, allow_out_of_screen, &screen_pos)) {
         return OUT_OF_SCREEN_POS;
-    } else {
-        if (!in_range(signed_angle_degrees, -90, 90)) {
-            double dist_to_viewplane = abs(v2_distance(pos, player->world_node.pos) * v2_cos_angle_between(playerForward, v2_sub(pos, player->world_node.pos)));
-
-            pos = v2_add(pos, v2_mul(playerForward, to_vec(dist_to_viewplane + 2)));
-
-            // we need to recalculate prev variables
-            signed_angle_to_forward = v2_signed_angle_between(playerForward, v2_sub(pos, player->world_node.pos));
-
-            signed_angle_degrees = deg_to_rad(signed_angle_to_forward);
-        }
     }
 
-
-    double cos_angle_to_forward = v2_cos_angle_between(playerForward, v2_sub(pos, player->world_node.pos));
-
-    double dist_to_player = v2_distance(pos, player->world_node.pos);
-
-
-    double dist_to_viewplane = dist_to_player * cos_angle_to_forward;
-    
-    if (dist_to_viewplane == 0) dist_to_viewplane = 0.001;
-
-    double fov_width_at_texture = 2 * dist_to_viewplane * tanHalfFOV;
-
-    double angle = acos(cos_angle_to_forward);
-
-    double texture_thing_width = dist_to_player * sin(angle); 
-
-    double x_pos_sign = signed_angle_to_forward >= 0 ? 1 : -1;
-    double ratio = fov_width_at_texture == 0? 0 : texture_thing_width / fov_width_at_texture;
-    double x_pos = WINDOW_WIDTH / 2 + (ratio * WINDOW_WIDTH) * x_pos_sign;
-
-    double fov_factor = tanHalfStartFOV / tanHalfFOV;
-    double wallSize = WALL_HEIGHT * WALL_HEIGHT_MULTIPLIER * WINDOW_HEIGHT / dist_to_viewplane * fov_factor;
-    double y_pos = WINDOW_HEIGHT / 2 + wallSize / 2 - ((height - get_player_height() + get_max_height() / 2) + WINDOW_HEIGHT / 2) / dist_to_viewplane;
-
-    x_pos += cameraOffset.x;
-    y_pos += -player->pitch + cameraOffset.y;
-
-    return (v2){x_pos, y_pos};
+    return screen_pos;
 }
 
 v2 screenToFloor(v2 pos) {
     v2 rayDir = getRayDirByIdx((int)pos.x);
 
+    return screen_row_to_floor(rayDir, v2_cos_angle_between(rayDir, playerForward), pos.y);
+}
+
+// screenToFloor() for a column whose ray is already known
+v2 screen_row_to_floor(v2 rayDir, double cosAngleToForward, double screen_y) {
+    v2 pos = (v2){0, screen_y};
+
     double wallSize = abs(pos.y - WINDOW_HEIGHT / 2) * 2;  // size of a wall at that position
     if (wallSize == 0) {
         return to_vec(0);
@@ -1672,8 +2127,6 @@ v2 screenToFloor(v2 pos) {
     double fovFactor = tanHalfStartFOV / tanHalfFOV;
     double dist = (WALL_HEIGHT * WALL_HEIGHT_MULTIPLIER * WINDOW_HEIGHT / wallSize) * fovFactor;
 
-    double cosAngleToForward = v2_cos_angle_between(rayDir, playerForward);
-
     dist /= cosAngleToForward;
 
 
@@ -1694,6 +2147,45 @@ struct floor_and_ceiling_thread_data {
     void **pixels;
 };
 
+// Fills the l/r floor interpolants for every row.
+void update_floor_rows(CameraPose pose, int row_count, float *l_positions, float *r_positions) {
+    // edge rays only depend on the angle, fov and which columns the (shaken) screen edges land on
+    static v2 left_ray, right_ray;
+    static double left_cos, right_cos;
+    static int left_col = -1, right_col = -1;
+    static double rays_angle, rays_tan_half_fov;
+    static int rays_columns = -1;
+
+    int new_left_col = SDL_clamp(-pose.offset.x, 0, pose.columns - 1);
+    int new_right_col = SDL_clamp(-pose.offset.x + pose.columns - 1, 0, pose.columns - 1);
+
+    if (new_left_col != left_col || new_right_col != right_col || rays_columns != pose.columns || rays_angle != pose.angle || rays_tan_half_fov != pose.tan_half_fov) {
+        left_col = new_left_col;
+        right_col = new_right_col;
+        rays_columns = pose.columns;
+        rays_angle = pose.angle;
+        rays_tan_half_fov = pose.tan_half_fov;
+
+        left_ray = Camera_ray_dir(&camera, left_col);
+        right_ray = Camera_ray_dir(&camera, right_col);
+        left_cos = v2_cos_angle_between(left_ray, playerForward);
+        right_cos = v2_cos_angle_between(right_ray, playerForward);
+    }
+
+    // past this point it's only the projection (pitch, shake, height, position)
+    for (int i = 0; i < row_count; i++) {
+        double screenY = i * WINDOW_HEIGHT / row_count;
+
+        v2 left = screen_row_to_floor(left_ray, left_cos, screenY + pose.pitch - pose.offset.y);
+        v2 right = screen_row_to_floor(right_ray, right_cos, screenY + pose.pitch - pose.offset.y);
+
+        l_positions[i * 2] = left.x;
+        l_positions[i * 2 + 1] = left.y;
+        r_positions[i * 2] = right.x;
+        r_positions[i * 2 + 1] = right.y;
+    }
+}
+
 void render_floor_and_ceiling() {
     // Use the shader for everything.
 
@@ -1704,19 +2196,18 @@ void render_floor_and_ceiling() {
     static int times_called = 0;
     times_called++;
 
-    float l_positions[RESOLUTION_Y];
-    float r_positions[RESOLUTION_Y];
+    static float l_positions[RESOLUTION_Y];
+    static float r_positions[RESOLUTION_Y];
 
-    for (int i = 0; i < RESOLUTION_Y / 2; i++) {
-        double screenY = i * WINDOW_HEIGHT / (RESOLUTION_Y / 2);
+    int row_count = render_resolution_y / 2;
 
-        v2 left = screenToFloor((v2){SDL_clamp(-cameraOffset.x, 0, RESOLUTION_X - 1), screenY + player->pitch - cameraOffset.y});
-        v2 right = screenToFloor((v2){SDL_clamp(-cameraOffset.x + RESOLUTION_X - 1, 0, RESOLUTION_X - 1), screenY + player->pitch - cameraOffset.y});
+    CameraPose pose = get_camera_pose();
 
-        l_positions[i * 2] = left.x;
-        l_positions[i * 2 + 1] = left.y;
-        r_positions[i * 2] = right.x;
-        r_positions[i * 2 + 1] = right.y;
+    // if nothing that affects the floor moved, last frame's interpolants are still right
+    if (!floor_cache_valid || !CameraPose_equal(pose, floor_cache_pose)) {
+        update_floor_rows(pose, row_count, l_positions, r_positions);
+        floor_cache_pose = pose;
+        floor_cache_valid = true;
     }
 
     //drawSkybox();
@@ -1725,8 +2216,9 @@ void render_floor_and_ceiling() {
 
     int floorTexLoc = GPU_GetUniformLocation(floor_shader, "floorTex");
 
-    GPU_SetUniformfv(GPU_GetUniformLocation(floor_shader, "lValues"), 2, RESOLUTION_Y / 2, l_positions);
-    GPU_SetUniformfv(GPU_GetUniformLocation(floor_shader, "rValues"), 2, RESOLUTION_Y / 2, r_positions);
+    GPU_SetUniformfv(GPU_GetUniformLocation(floor_shader, "lValues"), 2, row_count, l_positions);
+    GPU_SetUniformfv(GPU_GetUniformLocation(floor_shader, "rValues"), 2, row_count, r_positions);
+    GPU_SetUniformi(GPU_GetUniformLocation(floor_shader, "rowCount"), row_count);
 
     float window_size[2] = {WINDOW_WIDTH, WINDOW_HEIGHT};
     float lightmap_size[2] = {TILEMAP_WIDTH * BAKED_LIGHT_RESOLUTION, TILEMAP_HEIGHT * BAKED_LIGHT_RESOLUTION};
@@ -1822,7 +2314,7 @@ void renderDirSprite(DirSprite *dSprite, v2 pos, v2 size, double height) {
 }
 
 RenderObject getWallStripe(int i) {
-    v2 ray_dir = getRayDirByIdx(i);
+    v2 ray_dir = Camera_ray_dir(&camera, i);
 
     RayCollisionData data = castRay(player->world_node.pos, ray_dir);
 
@@ -1834,7 +2326,7 @@ RenderObject getWallStripe(int i) {
     stripe.i = i;
     stripe.texture = data.colliderTexture;
 
-    double cos_angle_to_forward = v2_cos_angle_between(ray_dir, playerForward);
+    double cos_angle_to_forward = v2_dot(ray_dir, camera.forward); // both are unit length
     double dist = v2_distance(data.startpos, data.collpos) * cos_angle_to_forward;
     double fov_factor = tanHalfStartFOV / tanHalfFOV;
     double final_size = WALL_HEIGHT * WALL_HEIGHT_MULTIPLIER * WINDOW_HEIGHT / dist * fov_factor;
@@ -1860,7 +2352,7 @@ RenderObject getWallStripe(int i) {
 
 int addWallStripes_Threaded(void *data) {
     int idx = *(int *)data;
-    for (int i = RESOLUTION_X / NUM_WALL_THREADS * idx; i < RESOLUTION_X / NUM_WALL_THREADS * (idx + 1); i++) {
+    for (int i = render_resolution_x / NUM_WALL_THREADS * idx; i < render_resolution_x / NUM_WALL_THREADS * (idx + 1); i++) {
         wallStripesToRender[i] = getWallStripe(i);
     }
 }
@@ -1874,10 +2366,53 @@ int _cmp(const void *a, const void *b) {
     return d2 - d1;
 }
 
+CameraPose get_camera_pose() {
+    CameraPose pose = {0};
+
+    pose.pos = player->world_node.pos;
+    pose.angle = player->angle;
+    pose.tan_half_fov = tanHalfFOV;
+    pose.player_height = get_player_height();
+    pose.pitch = player->pitch;
+    pose.offset = cameraOffset;
+    pose.columns = render_resolution_x;
+    pose.rows = render_resolution_y;
+    pose.tilemap_version = tilemap_version;
+
+    return pose;
+}
+
+bool CameraPose_equal(CameraPose a, CameraPose b) {
+    return v2_equal(a.pos, b.pos)
+        && a.angle == b.angle
+        && a.tan_half_fov == b.tan_half_fov
+        && a.player_height == b.player_height
+        && a.pitch == b.pitch
+        && v2_equal(a.offset, b.offset)
+        && a.columns == b.columns
+        && a.rows == b.rows
+        && a.tilemap_version == b.tilemap_version;
+}
+
+// Wall stripes don't care about pitch, height or camera shake, those are applied when drawing them.
+bool wall_cache_matches(CameraPose pose) {
+    if (!wall_cache_valid) return false;
+
+    return v2_equal(pose.pos, wall_cache_pose.pos)
+        && pose.angle == wall_cache_pose.angle
+        && pose.tan_half_fov == wall_cache_pose.tan_half_fov
+        && pose.columns == wall_cache_pose.columns
+        && pose.tilemap_version == wall_cache_pose.tilemap_version;
+}
+
 RenderObject *get_render_list() {
-    RenderObject *renderList = array(RenderObject, RESOLUTION_X + get_node_count() - 1);
+    RenderObject *renderList = array(RenderObject, render_resolution_x + get_node_count() - 1);
+
+    CameraPose pose = get_camera_pose();
 
-    if (NUM_WALL_THREADS == 1) {
+    if (wall_cache_matches(pose)) {
+        // standing still, wallStripesToRender is already up to date
+    } else if (NUM_WALL_THREADS == 1) {
         int i = 0;
         addWallStripes_Threaded(&i); // hehe its not threaded
     } else {
@@ -1894,7 +2429,10 @@ RenderObject *get_render_list() {
         
     }
 
-    for (int i = RESOLUTION_X - 1; i >= 0; i--) {
+    wall_cache_pose = pose;
+    wall_cache_valid = true;
+
+    for (int i = render_resolution_x - 1; i >= 0; i--) {
         array_append(renderList, wallStripesToRender[i]);
     }
 
@@ -1985,10 +2523,12 @@ void renderWallStripe(RenderObject render_object) {
 
     double p_height = (get_player_height() / get_max_height() - 0.5) * (stripe.size);
 
+    double column_width = (double)WINDOW_WIDTH / render_resolution_x;
+
     GPU_Rect dstRect = {
-        stripe.i * WINDOW_WIDTH / RESOLUTION_X + cameraOffset.x, 
+        (int)(stripe.i * column_width) + cameraOffset.x, 
         WINDOW_HEIGHT / 2 - stripe.size / 2 + p_height - player->pitch + cameraOffset.y,
-        WINDOW_WIDTH / RESOLUTION_X + 1,
+        (int)column_width + 1,
         stripe.size
     };
 
@@ -2087,13 +2627,19 @@ void drawSkybox() {
 
 void render(double delta) {  // #RENDER
 
+    u64 render_start = SDL_GetPerformanceCounter();
+
     bool can_render = !loading_map && ready_to_render;
 
     GPU_Clear(screen);
     GPU_Clear(hud);
     GPU_Clear(actual_screen);
 
-    if (can_render) Node_render(renderer);
+    if (can_render) {
+        interpolate_world_transforms(tick_alpha);
+        Node_render(renderer);
+        restore_world_transforms();
+    }
     UI_render(hud, UI_get_root());
 
     GPU_ActivateShaderProgram(bloom_shader, &bloom_shader_block);
@@ -2112,21 +2658,79 @@ void render(double delta) {  // #RENDER
 
     GPU_Blit(hud_image, NULL, actual_screen, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2);
 
+    if (level_building) draw_loading_bar(atomic_load(&level_build.progress) / 1000.0);
+
     GPU_Flip(actual_screen);
+
+    double render_time = (double)(SDL_GetPerformanceCounter() - render_start) / SDL_GetPerformanceFrequency();
+    if (can_render) update_render_scale(render_time, delta);
 } // #RENDER END
 
+void set_render_scale(double scale) {
+    render_scale = SDL_clamp(scale, MIN_RENDER_SCALE, 1);
+
+    // columns are split evenly between the wall threads
+    render_resolution_x = (int)(RESOLUTION_X * render_scale) / NUM_WALL_THREADS * NUM_WALL_THREADS;
+    render_resolution_y = (int)(RESOLUTION_Y * render_scale) / 2 * 2;
+}
+
+double get_render_scale() {
+    return render_scale;
+}
+
+void set_dynamic_resolution(bool enabled) {
+    dynamic_resolution = enabled;
+}
+
+// Drops the resolution quickly when over budget and raises it slowly when there's headroom,
+// with a dead zone in between so it doesn't flicker back and forth.
+void update_render_scale(double render_time, double delta) {
+    static double over_budget_timer = 0;
+    static double under_budget_timer = 0;
+
+    if (smoothed_render_time == 0) smoothed_render_time = render_time;
+    smoothed_render_time = lerp(smoothed_render_time, render_time, 0.05);
+
+    if (!dynamic_resolution) {
+        over_budget_timer = 0;
+        under_budget_timer = 0;
+        return;
+    }
+
+    if (smoothed_render_time > TARGET_FRAME_TIME * 1.1) {
+        over_budget_timer += delta;
+        under_budget_timer = 0;
+    } else if (smoothed_render_time < TARGET_FRAME_TIME * 0.7) {
+        under_budget_timer += delta;
+        over_budget_timer = 0;
+    } else {
+        over_budget_timer = 0;
+        under_budget_timer = 0;
+    }
+
+    if (over_budget_timer >= RENDER_SCALE_DOWN_AFTER && render_scale > MIN_RENDER_SCALE) {
+        set_render_scale(render_scale - RENDER_SCALE_DOWN_STEP);
+        over_budget_timer = 0;
+        smoothed_render_time = 0; // measure the new scale from scratch
+    } else if (under_budget_timer >= RENDER_SCALE_UP_AFTER && render_scale < 1) {
+        set_render_scale(render_scale + RENDER_SCALE_UP_STEP);
+        under_budget_timer = 0;
+        smoothed_render_time = 0;
+    }
+}
+
 void _left_hand_tick(Node *node, double delta) {
     WorldNode *left_hand = node;
 
-    left_hand->pos = v2_lerp(left_hand->pos, player->left_hand_pos, delta * 144 * 0.5);
-    left_hand->height = lerp(left_hand->height, player->left_hand_height, delta * 144 * 0.5);
+    left_hand->pos = v2_lerp(left_hand->pos, player->left_hand_pos, tick_lerp_weight(0.5, delta));
+    left_hand->height = lerp(left_hand->height, player->left_hand_height, tick_lerp_weight(0.5, delta));
 }
 
 void _right_hand_tick(Node *node, double delta) {
     WorldNode *right_hand = node;
 
-    right_hand->pos = v2_lerp(right_hand->pos, player->right_hand_pos, delta * 144 * 0.5);
-    right_hand->height = lerp(right_hand->height, player->right_hand_height, delta * 144 * 0.5);
+    right_hand->pos = v2_lerp(right_hand->pos, player->right_hand_pos, tick_lerp_weight(0.5, delta));
+    right_hand->height = lerp(right_hand->height, player->right_hand_height, tick_lerp_weight(0.5, delta));
 }
 
 // #PLAYER INIT
@@ -2222,6 +2826,11 @@ RayCollisionData ray_node(Raycast ray, Node *node) {
 }
 
 RayCollisionData castRay(v2 pos, v2 dir) {
+    return castRayOn(tilemap->level_tilemap, pos, dir);
+}
+
+// castRay() against any tilemap, the level build bakes its lights against one that isn't in the game yet
+RayCollisionData castRayOn(int level_tilemap[TILEMAP_HEIGHT][TILEMAP_WIDTH], v2 pos, v2 dir) {
     // use DDA stupid
     // set tilesize to 1
 
@@ -2268,7 +2877,7 @@ RayCollisionData castRay(v2 pos, v2 dir) {
         }
 
         if (in_range((int)currentCell.y, 0, TILEMAP_HEIGHT - 1) && in_range((int)currentCell.x, 0, TILEMAP_WIDTH - 1)) {
-            int t = tilemap->level_tilemap[(int)currentCell.y][(int)currentCell.x];
+            int t = level_tilemap[(int)currentCell.y][(int)currentCell.x];
 
             if (t != -1) {
                 found = true;
@@ -2303,23 +2912,14 @@ RayCollisionData ray_circle(Raycast ray, CircleCollider *collider) {
     
     RayCollisionData data = {0};
 
-    if (v2_distance(ray.pos, collider->world_node.pos) <= collider->radius || v2_dot(ray.dir, v2_dir(ray.pos, collider->world_node.pos)) < 0) {
+    // the math is in vec2.c, the server checks shots with it too
+    double distance;
+    if (!v2_ray_circle(ray.pos, ray.dir, collider->world_node.pos, collider->radius, &distance)) {
         data.hit = false;
         return data;
     }
 
-    v2 rayToCircle = v2_sub(collider->world_node.pos, ray.pos);
-    double a = v2_dot(rayToCircle, ray.dir);
-    double cSquared = v2_length_squared(rayToCircle);
-    double bSquared = cSquared - a * a;  // pythagoras
-    if (collider->radius * collider->radius - bSquared < 0) {
-        data.hit = false;
-        return data;
-    }                                                           // no imaginary numbers pls
-    double d = sqrt(collider->radius * collider->radius - bSquared);  // more pythagoras
-
-    // raypos + raydir * (a - d)
-    v2 collision_pos = v2_add(ray.pos, v2_mul(ray.dir, to_vec(a - d)));  // woohoo!
+    v2 collision_pos = v2_add(ray.pos, v2_mul(ray.dir, to_vec(distance)));  // woohoo!
 
     v2 normal = v2_dir(collider->world_node.pos, collision_pos);
     double collIdx = v2_get_angle(v2_dir(collider->world_node.pos, data.collpos)) / (2 * PI);
@@ -2356,6 +2956,8 @@ void reset_tilemap(int t[TILEMAP_HEIGHT][TILEMAP_WIDTH]) {
             t[r][c] = -1;
         }
     }
+
+    tilemap_version++;
 }
 
 void clear_level() {
@@ -2364,41 +2966,59 @@ void clear_level() {
     }
 }
 
-void spawn_floor_light(v2 pos) {
-    LightPoint *light = alloc(LightPoint, LIGHT_POINT);
+LevelLight floor_light(v2 pos) {
+    LevelLight light;
 
-    light->color = (SDL_Color){255, 50, 50};
-    light->strength = 4;
-    light->radius = 140;
-    light->pos = pos;
-    Node_add_child(game_node, light);
+    light.color = (SDL_Color){255, 50, 50};
+    light.strength = 4;
+    light.radius = 140;
+    light.pos = pos;
+    return light;
 }
 
-void spawn_ceiling_light(v2 pos) {
-    LightPoint *light = alloc(LightPoint, LIGHT_POINT);
+LevelLight ceiling_light(v2 pos) {
+    LevelLight light;
     
-    randomize();
     int chance = randi_range(0, 2);
 
     if (chance == 0) {
-        light->color = (SDL_Color){randf_range(200, 255), randf_range(160, 200), 50};//{255, 200, 100};
+        light.color = (SDL_Color){randf_range(200, 255), randf_range(160, 200), 50};//{255, 200, 100};
     } else if (chance == 1) {
-        light->color = (SDL_Color){110, 110, 255};
+        light.color = (SDL_Color){110, 110, 255};
     } else {
-        light->color = (SDL_Color){80, 255, 80};
+        light.color = (SDL_Color){80, 255, 80};
     }
     
-    light->strength = 5;
-    light->radius = 400;
-    light->pos = pos;
+    light.strength = 5;
+    light.radius = 400;
+    light.pos = pos;
+    return light;
+}
+
+void spawn_light(LevelLight level_light) {
+    LightPoint *light = alloc(LightPoint, LIGHT_POINT);
+
+    light->color = level_light.color;
+    light->strength = level_light.strength;
+    light->radius = level_light.radius;
+    light->pos = level_light.pos;
     Node_add_child(game_node, light);
 }
 
+void spawn_floor_light(v2 pos) {
+    spawn_light(floor_light(pos));
+}
+
+void spawn_ceiling_light(v2 pos) {
+    spawn_light(ceiling_light(pos));
+}
+
 void place_entity(v2 pos, int type) {
     switch (type) {
         case (int)P_PLAYER:
             if (player == NULL) printf("player = null \n");
             player->world_node.pos = pos;
+            WorldNode_reset_interpolation(&player->world_node);
             spawn_point = pos;
             break;
     }
@@ -2474,13 +3094,20 @@ void load_level(char *file) {
 
     fclose(fh);
     // create tilemap image for floor shader
+    upload_tilemap_image();
+
+    bake_lights();
 
+    tilemap_version++;
+}
+
+// The floor and ceiling tiles for the floor shader.
+void upload_tilemap_image() {
+    if (tilemap_image != NULL) GPU_FreeImage(tilemap_image);
     tilemap_image = GPU_CreateImage(TILEMAP_WIDTH, TILEMAP_HEIGHT, GPU_FORMAT_RGBA);
 
     SDL_Surface *surface = GPU_CopySurfaceFromImage(tilemap_image);
 
-    
-
     for (int row = 0; row < TILEMAP_HEIGHT; row++) {
         for (int col = 0; col < TILEMAP_WIDTH; col++) {
 
@@ -2501,9 +3128,6 @@ void load_level(char *file) {
     GPU_UpdateImage(tilemap_image, NULL, surface, NULL);
 
     SDL_FreeSurface(surface);
-
-    bake_lights();
-
 }
 
 void freeAnimation(Animation *anim) {
@@ -2780,6 +3404,83 @@ GPU_Image **get_texture_files(char *file_name, int file_count) {
     return textures;
 }
 
+// The AssetLoader steps for init_textures(): decoding on the workers, whatever needs the GPU or the audio device on
+// the main thread.
+
+void decode_texture_asset(Asset *asset) {
+    if (!texture_cache_has(asset->path)) asset->decoded = decode_texture(asset->path);
+}
+
+void upload_texture_asset(Asset *asset) {
+    GPU_Image *image = upload_texture(asset->path, asset->decoded);
+    *(GPU_Image **)asset->target = image;
+    asset->failed = image == NULL;
+}
+
+void decode_sound_asset(Asset *asset) {
+    u8 *data;
+    u32 data_len;
+    if (!decode_sound(asset->path, &data, &data_len)) return;
+
+    asset->decoded = data;
+    asset->decoded_size = data_len;
+}
+
+void create_sound_asset(Asset *asset) {
+    Sound *sound = asset->decoded != NULL ? create_sound_from_samples(asset->decoded, asset->decoded_size) : NULL;
+    *(Sound **)asset->target = sound;
+    asset->failed = sound == NULL;
+}
+
+void read_shader_asset(Asset *asset) {
+    asset->decoded = SDL_LoadFile(asset->path, &asset->decoded_size);
+    if (asset->decoded == NULL) fprintf(stderr, "Couldn't read shader %s: %s \n", asset->path, SDL_GetError());
+}
+
+void _compile_shader_asset(Asset *asset, GPU_ShaderEnum type) {
+    Uint32 shader = asset->decoded != NULL ? GPU_CompileShader(type, asset->decoded) : 0;
+    *(Uint32 *)asset->target = shader;
+    asset->failed = shader == 0;
+    SDL_free(asset->decoded);
+}
+
+void compile_fragment_shader_asset(Asset *asset) {
+    _compile_shader_asset(asset, GPU_FRAGMENT_SHADER);
+}
+
+void compile_vertex_shader_asset(Asset *asset) {
+    _compile_shader_asset(asset, GPU_VERTEX_SHADER);
+}
+
+void add_texture(AssetLoader *loader, char *file, GPU_Image **target) {
+    Assets_add(loader, file, decode_texture_asset, upload_texture_asset, target);
+}
+
+// get_texture_files() for the loader, the array's filled in as they're uploaded
+GPU_Image **add_texture_files(AssetLoader *loader, char *file_name, int file_count) {
+
+    GPU_Image **textures = malloc(sizeof(GPU_Image *) * file_count);
+
+    for (int i = 0; i < file_count; i++) {
+        char file[ASSET_MAX_PATH];
+        snprintf(file, sizeof(file), "%s%d.png", file_name, i + 1);
+
+        textures[i] = NULL;
+        add_texture(loader, file, &textures[i]);
+    }
+
+    return textures;
+}
+
+void add_sound(AssetLoader *loader, char *file, Sound **target) {
+    Assets_add(loader, file, decode_sound_asset, create_sound_asset, target);
+}
+
+void add_shader(AssetLoader *loader, char *file, GPU_ShaderEnum type, Uint32 *target) {
+    AssetStep compile = type == GPU_FRAGMENT_SHADER ? compile_fragment_shader_asset : compile_vertex_shader_asset;
+    Assets_add(loader, file, read_shader_asset, compile, target);
+}
+
 void update_fullscreen() { // iffy solution but whatever
     GPU_SetFullscreen(fullscreen, true);
     // UI_set_fullscreen(fullscreen);
@@ -2793,38 +3494,74 @@ BakedLightColor _lerp_baked_light_color(BakedLightColor a, BakedLightColor b, do
     };
 }
 
+// Bakes the lights that are in the level right now, for load_level(). The dungeon bakes off the tick thread instead,
+// see build_level().
 void bake_lights() {
+    static LevelBuild build; // too big for the stack
 
-    static int call_count = 0;
-    call_count++;
-
-    bool has_lights = false;
+    memset(&build, 0, sizeof(build));
+    build.seed = -1; // not a level anyone else can have
+    memcpy(build.level_tilemap, tilemap->level_tilemap, sizeof(build.level_tilemap));
 
     iter_over_all_nodes(node, {
-        if (node->type == LIGHT_POINT) {
-            has_lights = true;
-            break;
+        if (node->type == LIGHT_POINT && build.lights_amount < LEVEL_MAX_LIGHTS) {
+            LightPoint *point = node;
+            build.lights[build.lights_amount++] = (LevelLight){point->pos, point->strength, point->radius, point->color};
         }
     });
 
-    if (!has_lights) {
+    if (build.lights_amount == 0) {
         return;
     }
 
+    init_loading_screen();
+
+    Shm_close(&world_cache); // the last level's
+    world_cache = (SharedMem){0};
 
+    attach_baked_lights(&build);
+    compute_baked_lights(&build);
+    baked_light_grid = build.light_grid;
 
-    init_loading_screen();
+    prepare_lightmap(&build);
+    upload_lightmap(build.lightmap_bytes);
+    free(build.lightmap_bytes);
+
+    update_loading_progress(1);
 
+    remove_loading_screen();
+}
+
+// Points build->light_grid at the world cache for its seed if there is one. True if it's baked already, false if it's
+// ours to bake: in the cache if we made it (Shm_publish() when done), in baked_light_storage if nothing's shared.
+// Nothing reads baked_light_storage while a level's building, so it can bake right into it.
+bool attach_baked_lights(LevelBuild *build) {
+    build->cache = (SharedMem){0};
+    build->light_grid = baked_light_storage;
+
+    if (build->seed == -1) return false; // not a level anyone else can have
+
+    char name[SHM_MAX_NAME];
+    snprintf(name, sizeof(name), "handcannon_world_%ld", build->seed);
+    if (!Shm_open(&build->cache, name, sizeof(baked_light_storage))) return false;
+
+    build->light_grid = build->cache.data;
+    return !build->cache.owner;
+}
+
+// Into build->light_grid, from build->lights against build->level_tilemap. Touches nothing else, it runs on the
+// level build's thread.
+void compute_baked_lights(LevelBuild *build) {
     const int CALC_RES = BAKED_LIGHT_CALC_RESOLUTION; // directly affects performance!
 
+    BakedLightColor (*baked_light_grid)[TILEMAP_WIDTH * BAKED_LIGHT_RESOLUTION] = build->light_grid;
     
     for (int r = 0; r < TILEMAP_HEIGHT * BAKED_LIGHT_RESOLUTION; r++) {
         for (int c = 0; c < TILEMAP_WIDTH * BAKED_LIGHT_RESOLUTION; c++) {
 
             if (r % 100 == 0 && c == 0) {
-                double max_progress = 0.1;
                 double progress = (double)r / (TILEMAP_HEIGHT * BAKED_LIGHT_RESOLUTION);
-                update_loading_progress(0.8 + progress * max_progress);
+                atomic_store(&build->progress, LEVEL_BUILD_BAKE_START + progress * (LEVEL_BUILD_BAKE_END - LEVEL_BUILD_BAKE_START));
             }
 
             baked_light_grid[r][c] = (BakedLightColor){ambient_light, ambient_light, ambient_light};
@@ -2835,7 +3572,7 @@ void bake_lights() {
 
             bool is_in_wall = in_range(tilemap_row, 0, TILEMAP_HEIGHT - 1)
             && in_range(tilemap_col, 0, TILEMAP_WIDTH - 1)
-            && tilemap->level_tilemap[tilemap_row][tilemap_col] == P_WALL;
+            && build->level_tilemap[tilemap_row][tilemap_col] == P_WALL;
 
             if (is_in_wall) continue;
 
@@ -2851,20 +3588,8 @@ void bake_lights() {
 
             const int calc_tile_size = BAKED_LIGHT_RESOLUTION / CALC_RES;
 
-            int k = array_length(game_node->children);
-            
-            int light_count = 0;
-            int total_nodes_count = 0;
-
-            iter_over_all_nodes(node, {
-
-                total_nodes_count++;
-
-                if (node->type != LIGHT_POINT) {
-                    continue;
-                }
-                LightPoint *point = node;
-                light_count += 1;
+            for (int i = 0; i < build->lights_amount; i++) {
+                LevelLight *point = &build->lights[i];
 
                 v2 current_pos = v2_mul(v2_div((v2){c, r}, to_vec(BAKED_LIGHT_RESOLUTION)), to_vec(tileSize));
                 if (abs(current_pos.x - point->pos.x) > point->radius || abs(current_pos.y - point->pos.y) > point->radius) continue;
@@ -2875,7 +3600,7 @@ void bake_lights() {
 
                 v2 dir = v2_div(v2_sub(point->pos, current_pos), to_vec(dist_to_point));
 
-                RayCollisionData data = castRay(current_pos, dir);
+                RayCollisionData data = castRayOn(build->level_tilemap, current_pos, dir);
 
                 BakedLightColor col = {0, 0, 0};
 
@@ -2902,7 +3627,7 @@ void bake_lights() {
                 baked_light_grid[r][c].r = SDL_clamp(baked_light_grid[r][c].r + col.r, ambient_light, MAX_LIGHT);
                 baked_light_grid[r][c].g = SDL_clamp(baked_light_grid[r][c].g + col.g, ambient_light, MAX_LIGHT);
                 baked_light_grid[r][c].b = SDL_clamp(baked_light_grid[r][c].b + col.b, ambient_light, MAX_LIGHT);
-            });
+            }
 
 
 
@@ -2957,7 +3682,7 @@ void bake_lights() {
 
         }
     }
-    update_loading_progress(0.95);
+    atomic_store(&build->progress, (LEVEL_BUILD_BAKE_END + 1000) / 2);
 
 
     // vertical
@@ -2997,32 +3722,40 @@ void bake_lights() {
         }
     }
 
-    if (lightmap_image != NULL) GPU_FreeImage(lightmap_image);
-    lightmap_image = GPU_CreateImage(BAKED_LIGHT_RESOLUTION * TILEMAP_WIDTH, BAKED_LIGHT_RESOLUTION * TILEMAP_HEIGHT, GPU_FORMAT_RGBA);
-    GPU_Target *image_target = GPU_LoadTarget(lightmap_image);
+}
 
-    for (int r = 0; r < TILEMAP_HEIGHT * BAKED_LIGHT_RESOLUTION; r++) {
-        for (int c = 0; c < TILEMAP_WIDTH * BAKED_LIGHT_RESOLUTION; c++) {
-            BakedLightColor color = baked_light_grid[r][c];
+// The lightmap's texels from build->light_grid into build->lightmap_bytes (malloc'd), still off the tick thread.
+void prepare_lightmap(LevelBuild *build) {
+    const int width = TILEMAP_WIDTH * BAKED_LIGHT_RESOLUTION;
+    const int height = TILEMAP_HEIGHT * BAKED_LIGHT_RESOLUTION;
 
-            double multiplier = 255.0 / 5;
+    // all at once, a GPU_Pixel() per texel took longer than baking
+    unsigned char *bytes = malloc((size_t)width * height * 4);
+    double multiplier = 255.0 / 5;
 
-            SDL_Color tex_color = {
-                SDL_clamp(color.r * multiplier, 0, 255),
-                SDL_clamp(color.g * multiplier, 0, 255),
-                SDL_clamp(color.b * multiplier, 0, 255),
-                255
-            };
-            GPU_Pixel(image_target, c, r, tex_color);
+    for (int r = 0; r < height; r++) {
+        for (int c = 0; c < width; c++) {
+            BakedLightColor color = build->light_grid[r][c];
+            unsigned char *texel = bytes + ((size_t)r * width + c) * 4;
+
+            texel[0] = SDL_clamp(color.r * multiplier, 0, 255);
+            texel[1] = SDL_clamp(color.g * multiplier, 0, 255);
+            texel[2] = SDL_clamp(color.b * multiplier, 0, 255);
+            texel[3] = 255;
         }
     }
 
-    GPU_FreeTarget(image_target);
+    build->lightmap_bytes = bytes;
+}
 
-    update_loading_progress(1);
+void upload_lightmap(const unsigned char *bytes) {
+    const int width = TILEMAP_WIDTH * BAKED_LIGHT_RESOLUTION;
+    const int height = TILEMAP_HEIGHT * BAKED_LIGHT_RESOLUTION;
 
-    remove_loading_screen();
+    if (lightmap_image != NULL) GPU_FreeImage(lightmap_image);
+    lightmap_image = GPU_CreateImage(width, height, GPU_FORMAT_RGBA);
 
+    GPU_UpdateImageBytes(lightmap_image, NULL, bytes, width * 4);
 }
 
 double get_max_height() {
@@ -3030,14 +3763,6 @@ double get_max_height() {
     return (WALL_HEIGHT * WALL_HEIGHT_MULTIPLIER * WINDOW_HEIGHT) * fov_factor;
 }
 
-void reset_level() {
-
-    init_loading_screen();
-    generate_dungeon();
-    update_loading_progress(0.1);
-    load_dungeon();
-}
-
 void player_take_dmg(double dmg) {
 
     player->health -= dmg;
@@ -3062,6 +3787,7 @@ void player_take_dmg(double dmg) {
 void player_die() {
     // play some dramatic ahh animation
     player->world_node.pos = spawn_point;
+    WorldNode_reset_interpolation(&player->world_node);
     player->vel = V2_ZERO;
     player->height_vel = 0;
     player->health = player->maxHealth;
@@ -3111,6 +3837,15 @@ void update_loading_progress(double progress) {
 
     GPU_Clear(actual_screen);
 
+    draw_loading_bar(progress);
+
+    GPU_Flip(actual_screen);
+
+}
+
+// 'progress' from 0 to 1, over whatever's on actual_screen
+void draw_loading_bar(double progress) {
+
     const v2 bar_container_size = {
         200,
         50
@@ -3150,9 +3885,6 @@ void update_loading_progress(double progress) {
     GPU_RectangleFilled2(actual_screen, bar_background, GPU_MakeColor(0, 0, 0, 255));
 
     GPU_RectangleFilled2(actual_screen, bar, GPU_MakeColor(255, 255, 255, 255));
-
-    GPU_Flip(actual_screen);
-
 }
 
 void remove_loading_screen() {
@@ -3272,7 +4004,7 @@ void _shoot(double spread) { // the sound isnt attached bc shotgun makes eargasm
     RayCollisionData ray_data = castRayForAll(player->world_node.pos, shoot_dir);
 
 
-    v2 hit_pos = screenToFloor((v2){RESOLUTION_X / 2, WINDOW_HEIGHT / 2 + pitch});
+    v2 hit_pos = screenToFloor((v2){render_resolution_x / 2, WINDOW_HEIGHT / 2 + pitch});
     double distance_to_hit_pos = v2_distance(hit_pos, player->world_node.pos);
     double distance_to_coll_pos = ray_data.hit? v2_distance(ray_data.collpos, player->world_node.pos) : 999999999999;
 
@@ -3332,7 +4064,9 @@ void _shoot(double spread) { // the sound isnt attached bc shotgun makes eargasm
         .hit_pos = final_pos,
         .hit_height = final_height,
         .shooter_id = client_self_id,
-        .hit_id = -1
+        .hit_id = -1,
+        .origin = player->world_node.pos,
+        .dir = shoot_dir
     };
     if (ray_data.hit) {
         if (ray_data.collider != NULL && ray_data.collider->parent->type == PLAYER_ENTITY) {
@@ -3341,6 +4075,7 @@ void _shoot(double spread) { // the sound isnt attached bc shotgun makes eargasm
 
             
             packet_data.hit_id = player_entity->id;
+            packet_data.view_delay = IB_delay(&player_entity->interp); // how far behind we saw them, for the server's check
             
         }
     }
@@ -3682,6 +4417,12 @@ void _back_pressed(UIComponent *comp, bool pressed) {
     host_menu->visible = false;
 }
 
+// The server puts us in a match before it sends anything, see server.c. Fine to call before the connect finishes.
+void client_join_match(int match_id) {
+    struct join_match_packet packet_data = {.match_id = match_id};
+    MPClient_send((MPPacket){.type = PACKET_JOIN_MATCH, .len = sizeof(packet_data), .is_broadcast = false}, &packet_data);
+}
+
 void _h_play_pressed(UIComponent *comp, bool pressed) {
 
     public_ip = get_public_ip();
@@ -3707,6 +4448,7 @@ void _h_play_pressed(UIComponent *comp, bool pressed) {
     await(MP_is_server);
 
     MPClient(local_ip.data);
+    client_join_match(MATCH_ANY);
 
     String clipboard_string = String_concat(StringRef("Join my game! \n\tPublic code: "), public_code);
     clipboard_string = String_concatf(clipboard_string, String("\n\tLAN code: "));
@@ -3742,6 +4484,7 @@ void _j_play_pressed(UIComponent *comp, bool pressed) {
     MP_set_port(port);
 
     MPClient(ip.data);
+    client_join_match(MATCH_ANY);
 
     started_game = true;
     main_menu->visible = false;
@@ -3808,6 +4551,18 @@ void make_ui() {
         UI_add_child(UI_get_root(), fps_label);
     );
 
+    net_label = UI_alloc(
+        UILabel,
+        net_label,
+        net_label->font_size = 20;
+        net_label->alignment_x = ALIGNMENT_LEFT;
+        UI_set_visible(net_label, false);
+        UILabel_set_text(net_label, StringRef("net: "));
+        UI_set_size(net_label, V2(WINDOW_WIDTH / 4, WINDOW_HEIGHT / 10));
+        UI_set_global_pos(net_label, V2(WINDOW_WIDTH * 0.03, WINDOW_HEIGHT * 0.25));
+        UI_add_child(UI_get_root(), net_label);
+    );
+
     pause_menu = UI_alloc(
         UIComponent,
         pause_menu,
@@ -4078,129 +4833,8 @@ void particle_spawner_explode(ParticleSpawner *spawner) {
     }
 }
 
-Room Room_new(v2 pos) {
-    Room room;
-    room.room_idx = pos;
-    room.left = NULL;
-    room.right = NULL;
-    room.down = NULL;
-    room.up = NULL;
-    room.is_start = false;
-    room.is_boss = false;
-    room.room_file_name = String("test_room.hcroom");
-    room.initialized = true;
-
-
-    return room;
-}
-
-void generate_room_recursive(Room *room_ptr, bool visited[DUNGEON_SIZE][DUNGEON_SIZE]) {
-    visited[(int)room_ptr->room_idx.y][(int)room_ptr->room_idx.x] = true;
-    // generated_count++;
-
-    v2 current = room_ptr->room_idx;
-
-    v2 dirs[4] = {V2_LEFT, V2_RIGHT, V2_UP, V2_DOWN};
-    const int LEFT = 0;
-    const int RIGHT = 1;
-    const int UP = 2;
-    const int DOWN = 3;
-    int dir_indicies[4] = {LEFT, RIGHT, UP, DOWN};
-
-    shuffle_array(dir_indicies, 4);
-
-
-    for (int i = 0; i < 4; i++) {
-        int dir_idx = dir_indicies[i];
-        v2 dir = dirs[dir_idx];
-
-
-        v2 pos = v2_add(current, dir);
-        if (!in_range(pos.x, 0, DUNGEON_SIZE - 1) || !in_range(pos.y, 0, DUNGEON_SIZE - 1)) continue;
-        if (visited[(int)pos.y][(int)pos.x]) {
-            return;
-        }
-
-        rooms[(int)pos.y][(int)pos.x] = Room_new(pos);
-        visited[(int)pos.y][(int)pos.x] = true;
-
-        Room *new_ref = &rooms[(int)pos.y][(int)pos.x];
-        
-        switch (dir_idx) {
-            case 0:
-                room_ptr->left = new_ref;
-                new_ref->right = room_ptr;
-                break;
-            case 1:
-                room_ptr->right = new_ref;
-                new_ref->left = room_ptr;
-                break;
-            case 2:
-                room_ptr->up = new_ref;
-                new_ref->down = room_ptr;
-                break;
-            case 3:
-                room_ptr->down = new_ref;
-                new_ref->up = room_ptr;
-                break;
-            default:
-                printf("Uh oh \n");
-                break;
-        }
-
-        generate_room_recursive(new_ref, visited);
-    }
-}
-
-void generate_dungeon() {
-    
-    Room empty_room = {0};
-
-    srand(client_dungeon_seed);
-
-    bool visited[DUNGEON_SIZE][DUNGEON_SIZE] = {0};
-
-
-    // for multiplayer testing
-    Room start_room = Room_new(V2_ZERO);//Room_new((v2){randi_range(0, DUNGEON_SIZE - 1), randi_range(0, DUNGEON_SIZE - 1)});
-
-    start_room.is_start = true;
-
-    rooms[(int)start_room.room_idx.y][(int)start_room.room_idx.x] = start_room;
-
-    Room *start_room_ptr = &rooms[(int)start_room.room_idx.y][(int)start_room.room_idx.x];
-    
-    generate_room_recursive(&rooms[(int)start_room.room_idx.y][(int)start_room.room_idx.x], visited);
-
-
-    v2 dirs[4] = {V2_LEFT, V2_RIGHT, V2_UP, V2_DOWN};
-
-    for (int i = 0; i < 4; i++) {
-        v2 pos = v2_add(start_room.room_idx, dirs[i]);
-        if (in_range(pos.x, 0, DUNGEON_SIZE - 1) && in_range(pos.y, 0, DUNGEON_SIZE - 1)) {
-            if (!struct_equal(Room, rooms[(int)pos.y][(int)pos.x], empty_room)) {
-
-                Room *room = &rooms[(int)pos.y][(int)pos.x];
-
-                if (v2_equal(dirs[i], V2_LEFT)) {
-                    start_room_ptr->left = room;
-                    room->right = start_room_ptr;
-                } else if (v2_equal(dirs[i], V2_RIGHT)) {
-                    start_room_ptr->right = room;
-                    room->left = start_room_ptr;
-                } else if (v2_equal(dirs[i], V2_UP)) {
-                    start_room_ptr->up = room;
-                    room->down = start_room_ptr;
-                } else {
-                    start_room_ptr->down = room;
-                    room->up = start_room_ptr;
-                }
-            }
-        }
-    }
-}
-
-void load_room(Room *room_ptr) {
+// The room's tiles into the build, with its lights and, in the start room, the player's spawn.
+void load_room(Room *room_ptr, LevelBuild *build) {
 
 
     room_ptr->left_entrance_pos = (v2){(int)ROOM_WIDTH / 2, (int)ROOM_HEIGHT / 2};
@@ -4254,10 +4888,10 @@ void load_room(Room *room_ptr) {
     
     for (int r = 0; r < ROOM_HEIGHT; r++) {
         for (int c = 0; c < ROOM_WIDTH; c++) {
-            tilemap->floor_tilemap[offset_r + r][offset_c + c] = data[data_ptr++];
-            if (tilemap->floor_tilemap[offset_r + r][offset_c + c] == P_FLOOR_LIGHT) {
+            build->floor_tilemap[offset_r + r][offset_c + c] = data[data_ptr++];
+            if (build->floor_tilemap[offset_r + r][offset_c + c] == P_FLOOR_LIGHT) {
                 v2 tile_mid = (v2){(offset_c + c + 0.5) * tileSize, (offset_r + r + 0.5) * tileSize};
-                spawn_floor_light(tile_mid);
+                build->lights[build->lights_amount++] = floor_light(tile_mid);
                 num_lights++;
             }
         }
@@ -4283,9 +4917,9 @@ void load_room(Room *room_ptr) {
                     room_ptr->top_entrance_pos = entrance_pos;
                 }
 
-                tilemap->level_tilemap[offset_r + r][offset_c + c] = P_WALL;
+                build->level_tilemap[offset_r + r][offset_c + c] = P_WALL;
             } else {
-                tilemap->level_tilemap[offset_r + r][offset_c + c] = tile;
+                build->level_tilemap[offset_r + r][offset_c + c] = tile;
             }
 
 
@@ -4295,12 +4929,12 @@ void load_room(Room *room_ptr) {
 
     for (int r = 0; r < ROOM_HEIGHT; r++) {
         for (int c = 0; c < ROOM_WIDTH; c++) {
-            tilemap->ceiling_tilemap[offset_r + r][offset_c + c ] = data[data_ptr++];
+            build->ceiling_tilemap[offset_r + r][offset_c + c ] = data[data_ptr++];
 
 
-            if (tilemap->ceiling_tilemap[offset_r + r][offset_c + c ] == P_CEILING_LIGHT) {
+            if (build->ceiling_tilemap[offset_r + r][offset_c + c ] == P_CEILING_LIGHT) {
                 v2 tile_mid = (v2){(offset_c + c + 0.5) * tileSize, (offset_r + r + 0.5) * tileSize};
-                spawn_ceiling_light(tile_mid);
+                build->lights[build->lights_amount++] = ceiling_light(tile_mid);
                 num_lights++;
             }
         }
@@ -4312,10 +4946,10 @@ void load_room(Room *room_ptr) {
 
             v2 tile_mid = (v2){(offset_c + c + 0.5) * tileSize, (offset_r + r + 0.5) * tileSize};
 
+            // place_entity() only knows the player so far, finish_level_build() puts it there
             if (room.is_start && etype == P_PLAYER) {
-                place_entity(tile_mid, P_PLAYER);
-            } else if (etype != P_PLAYER && !room.is_start) {
-                place_entity(tile_mid, etype);
+                build->spawn_point = tile_mid;
+                build->has_spawn_point = true;
             }
         }
     }
@@ -4327,7 +4961,7 @@ void load_room(Room *room_ptr) {
 }
 
 
-void _carve_path(v2 pos1, v2 pos2, bool vertical) {
+void _carve_path(LevelBuild *build, v2 pos1, v2 pos2, bool vertical) {
 
     //const int PATH_SIZE = 3;
 
@@ -4351,7 +4985,7 @@ void _carve_path(v2 pos1, v2 pos2, bool vertical) {
             current_col = c;
             for (int i = -1; i <= 1; i++) {
                 for (int j = -1; j <= 1; j++) {
-                    tilemap->level_tilemap[current_row + i][current_col + j] = -1;
+                    build->level_tilemap[current_row + i][current_col + j] = -1;
                 }
             }
         }
@@ -4359,7 +4993,7 @@ void _carve_path(v2 pos1, v2 pos2, bool vertical) {
             current_row = r;
             for (int i = -1; i <= 1; i++) {
                 for (int j = -1; j <= 1; j++) {
-                    tilemap->level_tilemap[current_row + i][current_col + j] = -1;
+                    build->level_tilemap[current_row + i][current_col + j] = -1;
                 }
             }
             
@@ -4368,7 +5002,7 @@ void _carve_path(v2 pos1, v2 pos2, bool vertical) {
             current_col = c;
             for (int i = -1; i <= 1; i++) {
                 for (int j = -1; j <= 1; j++) {
-                    tilemap->level_tilemap[current_row + i][current_col + j] = -1;
+                    build->level_tilemap[current_row + i][current_col + j] = -1;
                 }
             }
         }
@@ -4378,7 +5012,7 @@ void _carve_path(v2 pos1, v2 pos2, bool vertical) {
             current_row = r;
             for (int i = -1; i <= 1; i++) {
                 for (int j = -1; j <= 1; j++) {
-                    tilemap->level_tilemap[current_row + i][current_col + j] = -1;
+                    build->level_tilemap[current_row + i][current_col + j] = -1;
                 }
             }
         }
@@ -4386,7 +5020,7 @@ void _carve_path(v2 pos1, v2 pos2, bool vertical) {
             current_col = c;
             for (int i = -1; i <= 1; i++) {
                 for (int j = -1; j <= 1; j++) {
-                    tilemap->level_tilemap[current_row + i][current_col + j] = -1;
+                    build->level_tilemap[current_row + i][current_col + j] = -1;
                 }
             }
         }
@@ -4394,7 +5028,7 @@ void _carve_path(v2 pos1, v2 pos2, bool vertical) {
             current_row = r;
             for (int i = -1; i <= 1; i++) {
                 for (int j = -1; j <= 1; j++) {
-                    tilemap->level_tilemap[current_row + i][current_col + j] = -1;
+                    build->level_tilemap[current_row + i][current_col + j] = -1;
                 }
             }
         }
@@ -4402,17 +5036,17 @@ void _carve_path(v2 pos1, v2 pos2, bool vertical) {
 
     for (int i = -1; i <= 1; i++) {
         for (int j = -1; j <= 1; j++) {
-            tilemap->level_tilemap[current_row + i][current_col + j] = -1;
+            build->level_tilemap[current_row + i][current_col + j] = -1;
         }
     }
 }
 
-void carve_room_paths() {
+void carve_room_paths(LevelBuild *build) {
     bool visited[DUNGEON_SIZE][DUNGEON_SIZE] = {0};
 
     for (int r = 0; r < DUNGEON_SIZE; r++) {
         for (int c = 0; c < DUNGEON_SIZE; c++) {
-            const Room room = rooms[r][c];
+            const Room room = build->rooms[r][c];
             visited[r][c] = true;
             v2 room_pos = v2_mul(room.room_idx, (v2){ROOM_WIDTH, ROOM_HEIGHT});
 
@@ -4420,84 +5054,130 @@ void carve_room_paths() {
 
             if (room.left != NULL && !visited[(int)room.left->room_idx.y][(int)room.left->room_idx.x]) {
                 v2 left_room_pos = v2_mul(room.left->room_idx, (v2){ROOM_WIDTH, ROOM_HEIGHT});
-                _carve_path(v2_add(room_pos, room.left_entrance_pos), v2_add(left_room_pos, v2_sub(room.left->right_entrance_pos, offset)), false);
+                _carve_path(build, v2_add(room_pos, room.left_entrance_pos), v2_add(left_room_pos, v2_sub(room.left->right_entrance_pos, offset)), false);
             }
             
             if (room.right != NULL && !visited[(int)room.right->room_idx.y][(int)room.right->room_idx.x]) {
                 v2 right_room_pos = v2_mul(room.right->room_idx, (v2){ROOM_WIDTH, ROOM_HEIGHT});
-                _carve_path(v2_add(room_pos, room.right_entrance_pos), v2_add(right_room_pos, v2_sub(room.right->left_entrance_pos, offset)), false);
+                _carve_path(build, v2_add(room_pos, room.right_entrance_pos), v2_add(right_room_pos, v2_sub(room.right->left_entrance_pos, offset)), false);
             }       
 
             if (room.up != NULL && !visited[(int)room.up->room_idx.y][(int)room.up->room_idx.x]) {
                 v2 top_room_pos = v2_mul(room.up->room_idx, (v2){ROOM_WIDTH, ROOM_HEIGHT});
-                _carve_path(v2_add(room_pos, room.top_entrance_pos), v2_add(top_room_pos, v2_sub(room.up->bottom_entrance_pos, offset)), true);
+                _carve_path(build, v2_add(room_pos, room.top_entrance_pos), v2_add(top_room_pos, v2_sub(room.up->bottom_entrance_pos, offset)), true);
             }       
 
             if (room.down != NULL && !visited[(int)room.down->room_idx.y][(int)room.down->room_idx.x]) {
                 v2 bottom_room_pos = v2_mul(room.down->room_idx, (v2){ROOM_WIDTH, ROOM_HEIGHT});
-                _carve_path(v2_add(room_pos, room.bottom_entrance_pos), v2_add(bottom_room_pos, v2_sub(room.down->top_entrance_pos, offset)), true);
+                _carve_path(build, v2_add(room_pos, room.bottom_entrance_pos), v2_add(bottom_room_pos, v2_sub(room.down->top_entrance_pos, offset)), true);
             }       
 
         }
     }
 }
 
-void load_dungeon() {
+// Off the tick thread: the dungeon for build->seed, the paths between its rooms, the baked lights and the lightmap's
+// bytes, all into 'build'. No nodes and no GPU, finish_level_build() does those. The rooms and the stream are the
+// build's own, the host's server generates its matches' layouts on the tick thread at the same time.
+void build_level(LevelBuild *build) {
+    double start = MP_time();
 
-    clear_level();
+    generate_dungeon(build->rooms, &build->rng, build->seed);
 
-    reset_tilemap(tilemap->level_tilemap);
-    reset_tilemap(tilemap->floor_tilemap);
-    reset_tilemap(tilemap->ceiling_tilemap);
+    // the room picks and lights come from the rest of the dungeon's stream
+    RNG *previous_rng = RNG_use(&build->rng);
 
-    double prog = 0.1;
+    memset(build->level_tilemap, -1, sizeof(build->level_tilemap)); // every int -1, nothing there
+    memset(build->floor_tilemap, -1, sizeof(build->floor_tilemap));
+    memset(build->ceiling_tilemap, -1, sizeof(build->ceiling_tilemap));
 
     for (int r = 0; r < DUNGEON_SIZE; r++) {
         for (int c = 0; c < DUNGEON_SIZE; c++) {
+            atomic_store(&build->progress, (r * DUNGEON_SIZE + c) * LEVEL_BUILD_BAKE_START / (DUNGEON_SIZE * DUNGEON_SIZE));
+
+            load_room(&build->rooms[r][c], build);
+        }    
+    }
 
-            prog = lerp(0.1, 0.8, (double)(r * DUNGEON_SIZE + c) / (DUNGEON_SIZE * DUNGEON_SIZE));
-            update_loading_progress(prog);
+    carve_room_paths(build);
 
-            load_room(&rooms[r][c]);
+    RNG_use(previous_rng);
 
-        }    
+    atomic_store(&build->progress, LEVEL_BUILD_BAKE_START);
+
+    // another instance on this machine (run2instances.bat) may have baked this level already
+    if (!attach_baked_lights(build)) {
+        compute_baked_lights(build);
+        Shm_publish(&build->cache);
     }
 
-    carve_room_paths();
-    prog += 0.05;
-    update_loading_progress(prog);
+    prepare_lightmap(build);
 
-    tilemap_image = GPU_CreateImage(TILEMAP_WIDTH, TILEMAP_HEIGHT, GPU_FORMAT_RGBA);
+    build->build_time = MP_time() - start;
+    atomic_store(&build->progress, 1000);
+    atomic_store(&build->done, true);
+}
 
-    SDL_Surface *surface = GPU_CopySurfaceFromImage(tilemap_image);
+MP_THREAD_RETURN level_build_thread(void *data) {
+    build_level(data);
+    return 0;
+}
 
-    for (int row = 0; row < TILEMAP_HEIGHT; row++) {
-        for (int col = 0; col < TILEMAP_WIDTH; col++) {
+// Clears the level and starts building the one for 'seed' off the tick thread. The tick and the network keep going
+// meanwhile, with a loading bar where the game would be, until tick() sees it's done and calls finish_level_build().
+void start_level_build(long seed) {
+    clear_level();
 
-            int floorTile = tilemap->floor_tilemap[row][col] == -1? 0 : tilemap->floor_tilemap[row][col];
-            int ceilingTile = tilemap->ceiling_tilemap[row][col] == -1? 0 : tilemap->ceiling_tilemap[row][col];
+    LevelBuild *build = &level_build;
+    build->seed = seed;
+    build->lights_amount = 0;
+    build->has_spawn_point = false;
+    build->lightmap_bytes = NULL;
+    build->started = MP_time();
+    atomic_store(&build->progress, 0);
+    atomic_store(&build->done, false);
 
-            SDL_Color color = {
-                SDL_clamp(ceilingTile * 10, 0, 255),
-                SDL_clamp(0, 0, 255),
-                SDL_clamp(floorTile * 10, 0, 255),
-                SDL_clamp(255, 0, 255)
-            };
+    level_building = true;
+    is_loading = true;
 
-            ((int *)surface->pixels)[row * TILEMAP_WIDTH + col] = color.a << 24 | color.b << 16 | color.g << 8 | color.r;
-        }
+    if (replaying) {
+        build_level(build); // done the same tick every time, so the replay goes the same way
+    } else {
+        MP_thread_start(level_build_thread, build);
     }
+}
 
-    GPU_UpdateImage(tilemap_image, NULL, surface, NULL);
+// On the tick thread once build_level() is done: its tiles, lights and spawn go into the game, its lightmap and
+// tilemap go to the GPU.
+void finish_level_build() {
+    LevelBuild *build = &level_build;
 
-    SDL_FreeSurface(surface);
+    memcpy(tilemap->level_tilemap, build->level_tilemap, sizeof(build->level_tilemap));
+    memcpy(tilemap->floor_tilemap, build->floor_tilemap, sizeof(build->floor_tilemap));
+    memcpy(tilemap->ceiling_tilemap, build->ceiling_tilemap, sizeof(build->ceiling_tilemap));
+    tilemap_version++;
 
-    bake_lights();
+    for (int i = 0; i < build->lights_amount; i++) {
+        spawn_light(build->lights[i]);
+    }
 
-    update_loading_progress(1);
-    
-    
+    if (build->has_spawn_point) place_entity(build->spawn_point, P_PLAYER);
+
+    Shm_close(&world_cache); // the last level's
+    world_cache = build->cache;
+    baked_light_grid = build->light_grid;
+
+    upload_tilemap_image();
+    upload_lightmap(build->lightmap_bytes);
+    free(build->lightmap_bytes);
+    build->lightmap_bytes = NULL;
 
+    level_building = false;
+    loading_map = false;
+    ready_to_render = true;
+    remove_loading_screen();
+
+    printf("Loaded level %ld in %.2fs, %.2fs of it building \n", build->seed, MP_time() - build->started, build->build_time);
 }
 
 double get_player_height() {
@@ -4515,96 +5195,146 @@ bool is_player_on_floor() {
 }
 
 
-void on_player_connect(SOCKET player_socket) {
-    int player_id = next_id++;
-
-    server_client_id_list[MP_clients_amount - 1] = player_id;
-
-    char buf[MP_DEFAULT_BUFFER_SIZE] = {0};
-
-    MPPacket packet = {
-        .is_broadcast = false,
-        .len = sizeof(player_id),
-        .type = PACKET_UPDATE_PLAYER_ID
-    };
-
-    memcpy(buf, &packet, sizeof(packet));
-    memcpy(buf + sizeof(packet), (void *)&player_id, packet.len);
-
-    send(player_socket, buf, sizeof(packet) + packet.len, 0);
-
-    MPServer_send(
-        (MPPacket){.type = PACKET_PLAYER_JOINED, .len = sizeof(struct player_joined_packet), .is_broadcast = true}, 
-        &player_id
-    );
-
-    for (int i = 0; i < MP_clients_amount; i++) {
-        // printf("Sending to the dude. ID: %d \n", server_client_id_list[i]);
-
-        struct player_joined_packet packet_data = {.id = server_client_id_list[i]};
+// server_tick(): the host's own projectiles are the authoritative ones
+int collect_projectile_states(SnapState *states, int capacity) {
+    int count = 0;
 
-        MPPacket packet = {.type = PACKET_PLAYER_JOINED, .len = sizeof(struct player_joined_packet), .is_broadcast = false};
+    iter_over_all_nodes(node, {
+        if (node->sync_id == -1 || !is_sync_id_valid(node->sync_id)) continue;
 
-        char bruh[MP_DEFAULT_BUFFER_SIZE] = {0};
+        if (instanceof(node->type, PROJECTILE) && count < capacity) {
 
-        memcpy(bruh, &packet, sizeof(packet));
-        memcpy(bruh + sizeof(packet), &packet_data, packet.len);
+            Projectile *proj = node;
 
-        send(player_socket, bruh, sizeof(packet) + packet.len, 0);
-    }
+            states[count++] = (SnapState){
+                .id = node->sync_id,
+                .pos = proj->entity.world_node.pos,
+                .height = proj->entity.world_node.height,
+                .vel = proj->vel,
+                .h_vel = proj->height_vel,
+                .accel = proj->accel,
+                .h_accel = proj->height_accel
+            };
+        }
+    });
 
+    return count;
+}
 
-    MPPacket seed_packet = {
-        .is_broadcast = false,
-        .len = sizeof(struct dungeon_seed_packet),
-        .type = PACKET_DUNGEON_SEED
-    };
+// The ability packet that creates a projectile like this one, -1 if it isn't one of those.
+int join_state_projectile_kind(Projectile *proj) {
+    if (proj->on_tick == switchshot_projectile_tick) return PACKET_ABILITY_SWITCHSHOT;
+    if (proj->type == PROJ_FORCEFIELD) return PACKET_ABILITY_FORCEFIELD;
+    if (proj->on_destruction == bomb_on_destroy) return PACKET_ABILITY_BOMB;
+    return -1;
+}
 
-    if (server_dungeon_seed == -1) {
-        server_dungeon_seed = rand();
-    }
+// Every synced projectile we have, for a newcomer that never got the packets that made them. Always at least one
+// chunk, so an empty match still tells the newcomer it's caught up.
+void send_join_state(int for_id) {
+    static int snapshots_sent = 0;
+    static unsigned char bytes[JOIN_STATE_MAX_CHUNKS * JOIN_STATE_CHUNK_SIZE];
+    int len = 0, projectiles = 0;
 
-    struct dungeon_seed_packet seed_packet_data = {
-        .seed = server_dungeon_seed
-    };
+    iter_over_all_nodes(node, {
+        if (node->sync_id == -1 || !is_sync_id_valid(node->sync_id) || !instanceof(node->type, PROJECTILE)) continue;
 
-    MPServer_send_to(seed_packet, &seed_packet_data, player_socket);
-    printf("Sent seed to client. \n");
-}
+        Projectile *proj = node;
+        int kind = join_state_projectile_kind(proj);
+        if (kind == -1) continue;
+
+        struct join_projectile_state state = {
+            .kind = kind,
+            .sync_id = node->sync_id,
+            .shooter_id = proj->shooter_id,
+            .pos = proj->entity.world_node.pos,
+            .height = proj->entity.world_node.height,
+            .vel = proj->vel,
+            .h_vel = proj->height_vel,
+            .life_left = proj->life_timer
+        };
 
-void on_player_disconnect(SOCKET player_socket) {
+        unsigned char record[64];
+        int record_len = Wire_encode(&join_projectile_schema, &state, record, sizeof(record));
+        if (record_len < 0 || len + 1 + record_len > (int)sizeof(bytes)) continue;
 
-}
+        bytes[len++] = record_len;
+        memcpy(bytes + len, record, record_len);
+        len += record_len;
+        projectiles++;
+    });
 
-// #SERVER RECV
-void on_server_recv(SOCKET socket, MPPacket packet, void *data) {
+    int chunks = len == 0 ? 1 : (len + JOIN_STATE_CHUNK_SIZE - 1) / JOIN_STATE_CHUNK_SIZE;
+    snapshots_sent++;
+
+    for (int i = 0; i < chunks; i++) {
+        struct join_state_packet chunk = {
+            .for_id = for_id,
+            .snapshot_id = client_self_id * 1000 + snapshots_sent,
+            .version = JOIN_STATE_VERSION,
+            .chunk = i,
+            .chunks = chunks,
+            .len = min(JOIN_STATE_CHUNK_SIZE, len - i * JOIN_STATE_CHUNK_SIZE)
+        };
+        memcpy(chunk.bytes, bytes + i * JOIN_STATE_CHUNK_SIZE, chunk.len);
 
-    if (packet.len > MP_DEFAULT_BUFFER_SIZE) {
-        printf("corrupted on_server_recv \n");
-        commit_sudoku();
+        MPPacket packet = {.type = PACKET_JOIN_STATE, .len = JOIN_STATE_HEADER_SIZE + chunk.len, .is_broadcast = false};
+        MPClient_send(packet, &chunk);
     }
 
-    if (packet.type == PACKET_REQUEST_DUNGEON_SEED) {
-        struct dungeon_seed_packet packet_data = {.seed = server_dungeon_seed};
-        MPPacket seed_packet = {.type = PACKET_DUNGEON_SEED, .len = sizeof(packet_data), .is_broadcast = false};
+    printf("Sent player %d the match: %d projectiles, %d bytes \n", for_id, projectiles, len);
+}
 
-        MPServer_send_to(seed_packet, &packet_data, socket);
-        return;
-    } 
-    if (instanceof(packet.type, PACKETS_TO_SYNC)) {
-        int sync_id = server_next_sync_id++;
+// Creates what the join state has that we don't, through the same handlers the ability packets go to.
+void apply_join_state() {
+    JoinStateAssembly *state = &client_join_state;
+    state->applied = true;
 
-        MPPacket packet = {.is_broadcast = false, .len = sizeof(struct send_sync_id_packet), .type = PACKET_SEND_SYNC_ID};
-        struct send_sync_id_packet pdata = {.sync_id = sync_id};
+    static unsigned char bytes[JOIN_STATE_MAX_CHUNKS * JOIN_STATE_CHUNK_SIZE];
+    int len = 0;
+    for (int i = 0; i < state->chunks; i++) {
+        memcpy(bytes + len, state->bytes[i], state->len[i]);
+        len += state->len[i];
+    }
 
-        MPServer_send_to(packet, &pdata, socket);
+    int created = 0;
+    int offset = 0;
+    while (offset < len) {
+        int record_len = bytes[offset++];
+        struct join_projectile_state proj;
 
-        // sync id must always be first then
-        *(int *)data = sync_id;
+        if (offset + record_len > len || Wire_decode(&join_projectile_schema, bytes + offset, record_len, &proj) < 0) {
+            printf("Join state cut short after %d projectiles \n", created);
+            break;
+        }
+        offset += record_len;
+
+        if (!is_sync_id_valid(proj.sync_id) || find_node_by_sync_id(proj.sync_id) != NULL) continue; // its packet beat us here
+
+        MPPacket packet = {.type = proj.kind, .is_broadcast = true};
+
+        if (proj.kind == PACKET_ABILITY_BOMB) {
+            struct ability_bomb_packet packet_data = {proj.sync_id, proj.pos, proj.height, proj.vel, proj.h_vel, proj.shooter_id};
+            packet.len = sizeof(packet_data);
+            client_handle_ability_bomb(packet, &packet_data);
+        } else if (proj.kind == PACKET_ABILITY_FORCEFIELD) {
+            struct ability_forcefield_packet packet_data = {proj.sync_id, proj.pos, proj.height, proj.vel, proj.h_vel, proj.shooter_id};
+            packet.len = sizeof(packet_data);
+            client_handle_ability_forcefield(packet, &packet_data);
+        } else if (proj.kind == PACKET_ABILITY_SWITCHSHOT) {
+            struct ability_switchshot_packet packet_data = {proj.sync_id, proj.pos, proj.height, proj.vel, proj.h_vel, proj.shooter_id};
+            packet.len = sizeof(packet_data);
+            client_handle_ability_switchshot(packet, &packet_data);
+        }
 
+        Projectile *created_proj = (Projectile *)find_node_by_sync_id(proj.sync_id);
+        if (created_proj != NULL) {
+            created_proj->life_timer = proj.life_left;
+            created++;
+        }
     }
 
-    MPServer_send(packet, data);
+    printf("Caught up with the match: %d projectiles \n", created);
 }
 
 void client_add_player_entity(int id) {
@@ -4621,8 +5351,7 @@ void client_add_player_entity(int id) {
     // player_entity->entity.sprite = createSprite(false, 0);
     // player_entity->entity.sprite->texture = entityTexture;
     player_entity->entity.color = (SDL_Color){255, 255, 255,  255};
-    player_entity->desired_pos = V2_ZERO;
-    player_entity->desired_height = 0;
+    player_entity->interp = IB_new();
 
 
     // Sprite *temp_sprite = alloc(Sprite, SPRITE, false);
@@ -4651,218 +5380,346 @@ void client_add_player_entity(int id) {
 }
 
 // #CLIENT RECV
-void on_client_recv(MPPacket packet, void *data) {
+// one handler per packet type, see client_packet_handlers
+void client_handle_update_player_id(MPPacket packet, void *data) {
+    client_self_id = ((struct update_player_id_packet *)data)->id;
+}
 
-    if (packet.len > MP_DEFAULT_BUFFER_SIZE) {
-        printf("Packet too big! \n");
+void client_handle_player_pos(MPPacket packet, void *data) {
+    struct player_pos_packet packet_data = *(struct player_pos_packet *)data;
+
+    if (packet_data.id == client_self_id) {
         return;
     }
 
-    if (packet.type < 0 || packet.type > PACKETS_END) {
-        printf("Invalid packet type! \n");
+    for (int i = 0; i < client_hidden_players_amount; i++) {
+        if (client_hidden_players[i].id != packet_data.id) continue;
+
+        if (packet_data.time <= client_hidden_players[i].time) return; // from before it went out of view
+        client_hidden_players[i] = client_hidden_players[--client_hidden_players_amount];
+        break;
+    }
+
+    PlayerEntity *player_entity = find_or_add_player_entity_by_id(packet_data.id);
+
+    if (player_entity == NULL) return;
+
+    // the crouch offset goes in the sample too, so crouching eases in like everything else
+    double size_y = 10000 * (packet_data.crouching? 0.5 : 1);
+    double height = packet_data.height - size_y / 2;
+    if (packet_data.crouching) {
+        height -= size_y;
+    }
+
+    InterpState state = {.pos = packet_data.pos, .height = height, .dir = packet_data.dir};
+
+    if (!IB_push(&player_entity->interp, packet_data.time, tick_clock, state)) return; // older than what we have
+
+    player_entity->entity.color = packet_data.color;
+    player_entity->crouching = packet_data.crouching;
+}
+
+void client_handle_dungeon_seed(MPPacket packet, void *data) {
+    if (client_dungeon_seed != -1) {
         return;
     }
 
-    if (packet.type == PACKET_UPDATE_PLAYER_ID) {
+    printf("Received dungeon seed. \n");
 
-        client_self_id = *(int *)(data);
+    struct dungeon_seed_packet *packet_data = data;
 
-    } else if (packet.type == PACKET_PLAYER_POS) {
-        
-        struct player_pos_packet packet_data = *(struct player_pos_packet *)data;
+    client_dungeon_seed = packet_data->seed;
 
-        if (packet_data.id == client_self_id) {
-            return;
+    loading_map = true;
+}
+
+void client_handle_ability_shoot(MPPacket packet, void *data) {
+    struct ability_shoot_packet *packet_data = data;
+
+    if (client_self_id == packet_data->shooter_id) {
+
+        if (packet_data->hit_id != -1) {
+            player_entity_take_dmg(find_or_add_player_entity_by_id(packet_data->hit_id), 1);
         }
 
-        PlayerEntity *player_entity = find_or_add_player_entity_by_id(packet_data.id);
+        return;
+    }
+
+    PlayerEntity *shooter = find_or_add_player_entity_by_id(packet_data->shooter_id);            
 
-        if (player_entity == NULL) return;
+    if (shooter == NULL) return;
+
+    // create the effect at the pos and height
+    Effect *hit_effect = alloc(Effect, EFFECT, 1);
+
+    hit_effect->entity.world_node.pos = packet_data->hit_pos;
+    hit_effect->entity.world_node.height = packet_data->hit_height;
+    hit_effect->entity.world_node.size = to_vec(8000);
+
+    Sprite *sprite = alloc(Sprite, SPRITE, true);
+
+    Animation anim = create_animation(5, 0, shootHitEffectFrames);
+
+    anim.fps = 12;
+    anim.loop = false;
+
+    array_append(sprite->animations, anim);
+
+    spritePlayAnim(sprite, 0);
+
+    Node_add_child(hit_effect, sprite);
+
+
+    Effect *ray_effect = alloc(Effect, EFFECT, 0.3);
+    Line *line = alloc(Line, LINE);
+    line->p1 = shooter->entity.world_node.pos;
+    line->p2 = packet_data->hit_pos;
+    line->h1 = shooter->entity.world_node.height;
+    line->h2 = packet_data->hit_height;
+    line->texture = shoot_ray;
+    line->fade = true;
+    line->width = 200;
+    Node_add_child(ray_effect, line);
+
+    Node_add_child(game_node, ray_effect);
+
+    Node_add_child(game_node, hit_effect);
 
-        player_entity->desired_pos = packet_data.pos;
-        player_entity->desired_height = packet_data.height;
-        player_entity->dir = packet_data.dir;
-        player_entity->entity.color = packet_data.color;
-        player_entity->crouching = packet_data.crouching;
-    
-    } else if (packet.type == PACKET_DUNGEON_SEED) {
 
-        if (client_dungeon_seed != -1) {
+    if (packet_data->hit_id != -1) {
+
+        if (packet_data->hit_id == client_self_id) {
+            player_take_dmg(1);
             return;
         }
 
-        printf("Received dungeon seed. \n");
+        PlayerEntity *player_entity = find_or_add_player_entity_by_id(packet_data->hit_id);
+        if (player_entity == NULL) return;
+        player_entity_take_dmg(player_entity, 1);
+    }
+}
 
-        struct dungeon_seed_packet *packet_data = data;
+void client_handle_host_left(MPPacket packet, void *data) {
+    exit(1);
+}
 
-        client_dungeon_seed = packet_data->seed;
+void client_handle_player_left(MPPacket packet, void *data) {
+    struct player_left_packet *packet_data = data;
 
-        loading_map = true;
 
-    } else if (packet.type == PACKET_ABILITY_SHOOT) {
-        struct ability_shoot_packet *packet_data = data;
-        
-        if (client_self_id == packet_data->shooter_id) {
-            
-            if (packet_data->hit_id != -1) {
-                player_entity_take_dmg(find_or_add_player_entity_by_id(packet_data->hit_id), 1);
-            }
-            
+    if (packet_data->id == client_self_id) {
+        MP_close();
+        can_exit = true;
+        return;
+    }
+
+    for (int i = 0; i < client_hidden_players_amount; i++) {
+        if (client_hidden_players[i].id == packet_data->id) client_hidden_players[i--] = client_hidden_players[--client_hidden_players_amount];
+    }
+
+    iter_over_all_nodes(node, {
+        if (node->type != PLAYER_ENTITY) continue;
+
+        PlayerEntity *player_entity = node;
+
+        if (player_entity->id == packet_data->id) {
+            Node_queue_deletion(node);
             return;
         }
-            
-        PlayerEntity *shooter = find_or_add_player_entity_by_id(packet_data->shooter_id);            
+    });
+}
 
-        if (shooter == NULL) return;
+void client_handle_player_hidden(MPPacket packet, void *data) {
+    struct player_hidden_packet *packet_data = data;
 
-        // create the effect at the pos and height
-        Effect *hit_effect = alloc(Effect, EFFECT, 1);
+    PlayerEntity *player_entity = find_player_entity_by_id(packet_data->id);
+    if (player_entity != NULL) Node_queue_deletion(player_entity);
 
-        hit_effect->entity.world_node.pos = packet_data->hit_pos;
-        hit_effect->entity.world_node.height = packet_data->hit_height;
-        hit_effect->entity.world_node.size = to_vec(8000);
+    for (int i = 0; i < client_hidden_players_amount; i++) {
+        if (client_hidden_players[i].id != packet_data->id) continue;
 
-        Sprite *sprite = alloc(Sprite, SPRITE, true);
+        client_hidden_players[i].time = fmax(client_hidden_players[i].time, packet_data->time);
+        return;
+    }
 
-        Animation anim = create_animation(5, 0, shootHitEffectFrames);
+    if (client_hidden_players_amount < MP_MAX_CLIENTS) {
+        client_hidden_players[client_hidden_players_amount++] = (HiddenPlayer){packet_data->id, packet_data->time};
+    }
+}
 
-        anim.fps = 12;
-        anim.loop = false;
+void client_handle_ability_bomb(MPPacket packet, void *data) {
+    struct ability_bomb_packet *packet_data = data;
 
-        array_append(sprite->animations, anim);
+    if (packet_data->sender_id == client_self_id) return;
 
-        spritePlayAnim(sprite, 0);
+    Projectile *bomb = create_bomb_projectile(packet_data->pos, packet_data->vel);
+    bomb->entity.world_node.height = packet_data->height;
+    bomb->height_vel = packet_data->height_vel;
+    bomb->shooter_id = packet_data->sender_id;
+    node(bomb)->sync_id = packet_data->sync_id;
 
-        Node_add_child(hit_effect, sprite);
+    Node_add_child(game_node, bomb);
+}
 
+void client_handle_ability_switchshot(MPPacket packet, void *data) {
+    struct ability_switchshot_packet *packet_data = data;
 
-        Effect *ray_effect = alloc(Effect, EFFECT, 0.3);
-        Line *line = alloc(Line, LINE);
-        line->p1 = shooter->entity.world_node.pos;
-        line->p2 = packet_data->hit_pos;
-        line->h1 = shooter->entity.world_node.height;
-        line->h2 = packet_data->hit_height;
-        line->texture = shoot_ray;
-        line->fade = true;
-        line->width = 200;
-        Node_add_child(ray_effect, line);
+    if (packet_data->sender_id == client_self_id) return;
 
-        Node_add_child(game_node, ray_effect);
+    Projectile *switchshot = create_switchshot_projectile(packet_data->pos, packet_data->height, packet_data->vel, packet_data->h_vel);
+    node(switchshot)->sync_id = packet_data->sync_id;
+    switchshot->shooter_id = packet_data->sender_id;
 
-        Node_add_child(game_node, hit_effect);
+    Node_add_child(game_node, switchshot);
+}
 
+void client_handle_sync_id_lease(MPPacket packet, void *data) {
+    struct sync_id_lease_packet *packet_data = data;
 
-        if (packet_data->hit_id != -1) {
+    SyncIdLease lease = {.next = packet_data->first, .end = packet_data->first + packet_data->count};
 
-            if (packet_data->hit_id == client_self_id) {
-                player_take_dmg(1);
-                return;
-            }
+    if (client_sync_ids.next >= client_sync_ids.end) {
+        client_sync_ids = lease;
+    } else if (client_spare_sync_ids.next >= client_spare_sync_ids.end) {
+        client_spare_sync_ids = lease;
+    }
+    // else it's the answer to a request we repeated, we're covered already
+}
 
-            PlayerEntity *player_entity = find_or_add_player_entity_by_id(packet_data->hit_id);
-            if (player_entity == NULL) return;
-            player_entity_take_dmg(player_entity, 1);
-        }
+void client_handle_projectile_snapshot(MPPacket packet, void *data) {
+    if (MP_is_server) return;
 
-    } else if (packet.type == PACKET_HOST_LEFT) {
-        exit(1);
+    SnapState updates[SNAP_MAX_PER_MESSAGE];
+    unsigned int stamp;
+    int count = Snap_read(data, packet.len, &stamp, updates, SNAP_MAX_PER_MESSAGE);
 
-    } else if (packet.type == PACKET_PLAYER_LEFT) {
-        struct player_left_packet *packet_data = data;
+    if (count == -1) {
+        printf("Bad projectile snapshot (%d bytes) \n", packet.len);
+        return;
+    }
 
+    // only the fields that changed are in there, the rest we keep simulating ourselves
+    for (int i = 0; i < count; i++) {
+        Projectile *sync_projectile = find_node_by_sync_id(updates[i].id);
 
-        if (packet_data->id == client_self_id) {
-            if (MP_is_server) {
-                shutdown(MPServer_socket, SD_BOTH);
-                closesocket(MPServer_socket);
-            }
-            shutdown(MPClient_socket, SD_BOTH);
-            closesocket(MPClient_socket);
-            can_exit = true;
-            return;
+        if (sync_projectile == NULL) {
+            continue;
         }
 
-        iter_over_all_nodes(node, {
-            if (node->type != PLAYER_ENTITY) continue;
+        // a datagram that got overtaken, we already have something newer for this one
+        if (sync_projectile->snap_stamp != 0 && !Snap_is_newer(stamp, sync_projectile->snap_stamp)) continue;
+        sync_projectile->snap_stamp = stamp;
 
-            PlayerEntity *player_entity = node;
+        if (updates[i].fields & SNAP_POS) sync_projectile->entity.world_node.pos = updates[i].pos;
+        if (updates[i].fields & SNAP_VEL) sync_projectile->vel = updates[i].vel;
+        if (updates[i].fields & SNAP_HEIGHT) sync_projectile->entity.world_node.height = updates[i].height;
+        if (updates[i].fields & SNAP_H_VEL) sync_projectile->height_vel = updates[i].h_vel;
+    }
+}
 
-            if (player_entity->id == packet_data->id) {
-                Node_queue_deletion(node);
-                return;
-            }
-        });
-    } else if (packet.type == PACKET_ABILITY_BOMB) {
-        struct ability_bomb_packet *packet_data = data;
+void client_handle_ability_forcefield(MPPacket packet, void *data) {
+    struct ability_forcefield_packet *packet_data = data;
+
+    if (packet_data->sender_id == client_self_id) return;
 
-        if (packet_data->sender_id == client_self_id) return;
+    Projectile *ff = create_forcefield_projectile();
+    ff->entity.world_node.pos = packet_data->pos;
+    ff->entity.world_node.height = packet_data->height;
+    ff->vel = packet_data->vel;
+    ff->height_vel = packet_data->h_vel;
+    node(ff)->sync_id = packet_data->sync_id;
+    ff->shooter_id = packet_data->sender_id;
 
-        Projectile *bomb = create_bomb_projectile(packet_data->pos, packet_data->vel);
-        bomb->entity.world_node.height = packet_data->height;
-        bomb->height_vel = packet_data->height_vel;
-        bomb->shooter_id = packet_data->sender_id;
-        node(bomb)->sync_id = packet_data->sync_id;
+    Node_add_child(game_node, ff);
+}
 
-        Node_add_child(game_node, bomb);
+void client_handle_switch_positions(MPPacket packet, void *data) {
+    struct switch_positions_packet *packet_data = data;
 
-    } else if (packet.type == PACKET_ABILITY_SWITCHSHOT) {
-        struct ability_switchshot_packet *packet_data = data;
+    if (packet_data->id1 == client_self_id) {
+        player->world_node.pos = packet_data->pos2;
+        player->world_node.height = packet_data->h2;
+        WorldNode_reset_interpolation(&player->world_node);
+    } else if (packet_data->id2 == client_self_id) {
+        player->world_node.pos = packet_data->pos1;
+        player->world_node.height = packet_data->h1;
+        WorldNode_reset_interpolation(&player->world_node);
+    }
+}
 
-        if (packet_data->sender_id == client_self_id) return;
+void client_handle_request_join_state(MPPacket packet, void *data) {
+    send_join_state(((struct request_join_state_packet *)data)->for_id);
+}
 
-        Projectile *switchshot = create_switchshot_projectile(packet_data->pos, packet_data->height, packet_data->vel, packet_data->h_vel);
-        node(switchshot)->sync_id = packet_data->sync_id;
-        switchshot->shooter_id = packet_data->sender_id;
+// Puts the chunks back together, tick() applies it once they're all here and the level is loaded.
+void client_handle_join_state(MPPacket packet, void *data) {
+    struct join_state_packet *chunk = data;
 
-        Node_add_child(game_node, switchshot);
-     
-    } else if (packet.type == PACKET_SEND_SYNC_ID) {
-        printf("Received sync id %d! \n", ((struct send_sync_id_packet *)data)->sync_id);
-        use_sync_id(((struct send_sync_id_packet *)data)->sync_id);
+    if (packet.len < JOIN_STATE_HEADER_SIZE || chunk->for_id != client_self_id) return;
 
-    } else if (packet.type == PACKET_SYNC_PROJECTILE) {
+    if (chunk->version != JOIN_STATE_VERSION) {
+        printf("Join state is version %d, we read %d. Waiting for updates instead \n", chunk->version, JOIN_STATE_VERSION);
+        return;
+    }
+    if (chunk->chunks == 0 || chunk->chunks > JOIN_STATE_MAX_CHUNKS || chunk->chunk >= chunk->chunks
+        || chunk->len > JOIN_STATE_CHUNK_SIZE || JOIN_STATE_HEADER_SIZE + chunk->len > packet.len) {
+        printf("Bad join state chunk \n");
+        return;
+    }
 
-        if (MP_is_server) return;
+    JoinStateAssembly *state = &client_join_state;
+    if (state->applied) return;
+
+    if (chunk->snapshot_id != state->snapshot_id || chunk->chunks != state->chunks) {
+        memset(state->have, 0, sizeof(state->have));
+        state->snapshot_id = chunk->snapshot_id;
+        state->chunks = chunk->chunks;
+        state->received = 0;
+    }
+    if (state->have[chunk->chunk]) return;
+
+    state->have[chunk->chunk] = true;
+    state->len[chunk->chunk] = chunk->len;
+    memcpy(state->bytes[chunk->chunk], chunk->bytes, chunk->len);
+    state->received++;
+}
+
+// what to do with each packet type, NULL ignores it
+void (*client_packet_handlers[PACKETS_END])(MPPacket packet, void *data) = {
+    [PACKET_UPDATE_PLAYER_ID] = client_handle_update_player_id,
+    [PACKET_PLAYER_POS] = client_handle_player_pos,
+    [PACKET_DUNGEON_SEED] = client_handle_dungeon_seed,
+    [PACKET_ABILITY_SHOOT] = client_handle_ability_shoot,
+    [PACKET_HOST_LEFT] = client_handle_host_left,
+    [PACKET_PLAYER_LEFT] = client_handle_player_left,
+    [PACKET_ABILITY_BOMB] = client_handle_ability_bomb,
+    [PACKET_ABILITY_SWITCHSHOT] = client_handle_ability_switchshot,
+    [PACKET_SYNC_ID_LEASE] = client_handle_sync_id_lease,
+    [PACKET_PROJECTILE_SNAPSHOT] = client_handle_projectile_snapshot,
+    [PACKET_ABILITY_FORCEFIELD] = client_handle_ability_forcefield,
+    [PACKET_SWITCH_POSITIONS] = client_handle_switch_positions,
+    [PACKET_REQUEST_JOIN_STATE] = client_handle_request_join_state,
+    [PACKET_JOIN_STATE] = client_handle_join_state,
+    [PACKET_PLAYER_HIDDEN] = client_handle_player_hidden,
+};
 
-        struct sync_projectile_packet *packet_data = data;
+// runs on the tick thread, from MP_dispatch_messages()
+void on_client_recv(MPPacket packet, void *data) {
 
-        // cd_print(true, "syncing projectile with sync id %d ! \n", packet_data->sync_id);
+    if (packet.len > MP_DEFAULT_BUFFER_SIZE) {
+        printf("Packet too big! \n");
+        return;
+    }
 
-        Projectile *sync_projectile = find_node_by_sync_id(packet_data->sync_id);
+    if (packet.type < 0 || packet.type >= PACKETS_END) {
+        printf("Invalid packet type! \n");
+        return;
+    }
 
-        if (sync_projectile == NULL) {
-            return;
-        }
+    Replay_record_packet(packet, data);
 
-        sync_projectile->entity.world_node.pos = packet_data->pos;
-        sync_projectile->entity.world_node.height = packet_data->height;
-        sync_projectile->vel = packet_data->vel;
-        sync_projectile->height_vel = packet_data->h_vel;
-
-    } else if (packet.type == PACKET_ABILITY_FORCEFIELD) {
-        struct ability_forcefield_packet *packet_data = data;
-
-        if (packet_data->sender_id == client_self_id) return;
-
-        Projectile *ff = create_forcefield_projectile();
-        ff->entity.world_node.pos = packet_data->pos;
-        ff->entity.world_node.height = packet_data->height;
-        ff->vel = packet_data->vel;
-        ff->height_vel = packet_data->h_vel;
-        node(ff)->sync_id = packet_data->sync_id;
-        ff->shooter_id = packet_data->sender_id;
-
-        Node_add_child(game_node, ff);
-    } else if (packet.type == PACKET_SWITCH_POSITIONS) {
-        struct switch_positions_packet *packet_data = data;
-
-        if (packet_data->id1 == client_self_id) {
-            player->world_node.pos = packet_data->pos2;
-            player->world_node.height = packet_data->h2;
-        } else if (packet_data->id2 == client_self_id) {
-            player->world_node.pos = packet_data->pos1;
-            player->world_node.height = packet_data->h1;
-        }
+    if (client_packet_handlers[packet.type] != NULL) {
+        client_packet_handlers[packet.type](packet, data);
     }
 }
 
@@ -4870,14 +5727,13 @@ void PlayerEntity_tick(PlayerEntity *player_entity, double delta) {
 
     player_entity->entity.world_node.size.y = 10000 * (player_entity->crouching? 0.5 : 1);
 
-    double real_desired_height = player_entity->desired_height - player_entity->entity.world_node.size.y / 2;
-    if (player_entity->crouching) {
-        real_desired_height -= player_entity->entity.world_node.size.y;
+    InterpState state;
+    if (IB_sample(&player_entity->interp, tick_clock, &state)) {
+        player_entity->entity.world_node.pos = state.pos;
+        player_entity->entity.world_node.height = state.height;
+        player_entity->dir = state.dir;
     }
 
-    player_entity->entity.world_node.pos = v2_lerp(player_entity->entity.world_node.pos, player_entity->desired_pos, 0.1 * (delta * 144));
-    player_entity->entity.world_node.height = lerp(player_entity->entity.world_node.height, real_desired_height, 0.1 * (delta * 144));
-
     DirSprite *dir_sprite = get_child_by_type(player_entity, DIR_SPRITE);
 
     dir_sprite->dir = player_entity->dir;
@@ -4889,76 +5745,52 @@ void PlayerEntity_tick(PlayerEntity *player_entity, double delta) {
 // #TEXTURES INIT
 void init_textures() {
 
-    hand_texture = load_texture("Textures/Player/Hands/hand.png");
+    // the files get decoded on the workers, this thread only does the uploads and the GPU work in between
+    AssetLoader loader = Assets_new();
+    Uint32 bloom_frag, bloom_vert, frag, vert;
 
-    ff_icon = load_texture("Textures/Abilities/Icons/ff_icon.png");
+    add_texture(&loader, "Textures/Player/Hands/hand.png", &hand_texture);
 
-    ff_spark_particle_anim = get_texture_files("Textures/Abilities/ForceField/spark", 2);
+    add_texture(&loader, "Textures/Abilities/Icons/ff_icon.png", &ff_icon);
 
-    switchshot_icon = load_texture("Textures/Abilities/Icons/switchshot_icon.png");
+    ff_spark_particle_anim = add_texture_files(&loader, "Textures/Abilities/ForceField/spark", 2);
 
-    switchshot_anim = get_texture_files("Textures/Abilities/Switchshot/switchshot", 4);
+    add_texture(&loader, "Textures/Abilities/Icons/switchshot_icon.png", &switchshot_icon);
 
-    bomb_smoke_particles = get_texture_files("Textures/ExplosionSmokeParticles/smoke", 8);
+    switchshot_anim = add_texture_files(&loader, "Textures/Abilities/Switchshot/switchshot", 4);
 
-    bomb_explosion_particles = get_texture_files("Textures/ExplosionParticles/explosion_particle", 11);
+    bomb_smoke_particles = add_texture_files(&loader, "Textures/ExplosionSmokeParticles/smoke", 8);
 
-    shoot_ray = load_texture("Textures/shoot_ray.png");
+    bomb_explosion_particles = add_texture_files(&loader, "Textures/ExplosionParticles/explosion_particle", 11);
 
-    forcefield_field = get_texture_files("Textures/Abilities/Forcefield/pulsate", 5);
+    add_texture(&loader, "Textures/shoot_ray.png", &shoot_ray);
 
-    hand_shoot = get_texture_files("Textures/rightHandAnim/rightHandAnim", 6);
+    forcefield_field = add_texture_files(&loader, "Textures/Abilities/Forcefield/pulsate", 5);
 
-    forcefield_anim = get_texture_files("Textures/Abilities/Forcefield/forcefield", 1);
+    hand_shoot = add_texture_files(&loader, "Textures/rightHandAnim/rightHandAnim", 6);
+
+    forcefield_anim = add_texture_files(&loader, "Textures/Abilities/Forcefield/forcefield", 1);
     
 
-    player_textures = get_texture_files("Textures/Player/player", 16);
+    player_textures = add_texture_files(&loader, "Textures/Player/player", 16);
     
 
-    bomb_icon = load_texture("Textures/Abilities/Icons/bomb_icon.png");
+    add_texture(&loader, "Textures/Abilities/Icons/bomb_icon.png", &bomb_icon);
 
-    bomb_anim = get_texture_files("Textures/Abilities/Bomb/bomb", 4);
+    bomb_anim = add_texture_files(&loader, "Textures/Abilities/Bomb/bomb", 4);
    
 
-    blood_particle = load_texture("Textures/BloodParticle.png");
-    
-    int bloom_frag = GPU_LoadShader(GPU_FRAGMENT_SHADER, "Shaders/bloom_frag.glsl");
-    int bloom_vert = GPU_LoadShader(GPU_VERTEX_SHADER, "Shaders/bloom_vert.glsl");
+    add_texture(&loader, "Textures/BloodParticle.png", &blood_particle);
     
-    bloom_shader = GPU_LinkShaders(bloom_frag, bloom_vert);
-
-    bloom_shader_block = GPU_LoadShaderBlock(bloom_shader, "gpu_Vertex", "gpu_TexCoord", "gpu_Color", "gpu_ModelViewProjectionMatrix");
-
-    GPU_FreeShader(bloom_frag);
-    GPU_FreeShader(bloom_vert);
-
-
-    tilemap_image = GPU_CreateImage(TILEMAP_WIDTH, TILEMAP_HEIGHT, GPU_FORMAT_RGBA);
-
-    GPU_Target *image_target = GPU_LoadTarget(tilemap_image);
-
-    for (int r = 0; r < TILEMAP_HEIGHT; r++) {
-        for (int c = 0; c < TILEMAP_WIDTH; c++) {
-            SDL_Color color = (SDL_Color){255, 255, 255, 255};
-            GPU_RectangleFilled2(image_target, (GPU_Rect){c, r, 1, 1}, color);
-        }
-    }
-
-    GPU_FreeTarget(image_target);
+    add_shader(&loader, "Shaders/bloom_frag.glsl", GPU_FRAGMENT_SHADER, &bloom_frag);
+    add_shader(&loader, "Shaders/bloom_vert.glsl", GPU_VERTEX_SHADER, &bloom_vert);
 
-    floor_and_ceiling_spritesheet = load_texture("Textures/floor_and_ceiling_spritesheet.png");
+    add_texture(&loader, "Textures/floor_and_ceiling_spritesheet.png", &floor_and_ceiling_spritesheet);
 
-    int frag = GPU_LoadShader(GPU_FRAGMENT_SHADER, "Shaders/floor_frag.glsl");
-    int vert = GPU_LoadShader(GPU_VERTEX_SHADER, "Shaders/floor_vert.glsl");
+    add_shader(&loader, "Shaders/floor_frag.glsl", GPU_FRAGMENT_SHADER, &frag);
+    add_shader(&loader, "Shaders/floor_vert.glsl", GPU_VERTEX_SHADER, &vert);
 
-    floor_shader = GPU_LinkShaders(frag, vert);
-
-    floor_shader_block = GPU_LoadShaderBlock(floor_shader, "gpu_Vertex", "gpu_TexCoord", "gpu_Color", "gpu_ModelViewProjectionMatrix");
-
-    GPU_FreeShader(frag);
-    GPU_FreeShader(vert);
-
-    dash_screen_anim = get_texture_files("Textures/Abilities/Dash/screen_anim", 6);
+    dash_screen_anim = add_texture_files(&loader, "Textures/Abilities/Dash/screen_anim", 6);
     
 
     // dash_anim_sprite = createSprite(true, 1);
@@ -4968,43 +5800,42 @@ void init_textures() {
     // dash_anim_sprite->animations[0].frame = 5;
 
 
-    dash_icon = load_texture("Textures/Abilities/Icons/dash_icon.png");
+    add_texture(&loader, "Textures/Abilities/Icons/dash_icon.png", &dash_icon);
 
-    ability_icon_frame = load_texture("Textures/Abilities/Icons/icon_frame.png");
+    add_texture(&loader, "Textures/Abilities/Icons/icon_frame.png", &ability_icon_frame);
 
-    shotgun_icon = load_texture("Textures/Abilities/Icons/shotgun_icon.png");
+    add_texture(&loader, "Textures/Abilities/Icons/shotgun_icon.png", &shotgun_icon);
 
-    shoot_icon = load_texture("Textures/Abilities/Icons/shoot_icon.png");
+    add_texture(&loader, "Textures/Abilities/Icons/shoot_icon.png", &shoot_icon);
 
-    default_particle_texture = load_texture("Textures/base_particle.png");
+    add_texture(&loader, "Textures/base_particle.png", &default_particle_texture);
 
-    player_default_hurt = create_sound("Sounds/player_default_hurt.wav");
-    player_default_hurt->volume_multiplier = 0.3;
+    add_sound(&loader, "Sounds/player_default_hurt.wav", &player_default_hurt);
 
-    player_default_shoot = create_sound("Sounds/player_default_shoot.wav");
-    player_default_shoot->volume_multiplier = 0.3;
+    add_sound(&loader, "Sounds/player_default_shoot.wav", &player_default_shoot);
 
-    mimran_jumpscare = load_texture("Textures/scary_monster2.png");
+    add_sound(&loader, "Sounds/ff_block.wav", &ff_block);
 
-    healthbar_texture = load_texture("Textures/health_bar1.png");
+    add_sound(&loader, "Sounds/explosion.wav", &bomb_explosion);
 
-    vignette_texture = load_texture("Textures/vignette.png");
+    add_sound(&loader, "Sounds/shotgun_ability.wav", &rapidfire_sound);
 
-    floorAndCeiling = GPU_CreateImage(RESOLUTION_X, RESOLUTION_Y, GPU_FORMAT_RGBA);
-    GPU_SetImageFilter(floorAndCeiling, GPU_FILTER_NEAREST);
+    add_sound(&loader, "Sounds/exploder_explosion.wav", &exploder_explosion);
 
-    floor_and_ceiling_target_image = GPU_CreateImage(RESOLUTION_X, RESOLUTION_Y, GPU_FORMAT_RGBA);
-    GPU_SetImageFilter(floor_and_ceiling_target_image, GPU_FILTER_NEAREST);
+    add_texture(&loader, "Textures/scary_monster2.png", &mimran_jumpscare);
+
+    add_texture(&loader, "Textures/health_bar1.png", &healthbar_texture);
 
-    floorTexture = load_texture("Textures/floor.png");
-    floorLightTexture = load_texture("Textures/floor_light.png");
-    floorTexture2 = load_texture("Textures/floor2.png");
-    ceilingTexture = load_texture("Textures/ceiling.png");
-    ceilingLightTexture = load_texture("Textures/ceiling_light.png");
-    wallTexture = load_texture("Textures/wall.png");
-     GPU_SetImageFilter(wallTexture, GPU_FILTER_NEAREST);
+    add_texture(&loader, "Textures/vignette.png", &vignette_texture);
 
-    crosshair = load_texture("Textures/crosshair.png");
+    add_texture(&loader, "Textures/floor.png", &floorTexture);
+    add_texture(&loader, "Textures/floor_light.png", &floorLightTexture);
+    add_texture(&loader, "Textures/floor2.png", &floorTexture2);
+    add_texture(&loader, "Textures/ceiling.png", &ceilingTexture);
+    add_texture(&loader, "Textures/ceiling_light.png", &ceilingLightTexture);
+    add_texture(&loader, "Textures/wall.png", &wallTexture);
+
+    add_texture(&loader, "Textures/crosshair.png", &crosshair);
 
     // leftHandSprite = createSprite(true, 2);
     // GPU_Image **default_hand = malloc(sizeof(GPU_Image *)); 
@@ -5019,11 +5850,62 @@ void init_textures() {
     // leftHandSprite->animations[1].loop = false;
     // spritePlayAnim(leftHandSprite, 0);
 
-    shootHitEffectFrames = get_texture_files("Textures/ShootEffectAnim/shootHitEffect", 5);
+    shootHitEffectFrames = add_texture_files(&loader, "Textures/ShootEffectAnim/shootHitEffect", 5);
+
+    add_texture(&loader, "Textures/scary_monster.png", &entityTexture);
+
+    add_texture(&loader, "Textures/skybox.png", &skybox_texture);
+
+    // one core's left for this thread, it decodes too while nothing's ready to upload
+    Assets_start(&loader, SDL_clamp(SDL_GetCPUCount() - 1, 0, MAX_ASSET_WORKERS));
+
+    tilemap_image = GPU_CreateImage(TILEMAP_WIDTH, TILEMAP_HEIGHT, GPU_FORMAT_RGBA);
+
+    GPU_Target *image_target = GPU_LoadTarget(tilemap_image);
+
+    for (int r = 0; r < TILEMAP_HEIGHT; r++) {
+        for (int c = 0; c < TILEMAP_WIDTH; c++) {
+            SDL_Color color = (SDL_Color){255, 255, 255, 255};
+            GPU_RectangleFilled2(image_target, (GPU_Rect){c, r, 1, 1}, color);
+        }
+    }
+
+    GPU_FreeTarget(image_target);
+
+    floorAndCeiling = GPU_CreateImage(RESOLUTION_X, RESOLUTION_Y, GPU_FORMAT_RGBA);
+    GPU_SetImageFilter(floorAndCeiling, GPU_FILTER_NEAREST);
+
+    floor_and_ceiling_target_image = GPU_CreateImage(RESOLUTION_X, RESOLUTION_Y, GPU_FORMAT_RGBA);
+    GPU_SetImageFilter(floor_and_ceiling_target_image, GPU_FILTER_NEAREST);
+
+    Assets_finish(&loader);
+
+    bloom_shader = GPU_LinkShaders(bloom_frag, bloom_vert);
+
+    bloom_shader_block = GPU_LoadShaderBlock(bloom_shader, "gpu_Vertex", "gpu_TexCoord", "gpu_Color", "gpu_ModelViewProjectionMatrix");
+
+    GPU_FreeShader(bloom_frag);
+    GPU_FreeShader(bloom_vert);
+
+    floor_shader = GPU_LinkShaders(frag, vert);
+
+    floor_shader_block = GPU_LoadShaderBlock(floor_shader, "gpu_Vertex", "gpu_TexCoord", "gpu_Color", "gpu_ModelViewProjectionMatrix");
+
+    GPU_FreeShader(frag);
+    GPU_FreeShader(vert);
 
-    entityTexture = load_texture("Textures/scary_monster.png");
+    if (player_default_hurt != NULL) player_default_hurt->volume_multiplier = 0.3;
+    if (player_default_shoot != NULL) player_default_shoot->volume_multiplier = 0.3;
+
+    FILE *report = fopen(ASSET_REPORT_FILE, "w");
+    if (report != NULL) {
+        Assets_report(&loader, report);
+        fclose(report);
+    }
+    printf("Loaded %d assets in %.0f ms on %d workers, the times are in %s \n", loader.amount,
+        loader.total_time * 1000, loader.workers, ASSET_REPORT_FILE);
 
-    skybox_texture = load_texture("Textures/skybox.png");
+    Assets_free(&loader);
 
     printf("Initialized textures! \n");
 
@@ -5074,7 +5956,7 @@ void ability_bomb_activate() {
     bomb->entity.world_node.height = get_player_height();
 
     Node_add_child(game_node, bomb);
-    add_to_sync_queue(bomb);
+    node(bomb)->sync_id = take_sync_id();
 
 
     MPPacket packet = {.type = PACKET_ABILITY_BOMB, .len = sizeof(struct ability_bomb_packet), .is_broadcast = true};
@@ -5085,7 +5967,7 @@ void ability_bomb_activate() {
         .vel = bomb->vel, 
         .height_vel = bomb->height_vel, 
         .sender_id = client_self_id,
-        .sync_id = -1
+        .sync_id = node(bomb)->sync_id
     };
 
     MPClient_send(packet, &packet_data);
@@ -5117,11 +5999,11 @@ void Projectile_tick(Node *node, double delta) {
         projectile->_created = true;
     }
 
-    projectile->vel = v2_add(projectile->vel, v2_mul(projectile->accel, to_vec(delta * 144)));
+    projectile->vel = v2_add(projectile->vel, v2_mul(projectile->accel, to_vec(delta * REFERENCE_TPS)));
     projectile->height_vel += projectile->height_accel * delta;
 
-    projectile->entity.world_node.pos = v2_add(projectile->entity.world_node.pos, v2_mul(projectile->vel, to_vec(delta * 144)));
-    projectile->entity.world_node.height += projectile->height_vel * delta * 144;
+    projectile->entity.world_node.pos = v2_add(projectile->entity.world_node.pos, v2_mul(projectile->vel, to_vec(delta * REFERENCE_TPS)));
+    projectile->entity.world_node.height += projectile->height_vel * delta * REFERENCE_TPS;
 
     if (projectile->entity.world_node.height - projectile->entity.world_node.size.y / 2 <= 0) {
         if (projectile->destroy_on_floor) {
@@ -5434,14 +6316,14 @@ void ability_forcefield_activate() {
     // ((ParticleSpawner *)proj->extra_data)->world_node.height = proj->entity.world_node.height;
     proj->vel = playerForward;
     Node_add_child(game_node, proj);
-    add_to_sync_queue(proj);
+    node(proj)->sync_id = take_sync_id();
 
 
     MPPacket packet = {.type = PACKET_ABILITY_FORCEFIELD, .len = sizeof(struct ability_forcefield_packet), .is_broadcast = true};
 
     struct ability_forcefield_packet packet_data = {
         .sender_id = client_self_id, 
-        .sync_id = -1, 
+        .sync_id = node(proj)->sync_id, 
         .vel = proj->vel, 
         .pos = proj->entity.world_node.pos,
         .height = proj->entity.world_node.height,
@@ -5552,7 +6434,7 @@ void projectile_forcefield_on_tick(Projectile *projectile, double delta) {
         start_size = projectile->entity.world_node.size;
     } 
 
-    projectile->vel = v2_lerp(projectile->vel, V2_ZERO, 0.01 * delta * 144);
+    projectile->vel = v2_lerp(projectile->vel, V2_ZERO, tick_lerp_weight(0.01, delta));
     projectile->entity.world_node.size = v2_lerp(start_size, V2(0, 0), 1 - (projectile->life_timer / projectile->life_time));
 
    
@@ -5725,6 +6607,8 @@ void Renderer_render(Node *node) {
 
     if (!started_game) return;
 
+    update_camera();
+
     render_floor_and_ceiling();
 
     RenderObject *render_list = get_render_list();
@@ -5906,11 +6790,58 @@ WorldNode WorldNode_new() {
     world_node.pos = V2_ZERO;
     world_node.height = 0;
     world_node.size = to_vec(5000);
+    world_node.has_prev_transform = false;
 
 
     return world_node;
 }
 
+// Call after teleporting a node so it doesn't visibly slide there over one tick.
+void WorldNode_reset_interpolation(WorldNode *world_node) {
+    world_node->prev_pos = world_node->pos;
+    world_node->prev_height = world_node->height;
+    world_node->has_prev_transform = true;
+}
+
+void save_world_transforms() {
+    iter_over_all_nodes(node, {
+        if (!instanceof(node->type, WORLD_NODE)) continue;
+
+        WorldNode_reset_interpolation(node);
+    });
+}
+
+// Swaps every WorldNode's transform for the one in between the last two ticks.
+// Must be paired with restore_world_transforms() before the next tick.
+void interpolate_world_transforms(double alpha) {
+    alpha = SDL_clamp(alpha, 0, 1);
+
+    iter_over_all_nodes(node, {
+        if (!instanceof(node->type, WORLD_NODE)) continue;
+
+        WorldNode *world_node = node;
+
+        world_node->tick_pos = world_node->pos;
+        world_node->tick_height = world_node->height;
+
+        if (!world_node->has_prev_transform) continue; // spawned this tick, nothing to lerp from
+
+        world_node->pos = v2_lerp(world_node->prev_pos, world_node->pos, alpha);
+        world_node->height = lerp(world_node->prev_height, world_node->height, alpha);
+    });
+}
+
+void restore_world_transforms() {
+    iter_over_all_nodes(node, {
+        if (!instanceof(node->type, WORLD_NODE)) continue;
+
+        WorldNode *world_node = node;
+
+        world_node->pos = world_node->tick_pos;
+        world_node->height = world_node->tick_height;
+    });
+}
+
 Particle Particle_new(double life_time) {
     Particle particle = {0};
 
@@ -6152,18 +7083,7 @@ void ColorRect_render(Node *node) {
 }
 
 v2 world_to_screen_size(v2 size, v2 pos, double height) {
-
-    double cos_angle_to_forward = v2_cos_angle_between(playerForward, v2_sub(pos, player->world_node.pos));
-
-    double dist = v2_distance(player->world_node.pos, pos);
-
-    double dist_from_viewplane = dist * cos_angle_to_forward;
-
-    double fov_factor = tanHalfFOV / tanHalfStartFOV;
-
-    v2 final_size = v2_div(size, to_vec(dist_from_viewplane * fov_factor));
-
-    return final_size;
+    return Camera_project_size(&camera, size, pos);
 }
 
 void health_node_tick(Node *node, double delta) {
@@ -6333,12 +7253,13 @@ void Line_render(Node *node) {
 
     double w = line->width;
 
-    v2 top_left = worldToScreen(line->p1, line->h1 - w, true);
-    v2 bot_left = worldToScreen(line->p1, line->h1 + w, true);
-    v2 top_right = worldToScreen(line->p2, line->h2 - w, true);
-    v2 bot_right = worldToScreen(line->p2, line->h2 + w, true);
+    v2 positions[4] = {line->p1, line->p1, line->p2, line->p2};
+    double heights[4] = {line->h1 - w, line->h1 + w, line->h2 - w, line->h2 + w};
+    v2 corners[4]; // top left, bottom left, top right, bottom right
+
+    Camera_project_batch(&camera, positions, heights, corners, 4);
 
-    render_textured_quad(line->texture, top_left, top_right, bot_left, bot_right);
+    render_textured_quad(line->texture, corners[0], corners[2], corners[1], corners[3]);
 
 }
 
@@ -6368,31 +7289,26 @@ void Line_tick(Node *node, double delta) {
     }
 }
 
-Node *use_sync_id(int sync_id) {
-    if (array_length(sync_id_queue) <= 0) {
-        
-        printf("Sync id queue is empty!\n");
-        
-        return NULL;
+// A sync id for something we just created, from our lease. -1 if it ran out, then it just doesn't get synced.
+int take_sync_id() {
+    if (client_sync_ids.next >= client_sync_ids.end) {
+        client_sync_ids = client_spare_sync_ids;
+        client_spare_sync_ids = (SyncIdLease){0};
     }
 
-    if (!is_sync_id_valid(sync_id)) {
-        return NULL;
+    if (client_sync_ids.next >= client_sync_ids.end) {
+        printf("Out of sync ids! \n");
+        return -1;
     }
 
-    Node *res = sync_id_queue[0];
-
-    array_remove(sync_id_queue, 0);
-
-    res->sync_id = sync_id;
+    int sync_id = client_sync_ids.next++;
+    client_last_seen_sync_id = max(client_last_seen_sync_id, sync_id);
 
-    client_last_seen_sync_id = sync_id;
-
-    return res;
+    return sync_id;
 }
 
-void add_to_sync_queue(Node *node) {
-    array_append(sync_id_queue, node);
+int sync_ids_left() {
+    return (client_sync_ids.end - client_sync_ids.next) + (client_spare_sync_ids.end - client_spare_sync_ids.next);
 }
 
 Node *find_node_by_sync_id(int sync_id) {
@@ -6430,12 +7346,12 @@ void switchshot_activate(Ability *ability) {
 
     Projectile *switchshot = create_switchshot_projectile(player->world_node.pos, player->world_node.height, playerForward, h_dir); 
 
-    add_to_sync_queue(switchshot);
+    node(switchshot)->sync_id = take_sync_id();
 
     MPPacket packet = {.is_broadcast = true, .len = sizeof(struct ability_switchshot_packet), .type = PACKET_ABILITY_SWITCHSHOT};
 
     struct ability_switchshot_packet packet_data = {
-        .sync_id = -1,
+        .sync_id = node(switchshot)->sync_id,
         .sender_id = client_self_id,
         .pos = switchshot->entity.world_node.pos,
         .height = switchshot->entity.world_node.height,
@@ -6638,18 +7554,6 @@ void Node_ready(Node *node) {
     }
 }
 
-bool is_sync_id_valid(int sync_id) {
-    if (sync_id < 42) return false;
-    // if (MP_is_server) {
-    //     if (sync_id > server_next_sync_id) return false;
-    // } else {
-    //     if (sync_id > client_last_seen_sync_id + 100) return false; // 100 so it's only violated by 
-    // }
-    
-
-    return true;
-}
-
 int get_digit(int num, int idx) {
 
     int i = 0;
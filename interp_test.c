@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "interp_buffer.c"
+
+// A remote player runs circles while sending its position at a few different rates over a channel with jitter and
+// loss. Renders it at 144 fps through an InterpBuffer and checks the motion stays smooth: every frame should move it
+// about as far as the real player moved, no freezing and no jumping. Prints what the old "lerp towards the latest
+// packet" did for comparison.
+
+#define SECONDS 30
+#define FPS 144
+#define SPEED 300.0 // units per second
+#define RADIUS 400.0
+#define JITTER 0.04 // seconds, on top of LATENCY
+#define LATENCY 0.05
+#define LOSS 0.1
+#define CLOCK_SKEW 12345.678 // the sender's clock has nothing to do with ours
+
+typedef struct InFlight {
+    double arrival;
+    double sender_time;
+    InterpState state;
+} InFlight;
+
+double randf(double min, double max) {
+    return min + ((double)rand() / RAND_MAX) * (max - min);
+}
+
+InterpState true_state(double t) {
+    double angle = t * SPEED / RADIUS;
+    return (InterpState){
+        .pos = {1000 + cos(angle) * RADIUS, 700 + sin(angle) * RADIUS},
+        .height = 5000 + sin(t * 2) * 1000,
+        .dir = {-sin(angle), cos(angle)}
+    };
+}
+
+typedef struct Result {
+    double stutter; // fraction of frames that moved less than half or more than twice what they should
+    double worst_error; // vs where the player really was a delay ago
+} Result;
+
+Result run(double send_rate, bool old_lerp) {
+    static InFlight in_flight[SECONDS * FPS];
+    int flight_count = 0;
+
+    InterpBuffer buf = IB_new();
+    double send_timer = 0;
+    v2 rendered = {0}, last_rendered = {0};
+    bool have_rendered = false;
+    v2 latest = {0};
+    int frames = 0, stutters = 0;
+    double worst_error = 0;
+
+    for (int frame = 0; frame < SECONDS * FPS; frame++) {
+        double now = (double)frame / FPS;
+
+        send_timer -= 1.0 / FPS;
+        if (send_timer <= 0) {
+            send_timer = 1.0 / send_rate;
+            if (randf(0, 1) >= LOSS) {
+                in_flight[flight_count++] = (InFlight){now + LATENCY + randf(0, JITTER), now + CLOCK_SKEW, true_state(now)};
+            }
+        }
+
+        // arrivals, in whatever order the jitter put them
+        for (int i = 0; i < flight_count; i++) {
+            if (in_flight[i].arrival > now) continue;
+            IB_push(&buf, in_flight[i].sender_time, now, in_flight[i].state);
+            latest = in_flight[i].state.pos; // the old way just took whatever came in last
+            in_flight[i--] = in_flight[--flight_count];
+        }
+
+        if (old_lerp) {
+            if (buf.count == 0) continue;
+            rendered = have_rendered ? v2_lerp(rendered, latest, 0.1) : latest;
+        } else {
+            InterpState state;
+            if (!IB_sample(&buf, now, &state)) continue;
+            rendered = state.pos;
+
+            // only judge it once it had a couple of seconds to settle
+            if (now > 2) {
+                double error = v2_distance(rendered, true_state(now - LATENCY - IB_delay(&buf)).pos);
+                worst_error = fmax(worst_error, error);
+            }
+        }
+
+        if (have_rendered && now > 2) {
+            double moved = v2_distance(rendered, last_rendered);
+            double expected = SPEED / FPS;
+            if (moved < expected * 0.5 || moved > expected * 2) stutters++;
+            frames++;
+        }
+
+        last_rendered = rendered;
+        have_rendered = true;
+    }
+
+    return (Result){(double)stutters / frames, worst_error};
+}
+
+int main(int argc, char *argv[]) {
+    srand(argc > 1 ? atoi(argv[1]) : 42);
+
+    int failures = 0;
+    double rates[] = {20, 10, 5};
+
+    for (int i = 0; i < 3; i++) {
+        Result old = run(rates[i], true);
+        Result interp = run(rates[i], false);
+
+        printf("%2.0f updates/s: old lerp stutters %5.1f%% of frames, interpolated %5.1f%% (worst error %.1f) \n",
+            rates[i], old.stutter * 100, interp.stutter * 100, interp.worst_error);
+
+        // 5/s with 10% loss still runs out now and then, but then it extrapolates instead of stopping
+        if (interp.stutter > (rates[i] >= 10 ? 0.02 : 0.05)) {
+            printf("Too jittery at %.0f updates/s \n", rates[i]);
+            failures++;
+        }
+    }
+
+    // a packet that arrives after a newer one is dropped, not played back
+    InterpBuffer buf = IB_new();
+    IB_push(&buf, 1.0, 0, true_state(1.0));
+    if (IB_push(&buf, 0.9, 0.1, true_state(0.9))) {
+        printf("Out of order sample accepted \n");
+        failures++;
+    }
+
+    // a restarted sender isn't stuck behind its old clock
+    if (!IB_push(&buf, 1.0 - IB_RESET_TIME * 2, 0.2, true_state(0)) || buf.count != 1) {
+        printf("Clock reset not picked up \n");
+        failures++;
+    }
+
+    if (failures > 0) {
+        printf("FAILED \n");
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "server.c"
+
+// Runs the dedicated server in this process, starts a bunch of bot_client processes against it over loopback and
+// reports how the server held up: CPU, bytes per second, how late and how long its ticks were, and how long
+// position updates took from one bot to another. Needs bot_client built next to it.
+//
+//     gcc load_test.c -o load_test -I. -ImyLibs -ImyLibs/include/SDL2 -lm -lpthread        (Linux)
+//     gcc load_test.c -o load_test.exe -I. -ImyLibs -ImyLibs/include/SDL2 -lws2_32         (Windows)
+//
+//     load_test [bots] [seconds] [workers] [positions/s] [shots/s] [bombs/s] [bots per match]
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define LOAD_BOT_COMMAND "bot_client.exe"
+#else
+#define LOAD_BOT_COMMAND "./bot_client"
+#endif
+
+#define LOAD_PORT 21177
+#define LOAD_TPS 60 // same as the dedicated server
+#define LOAD_SETTLE_TIME 1.0 // seconds for the bots to connect before measuring
+#define LOAD_LATENCY_BUCKETS 1000 // same as the bots'
+
+typedef struct LoadBot {
+    FILE *output;
+    bool reported;
+    long long sent, received;
+} LoadBot;
+
+int _compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// 'samples' gets sorted
+double percentile(double *samples, int count, double p) {
+    if (count == 0) return 0;
+    qsort(samples, count, sizeof(double), _compare_doubles);
+    int idx = (int)(p * (count - 1) + 0.5);
+    return samples[idx];
+}
+
+double histogram_percentile(const long long *buckets, int bucket_count, double p) {
+    long long total = 0;
+    for (int i = 0; i < bucket_count; i++) total += buckets[i];
+    if (total == 0) return 0;
+
+    long long wanted = (long long)(p * (total - 1)) + 1, seen = 0;
+    for (int i = 0; i < bucket_count; i++) {
+        seen += buckets[i];
+        if (seen >= wanted) return i;
+    }
+    return bucket_count - 1;
+}
+
+// Reads what a bot printed when it finished, adding its latencies to 'latency'. False if it didn't say anything.
+bool read_bot_report(LoadBot *bot, long long *latency) {
+    char line[128];
+    int id;
+
+    while (fgets(line, sizeof(line), bot->output) != NULL) {
+        int ms;
+        long long count;
+
+        if (sscanf(line, "bot %d %lld %lld", &id, &bot->sent, &bot->received) == 3) {
+            bot->reported = true;
+        } else if (sscanf(line, "lat %d %lld", &ms, &count) == 2 && ms >= 0 && ms < LOAD_LATENCY_BUCKETS) {
+            latency[ms] += count;
+        } else if (strncmp(line, "end", 3) == 0) {
+            break;
+        }
+    }
+
+    return bot->reported;
+}
+
+int main(int argc, char *argv[]) {
+    int bot_count = argc > 1 ? atoi(argv[1]) : 16;
+    double seconds = argc > 2 ? atof(argv[2]) : 10;
+    int workers = argc > 3 ? atoi(argv[3]) : 0;
+    double pos_rate = argc > 4 ? atof(argv[4]) : 10;
+    double shoot_rate = argc > 5 ? atof(argv[5]) : 1;
+    double bomb_rate = argc > 6 ? atof(argv[6]) : 0.2;
+    int per_match = argc > 7 ? atoi(argv[7]) : 8;
+
+    if (bot_count <= 0 || bot_count > MP_MAX_CLIENTS || seconds <= 0 || per_match <= 0
+        || workers < 0 || workers > SERVER_MAX_WORKERS) {
+        fprintf(stderr, "Usage: %s [bots (1-%d)] [seconds] [workers] [positions/s] [shots/s] [bombs/s] [bots per match] \n",
+            argv[0], MP_MAX_CLIENTS);
+        return 1;
+    }
+
+    double tick_delta = 1.0 / LOAD_TPS;
+
+    MP_init(LOAD_PORT);
+    MP_queue_messages();
+    _MP_encode_payload = encode_packet_payload;
+    _MP_decode_payload = decode_packet_payload;
+    server_init(tick_delta);
+    server_max_matches = SERVER_MAX_MATCHES;
+    server_players_per_match = per_match;
+    server_start_workers(workers);
+
+    v2 world_size = {TILEMAP_WIDTH * TILE_SIZE, TILEMAP_HEIGHT * TILE_SIZE};
+    Wire_set_world_bounds(v2_mul(world_size, to_vec(-0.5)), v2_mul(world_size, to_vec(1.5)));
+
+    MPServer();
+
+    double started = MP_time();
+    while (!MP_is_server) {
+        if (MP_time() - started > 5) {
+            fprintf(stderr, "Couldn't start the server on port %d \n", LOAD_PORT);
+            return 1;
+        }
+        MP_sleep(1);
+    }
+
+    static LoadBot bots[MP_MAX_CLIENTS];
+    char command[256];
+
+    // the bots measure from when they joined, so they run through the settle time too
+    snprintf(command, sizeof(command), "%s %d %g %g %g %g", LOAD_BOT_COMMAND, LOAD_PORT,
+        seconds + LOAD_SETTLE_TIME, pos_rate, shoot_rate, bomb_rate);
+
+    for (int i = 0; i < bot_count; i++) {
+        bots[i] = (LoadBot){.output = popen(command, "r")};
+        if (bots[i].output == NULL) {
+            fprintf(stderr, "Couldn't start bot %d with '%s' \n", i, command);
+            return 1;
+        }
+    }
+
+    printf("%d bots, %.0f seconds, %d workers \n", bot_count, seconds, workers);
+
+    int max_ticks = (int)(seconds * LOAD_TPS) + LOAD_TPS;
+    double *lateness = malloc(max_ticks * sizeof(double));
+    double *durations = malloc(max_ticks * sizeof(double));
+    int ticks = 0;
+
+    double measure_from = MP_time() + LOAD_SETTLE_TIME;
+    double measure_until = measure_from + seconds;
+    double stop_at = measure_until + LOAD_SETTLE_TIME; // the bots stop on their own around here
+    bool measuring = false;
+    MPIOStats io_start = {0};
+    double cpu_start = 0;
+
+    double next_tick = MP_time();
+
+    while (true) {
+        double now = MP_time();
+        if (now >= stop_at) break;
+
+        if (now < next_tick) {
+            MP_sleep((int)((next_tick - now) * 1000));
+            continue;
+        }
+
+        if (!measuring && now >= measure_from) {
+            measuring = true;
+            io_start = MP_get_io_stats();
+            cpu_start = MP_process_cpu_time();
+        }
+
+        double late = now - next_tick;
+        next_tick += tick_delta;
+        if (now - next_tick > 1) next_tick = now;
+
+        MP_begin_batch();
+        MP_dispatch_messages();
+        server_tick(tick_delta, NULL);
+        MP_end_batch();
+
+        if (measuring && now < measure_until && ticks < max_ticks) {
+            lateness[ticks] = late * 1000;
+            durations[ticks] = (MP_time() - now) * 1000;
+            ticks++;
+        }
+
+        if (measuring && now >= measure_until && cpu_start >= 0) {
+            double elapsed = now - measure_from;
+            MPIOStats io = MP_get_io_stats();
+
+            printf("server cpu %.1f%%, %d matches, %.1f KB/s out, %.1f KB/s in \n",
+                100 * (MP_process_cpu_time() - cpu_start) / elapsed,
+                server_matches_amount(),
+                (io.bytes_sent - io_start.bytes_sent) / elapsed / 1024,
+                (io.bytes_received - io_start.bytes_received) / elapsed / 1024
+            );
+            cpu_start = -1; // printed
+        }
+    }
+
+    printf("tick late p50 %.2f ms, p99 %.2f ms, max %.2f ms \n",
+        percentile(lateness, ticks, 0.5), percentile(lateness, ticks, 0.99), percentile(lateness, ticks, 1));
+    printf("tick work p50 %.3f ms, p99 %.3f ms, max %.3f ms \n",
+        percentile(durations, ticks, 0.5), percentile(durations, ticks, 0.99), percentile(durations, ticks, 1));
+
+    static long long latency[LOAD_LATENCY_BUCKETS];
+    long long sent = 0, received = 0;
+    int reported = 0;
+
+    for (int i = 0; i < bot_count; i++) {
+        if (read_bot_report(&bots[i], latency)) {
+            reported++;
+            sent += bots[i].sent;
+            received += bots[i].received;
+        }
+        pclose(bots[i].output);
+    }
+
+    printf("%d of %d bots reported, %lld packets sent, %lld received \n", reported, bot_count, sent, received);
+    printf("bot to bot latency p50 %.0f ms, p90 %.0f ms, p99 %.0f ms, max %.0f ms \n",
+        histogram_percentile(latency, LOAD_LATENCY_BUCKETS, 0.5),
+        histogram_percentile(latency, LOAD_LATENCY_BUCKETS, 0.9),
+        histogram_percentile(latency, LOAD_LATENCY_BUCKETS, 0.99),
+        histogram_percentile(latency, LOAD_LATENCY_BUCKETS, 1)
+    );
+
+    MPServer_send((MPPacket){.type = PACKET_HOST_LEFT, .len = 0, .is_broadcast = true}, NULL);
+    MP_sleep(100);
+    MP_close();
+
+    free(lateness);
+    free(durations);
+
+    return reported == bot_count ? 0 : 1;
+}
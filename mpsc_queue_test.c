@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "multiplayer.c"
+
+// A few producer threads push numbered items of different sizes into a small MPSCQueue as fast as they can
+// while this thread pops. Checks nothing is lost, duplicated, torn or reordered within a producer.
+
+#define PRODUCERS 4
+#define ITEMS_PER_PRODUCER 50000
+#define CAPACITY 64
+#define MAX_ITEM 64
+
+typedef struct Item {
+    int producer;
+    int counter;
+    unsigned char payload[MAX_ITEM - 2 * sizeof(int)];
+} Item;
+
+MPSCQueue queue;
+atomic_int full_count = 0;
+
+MP_THREAD_RETURN producer(void *data) {
+    int id = (int)(intptr_t)data;
+
+    for (int i = 0; i < ITEMS_PER_PRODUCER; i++) {
+        Item item = {.producer = id, .counter = i};
+        int payload_len = (i * 7 + id) % (int)sizeof(item.payload);
+        memset(item.payload, (unsigned char)(i + id), payload_len);
+
+        while (!MQ_push(&queue, &item, offsetof(Item, payload) + payload_len)) {
+            full_count++;
+            MP_sleep(0); // let the consumer run, this might be a single core
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    queue = MQ_new(CAPACITY, sizeof(Item));
+
+    for (int i = 0; i < PRODUCERS; i++) MP_thread_start(producer, (void *)(intptr_t)i);
+
+    int next[PRODUCERS] = {0};
+    int received = 0, failures = 0;
+    double started = MP_time();
+
+    while (received < PRODUCERS * ITEMS_PER_PRODUCER) {
+        int size;
+        Item *item = MQ_front(&queue, &size);
+
+        if (item == NULL) {
+            if (MP_time() - started > 30) {
+                printf("Timed out with %d items \n", received);
+                return 1;
+            }
+            MP_sleep(0);
+            continue;
+        }
+
+        int payload_len = size - (int)offsetof(Item, payload);
+
+        if (item->producer < 0 || item->producer >= PRODUCERS) {
+            printf("Garbage producer %d \n", item->producer);
+            failures++;
+        } else {
+            if (item->counter != next[item->producer]) {
+                if (failures < 10) printf("Producer %d: got %d, expected %d \n", item->producer, item->counter, next[item->producer]);
+                failures++;
+            }
+            next[item->producer] = item->counter + 1;
+
+            if (payload_len != (item->counter * 7 + item->producer) % (int)sizeof(item->payload)) {
+                if (failures < 10) printf("Item %d/%d came back %d bytes long \n", item->producer, item->counter, payload_len);
+                failures++;
+            }
+            for (int i = 0; i < payload_len; i++) {
+                if (item->payload[i] != (unsigned char)(item->counter + item->producer)) {
+                    if (failures < 10) printf("Item %d/%d torn at byte %d \n", item->producer, item->counter, i);
+                    failures++;
+                    break;
+                }
+            }
+        }
+
+        MQ_pop(&queue);
+        received++;
+    }
+
+    printf("%d items in %.2f s, producers found it full %d times \n", received, MP_time() - started, atomic_load(&full_count));
+
+    if (MQ_front(&queue, NULL) != NULL) {
+        printf("Queue not empty at the end \n");
+        failures++;
+    }
+
+    // an item bigger than a slot is refused, not truncated
+    unsigned char big[MAX_ITEM * 2] = {0};
+    if (MQ_push(&queue, big, sizeof(big))) {
+        printf("Oversized item accepted \n");
+        failures++;
+    }
+
+    // fill it up on this thread alone, MQ_has_room() has to agree with MQ_push() all the way
+    Item item = {0};
+    int pushed = 0;
+    while (MQ_has_room(&queue)) {
+        if (!MQ_push(&queue, &item, sizeof(item))) break;
+        pushed++;
+    }
+    if (pushed != CAPACITY || MQ_push(&queue, &item, sizeof(item))) {
+        printf("MQ_has_room() said %d fit in a queue of %d \n", pushed, CAPACITY);
+        failures++;
+    }
+    MQ_pop(&queue);
+    if (!MQ_has_room(&queue)) {
+        printf("No room after a pop \n");
+        failures++;
+    }
+
+    if (failures > 0) {
+        printf("FAILED: %d \n", failures);
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}
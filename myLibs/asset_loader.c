@@ -0,0 +1,211 @@
+#ifndef ASSET_LOADER_C
+#define ASSET_LOADER_C
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "multiplayer.c" // MP_thread_start(), MP_time(), and mpsc_queue.c
+
+// Loads a manifest of files on a pool of workers. Every asset has a decode step that runs on whichever worker gets
+// to it (reading and decompressing the file, no GPU) and a finish step that runs on the thread that called
+// Assets_finish(), as the decoded ones come in (GPU uploads and anything else that can't be done elsewhere).
+//
+//     AssetLoader loader = Assets_new();
+//     Assets_add(&loader, "Textures/wall.png", decode_png, upload_png, &wall_texture);
+//     ...
+//     Assets_start(&loader, workers);      // the decoding starts
+//     ...                                  // anything else this thread has to do meanwhile
+//     Assets_finish(&loader);              // finishes them as they're decoded, returns once they all are
+//     Assets_report(&loader, file);        // how long each one took
+//     Assets_free(&loader);
+//
+// While nothing's decoded yet Assets_finish() decodes the next one itself, so with 0 workers it's all on one thread,
+// in manifest order.
+
+#define ASSET_MAX_PATH 128
+
+typedef struct Asset Asset;
+
+typedef void (*AssetStep)(Asset *asset);
+
+struct Asset {
+    char path[ASSET_MAX_PATH];
+    AssetStep decode; // any thread: reads 'path', leaves what it made in 'decoded'
+    AssetStep finish; // the loading thread: 'decoded' into 'target', frees what's left of it
+    void *target;
+    void *decoded;
+    size_t decoded_size;
+    bool failed; // for either step to set, it shows in the report
+
+    double decode_time; // seconds
+    double finish_time;
+};
+
+typedef struct AssetLoader {
+    Asset *assets; // the manifest, in the order they were added
+    int amount;
+    int capacity;
+
+    int workers;
+    atomic_int next; // the next asset to decode
+    atomic_int workers_running;
+    MPSCQueue decoded; // indices of the assets that are ready to finish
+
+    double started;
+    double total_time; // seconds, from Assets_start() to the last finish
+} AssetLoader;
+
+AssetLoader Assets_new() {
+    return (AssetLoader){0};
+}
+
+// Returns the asset, which stays where it is until Assets_free(). Nothing can be added after Assets_start().
+Asset *Assets_add(AssetLoader *loader, const char *path, AssetStep decode, AssetStep finish, void *target) {
+    if (loader->amount == loader->capacity) {
+        int capacity = loader->capacity == 0 ? 64 : loader->capacity * 2;
+        Asset *assets = realloc(loader->assets, capacity * sizeof(Asset));
+        if (assets == NULL) {
+            printf("Assets_add: couldn't allocate memory! \n");
+            return NULL;
+        }
+        loader->assets = assets;
+        loader->capacity = capacity;
+    }
+
+    Asset *asset = &loader->assets[loader->amount++];
+    *asset = (Asset){.decode = decode, .finish = finish, .target = target};
+    if (snprintf(asset->path, sizeof(asset->path), "%s", path) >= (int)sizeof(asset->path)) {
+        fprintf(stderr, "Asset path too long, cut to '%s' \n", asset->path);
+    }
+    return asset;
+}
+
+// Takes the next asset nobody's decoding and decodes it. Returns its index, -1 once they're all taken.
+int _Assets_decode_next(AssetLoader *loader) {
+    int i = atomic_fetch_add(&loader->next, 1);
+    if (i >= loader->amount) return -1;
+
+    Asset *asset = &loader->assets[i];
+    double start = MP_time();
+    if (asset->decode != NULL) asset->decode(asset);
+    asset->decode_time = MP_time() - start;
+
+    // it has a slot for every asset, it can't be full. Without one it's all on the loading thread, see Assets_start()
+    if (loader->decoded.slots != NULL) MQ_push(&loader->decoded, &i, sizeof(i));
+    return i;
+}
+
+void _Assets_finish_one(AssetLoader *loader, int index) {
+    Asset *asset = &loader->assets[index];
+
+    double start = MP_time();
+    if (asset->finish != NULL) asset->finish(asset);
+    asset->finish_time = MP_time() - start;
+}
+
+MP_THREAD_RETURN _Assets_worker(void *data) {
+    AssetLoader *loader = data;
+
+    while (_Assets_decode_next(loader) != -1);
+
+    atomic_fetch_sub(&loader->workers_running, 1);
+    return 0;
+}
+
+// Returns false if there's no memory for the queue the workers hand their results over in. Then there are no workers
+// and Assets_finish() decodes and finishes every asset in turn on its own thread.
+bool Assets_start(AssetLoader *loader, int workers) {
+    loader->started = MP_time();
+    loader->workers = workers > 0 ? workers : 0;
+    loader->decoded = MQ_new(loader->amount > 0 ? loader->amount : 1, sizeof(int));
+    atomic_store(&loader->next, 0);
+
+    bool queued = loader->decoded.slots != NULL;
+    if (!queued) {
+        fprintf(stderr, "Assets_start: couldn't allocate the queue, loading on one thread \n");
+        loader->workers = 0;
+    }
+
+    atomic_store(&loader->workers_running, loader->workers);
+    for (int i = 0; i < loader->workers; i++) MP_thread_start(_Assets_worker, loader);
+
+    return queued;
+}
+
+// Finishes every asset as it's decoded, on this thread. Returns once they're all finished and the workers are gone.
+void Assets_finish(AssetLoader *loader) {
+    int finished = 0;
+
+    if (loader->decoded.slots == NULL) { // Assets_start() had no queue, so no workers either
+        int index;
+        while ((index = _Assets_decode_next(loader)) != -1) _Assets_finish_one(loader, index);
+        finished = loader->amount;
+    }
+
+    while (finished < loader->amount) {
+        int *index = MQ_front(&loader->decoded, NULL);
+
+        if (index == NULL) {
+            // rather than wait, unless they've all been taken already
+            if (_Assets_decode_next(loader) == -1) MP_sleep(1);
+            continue;
+        }
+
+        int taken = *index;
+        MQ_pop(&loader->decoded);
+        _Assets_finish_one(loader, taken);
+
+        finished++;
+    }
+
+    while (atomic_load(&loader->workers_running) > 0) MP_sleep(1);
+
+    loader->total_time = MP_time() - loader->started;
+    MQ_free(&loader->decoded);
+}
+
+// The totals, then every asset with its times, slowest first.
+void Assets_report(AssetLoader *loader, FILE *out) {
+    double decoding = 0, finishing = 0;
+    int failed = 0;
+
+    for (int i = 0; i < loader->amount; i++) {
+        decoding += loader->assets[i].decode_time;
+        finishing += loader->assets[i].finish_time;
+        failed += loader->assets[i].failed;
+    }
+
+    fprintf(out, "%d assets in %.1f ms on %d workers: %.1f ms decoding, %.1f ms finishing, %d failed \n",
+        loader->amount, loader->total_time * 1000, loader->workers, decoding * 1000, finishing * 1000, failed);
+
+    // a selection sort on indices, it's a report of a few dozen
+    int *order = malloc(loader->amount * sizeof(int));
+    if (order == NULL) return;
+    for (int i = 0; i < loader->amount; i++) order[i] = i;
+
+    for (int i = 0; i < loader->amount; i++) {
+        int slowest = i;
+        for (int j = i + 1; j < loader->amount; j++) {
+            Asset *a = &loader->assets[order[j]], *b = &loader->assets[order[slowest]];
+            if (a->decode_time + a->finish_time > b->decode_time + b->finish_time) slowest = j;
+        }
+        int swap = order[i];
+        order[i] = order[slowest];
+        order[slowest] = swap;
+
+        Asset *asset = &loader->assets[order[i]];
+        fprintf(out, "%8.2f ms decode %8.2f ms finish  %s%s \n", asset->decode_time * 1000, asset->finish_time * 1000,
+            asset->path, asset->failed ? " (failed)" : "");
+    }
+
+    free(order);
+}
+
+void Assets_free(AssetLoader *loader) {
+    free(loader->assets);
+    *loader = (AssetLoader){0};
+}
+
+#endif
@@ -40,7 +40,7 @@ s16 get_next_sample(Sound *sound) {
             sound->current_sample = 0;
         } else {
             sound->active = false;
-            return BS_audio_spec.silence;
+            return BS_obtained.silence; // what the device was opened with, it's what we're mixing into
         }
         
     }
@@ -104,16 +104,22 @@ void BS_init() {
 
 }
 
-Sound *create_sound(const char *filename) {
+// Reads the WAV's samples into 'data' (SDL_FreeWAV() it), without touching the audio device so any thread can do it.
+// The WAV's own spec isn't kept, the samples are mixed as the device's format whatever the file says, and
+// BS_audio_spec stays what BS_init() asked for.
+bool decode_sound(const char *filename, u8 **data, u32 *data_len) {
     SDL_AudioSpec audio_spec = {0};
-    u8 *data = {0};
-    u32 data_len = 0;
     
-    if (SDL_LoadWAV(filename, &BS_audio_spec, &data, &data_len) == NULL) {
+    if (SDL_LoadWAV(filename, &audio_spec, data, data_len) == NULL) {
         fprintf(stderr, "Could not open %s: %s\n", filename, SDL_GetError());
-        return NULL;
+        return false;
     }
 
+    return true;
+}
+
+// A sound for samples from decode_sound(), it owns them now.
+Sound *create_sound_from_samples(u8 *data, u32 data_len) {
     Sound *sound = malloc(sizeof(Sound));
     if (sound == NULL) {
         fprintf(stderr, "Could not allocate memory for Sound\n");
@@ -133,6 +139,15 @@ Sound *create_sound(const char *filename) {
     return sound;
 }
 
+Sound *create_sound(const char *filename) {
+    u8 *data = {0};
+    u32 data_len = 0;
+    
+    if (!decode_sound(filename, &data, &data_len)) return NULL;
+
+    return create_sound_from_samples(data, data_len);
+}
+
 void free_sound(Sound *sound) {
 
     int idx = -1;
@@ -0,0 +1,165 @@
+#ifndef BITPACK_C
+#define BITPACK_C
+
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+// Bit level reader/writer for wire formats. Bits go in least significant first, byte by byte,
+// so the result is the same on any endianness.
+// Running past the end sets 'overflow' instead of writing/reading out of bounds, check it once at the end.
+
+typedef struct BitWriter {
+    unsigned char *data;
+    int capacity; // bytes
+    int bit_pos;
+    bool overflow;
+} BitWriter;
+
+typedef struct BitReader {
+    const unsigned char *data;
+    int size; // bytes
+    int bit_pos;
+    bool overflow;
+} BitReader;
+
+BitWriter BW_new(void *data, int capacity) {
+    BitWriter bw = {0};
+    bw.data = data;
+    bw.capacity = capacity;
+    return bw;
+}
+
+// bits <= 32
+void BW_write_bits(BitWriter *bw, unsigned int value, int bits) {
+    if (bw->bit_pos + bits > bw->capacity * 8) {
+        bw->overflow = true;
+        return;
+    }
+
+    while (bits > 0) {
+        int byte = bw->bit_pos >> 3;
+        int offset = bw->bit_pos & 7;
+        int chunk = 8 - offset < bits ? 8 - offset : bits;
+        unsigned int mask = (1u << chunk) - 1;
+
+        if (offset == 0) bw->data[byte] = 0;
+        bw->data[byte] |= (value & mask) << offset;
+
+        value >>= chunk;
+        bits -= chunk;
+        bw->bit_pos += chunk;
+    }
+}
+
+void BW_write_bool(BitWriter *bw, bool value) {
+    BW_write_bits(bw, value ? 1 : 0, 1);
+}
+
+// 7 bits at a time, small numbers take a byte.
+void BW_write_varint(BitWriter *bw, unsigned long long value) {
+    while (value >= 0x80) {
+        BW_write_bits(bw, (value & 0x7F) | 0x80, 8);
+        value >>= 7;
+    }
+    BW_write_bits(bw, (unsigned int)value, 8);
+}
+
+// Zigzag first so small negative numbers stay small.
+void BW_write_svarint(BitWriter *bw, long long value) {
+    BW_write_varint(bw, ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63));
+}
+
+// Maps [min, max] onto 'bits' bits, values outside get clamped. Error is at most (max - min) / (2^bits - 1) / 2.
+void BW_write_quantized(BitWriter *bw, double value, double min, double max, int bits) {
+    unsigned int steps = bits >= 32 ? 0xFFFFFFFF : (1u << bits) - 1;
+
+    double t = (value - min) / (max - min);
+    if (!(t > 0)) t = 0; // also NaN
+    if (t > 1) t = 1;
+
+    BW_write_bits(bw, (unsigned int)(t * steps + 0.5), bits);
+}
+
+// Fixed point with 1/scale resolution, as a svarint.
+void BW_write_fixed(BitWriter *bw, double value, double scale) {
+    double scaled = value * scale;
+    if (!(scaled == scaled)) scaled = 0; // NaN
+    if (scaled > 1e15) scaled = 1e15;
+    if (scaled < -1e15) scaled = -1e15;
+
+    BW_write_svarint(bw, llround(scaled));
+}
+
+// Bytes used so far, the last one may be partial.
+int BW_bytes(BitWriter *bw) {
+    return (bw->bit_pos + 7) >> 3;
+}
+
+BitReader BR_new(const void *data, int size) {
+    BitReader br = {0};
+    br.data = data;
+    br.size = size;
+    return br;
+}
+
+unsigned int BR_read_bits(BitReader *br, int bits) {
+    if (br->bit_pos + bits > br->size * 8) {
+        br->overflow = true;
+        return 0;
+    }
+
+    unsigned int value = 0;
+    int shift = 0;
+
+    while (bits > 0) {
+        int byte = br->bit_pos >> 3;
+        int offset = br->bit_pos & 7;
+        int chunk = 8 - offset < bits ? 8 - offset : bits;
+        unsigned int mask = (1u << chunk) - 1;
+
+        value |= ((br->data[byte] >> offset) & mask) << shift;
+
+        shift += chunk;
+        bits -= chunk;
+        br->bit_pos += chunk;
+    }
+
+    return value;
+}
+
+bool BR_read_bool(BitReader *br) {
+    return BR_read_bits(br, 1) != 0;
+}
+
+unsigned long long BR_read_varint(BitReader *br) {
+    unsigned long long value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        unsigned int byte = BR_read_bits(br, 8);
+        if (br->overflow) return 0;
+
+        value |= (unsigned long long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+
+    br->overflow = true; // more than 10 bytes, not something we wrote
+    return 0;
+}
+
+long long BR_read_svarint(BitReader *br) {
+    unsigned long long value = BR_read_varint(br);
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+double BR_read_quantized(BitReader *br, double min, double max, int bits) {
+    unsigned int steps = bits >= 32 ? 0xFFFFFFFF : (1u << bits) - 1;
+
+    return min + (max - min) * ((double)BR_read_bits(br, bits) / steps);
+}
+
+double BR_read_fixed(BitReader *br, double scale) {
+    return BR_read_svarint(br) / scale;
+}
+
+#endif
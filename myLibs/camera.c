@@ -0,0 +1,185 @@
+#ifndef CAMERA_C
+#define CAMERA_C
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include "vec2.c"
+
+// Per-frame camera basis for the raycaster.
+// Everything that only depends on the camera is worked out once in Camera_update(),
+// after that projecting a point is two dot products, one reciprocal and a few multiply-adds.
+
+typedef struct Camera {
+    v2 pos;
+    v2 forward; // unit
+    v2 right; // forward rotated +90 degrees, same handedness as v2_signed_angle_between
+    double angle; // degrees
+
+    double tan_half_fov;
+    double size_scale; // tan(start_fov / 2) / tan(fov / 2)
+
+    v2 screen_size;
+    v2 screen_center; // center of the screen including pitch and camera offset
+    double x_scale; // screen_size.x / (2 * tan_half_fov)
+    double y_numerator; // eye_height - screen_size.y / 2, height gets subtracted from this
+
+    // per column ray directions, see Camera_ray_dir()
+    int columns;
+    int max_columns;
+    v2 *ray_dirs;
+    double *_column_slopes; // where each column crosses the view plane at distance 1
+    double *_column_inv_lengths;
+    double _table_tan_half_fov;
+    int _table_columns;
+} Camera;
+
+Camera Camera_new(int max_columns) {
+    Camera camera = {0};
+    camera.max_columns = max_columns;
+    camera.ray_dirs = malloc(sizeof(v2) * max_columns);
+    camera._column_slopes = malloc(sizeof(double) * max_columns);
+    camera._column_inv_lengths = malloc(sizeof(double) * max_columns);
+    camera._table_columns = -1;
+    camera.forward = (v2){1, 0};
+    camera.right = (v2){0, 1};
+
+    return camera;
+}
+
+void Camera_free(Camera *camera) {
+    free(camera->ray_dirs);
+    free(camera->_column_slopes);
+    free(camera->_column_inv_lengths);
+    camera->ray_dirs = NULL;
+    camera->_column_slopes = NULL;
+    camera->_column_inv_lengths = NULL;
+}
+
+void _Camera_update_column_table(Camera *camera) {
+    if (camera->_table_columns == camera->columns && camera->_table_tan_half_fov == camera->tan_half_fov) return;
+
+    for (int i = 0; i < camera->columns; i++) {
+        double w = (double)(i + 1) / camera->columns; // the +1 matches the old getRayDirByIdx
+        double slope = -camera->tan_half_fov + w * 2 * camera->tan_half_fov;
+        camera->_column_slopes[i] = slope;
+        camera->_column_inv_lengths[i] = 1 / sqrt(1 + slope * slope);
+    }
+
+    camera->_table_columns = camera->columns;
+    camera->_table_tan_half_fov = camera->tan_half_fov;
+}
+
+// eye_height is the camera height in world units (the player's height, not the max height).
+void Camera_update(Camera *camera, v2 pos, double angle, double tan_half_fov, double tan_half_start_fov, double eye_height, double pitch, v2 offset, v2 screen_size, int columns) {
+    bool rotated = camera->angle != angle || camera->_table_columns == -1;
+
+    camera->pos = pos;
+    camera->angle = angle;
+    camera->forward = (v2){cos(angle * PI / 180), sin(angle * PI / 180)};
+    camera->right = (v2){-camera->forward.y, camera->forward.x};
+
+    camera->tan_half_fov = tan_half_fov;
+    camera->size_scale = tan_half_start_fov / tan_half_fov;
+
+    camera->screen_size = screen_size;
+    camera->screen_center = (v2){screen_size.x / 2 + offset.x, screen_size.y / 2 - pitch + offset.y};
+    camera->x_scale = screen_size.x / (2 * tan_half_fov);
+    camera->y_numerator = eye_height - screen_size.y / 2;
+
+    if (columns > camera->max_columns) columns = camera->max_columns;
+
+    bool table_changed = camera->_table_columns != columns || camera->_table_tan_half_fov != tan_half_fov;
+    camera->columns = columns;
+    _Camera_update_column_table(camera);
+
+    if (!rotated && !table_changed) return;
+
+    v2 f = camera->forward;
+    v2 r = camera->right;
+    for (int i = 0; i < columns; i++) {
+        double slope = camera->_column_slopes[i];
+        double inv_length = camera->_column_inv_lengths[i];
+        camera->ray_dirs[i] = (v2){(f.x + r.x * slope) * inv_length, (f.y + r.y * slope) * inv_length};
+    }
+}
+
+v2 Camera_ray_dir(Camera *camera, int column) {
+    return camera->ray_dirs[column];
+}
+
+// Distance along forward, what the old code called dist_to_viewplane.
+double Camera_depth(Camera *camera, v2 pos) {
+    return (pos.x - camera->pos.x) * camera->forward.x + (pos.y - camera->pos.y) * camera->forward.y;
+}
+
+// Same rules as the old worldToScreen(): points behind the camera get pushed in front of it
+// so lines that go behind you still draw, and depth 0 is nudged to 0.001.
+// Returns false (and leaves screen_pos alone) if allow_out_of_screen is false and the point is outside the fov.
+bool Camera_project(Camera *camera, v2 pos, double height, bool allow_out_of_screen, v2 *screen_pos) {
+    double dx = pos.x - camera->pos.x;
+    double dy = pos.y - camera->pos.y;
+
+    if (dx == 0 && dy == 0) {
+        *screen_pos = (v2){camera->screen_size.x / 2, camera->screen_size.y};
+        return true;
+    }
+
+    double z = dx * camera->forward.x + dy * camera->forward.y;
+    double side = dx * camera->right.x + dy * camera->right.y;
+
+    if (!allow_out_of_screen) {
+        if (z <= 0 || fabs(side) > z * camera->tan_half_fov) return false;
+    } else if (z < 0) {
+        z += (int)-z + 2; // truncation on purpose, it's what the old code did
+    }
+
+    if (z == 0) z = 0.001;
+
+    double inv_z = 1 / z;
+
+    screen_pos->x = camera->screen_center.x + side * camera->x_scale * inv_z;
+    screen_pos->y = camera->screen_center.y + (camera->y_numerator - height) * inv_z;
+
+    return true;
+}
+
+// Camera_project() with allow_out_of_screen for a whole batch, no branches besides the behind-camera fixup.
+void Camera_project_batch(Camera *camera, const v2 *positions, const double *heights, v2 *out, int count) {
+    v2 f = camera->forward;
+    v2 r = camera->right;
+    v2 c = camera->pos;
+    v2 center = camera->screen_center;
+    double x_scale = camera->x_scale;
+    double y_numerator = camera->y_numerator;
+
+    for (int i = 0; i < count; i++) {
+        double dx = positions[i].x - c.x;
+        double dy = positions[i].y - c.y;
+
+        if (dx == 0 && dy == 0) {
+            out[i] = (v2){camera->screen_size.x / 2, camera->screen_size.y};
+            continue;
+        }
+
+        double z = dx * f.x + dy * f.y;
+        double side = dx * r.x + dy * r.y;
+
+        if (z < 0) z += (int)-z + 2;
+        if (z == 0) z = 0.001;
+
+        double inv_z = 1 / z;
+
+        out[i].x = center.x + side * x_scale * inv_z;
+        out[i].y = center.y + (y_numerator - heights[i]) * inv_z;
+    }
+}
+
+// Screen size of something 'size' big at pos. Doesn't guard against depth 0, the old code didn't either.
+v2 Camera_project_size(Camera *camera, v2 size, v2 pos) {
+    double scale = camera->size_scale / Camera_depth(camera, pos);
+
+    return (v2){size.x * scale, size.y * scale};
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef CORE_UTILS_C
+#define CORE_UTILS_C
+
+#include <stdlib.h>
+#include <string.h>
+#include "rng.c"
+
+// The bits of game_utils.c that don't need SDL, for things that have to build without it (the dedicated server).
+
+#define in_range(a, min, max) (a <= max && a >= min)
+
+#define struct_equal(type, s1, s2) (!strncmp((const char *)&s1, (const char *)&s2, sizeof(type)))
+
+// self_defstruct
+// kill_yourself_NOW
+// overdose_on_...
+// commit_sudoku
+
+#define commit_sudoku() *(int *)NULL = 42
+
+// inclusive, from the current RNG stream
+int randi_range(int min, int max) {
+    return min + (int)(RNG_next(rng_current) % (unsigned int)(max - min + 1));
+}
+
+void shuffle_array(int *arr, int l) {
+    for (int i = 0; i < l; i++) {
+        int rand_idx = randi_range(0, i);
+
+        int temp = arr[i];
+        arr[i] = arr[rand_idx];
+        arr[rand_idx] = temp;
+    }
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef FRAME_PACER_C
+#define FRAME_PACER_C
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+
+// Sleeps the main loop until the next deadline instead of spinning on SDL_PollEvent.
+// Events that arrive while waiting are handed to on_event right away, so input isn't delayed.
+
+#define FP_DEFAULT_SPIN_MARGIN 0.001 // seconds before a deadline where we stop sleeping and spin
+#define FP_STATS_WINDOW 1.0 // max frame time is reset every this many seconds
+
+typedef struct FramePacer {
+    Uint64 start;
+    double freq;
+
+    // hybrid pacing: sleep until spin_margin before the deadline, then spin the rest.
+    // 0 means always sleep (lowest power, a bit more jitter)
+    double spin_margin;
+
+    void (*on_event)(SDL_Event event);
+
+    // stats, all in seconds
+    double last_frame;
+    double frame_time; // last interval between two FP_mark_frame() calls
+    double mean_frame_time;
+    double jitter; // mean |frame_time - target|
+    double max_frame_time;
+    double _window_max;
+    double _window_start;
+    double _window_waited;
+    double idle; // fraction of the last stats window spent waiting rather than working
+} FramePacer;
+
+double FP_now(FramePacer *pacer) {
+    return (double)(SDL_GetPerformanceCounter() - pacer->start) / pacer->freq;
+}
+
+FramePacer FP_new(void (*on_event)(SDL_Event event)) {
+    FramePacer pacer = {0};
+    pacer.start = SDL_GetPerformanceCounter();
+    pacer.freq = (double)SDL_GetPerformanceFrequency();
+    pacer.spin_margin = FP_DEFAULT_SPIN_MARGIN;
+    pacer.on_event = on_event;
+    pacer.last_frame = -1;
+
+    return pacer;
+}
+
+void FP_set_hybrid(FramePacer *pacer, bool hybrid) {
+    pacer->spin_margin = hybrid ? FP_DEFAULT_SPIN_MARGIN : 0;
+}
+
+void _FP_handle_event(FramePacer *pacer, SDL_Event event) {
+    if (pacer->on_event != NULL) pacer->on_event(event);
+}
+
+void FP_poll_events(FramePacer *pacer) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        _FP_handle_event(pacer, event);
+    }
+}
+
+// Blocks until FP_now() >= deadline, handling events in the meantime.
+// 'spin' lets the caller turn hybrid pacing off for frames where precision doesn't matter (menus).
+void FP_wait_until(FramePacer *pacer, double deadline, bool spin) {
+    double wait_start = FP_now(pacer);
+
+    FP_poll_events(pacer);
+
+    double spin_margin = spin ? pacer->spin_margin : 0;
+
+    while (true) {
+        double remaining = deadline - FP_now(pacer);
+        if (remaining <= 0) break;
+
+        if (remaining > spin_margin) {
+            int ms = (int)((remaining - spin_margin) * 1000);
+            if (ms < 1) {
+                if (spin_margin > 0) continue; // close enough, just spin
+                ms = 1;
+            }
+
+            SDL_Event event;
+            if (SDL_WaitEventTimeout(&event, ms)) {
+                _FP_handle_event(pacer, event);
+                FP_poll_events(pacer);
+            }
+        } else {
+            FP_poll_events(pacer);
+        }
+    }
+
+    pacer->_window_waited += FP_now(pacer) - wait_start;
+}
+
+// Call once per presented frame. 'target' is the interval we were aiming for.
+void FP_mark_frame(FramePacer *pacer, double target) {
+    double now = FP_now(pacer);
+
+    if (pacer->last_frame < 0) {
+        pacer->last_frame = now;
+        pacer->_window_start = now;
+        pacer->_window_waited = 0;
+        return;
+    }
+
+    double frame_time = now - pacer->last_frame;
+    pacer->last_frame = now;
+    pacer->frame_time = frame_time;
+
+    if (pacer->mean_frame_time == 0) pacer->mean_frame_time = frame_time;
+    pacer->mean_frame_time += (frame_time - pacer->mean_frame_time) * 0.05;
+    pacer->jitter += (fabs(frame_time - target) - pacer->jitter) * 0.05;
+
+    if (frame_time > pacer->_window_max) pacer->_window_max = frame_time;
+    if (now - pacer->_window_start >= FP_STATS_WINDOW) {
+        pacer->max_frame_time = pacer->_window_max;
+        pacer->idle = SDL_clamp(pacer->_window_waited / (now - pacer->_window_start), 0, 1);
+        pacer->_window_max = 0;
+        pacer->_window_waited = 0;
+        pacer->_window_start = now;
+    }
+}
+
+void FP_print_stats(FramePacer *pacer) {
+    printf("frame pacing: mean %.2fms, jitter %.2fms, max %.2fms, idle %.0f%%\n",
+        pacer->mean_frame_time * 1000,
+        pacer->jitter * 1000,
+        pacer->max_frame_time * 1000,
+        pacer->idle * 100
+    );
+}
+
+#endif
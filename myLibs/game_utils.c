@@ -15,12 +15,12 @@
 #include <sys/time.h>
 #include "hashtable.c"
 #include "inttypes.h"
+#include "core_utils.c" // in_range, commit_sudoku, randi_range, shuffle_array
+#include "shared_mem.c"
 
 #define RENDERER_FLAGS (SDL_RENDERER_ACCELERATED)
 #define EPSILON 0.001
 
-#define in_range(a, min, max) (a <= max && a >= min)
-
 #ifndef min
 
 #define min(a, b) (a < b ? a : b)
@@ -28,14 +28,12 @@
 
 #endif
 
-// self_defstruct
-// kill_yourself_NOW
-// overdose_on_...
-// commit_sudoku
-
 #define float_equal(a, b) in_range(a, b - EPSILON, b + EPSILON)
 
-#define commit_sudoku() *(int *)NULL = 42
+#define TEXTURE_CACHE_NAME "handcannon_textures"
+#define TEXTURE_CACHE_SIZE (32 * 1024 * 1024) // decoded RGBA, everything in Textures/ comes to about 21 MB
+#define TEXTURE_CACHE_MAX 512
+#define TEXTURE_CACHE_PATH 96
 
 #define init_grid(type, rows, cols, default, result) do { \
     result = malloc(sizeof(type *) * rows); \
@@ -69,6 +67,20 @@ typedef struct Pixel {
 } Pixel;
 
 
+// At the start of the texture cache, the pixels come right after it
+typedef struct TextureCacheDir {
+    int count;
+    size_t used; // bytes of pixels
+    struct {
+        char path[TEXTURE_CACHE_PATH];
+        int w, h;
+        size_t offset;
+    } entries[TEXTURE_CACHE_MAX];
+} TextureCacheDir;
+
+SharedMem texture_cache = {0};
+bool texture_cache_filling = false;
+
 const double DEG_TO_RAD = PI / 180;
 const double RAD_TO_DEG = 180 / PI;
 
@@ -191,8 +203,10 @@ u64 get_systime_mili() {
 	return tp.tv_sec * 1000 + tp.tv_usec / 1000;
 }
 
+// seeds the gameplay stream (and rand()) from the clock
 void randomize() {
     srand(get_systime_mili());
+    RNG_seed(&rng_game, get_systime_mili());
 }
 
 Pixel TextureData_get_pixel(TextureData *data, int x, int y) {
@@ -270,24 +284,110 @@ char *concat(char *s1, char *s2) {
 
 }
 
-// inclusive
-int randi_range(int min, int max) {
-    return min + rand() % (max - min + 1);
-}
-
 double randf() {
-    return ((double)rand()) / RAND_MAX;
+    return RNG_float(rng_current);
 }
 
 double randf_range(double min, double max) {
     return min + randf() * (max - min);
 }
 
-GPU_Image *load_texture(char *file) {
+// Decoded pixels shared by the instances on this machine: the first one decodes every texture it loads into it, the
+// others upload from it instead of decoding the PNGs again. Between texture_cache_open() and texture_cache_close().
+void texture_cache_open() {
+    if (!Shm_open(&texture_cache, TEXTURE_CACHE_NAME, TEXTURE_CACHE_SIZE)) return;
+    texture_cache_filling = texture_cache.owner;
+}
+
+// The owner publishes what it decoded and keeps it open for instances started later, the rest are done with it.
+void texture_cache_close() {
+    if (texture_cache.owner) {
+        Shm_publish(&texture_cache);
+        texture_cache_filling = false;
+    } else {
+        Shm_close(&texture_cache);
+    }
+}
+
+// True if 'file' is in the texture cache we're reading, then there's nothing to decode.
+bool texture_cache_has(const char *file) {
+    if (texture_cache.data == NULL || texture_cache.owner) return false;
+
+    TextureCacheDir *dir = texture_cache.data;
+    for (int i = 0; i < dir->count; i++) {
+        if (strcmp(dir->entries[i].path, file) == 0) return true;
+    }
+    return false;
+}
+
+// From the texture cache we're reading. NULL if it's not in there.
+GPU_Image *_texture_cache_load(const char *file) {
+    if (texture_cache.data == NULL || texture_cache.owner) return NULL;
+
+    TextureCacheDir *dir = texture_cache.data;
+    unsigned char *pixels = (unsigned char *)texture_cache.data + sizeof(TextureCacheDir);
+
+    for (int i = 0; i < dir->count; i++) {
+        if (strcmp(dir->entries[i].path, file) != 0) continue;
+
+        GPU_Image *image = GPU_CreateImage(dir->entries[i].w, dir->entries[i].h, GPU_FORMAT_RGBA);
+        if (image != NULL) GPU_UpdateImageBytes(image, NULL, pixels + dir->entries[i].offset, dir->entries[i].w * 4);
+        return image;
+    }
+    return NULL;
+}
+
+// Into the texture cache while we're filling it.
+void _texture_cache_store(const char *file, SDL_Surface *surface) {
+    if (!texture_cache_filling || strlen(file) >= TEXTURE_CACHE_PATH) return;
+
+    TextureCacheDir *dir = texture_cache.data;
+    unsigned char *pixels = (unsigned char *)texture_cache.data + sizeof(TextureCacheDir);
+    size_t row_bytes = (size_t)surface->w * 4;
+
+    if (dir->count >= TEXTURE_CACHE_MAX || dir->used + row_bytes * surface->h > texture_cache.size - sizeof(TextureCacheDir)) {
+        return;
+    }
+
+    snprintf(dir->entries[dir->count].path, TEXTURE_CACHE_PATH, "%s", file);
+    dir->entries[dir->count].w = surface->w;
+    dir->entries[dir->count].h = surface->h;
+    dir->entries[dir->count].offset = dir->used;
+
+    for (int row = 0; row < surface->h; row++) {
+        memcpy(pixels + dir->used + row * row_bytes, (unsigned char *)surface->pixels + row * surface->pitch, row_bytes);
+    }
+    dir->used += row_bytes * surface->h;
+    dir->count++;
+}
+
+// The half of loading a texture that doesn't touch the GPU, so any thread can do it: 'file' decoded to RGBA pixels.
+// NULL if it couldn't be.
+SDL_Surface *decode_texture(const char *file) {
+    SDL_Surface *loaded = GPU_LoadSurface(file);
+    if (loaded == NULL) return NULL;
+
+    SDL_Surface *surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(loaded);
+    return surface;
+}
+
+// The other half, on the thread with the GPU: 'surface' from decode_texture() (freed here), or NULL if it's in the
+// texture cache or couldn't be decoded.
+GPU_Image *upload_texture(const char *file, SDL_Surface *surface) {
+    GPU_Image *image = NULL;
+
+    if (surface != NULL) {
+        image = GPU_CopyImageFromSurface(surface);
+        if (image != NULL) _texture_cache_store(file, surface);
+        SDL_FreeSurface(surface);
+    } else {
+        image = _texture_cache_load(file);
+    }
 
-    GPU_Image *image = GPU_LoadImage(file);
     if (image == NULL) {
         fprintf(stderr, "Failed to load image! File: '%s' \n", file);
+        return NULL;
     }
 
     GPU_SetImageFilter(image, GPU_FILTER_NEAREST);
@@ -295,6 +395,10 @@ GPU_Image *load_texture(char *file) {
     return image;
 }
 
+GPU_Image *load_texture(char *file) {
+    return upload_texture(file, texture_cache_has(file) ? NULL : decode_texture(file));
+}
+
 void decimal_to_text(double decimal, char *buf) {
     gcvt(decimal, 4, buf);
 }
@@ -420,14 +524,4 @@ void play_spatial_sound(Sound *sound, double base_volume, v2 listener_pos, v2 so
     play_sound(sound);
 }
 
-void shuffle_array(int *arr, int l) {
-    for (int i = 0; i < l; i++) {
-        int rand_idx = randi_range(0, i);
-
-        int temp = arr[i];
-        arr[i] = arr[rand_idx];
-        arr[rand_idx] = temp;
-    }
-}
-
 // #END
\ No newline at end of file
@@ -0,0 +1,152 @@
+#ifndef INTERP_BUFFER_C
+#define INTERP_BUFFER_C
+
+#include <math.h>
+#include <stdbool.h>
+#include "vec2.c"
+
+// Keeps the last few timestamped states of something remote and plays them back a little in the past, so there's
+// almost always a newer sample to interpolate towards. When the newer one doesn't show up (lost, late) it keeps going
+// with the last known velocity for up to IB_MAX_EXTRAPOLATION, then stops and waits.
+//
+//     IB_push(&buf, packet.time, MP_time(), state);    // on every update
+//     IB_sample(&buf, MP_time(), &state);              // every tick
+//
+// Times are the sender's clock, which only has to be steady, not in sync with ours. The delay follows the
+// rate the sender actually sends at, so turning the send rate down doesn't need anything changed here.
+
+#define IB_SIZE 32
+#define IB_DELAY_INTERVALS 2.0 // play back this many send intervals behind, one lost update doesn't run us dry
+#define IB_DELAY_MARGIN 0.02 // seconds, for jitter on top of that
+#define IB_MAX_EXTRAPOLATION 0.25 // seconds past the newest sample before freezing
+#define IB_INTERVAL_SMOOTHING 0.1
+#define IB_OFFSET_CREEP 0.01 // how fast the clock offset follows samples that arrive later than the best one
+#define IB_RESET_TIME 1.0 // a gap or clock jump bigger than this starts over
+
+typedef struct InterpState {
+    v2 pos;
+    double height;
+    v2 dir;
+} InterpState;
+
+typedef struct InterpSample {
+    double time; // sender's clock
+    InterpState state;
+} InterpSample;
+
+typedef struct InterpBuffer {
+    InterpSample samples[IB_SIZE];
+    int newest;
+    int count;
+    double clock_offset; // our clock - sender's clock for the fastest recent delivery
+    double interval; // smoothed time between the sender's updates
+} InterpBuffer;
+
+InterpBuffer IB_new() {
+    return (InterpBuffer){0};
+}
+
+void IB_clear(InterpBuffer *buf) {
+    buf->count = 0;
+}
+
+InterpSample *_IB_get(InterpBuffer *buf, int age) {
+    return &buf->samples[(buf->newest - age + IB_SIZE) % IB_SIZE];
+}
+
+double IB_delay(InterpBuffer *buf) {
+    return buf->interval * IB_DELAY_INTERVALS + IB_DELAY_MARGIN;
+}
+
+// Returns false if the sample was older than what we have and got dropped.
+bool IB_push(InterpBuffer *buf, double sender_time, double local_time, InterpState state) {
+    double offset = local_time - sender_time;
+
+    if (buf->count > 0) {
+        double newest_time = _IB_get(buf, 0)->time;
+        if (sender_time <= newest_time) {
+            // out of order, unless the sender restarted its clock
+            if (newest_time - sender_time < IB_RESET_TIME) return false;
+            IB_clear(buf);
+        } else if (sender_time - newest_time > IB_RESET_TIME || fabs(offset - buf->clock_offset) > IB_RESET_TIME) {
+            IB_clear(buf);
+        }
+    }
+
+    if (buf->count == 0) {
+        buf->clock_offset = offset;
+        buf->newest = 0;
+        buf->samples[0] = (InterpSample){sender_time, state};
+        buf->count = 1;
+        return true;
+    }
+
+    double gap = sender_time - _IB_get(buf, 0)->time;
+    buf->interval = buf->count == 1 ? gap : buf->interval + (gap - buf->interval) * IB_INTERVAL_SMOOTHING;
+
+    // the least delayed sample is the closest to the real offset. Creeping up lets it recover from drift and route changes
+    if (offset < buf->clock_offset) {
+        buf->clock_offset = offset;
+    } else {
+        buf->clock_offset += (offset - buf->clock_offset) * IB_OFFSET_CREEP;
+    }
+
+    buf->newest = (buf->newest + 1) % IB_SIZE;
+    buf->samples[buf->newest] = (InterpSample){sender_time, state};
+    if (buf->count < IB_SIZE) buf->count++;
+
+    return true;
+}
+
+InterpState _IB_lerp(InterpState a, InterpState b, double w) {
+    InterpState result = {
+        .pos = v2_lerp(a.pos, b.pos, w),
+        .height = a.height + (b.height - a.height) * w,
+        .dir = v2_lerp(a.dir, b.dir, w)
+    };
+
+    double len = v2_length(result.dir);
+    result.dir = len > 0.0001 ? v2_div(result.dir, to_vec(len)) : b.dir;
+
+    return result;
+}
+
+// What the remote thing looked like IB_delay() ago. Returns false if nothing was pushed yet.
+bool IB_sample(InterpBuffer *buf, double local_time, InterpState *out) {
+    if (buf->count == 0) return false;
+
+    double time = local_time - buf->clock_offset - IB_delay(buf);
+
+    InterpSample *newest = _IB_get(buf, 0);
+
+    if (time >= newest->time) {
+        *out = newest->state;
+        if (buf->count == 1) return true;
+
+        InterpSample *prev = _IB_get(buf, 1);
+        double dt = newest->time - prev->time;
+        if (dt <= 0) return true;
+
+        double ahead = fmin(time - newest->time, IB_MAX_EXTRAPOLATION);
+        double w = ahead / dt;
+
+        out->pos = v2_add(newest->state.pos, v2_mul(v2_sub(newest->state.pos, prev->state.pos), to_vec(w)));
+        out->height = newest->state.height + (newest->state.height - prev->state.height) * w;
+        return true;
+    }
+
+    for (int age = 1; age < buf->count; age++) {
+        InterpSample *a = _IB_get(buf, age);
+        if (a->time > time) continue;
+
+        InterpSample *b = _IB_get(buf, age - 1);
+        *out = _IB_lerp(a->state, b->state, (time - a->time) / (b->time - a->time));
+        return true;
+    }
+
+    // further back than we remember
+    *out = _IB_get(buf, buf->count - 1)->state;
+    return true;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef MPSC_QUEUE_C
+#define MPSC_QUEUE_C
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bounded lock-free queue: any number of threads push, one thread pops.
+// Every slot has a sequence number saying whose turn it is. A pusher claims a position with a CAS on 'tail',
+// copies its item in and then bumps the slot's sequence, the popper only reads a slot once that happened.
+// Items are copied into fixed size slots, nothing gets allocated after MQ_new().
+//
+//     MQ_push(&queue, &item, sizeof(item));            // any thread
+//     while ((item = MQ_front(&queue, &size))) {       // the one consuming thread
+//         ...
+//         MQ_pop(&queue);
+//     }
+
+#define MQ_CACHE_LINE 64
+
+typedef struct MQSlot {
+    atomic_size_t sequence;
+    int size;
+    double item[]; // aligned for whatever gets put in
+} MQSlot;
+
+typedef struct MPSCQueue {
+    unsigned char *slots;
+    size_t slot_stride;
+    size_t mask; // capacity - 1
+    int item_capacity; // bytes per item
+
+    // on their own cache lines, the pushers hammer 'tail'
+    _Alignas(MQ_CACHE_LINE) atomic_size_t tail;
+    _Alignas(MQ_CACHE_LINE) size_t head; // only the consumer touches it
+} MPSCQueue;
+
+MQSlot *_MQ_slot(MPSCQueue *queue, size_t pos) {
+    return (MQSlot *)(queue->slots + (pos & queue->mask) * queue->slot_stride);
+}
+
+// 'capacity' gets rounded up to a power of 2.
+MPSCQueue MQ_new(int capacity, int item_capacity) {
+    MPSCQueue queue = {0};
+
+    size_t slots = 1;
+    while (slots < (size_t)capacity) slots <<= 1;
+
+    queue.mask = slots - 1;
+    queue.item_capacity = item_capacity;
+    queue.slot_stride = (sizeof(MQSlot) + item_capacity + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+    queue.slots = malloc(slots * queue.slot_stride);
+
+    if (queue.slots == NULL) {
+        printf("MQ_new: couldn't allocate memory! \n");
+        queue.mask = 0;
+        return queue;
+    }
+
+    for (size_t i = 0; i < slots; i++) atomic_init(&_MQ_slot(&queue, i)->sequence, i);
+    atomic_init(&queue.tail, 0);
+    queue.head = 0;
+
+    return queue;
+}
+
+void MQ_free(MPSCQueue *queue) {
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+// Copies 'size' bytes in. Returns false if the queue is full (or it doesn't fit a slot), never blocks.
+bool MQ_push(MPSCQueue *queue, const void *item, int size) {
+    if (queue->slots == NULL || size > queue->item_capacity) return false;
+
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    MQSlot *slot;
+
+    while (true) {
+        slot = _MQ_slot(queue, pos);
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            // free and it's our turn, try to claim it. On failure 'pos' gets the new tail
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false; // the consumer hasn't freed this one yet, full
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed); // someone else got it first
+        }
+    }
+
+    slot->size = size;
+    if (size > 0) memcpy(slot->item, item, size);
+
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+    return true;
+}
+
+// Whether an MQ_push() right now would find a free slot. Only a promise if nobody else pushes in between.
+bool MQ_has_room(MPSCQueue *queue) {
+    if (queue->slots == NULL) return false;
+
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    return atomic_load_explicit(&_MQ_slot(queue, pos)->sequence, memory_order_acquire) == pos;
+}
+
+// The oldest item, left in place until MQ_pop(). NULL if there's nothing (fully pushed) yet.
+void *MQ_front(MPSCQueue *queue, int *size) {
+    if (queue->slots == NULL) return NULL;
+
+    MQSlot *slot = _MQ_slot(queue, queue->head);
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != queue->head + 1) return NULL;
+
+    if (size != NULL) *size = slot->size;
+    return slot->item;
+}
+
+void MQ_pop(MPSCQueue *queue) {
+    MQSlot *slot = _MQ_slot(queue, queue->head);
+
+    // free for the pusher one lap later
+    atomic_store_explicit(&slot->sequence, queue->head + queue->mask + 1, memory_order_release);
+    queue->head++;
+}
+
+// Items pushed and not popped yet, some may still be mid-push. Only exact on the consuming thread, a rough
+// number anywhere else.
+int MQ_count(MPSCQueue *queue) {
+    if (queue->slots == NULL) return 0;
+    return (int)(atomic_load_explicit(&queue->tail, memory_order_relaxed) - queue->head);
+}
+
+#endif
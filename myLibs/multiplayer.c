@@ -2,37 +2,582 @@
 #ifndef MULTIPLAYER_C
 #define MULTIPLAYER_C
 
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // sendmmsg, only works if nothing included a libc header before us
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "ringbuffer.c"
+#include "mpsc_queue.c"
+
+// Everything runs on one I/O thread: the listening socket, every client the server has, and our own
+// connection to the server. Sockets are non-blocking and each connection has its own read and write buffer.
+// Callbacks are called from the I/O thread, unless MP_queue_messages() was called: then received packets go into a
+// lock-free queue and the recv callbacks run on whichever thread calls MP_dispatch_messages().
+//
+// On the wire a packet is two varints (type with the broadcast flag, then len) followed by the data, see
+// MP_encode_header(). If a payload codec is set the data is whatever it turned the game's struct into.
+//
+// Next to the TCP connection there's an optional UDP channel for state that's sent many times a second
+// (positions etc). Datagrams carry a sequence number and ack the other side's newest ones. They're delivered in
+// whatever order they come, each at most once, and only what was delivered gets acked. Nothing waits for a lost one,
+// and it's up to the handlers to ignore state older than what they have (positions carry the sender's time,
+// snapshots their id). See MPClient_send_unreliable().
+//
+// Sends made between MP_begin_batch() and MP_end_batch() on the same thread are only queued, and the end of the batch
+// flushes every connection once: one send() per TCP connection, and every connection's unreliable packets packed
+// into one datagram.
+
+#ifdef _WIN32
+
 #include <winsock.h>
 
-#define MP_DEFAULT_BUFFER_SIZE 2048
+typedef HANDLE MPThread;
+typedef CRITICAL_SECTION MPMutex;
+typedef HANDLE MPSemaphore;
+typedef int MPSocklen;
+#define MP_THREAD_RETURN DWORD WINAPI
+#define MP_WOULD_BLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
+#define MP_SEND_FLAGS 0
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+typedef int SOCKET;
+typedef pthread_t MPThread;
+typedef pthread_mutex_t MPMutex;
+typedef sem_t MPSemaphore;
+typedef socklen_t MPSocklen;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define SD_BOTH SHUT_RDWR
+#define closesocket close
+#define MP_THREAD_RETURN void *
+#define MP_WOULD_BLOCK() (errno == EAGAIN || errno == EWOULDBLOCK)
+#define MP_SEND_FLAGS MSG_NOSIGNAL // a dead peer is an error, not a SIGPIPE
+#ifdef __USE_GNU // glibc only declares sendmmsg with _GNU_SOURCE
+#define MP_HAVE_SENDMMSG
+#endif
+
+#endif
+
+#define MP_DEFAULT_BUFFER_SIZE 2048 // max size of a single packet including the header
+#define MP_MAX_HEADER_SIZE 10 // two varints
+#define MP_MAX_PAYLOAD (MP_DEFAULT_BUFFER_SIZE - 12) // what it was back when the header was the raw 12 byte struct
 #define MP_MAX_CLIENTS 100
+#define MP_READ_BUFFER_SIZE (MP_DEFAULT_BUFFER_SIZE * 8) // must fit at least one max size packet
+#define MP_WRITE_HIGH_WATER (256 * 1024) // stop reading from a client we can't write to fast enough
+#define MP_WRITE_LOW_WATER (64 * 1024) // ...and start again once it drained to here
+#define MP_WRITE_HARD_CAP (1024 * 1024) // past this the client is hopeless, drop it
+#define MP_POLL_TIMEOUT_MS 5
+#define MP_MAX_CONNECTIONS (MP_MAX_CLIENTS + 1) // + our own connection to the server
+#define MP_SENT_HISTORY 256 // how many of our own datagrams we remember, for acks and rtt
+#define MP_UDP_HELLO_INTERVAL 0.1 // seconds between hellos until the server answers
+#define MP_UDP_MAX_READS 64 // datagrams handled per wakeup
+#define MP_SIM_QUEUE_SIZE 512
+#define MP_UDP_BATCH_SIZE 1200 // packets get packed into one datagram up to this, stays under the usual MTU
+#define MP_UDP_MAX_PENDING 8 // datagrams per connection held back until the end of a batch
+#define MP_MESSAGE_QUEUE_SIZE 1024 // received packets waiting for MP_dispatch_messages()
+#define MP_PING_INTERVAL 1.0 // seconds between pings on every connection
+#define MP_STATS_TYPES 64 // packet types below this get their own counters in MPIOStats
+
+// Internal packet types for setting up the UDP channel, the callbacks never see these.
+#define MP_PACKET_UDP_TOKEN -1 // server -> client over TCP: put this in every datagram
+#define MP_PACKET_UDP_READY -2 // server -> client over TCP: got your hello, the channel works
+#define MP_PACKET_UDP_HELLO -3 // client -> server over UDP, repeated until READY arrives
+#define MP_PACKET_PING -4 // either way over TCP, carries the sender's MP_time()
+#define MP_PACKET_PONG -5 // the ping sent back as is, answered on the I/O thread
 
 int MP_SERVER_PORT = 1155;
 char *MP_SERVER_IP = "127.0.0.1";
 bool MP_is_server = false;
 
-typedef struct MPPacket { // 12 bytes
+typedef struct MPPacket { // in memory only, see MP_encode_header()
     int len;
     int type;
     bool is_broadcast;
 } MPPacket;
 
-SOCKET MPClient_socket;
-SOCKET MPServer_socket;
-
+typedef struct MPDatagramHeader { // MP_DATAGRAM_HEADER_SIZE bytes on the wire, followed by one or more packets
+    unsigned int token; // which connection this belongs to
+    unsigned short seq;
+    unsigned short ack; // newest seq we got from the other side
+    unsigned int ack_bits; // bit i set = we also got ack - 1 - i
+    bool has_ack; // false until we got anything, ack and ack_bits mean nothing before that
+} MPDatagramHeader;
+
+#define MP_DATAGRAM_HEADER_SIZE 13
+#define MP_MAX_DATAGRAM (MP_DEFAULT_BUFFER_SIZE + MP_DATAGRAM_HEADER_SIZE)
+
+typedef struct MPUdpState {
+    unsigned int token; // 0 = no UDP channel on this connection
+    bool ready; // both sides know where to send, until then unreliable sends go over TCP
+    struct sockaddr_in addr;
+    double last_hello;
+
+    unsigned short local_seq;
+    unsigned short remote_seq;
+    bool has_remote_seq;
+    unsigned int ack_bits;
+
+    unsigned short sent_seqs[MP_SENT_HISTORY];
+    double sent_times[MP_SENT_HISTORY];
+    bool acked[MP_SENT_HISTORY];
+    double rtt; // smoothed, seconds
+} MPUdpState;
+
+typedef struct MPConnection {
+    SOCKET socket;
+    bool in_use;
+    bool is_client; // our connection to the server, as opposed to a client connected to our server
+    bool registered; // added to the poller
+    bool read_paused;
+    bool queue_stalled; // a frame in read_ring is waiting for room in _MP_messages, we stop reading until then
+
+    RingBuffer read_ring; // frames get reassembled here and handed out in place
+
+    char *write_buf;
+    int write_len;
+    int write_cap;
+
+    MPUdpState udp;
+    char *udp_out; // MP_UDP_MAX_PENDING datagram slots, MP_MAX_DATAGRAM apart, each with header space first
+    int udp_out_lens[MP_UDP_MAX_PENDING]; // full length of the finished ones
+    int udp_out_count; // finished, waiting to be sent
+    int udp_out_len; // bytes of packets in the one being filled (slot udp_out_count)
+    unsigned int polled_events; // what epoll was last told, to skip redundant epoll_ctl calls
+
+    double last_ping;
+    double ping_rtt; // smoothed, seconds
+
+    // packets and their bytes on the wire (header included, socket overhead not)
+    long long packets_sent, bytes_sent, packets_received, bytes_received;
+} MPConnection;
+
+typedef struct MPTypeStats {
+    long long packets_sent, bytes_sent;
+    long long packets_received, bytes_received;
+} MPTypeStats;
+
+typedef struct MPIOStats {
+    long long send_calls; // send, sendto and sendmmsg
+    long long recv_calls;
+    long long bytes_sent;
+    long long bytes_received;
+    long long packets_sent; // what the game asked for, TCP and UDP
+    long long packets_received; // what made it to the callbacks (or the queue)
+
+    long long dropped_queue_full; // received but no room in the message queue
+    long long dropped_stale; // datagrams we already had, or too old to ack
+    long long codec_errors; // payloads the codec refused, either way
+    long long oversized; // sends bigger than MP_MAX_PAYLOAD, refused
+    long long corrupt_frames; // impossible headers, the connection gets dropped
+    long long dropped_backlog; // connections dropped for falling MP_WRITE_HARD_CAP behind
+
+    int message_queue_depth; // waiting for MP_dispatch_messages(), when the stats were taken
+
+    MPTypeStats types[MP_STATS_TYPES]; // game packets by type, wire bytes with the header
+} MPIOStats;
+
+typedef struct MPConnectionStats {
+    SOCKET socket;
+    bool is_client; // our connection to the server
+    double rtt; // seconds, from pings over TCP. 0 until the first pong
+    double udp_rtt; // seconds, from datagram acks. 0 without a UDP channel
+    int write_queued; // bytes waiting to go out
+    long long packets_sent, bytes_sent, packets_received, bytes_received;
+} MPConnectionStats;
+
+SOCKET MPClient_socket = INVALID_SOCKET;
+SOCKET MPServer_socket = INVALID_SOCKET;
+SOCKET MPClient_udp_socket = INVALID_SOCKET;
+SOCKET MPServer_udp_socket = INVALID_SOCKET;
+struct sockaddr_in _MP_server_udp_addr;
+
+bool MP_udp_enabled = true; // false sends everything over TCP
+
+// only written by the I/O thread, with MP_lock held
 SOCKET MP_clients[MP_MAX_CLIENTS];
 int MP_clients_amount = 0;
 
+MPConnection MP_connections[MP_MAX_CONNECTIONS];
+MPMutex MP_lock;
+bool MP_running = false;
+bool _MP_io_thread_started = false;
+_Thread_local int _MP_batch_depth = 0; // a batch only holds back the sends of the thread that opened it
+MPIOStats _MP_io_stats; // totals, only touched with MP_lock held
+
+#ifndef _WIN32
+int _MP_epoll_fd = -1;
+#endif
+
 void (*_MP_client_handle_recv)(MPPacket, void *) = NULL;
 void (*_MP_server_handle_recv)(SOCKET, MPPacket, void *) = NULL;
 void (*_MP_on_client_connected)(SOCKET) = NULL;
 void (*_MP_on_client_disconnected)(SOCKET) = NULL;
+void (*_MP_on_datagram_acked)(SOCKET, unsigned short seq) = NULL; // seq is what the unreliable send returned
+
+// a received packet waiting in _MP_messages
+typedef struct MPMessage {
+    SOCKET socket; // who sent it, for the server callback
+    bool for_client; // which callback it goes to
+    MPPacket packet;
+    double data[MP_DEFAULT_BUFFER_SIZE / sizeof(double)]; // only packet.len of it gets queued
+} MPMessage;
+
+bool _MP_queue_messages = false;
+MPSCQueue _MP_messages;
+
+// Optional payload codec, set both or neither. encode gets what the game passed to a send and writes the wire
+// version to 'out', decode does the opposite before the recv callbacks see it. Both return the new length,
+// -1 drops the packet. Internal (negative) packet types skip them.
+int (*_MP_encode_payload)(int type, const void *data, int len, void *out, int capacity) = NULL;
+int (*_MP_decode_payload)(int type, const void *data, int len, void *out, int capacity) = NULL;
+
+// loss/latency shim for testing the UDP channel, see MP_set_udp_simulation()
+typedef struct _MPSimDatagram {
+    double send_at;
+    SOCKET sock;
+    struct sockaddr_in addr;
+    int len;
+    char data[MP_MAX_DATAGRAM];
+} _MPSimDatagram;
+
+double _MP_sim_loss = 0;
+double _MP_sim_latency = 0;
+double _MP_sim_jitter = 0;
+_MPSimDatagram *_MP_sim_queue = NULL;
+int _MP_sim_count = 0;
+unsigned int _MP_rng_state = 0; // own rng so the game's rand() sequence isn't touched from this thread
+
+// #PLATFORM
+
+void MP_mutex_init(MPMutex *mutex) {
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE); // same as a CRITICAL_SECTION
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+#endif
+}
+
+void MP_mutex_lock(MPMutex *mutex) {
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void MP_mutex_unlock(MPMutex *mutex) {
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+void MP_semaphore_init(MPSemaphore *sem, int count) {
+#ifdef _WIN32
+    *sem = CreateSemaphore(NULL, count, 0x7FFFFFFF, NULL);
+#else
+    sem_init(sem, 0, count);
+#endif
+}
+
+void MP_semaphore_wait(MPSemaphore *sem) {
+#ifdef _WIN32
+    WaitForSingleObject(*sem, INFINITE);
+#else
+    while (sem_wait(sem) != 0 && errno == EINTR) {}
+#endif
+}
+
+void MP_semaphore_post(MPSemaphore *sem, int count) {
+#ifdef _WIN32
+    ReleaseSemaphore(*sem, count, NULL);
+#else
+    for (int i = 0; i < count; i++) sem_post(sem);
+#endif
+}
+
+void MP_thread_start(MP_THREAD_RETURN (*func)(void *), void *data) {
+#ifdef _WIN32
+    HANDLE h = CreateThread(NULL, 0, func, data, 0, NULL);
+    CloseHandle(h);
+#else
+    pthread_t thread;
+    pthread_create(&thread, NULL, func, data);
+    pthread_detach(thread);
+#endif
+}
+
+void MP_sleep(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+bool _MP_set_nonblocking(SOCKET sock) {
+#ifdef _WIN32
+    unsigned long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags != -1 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+double MP_time() {
+#ifdef _WIN32
+    static LARGE_INTEGER freq = {0};
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// CPU time the calling thread has used so far, in seconds. Diff two on the same thread to see what something cost.
+// On Windows it only moves in scheduler ticks (~15 ms), fine over a few seconds but not for a single call.
+double MP_thread_cpu_time() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+
+    ULARGE_INTEGER k = {.LowPart = kernel.dwLowDateTime, .HighPart = kernel.dwHighDateTime};
+    ULARGE_INTEGER u = {.LowPart = user.dwLowDateTime, .HighPart = user.dwHighDateTime};
+    return (k.QuadPart + u.QuadPart) / 1e7; // 100 ns units
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// Same for the whole process, every thread together.
+double MP_process_cpu_time() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0;
+
+    ULARGE_INTEGER k = {.LowPart = kernel.dwLowDateTime, .HighPart = kernel.dwHighDateTime};
+    ULARGE_INTEGER u = {.LowPart = user.dwLowDateTime, .HighPart = user.dwHighDateTime};
+    return (k.QuadPart + u.QuadPart) / 1e7;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+void _MP_set_nodelay(SOCKET sock) {
+    int yes = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&yes, sizeof(yes)); // we only send small packets
+}
+
+#ifdef _WIN32
+// fd_set on windows is a count + an array, FD_SETSIZE is only 64 by default but select() reads fd_count entries
+typedef struct _MPFdSet {
+    unsigned int fd_count;
+    SOCKET fd_array[MP_MAX_CONNECTIONS + 3]; // + listen socket and the two UDP sockets
+} _MPFdSet;
+#endif
+
+bool _MP_wants_read(MPConnection *conn) {
+    return !conn->read_paused && !conn->queue_stalled;
+}
+
+// Tells the poller what we care about on this connection right now.
+void _MP_poller_update(MPConnection *conn) {
+#ifndef _WIN32
+    if (!conn->registered || _MP_epoll_fd == -1) return;
+
+    unsigned int events = (_MP_wants_read(conn) ? EPOLLIN : 0) | (conn->write_len > 0 ? EPOLLOUT : 0);
+    if (events == conn->polled_events) return;
+
+    struct epoll_event event = {0};
+    event.events = events;
+    event.data.u32 = conn - MP_connections;
+    epoll_ctl(_MP_epoll_fd, EPOLL_CTL_MOD, conn->socket, &event);
+    conn->polled_events = events;
+#endif
+    // the select() backend rebuilds its sets every loop
+}
+
+void _MP_poller_add(SOCKET sock, unsigned int data) {
+#ifndef _WIN32
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.u32 = data;
+    epoll_ctl(_MP_epoll_fd, EPOLL_CTL_ADD, sock, &event);
+#endif
+}
+
+void _MP_poller_remove(SOCKET sock) {
+#ifndef _WIN32
+    struct epoll_event event = {0};
+    epoll_ctl(_MP_epoll_fd, EPOLL_CTL_DEL, sock, &event);
+#endif
+}
+
+// #PLATFORM END
+
+// #WIRE
+
+int _MP_put_varint(unsigned char *out, unsigned long long value) {
+    int size = 0;
+    while (value >= 0x80) {
+        out[size++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[size++] = value;
+    return size;
+}
+
+// Returns how many bytes it took, 0 if 'available' ran out first, -1 if it's longer than max_bytes.
+int _MP_get_varint(const unsigned char *in, int available, int max_bytes, unsigned long long *value) {
+    *value = 0;
+    for (int i = 0; i < max_bytes; i++) {
+        if (i >= available) return 0;
+
+        *value |= (unsigned long long)(in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80)) return i + 1;
+    }
+    return -1;
+}
+
+void _MP_put_u16(unsigned char *out, unsigned int value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+}
+
+void _MP_put_u32(unsigned char *out, unsigned int value) {
+    _MP_put_u16(out, value & 0xFFFF);
+    _MP_put_u16(out + 2, value >> 16);
+}
+
+unsigned int _MP_get_u16(const unsigned char *in) {
+    return in[0] | (in[1] << 8);
+}
+
+unsigned int _MP_get_u32(const unsigned char *in) {
+    return _MP_get_u16(in) | (_MP_get_u16(in + 2) << 16);
+}
+
+// Writes the packet header, at most MP_MAX_HEADER_SIZE bytes: varint of (zigzag(type) << 1 | is_broadcast),
+// then varint of len. Usually 2 bytes. Returns the size.
+int MP_encode_header(MPPacket packet, unsigned char *out) {
+    unsigned long long zigzag = ((unsigned int)packet.type << 1) ^ (unsigned int)(packet.type >> 31);
+
+    int size = _MP_put_varint(out, (zigzag << 1) | (packet.is_broadcast ? 1 : 0));
+    size += _MP_put_varint(out + size, (unsigned int)packet.len);
+    return size;
+}
+
+// Returns the header size, 0 if it isn't all there yet, or -1 if it can't be a header we wrote.
+int MP_decode_header(const unsigned char *in, int available, MPPacket *packet) {
+    unsigned long long first, len;
+
+    int first_size = _MP_get_varint(in, available, 5, &first);
+    if (first_size <= 0) return first_size;
+
+    int len_size = _MP_get_varint(in + first_size, available - first_size, 5, &len);
+    if (len_size <= 0) return len_size;
 
+    if (first >> 33 || len > MP_MAX_PAYLOAD) return -1;
 
-DWORD WINAPI _MPClient_handle_received_data(void *data);
+    unsigned int zigzag = (unsigned int)(first >> 1);
+    packet->type = (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+    packet->is_broadcast = first & 1;
+    packet->len = (int)len;
+
+    return first_size + len_size;
+}
+
+void _MP_write_datagram_header(unsigned char *out, MPDatagramHeader header) {
+    _MP_put_u32(out, header.token);
+    _MP_put_u16(out + 4, header.seq);
+    _MP_put_u16(out + 6, header.ack);
+    _MP_put_u32(out + 8, header.ack_bits);
+    out[12] = header.has_ack ? 1 : 0;
+}
+
+MPDatagramHeader _MP_read_datagram_header(const unsigned char *in) {
+    MPDatagramHeader header;
+    header.token = _MP_get_u32(in);
+    header.seq = _MP_get_u16(in + 4);
+    header.ack = _MP_get_u16(in + 6);
+    header.ack_bits = _MP_get_u32(in + 8);
+    header.has_ack = in[12] != 0;
+    return header;
+}
+
+// Bumps one of the drop counters in _MP_io_stats from anywhere.
+void _MP_count_drop(long long *counter) {
+    MP_mutex_lock(&MP_lock);
+    (*counter)++;
+    MP_mutex_unlock(&MP_lock);
+}
+
+// Runs the payload codec on an outgoing packet, 'scratch' holds the result. Returns false if it should be dropped.
+bool _MP_encode(MPPacket *packet, void **data, void *scratch) {
+    if (_MP_encode_payload == NULL || packet->type < 0) return true;
+
+    int len = _MP_encode_payload(packet->type, *data, packet->len, scratch, MP_MAX_PAYLOAD);
+    if (len < 0) {
+        fprintf(stderr, "Couldn't encode packet type %d. \n", packet->type);
+        _MP_count_drop(&_MP_io_stats.codec_errors);
+        return false;
+    }
+
+    packet->len = len;
+    *data = scratch;
+    return true;
+}
+
+// Same for incoming packets, before they go to the callbacks.
+bool _MP_decode(MPPacket *packet, void **data, void *scratch) {
+    if (_MP_decode_payload == NULL || packet->type < 0) return true;
+
+    int len = _MP_decode_payload(packet->type, *data, packet->len, scratch, MP_DEFAULT_BUFFER_SIZE);
+    if (len < 0) {
+        fprintf(stderr, "Couldn't decode packet type %d. \n", packet->type);
+        _MP_count_drop(&_MP_io_stats.codec_errors);
+        return false;
+    }
+
+    packet->len = len;
+    *data = scratch;
+    return true;
+}
+
+// #WIRE END
 
 void MP_print_hex(const unsigned char *buf, int len) {
     for (int i = 0; i < len; i++) {
@@ -41,145 +586,978 @@ void MP_print_hex(const unsigned char *buf, int len) {
     printf("\n");
 }
 
-void MPClient_send(MPPacket packet, void *data) {
+MPConnection *_MP_find_connection(SOCKET sock) {
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        if (MP_connections[i].in_use && MP_connections[i].socket == sock) return &MP_connections[i];
+    }
+    return NULL;
+}
+
+MPConnection *_MP_alloc_connection(SOCKET sock, bool is_client) {
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        MPConnection *conn = &MP_connections[i];
+        if (conn->in_use) continue;
+
+        conn->socket = sock;
+        conn->in_use = true;
+        conn->is_client = is_client;
+        conn->registered = false;
+        conn->read_paused = false;
+        conn->queue_stalled = false;
+        conn->write_len = 0;
+        conn->udp = (MPUdpState){0};
+        conn->udp_out_len = 0;
+        conn->udp_out_count = 0;
+        conn->last_ping = MP_time();
+        conn->ping_rtt = 0;
+        conn->packets_sent = conn->bytes_sent = conn->packets_received = conn->bytes_received = 0;
+#ifndef _WIN32
+        conn->polled_events = EPOLLIN; // what _MP_poller_add() registers with
+#endif
+
+        if (conn->read_ring.data == NULL) conn->read_ring = RB_new(MP_READ_BUFFER_SIZE, MP_DEFAULT_BUFFER_SIZE);
+        RB_clear(&conn->read_ring);
+
+        return conn;
+    }
+    return NULL;
+}
+
+// Must be called with MP_lock held.
+MPConnection *_MP_client_connection() {
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        if (MP_connections[i].in_use && MP_connections[i].is_client) return &MP_connections[i];
+    }
+    return NULL;
+}
+
+// Sends as much of the write buffer as the socket takes. Returns false if the connection died.
+bool _MP_flush(MPConnection *conn) {
+    int sent_total = 0;
+
+    while (sent_total < conn->write_len) {
+        int sent = send(conn->socket, conn->write_buf + sent_total, conn->write_len - sent_total, MP_SEND_FLAGS);
+        _MP_io_stats.send_calls++;
+        if (sent == SOCKET_ERROR) {
+            if (MP_WOULD_BLOCK()) break;
+            return false;
+        }
+        if (sent == 0) break;
+        sent_total += sent;
+        _MP_io_stats.bytes_sent += sent;
+    }
 
-    if (packet.len > MP_DEFAULT_BUFFER_SIZE - sizeof(packet)) {
+    if (sent_total > 0) {
+        memmove(conn->write_buf, conn->write_buf + sent_total, conn->write_len - sent_total);
+        conn->write_len -= sent_total;
+    }
+
+    if (conn->read_paused && conn->write_len <= MP_WRITE_LOW_WATER) {
+        conn->read_paused = false;
+    }
+
+    _MP_poller_update(conn);
+
+    return true;
+}
+
+// Must be called with MP_lock held.
+void _MP_count_sent(MPConnection *conn, MPPacket packet, int size) {
+    _MP_io_stats.packets_sent++;
+    conn->packets_sent++;
+    conn->bytes_sent += size;
+
+    if (packet.type >= 0 && packet.type < MP_STATS_TYPES) {
+        _MP_io_stats.types[packet.type].packets_sent++;
+        _MP_io_stats.types[packet.type].bytes_sent += size;
+    }
+}
+
+// 'packet' as it came off the wire, before decoding.
+void _MP_count_received(MPConnection *conn, MPPacket packet) {
+    unsigned char header[MP_MAX_HEADER_SIZE];
+    int size = MP_encode_header(packet, header) + packet.len;
+
+    MP_mutex_lock(&MP_lock);
+
+    _MP_io_stats.packets_received++;
+    conn->packets_received++;
+    conn->bytes_received += size;
+
+    if (packet.type >= 0 && packet.type < MP_STATS_TYPES) {
+        _MP_io_stats.types[packet.type].packets_received++;
+        _MP_io_stats.types[packet.type].bytes_received += size;
+    }
+
+    MP_mutex_unlock(&MP_lock);
+}
+
+// Queues a packet on a connection and tries to send it right away (or at the end of the batch). Must be called with MP_lock held.
+bool _MP_queue_packet(MPConnection *conn, MPPacket packet, void *data) {
+    unsigned char header[MP_MAX_HEADER_SIZE];
+    int header_size = MP_encode_header(packet, header);
+    int size = header_size + packet.len;
+
+    if (conn->write_len + size > MP_WRITE_HARD_CAP) {
+        fprintf(stderr, "Connection fell %d bytes behind, dropping it. \n", conn->write_len);
+        _MP_io_stats.dropped_backlog++;
+        shutdown(conn->socket, SD_BOTH); // the I/O thread sees the error and cleans up
+        return false;
+    }
+
+    if (conn->write_len + size > conn->write_cap) {
+        int new_cap = conn->write_cap == 0 ? MP_DEFAULT_BUFFER_SIZE * 4 : conn->write_cap;
+        while (new_cap < conn->write_len + size) new_cap *= 2;
+        conn->write_buf = realloc(conn->write_buf, new_cap);
+        conn->write_cap = new_cap;
+    }
+
+    _MP_count_sent(conn, packet, size);
+
+    memcpy(conn->write_buf + conn->write_len, header, header_size);
+    if (packet.len > 0) memcpy(conn->write_buf + conn->write_len + header_size, data, packet.len);
+    conn->write_len += size;
+
+    if (conn->write_len > MP_WRITE_HIGH_WATER && !conn->read_paused) {
+        conn->read_paused = true; // backpressure, don't take more work from someone who isn't reading ours
+    }
+
+    if (conn->registered && _MP_batch_depth == 0) _MP_flush(conn);
+
+    return true;
+}
+
+bool _MP_check_packet(MPPacket packet) {
+    if (packet.len > MP_MAX_PAYLOAD) {
         fprintf(stderr, "Packet too big to send! Packet size: %d \n", packet.len);
-        //exit(-1);
-        return; // what could ever go wrong?
+        _MP_count_drop(&_MP_io_stats.oversized);
+        return false;
     }
     if (packet.len < 0) {
         fprintf(stderr, "Invalid packet size! Packet size: %d \n", packet.len);
-        //exit(-1);
-        return; // :)
+        return false;
     }
+    return true;
+}
 
-    char buff[MP_DEFAULT_BUFFER_SIZE] = {0};
+// #UDP
 
-    memcpy(buff, &packet, sizeof(packet));
-    memcpy(buff + sizeof(packet), data, packet.len);
+unsigned int _MP_random() {
+    if (_MP_rng_state == 0) _MP_rng_state = (unsigned int)(MP_time() * 1000003) | 1;
 
-    send(MPClient_socket, buff, packet.len + sizeof(MPPacket), 0);
+    // xorshift32
+    _MP_rng_state ^= _MP_rng_state << 13;
+    _MP_rng_state ^= _MP_rng_state >> 17;
+    _MP_rng_state ^= _MP_rng_state << 5;
+    return _MP_rng_state;
 }
 
-void MP_init(const int port) {
-    MP_SERVER_PORT = port;
-    WSADATA data;
-    WSAStartup(MAKEWORD(2, 2), &data);
+double _MP_random01() {
+    return (_MP_random() & 0xFFFFFF) / (double)0x1000000;
 }
 
-DWORD WINAPI _MPClient(void *ip) {
-    MP_SERVER_IP = (char *)ip;
+// Wrap-around aware 'a is newer than b'.
+bool _MP_seq_newer(unsigned short a, unsigned short b) {
+    return (short)(a - b) > 0;
+}
+
+// Every datagram goes through here so the shim can drop or hold it. Must be called with MP_lock held.
+void _MP_udp_transmit(SOCKET sock, struct sockaddr_in *addr, const char *buf, int len) {
+    if (_MP_sim_loss > 0 && _MP_random01() < _MP_sim_loss) return;
+
+    if (_MP_sim_queue != NULL && (_MP_sim_latency > 0 || _MP_sim_jitter > 0)) {
+        if (_MP_sim_count >= MP_SIM_QUEUE_SIZE) return; // counts as lost
+
+        _MPSimDatagram *d = &_MP_sim_queue[_MP_sim_count++];
+        d->send_at = MP_time() + _MP_sim_latency + _MP_sim_jitter * _MP_random01();
+        d->sock = sock;
+        d->addr = *addr;
+        d->len = len;
+        memcpy(d->data, buf, len);
+        return;
+    }
+
+    sendto(sock, buf, len, 0, (struct sockaddr *)addr, sizeof(*addr));
+    _MP_io_stats.send_calls++;
+    _MP_io_stats.bytes_sent += len;
+}
+
+bool _MP_simulating() {
+    return _MP_sim_loss > 0 || (_MP_sim_queue != NULL && (_MP_sim_latency > 0 || _MP_sim_jitter > 0));
+}
+
+// Sends whatever the shim held back long enough. Jitter reorders on purpose. Must be called with MP_lock held.
+void _MP_flush_simulated() {
+    double now = MP_time();
+
+    for (int i = 0; i < _MP_sim_count; i++) {
+        _MPSimDatagram *d = &_MP_sim_queue[i];
+        if (d->send_at > now) continue;
+
+        sendto(d->sock, d->data, d->len, 0, (struct sockaddr *)&d->addr, sizeof(d->addr));
+        _MP_io_stats.send_calls++;
+        _MP_io_stats.bytes_sent += d->len;
 
-    MPClient_socket = socket(AF_INET, SOCK_STREAM, 0);
+        *d = _MP_sim_queue[--_MP_sim_count];
+        i--;
+    }
+}
 
-    struct sockaddr_in server_addr = {
-        .sin_port = htons(MP_SERVER_PORT),
-        .sin_family = AF_INET,
-        .sin_addr.S_un.S_addr = inet_addr(MP_SERVER_IP)
+// Puts the header on the datagram being filled and records it for acks. Must be called with MP_lock held.
+void _MP_finish_datagram(MPConnection *conn) {
+    MPUdpState *udp = &conn->udp;
+
+    MPDatagramHeader header = {
+        .token = udp->token,
+        .seq = udp->local_seq++,
+        .ack = udp->remote_seq,
+        .ack_bits = udp->ack_bits,
+        .has_ack = udp->has_remote_seq
     };
 
-    int res = connect(MPClient_socket, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    int idx = header.seq % MP_SENT_HISTORY;
+    udp->sent_seqs[idx] = header.seq;
+    udp->sent_times[idx] = MP_time();
+    udp->acked[idx] = false;
 
-    if (res != SOCKET_ERROR) {
-        printf("Client connected. \n");
-    } else {
-        printf("error %d \n", res);
-        exit(1);
+    _MP_write_datagram_header((unsigned char *)conn->udp_out + conn->udp_out_count * MP_MAX_DATAGRAM, header);
+
+    conn->udp_out_lens[conn->udp_out_count++] = MP_DATAGRAM_HEADER_SIZE + conn->udp_out_len;
+    conn->udp_out_len = 0;
+}
+
+// Sends the finished datagrams one by one. Must be called with MP_lock held.
+void _MP_transmit_datagrams(MPConnection *conn) {
+    SOCKET sock = conn->is_client ? MPClient_udp_socket : MPServer_udp_socket;
+
+    for (int i = 0; i < conn->udp_out_count; i++) {
+        _MP_udp_transmit(sock, &conn->udp.addr, conn->udp_out + i * MP_MAX_DATAGRAM, conn->udp_out_lens[i]);
     }
-    
-    HANDLE h = CreateThread(NULL, 0, _MPClient_handle_received_data, (PVOID)MPClient_socket, 0, NULL);
-    CloseHandle(h);
+    conn->udp_out_count = 0;
 }
 
-void MPClient(char *ip) {
-    HANDLE h = CreateThread(NULL, 0, _MPClient, ip, 0, NULL);
-    CloseHandle(h);
+// Returns the seq of the datagram the packet goes out in. Outside of a batch that's right away, in a batch
+// packets are packed together up to MP_UDP_BATCH_SIZE per datagram. Must be called with MP_lock held.
+int _MP_send_datagram(MPConnection *conn, MPPacket packet, void *data) {
+    if (conn->udp_out == NULL) conn->udp_out = malloc(MP_MAX_DATAGRAM * MP_UDP_MAX_PENDING);
+
+    unsigned char header[MP_MAX_HEADER_SIZE];
+    int header_size = MP_encode_header(packet, header);
+    int size = header_size + packet.len;
+
+    if (conn->udp_out_len > 0 && conn->udp_out_len + size > MP_UDP_BATCH_SIZE) {
+        _MP_finish_datagram(conn);
+    }
+    if (conn->udp_out_count == MP_UDP_MAX_PENDING) {
+        _MP_transmit_datagrams(conn); // a lot for one batch, let some out early
+    }
+
+    char *dst = conn->udp_out + conn->udp_out_count * MP_MAX_DATAGRAM + MP_DATAGRAM_HEADER_SIZE + conn->udp_out_len;
+    memcpy(dst, header, header_size);
+    if (packet.len > 0) memcpy(dst + header_size, data, packet.len);
+    conn->udp_out_len += size;
+
+    _MP_count_sent(conn, packet, size);
+
+    int seq = conn->udp.local_seq;
+    if (_MP_batch_depth == 0) {
+        _MP_finish_datagram(conn);
+        _MP_transmit_datagrams(conn);
+    }
+
+    return seq;
+}
+
+void _MP_send_hello(MPConnection *conn) {
+    MPDatagramHeader header = {.token = conn->udp.token};
+    MPPacket packet = {.type = MP_PACKET_UDP_HELLO, .len = 0};
+
+    unsigned char buf[MP_DATAGRAM_HEADER_SIZE + MP_MAX_HEADER_SIZE];
+    _MP_write_datagram_header(buf, header);
+    int size = MP_DATAGRAM_HEADER_SIZE + MP_encode_header(packet, buf + MP_DATAGRAM_HEADER_SIZE);
+
+    _MP_udp_transmit(MPClient_udp_socket, &conn->udp.addr, (char *)buf, size);
+    conn->udp.last_hello = MP_time();
+}
+
+// Marks what the other side says it got. Fills 'acked' with the seqs that weren't acked before,
+// returns how many. Must be called with MP_lock held.
+int _MP_process_acks(MPConnection *conn, MPDatagramHeader *header, unsigned short *acked) {
+    if (!header->has_ack) return 0;
+
+    MPUdpState *udp = &conn->udp;
+    int count = 0;
+    double now = MP_time();
+
+    for (int i = -1; i < 32; i++) {
+        if (i >= 0 && !(header->ack_bits & (1u << i))) continue;
+
+        unsigned short seq = header->ack - 1 - i;
+        int idx = seq % MP_SENT_HISTORY;
+        if (udp->sent_seqs[idx] != seq || udp->acked[idx]) continue;
+
+        udp->acked[idx] = true;
+        acked[count++] = seq;
+
+        double sample = now - udp->sent_times[idx];
+        udp->rtt = udp->rtt == 0 ? sample : udp->rtt * 0.9 + sample * 0.1;
+    }
+
+    return count;
 }
 
+// Records that we got 'seq' and acks it. Returns false for a duplicate, or one too far behind to go in ack_bits:
+// those aren't acked and their data is dropped. Anything else is delivered, even if it's older than the newest,
+// the handlers know what's stale for them. Must be called with MP_lock held.
+bool _MP_receive_seq(MPUdpState *udp, unsigned short seq) {
+    if (!udp->has_remote_seq) {
+        udp->has_remote_seq = true;
+        udp->remote_seq = seq;
+        udp->ack_bits = 0;
+        return true;
+    }
 
-int MP_full_recv(SOCKET sock, char *buf, int size) {
-    int bytes_received = recv(sock, buf, size, 0);
+    if (_MP_seq_newer(seq, udp->remote_seq)) {
+        int diff = (unsigned short)(seq - udp->remote_seq);
 
-    MPPacket *first_packet = buf;
+        if (diff > 32) udp->ack_bits = 0;
+        else if (diff == 32) udp->ack_bits = 1u << 31;
+        else udp->ack_bits = (udp->ack_bits << diff) | (1u << (diff - 1));
 
-    if (first_packet->len > MP_DEFAULT_BUFFER_SIZE) {
-        printf("Corrupted first packet \n");
-        commit_sudoku();
+        udp->remote_seq = seq;
+        return true;
     }
 
-    int total_bytes_received = bytes_received;
+    int back = (unsigned short)(udp->remote_seq - seq);
+    if (back < 1 || back > 32) return false;
+    if (udp->ack_bits & (1u << (back - 1))) return false;
+
+    udp->ack_bits |= 1u << (back - 1);
+    return true;
+}
 
+// Server side: which client a datagram is from. Must be called with MP_lock held.
+MPConnection *_MP_find_udp_connection(unsigned int token) {
+    if (token == 0) return NULL;
 
-    MPPacket *current_packet = first_packet;
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        MPConnection *conn = &MP_connections[i];
+        if (conn->in_use && !conn->is_client && conn->registered && conn->udp.token == token) return conn;
+    }
+    return NULL;
+}
 
-    int buffer_end = (int)buf + total_bytes_received;
+// Every packet in a datagram has to have a sane length and together they have to fill it exactly.
+bool _MP_check_datagram_frames(const char *frames, int len) {
+    int offset = 0;
 
-    int bytes_left = total_bytes_received;
+    while (offset < len) {
+        MPPacket packet;
+        int header_size = MP_decode_header((const unsigned char *)frames + offset, len - offset, &packet);
+        if (header_size <= 0 || packet.len > len - offset - header_size) return false;
 
-    while ((char *)current_packet + sizeof(MPPacket) + current_packet->len < (char *)buffer_end) {
-        current_packet = (char *)current_packet + current_packet->len + sizeof(MPPacket);
+        offset += header_size + packet.len;
     }
 
-    while ((char *)current_packet + current_packet->len > (char *)buffer_end) {
-        int bytes = recv(sock, buf + total_bytes_received, first_packet->len - (total_bytes_received - sizeof(MPPacket)), 0);
-        total_bytes_received += bytes;
-        buffer_end = (int)buf + total_bytes_received;
+    return true;
+}
 
-        while ((char *)current_packet + sizeof(MPPacket) + current_packet->len < (char *)buffer_end) {
-            current_packet = (char *)current_packet + current_packet->len + sizeof(MPPacket);
+// Hands a received packet to its callback, or queues it for MP_dispatch_messages(). Callers check
+// _MP_has_queue_room() first, TCP ones stop reading instead of getting here with a full queue.
+void _MP_deliver(bool for_client, SOCKET socket, MPPacket packet, void *data) {
+    if (!_MP_queue_messages) {
+        if (for_client) {
+            if (_MP_client_handle_recv != NULL) _MP_client_handle_recv(packet, data);
+        } else {
+            if (_MP_server_handle_recv != NULL) _MP_server_handle_recv(socket, packet, data);
         }
+        return;
     }
 
+    MPMessage message;
+    message.socket = socket;
+    message.for_client = for_client;
+    message.packet = packet;
+    if (packet.len > 0) memcpy(message.data, data, packet.len);
+
+    int size = offsetof(MPMessage, data) + packet.len;
 
-    return total_bytes_received;
+    if (!MQ_push(&_MP_messages, &message, size)) {
+        fprintf(stderr, "Message queue full, dropped a packet of type %d. \n", packet.type);
+        _MP_count_drop(&_MP_io_stats.dropped_queue_full);
+    }
 }
 
-DWORD WINAPI _MPClient_handle_received_data(void *data) {
-    SOCKET client_socket = (SOCKET)data;
+// Only the I/O thread pushes to _MP_messages, so this stays true until it delivers something.
+bool _MP_has_queue_room() {
+    return !_MP_queue_messages || MQ_has_room(&_MP_messages);
+}
 
-    
-    
-    while (TRUE) {
-        
-        char receive_buffer[MP_DEFAULT_BUFFER_SIZE] = {0};
+void _MP_handle_datagrams(SOCKET sock) {
+    char buf[MP_MAX_DATAGRAM];
 
-        char *data_ptr = receive_buffer;
+    for (int reads = 0; reads < MP_UDP_MAX_READS; reads++) {
+        struct sockaddr_in from;
+        MPSocklen from_size = sizeof(from);
 
-        int bytes_received = MP_full_recv(client_socket, receive_buffer, MP_DEFAULT_BUFFER_SIZE);
+        int received = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_size);
+        if (received == SOCKET_ERROR) {
+            if (MP_WOULD_BLOCK()) return;
+            continue; // windows reports ICMP port unreachable here, nothing to do about it
+        }
 
-        if (bytes_received == SOCKET_ERROR) {
-            fprintf(stderr, "Received socket error. Disconnecting... \n");
-            shutdown(client_socket, SD_BOTH);
-            closesocket(client_socket);
-            exit(-1);
+        int header_size = MP_DATAGRAM_HEADER_SIZE;
+        if (received <= header_size) continue;
+        if (!_MP_check_datagram_frames(buf + header_size, received - header_size)) continue;
+
+        MPDatagramHeader header = _MP_read_datagram_header((unsigned char *)buf);
+        MPPacket packet; // the first one, a hello is always alone
+        MP_decode_header((unsigned char *)buf + header_size, received - header_size, &packet);
+
+        MP_mutex_lock(&MP_lock);
+
+        _MP_io_stats.recv_calls++;
+        _MP_io_stats.bytes_received += received;
+
+        MPConnection *conn;
+        if (sock == MPServer_udp_socket) {
+            conn = _MP_find_udp_connection(header.token);
+        } else {
+            conn = _MP_client_connection();
+            if (conn != NULL && (conn->udp.token == 0 || conn->udp.token != header.token)) conn = NULL;
+        }
+
+        if (conn == NULL) {
+            MP_mutex_unlock(&MP_lock);
+            continue;
+        }
+
+        if (packet.type == MP_PACKET_UDP_HELLO) {
+            if (!conn->is_client && !conn->udp.ready) {
+                conn->udp.addr = from;
+                conn->udp.ready = true;
+                _MP_queue_packet(conn, (MPPacket){.type = MP_PACKET_UDP_READY, .len = 0}, NULL);
+            }
+            MP_mutex_unlock(&MP_lock);
+            continue;
+        }
+
+        bool from_peer = conn->udp.ready &&
+            conn->udp.addr.sin_addr.s_addr == from.sin_addr.s_addr && conn->udp.addr.sin_port == from.sin_port;
+
+        if (!from_peer) {
+            MP_mutex_unlock(&MP_lock);
+            continue;
+        }
+
+        unsigned short acked[33];
+        int acked_count = _MP_process_acks(conn, &header, acked);
+
+        // the game is behind, as good as lost. Not marking it received keeps it from getting acked
+        bool deliver = _MP_has_queue_room();
+        if (!deliver) _MP_io_stats.dropped_queue_full++;
+        else if (!(deliver = _MP_receive_seq(&conn->udp, header.seq))) _MP_io_stats.dropped_stale++;
+
+        SOCKET conn_socket = conn->socket;
+        bool is_client = conn->is_client;
+
+        MP_mutex_unlock(&MP_lock);
+
+        if (_MP_on_datagram_acked != NULL) {
+            for (int i = 0; i < acked_count; i++) _MP_on_datagram_acked(conn_socket, acked[i]);
+        }
+
+        if (!deliver) continue;
+
+        double scratch[MP_DEFAULT_BUFFER_SIZE / sizeof(double)]; // aligned for whatever the decoder puts there
+
+        for (int offset = header_size; offset < received; offset += packet.len) {
+            offset += MP_decode_header((unsigned char *)buf + offset, received - offset, &packet);
+            if (packet.type < 0) continue;
+
+            _MP_count_received(conn, packet);
+
+            void *data = buf + offset;
+            if (!_MP_decode(&packet, &data, scratch)) continue;
+
+            _MP_deliver(is_client, conn_socket, packet, data);
         }
+    }
+}
 
+// Hellos and the shim's delayed datagrams, called every I/O loop.
+void _MP_udp_tick() {
+    MP_mutex_lock(&MP_lock);
 
-        while (data_ptr < receive_buffer + bytes_received) {
+    _MP_flush_simulated();
+
+    MPConnection *conn = _MP_client_connection();
+    if (conn != NULL && conn->registered && conn->udp.token != 0 && !conn->udp.ready &&
+        MP_time() - conn->udp.last_hello >= MP_UDP_HELLO_INTERVAL) {
+        _MP_send_hello(conn);
+    }
+
+    MP_mutex_unlock(&MP_lock);
+}
 
-            int data_ptr_num = (int)data_ptr;
-            int receive_buffer_num = (int)receive_buffer;
-            int diff = data_ptr_num - receive_buffer_num;
+// Internal packets that came over TCP.
+void _MP_handle_internal_packet(MPConnection *conn, MPPacket packet, void *data) {
+    MP_mutex_lock(&MP_lock);
 
-            MPPacket *packet = data_ptr;
-            
-            
-            // process packet from server...
-            if (_MP_client_handle_recv != NULL) {
-                _MP_client_handle_recv(*packet, data_ptr + sizeof(MPPacket));
+    if (packet.type == MP_PACKET_PING) {
+        // straight back even mid-batch, or the rtt would include however long the game's tick takes
+        if (_MP_queue_packet(conn, (MPPacket){.type = MP_PACKET_PONG, .len = packet.len}, data)) _MP_flush(conn);
+    } else if (packet.type == MP_PACKET_PONG && packet.len == sizeof(double)) {
+        double sent_at;
+        memcpy(&sent_at, data, sizeof(sent_at));
+
+        double sample = MP_time() - sent_at;
+        conn->ping_rtt = conn->ping_rtt == 0 ? sample : conn->ping_rtt * 0.9 + sample * 0.1;
+    }
+
+    if (!conn->is_client) {
+        MP_mutex_unlock(&MP_lock);
+        return;
+    }
+
+    if (packet.type == MP_PACKET_UDP_TOKEN && packet.len == 4 && MPClient_udp_socket != INVALID_SOCKET) {
+        conn->udp.token = _MP_get_u32(data);
+        conn->udp.addr = _MP_server_udp_addr;
+        conn->udp.ready = false;
+        _MP_send_hello(conn);
+    } else if (packet.type == MP_PACKET_UDP_READY && conn->udp.token != 0) {
+        conn->udp.ready = true;
+    }
+
+    MP_mutex_unlock(&MP_lock);
+}
+
+// Pings every connection once per MP_PING_INTERVAL, called every I/O loop.
+void _MP_ping_tick() {
+    double now = MP_time();
+
+    MP_mutex_lock(&MP_lock);
+
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        MPConnection *conn = &MP_connections[i];
+        if (!conn->in_use || !conn->registered || now - conn->last_ping < MP_PING_INTERVAL) continue;
+
+        conn->last_ping = now;
+        if (_MP_queue_packet(conn, (MPPacket){.type = MP_PACKET_PING, .len = sizeof(now)}, &now)) _MP_flush(conn);
+    }
+
+    MP_mutex_unlock(&MP_lock);
+}
+
+SOCKET _MP_open_udp_socket(int port) {
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    _MP_set_nonblocking(sock);
+    return sock;
+}
+
+// #UDP END
+
+void MPClient_send(MPPacket packet, void *data) {
+    char wire[MP_MAX_PAYLOAD];
+    if (!_MP_encode(&packet, &data, wire) || !_MP_check_packet(packet)) return;
+
+    MP_mutex_lock(&MP_lock);
+
+    MPConnection *conn = _MP_client_connection();
+
+    if (conn != NULL) _MP_queue_packet(conn, packet, data); // before we're connected this just buffers
+
+    MP_mutex_unlock(&MP_lock);
+}
+
+void MPServer_send(MPPacket packet, void *data) {
+    char wire[MP_MAX_PAYLOAD];
+    if (!_MP_encode(&packet, &data, wire) || !_MP_check_packet(packet)) return;
+
+    MP_mutex_lock(&MP_lock);
+
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        MPConnection *conn = &MP_connections[i];
+        if (!conn->in_use || conn->is_client || !conn->registered) continue;
+
+        _MP_queue_packet(conn, packet, data);
+    }
+
+    MP_mutex_unlock(&MP_lock);
+}
+
+void MPServer_send_to(MPPacket packet, void *data, SOCKET target) {
+    char wire[MP_MAX_PAYLOAD];
+    if (!_MP_encode(&packet, &data, wire) || !_MP_check_packet(packet)) return;
+
+    MP_mutex_lock(&MP_lock);
+
+    MPConnection *conn = _MP_find_connection(target);
+    if (conn != NULL && !conn->is_client) _MP_queue_packet(conn, packet, data);
+
+    MP_mutex_unlock(&MP_lock);
+}
+
+// MPServer_send_to() for several clients, encodes once.
+void MPServer_send_to_group(MPPacket packet, void *data, const SOCKET *targets, int count) {
+    char wire[MP_MAX_PAYLOAD];
+    if (!_MP_encode(&packet, &data, wire) || !_MP_check_packet(packet)) return;
+
+    MP_mutex_lock(&MP_lock);
+
+    for (int i = 0; i < count; i++) {
+        MPConnection *conn = _MP_find_connection(targets[i]);
+        if (conn != NULL && !conn->is_client) _MP_queue_packet(conn, packet, data);
+    }
+
+    MP_mutex_unlock(&MP_lock);
+}
+
+// Unreliable sends: for state that gets resent all the time anyway. Goes over UDP once the channel is up
+// (over TCP before that, or if MP_udp_enabled is false), can be lost or dropped for being older than
+// something the other side already got. Returns the datagram's seq for _MP_on_datagram_acked, or -1 if it went over TCP.
+int MPClient_send_unreliable(MPPacket packet, void *data) {
+    char wire[MP_MAX_PAYLOAD];
+    if (!_MP_encode(&packet, &data, wire) || !_MP_check_packet(packet)) return -1;
+
+    MP_mutex_lock(&MP_lock);
+
+    int seq = -1;
+    MPConnection *conn = _MP_client_connection();
+
+    if (conn != NULL) {
+        if (MP_udp_enabled && conn->udp.ready) seq = _MP_send_datagram(conn, packet, data);
+        else _MP_queue_packet(conn, packet, data);
+    }
+
+    MP_mutex_unlock(&MP_lock);
+
+    return seq;
+}
+
+void MPServer_send_unreliable(MPPacket packet, void *data) {
+    char wire[MP_MAX_PAYLOAD];
+    if (!_MP_encode(&packet, &data, wire) || !_MP_check_packet(packet)) return;
+
+    MP_mutex_lock(&MP_lock);
+
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        MPConnection *conn = &MP_connections[i];
+        if (!conn->in_use || conn->is_client || !conn->registered) continue;
+
+        if (MP_udp_enabled && conn->udp.ready) _MP_send_datagram(conn, packet, data);
+        else _MP_queue_packet(conn, packet, data);
+    }
+
+    MP_mutex_unlock(&MP_lock);
+}
+
+int MPServer_send_unreliable_to(MPPacket packet, void *data, SOCKET target) {
+    char wire[MP_MAX_PAYLOAD];
+    if (!_MP_encode(&packet, &data, wire) || !_MP_check_packet(packet)) return -1;
+
+    MP_mutex_lock(&MP_lock);
+
+    int seq = -1;
+    MPConnection *conn = _MP_find_connection(target);
+
+    if (conn != NULL && !conn->is_client) {
+        if (MP_udp_enabled && conn->udp.ready) seq = _MP_send_datagram(conn, packet, data);
+        else _MP_queue_packet(conn, packet, data);
+    }
+
+    MP_mutex_unlock(&MP_lock);
+
+    return seq;
+}
+
+// MPServer_send_unreliable_to() for several clients, encodes once.
+void MPServer_send_unreliable_to_group(MPPacket packet, void *data, const SOCKET *targets, int count) {
+    char wire[MP_MAX_PAYLOAD];
+    if (!_MP_encode(&packet, &data, wire) || !_MP_check_packet(packet)) return;
+
+    MP_mutex_lock(&MP_lock);
+
+    for (int i = 0; i < count; i++) {
+        MPConnection *conn = _MP_find_connection(targets[i]);
+        if (conn == NULL || conn->is_client) continue;
+
+        if (MP_udp_enabled && conn->udp.ready) _MP_send_datagram(conn, packet, data);
+        else _MP_queue_packet(conn, packet, data);
+    }
+
+    MP_mutex_unlock(&MP_lock);
+}
+
+bool MPClient_udp_ready() {
+    MP_mutex_lock(&MP_lock);
+    MPConnection *conn = _MP_client_connection();
+    bool ready = conn != NULL && conn->udp.ready;
+    MP_mutex_unlock(&MP_lock);
+
+    return ready;
+}
+
+// Smoothed round trip of the client's UDP channel in seconds, 0 until something was acked.
+double MPClient_rtt() {
+    MP_mutex_lock(&MP_lock);
+    MPConnection *conn = _MP_client_connection();
+    double rtt = conn != NULL ? conn->udp.rtt : 0;
+    MP_mutex_unlock(&MP_lock);
+
+    return rtt;
+}
+
+// Smoothed round trip to one of our clients in seconds: its UDP channel's if it has one, the TCP pings' if not.
+// 0 until something was measured.
+double MPServer_rtt(SOCKET client) {
+    MP_mutex_lock(&MP_lock);
+    MPConnection *conn = _MP_find_connection(client);
+    double rtt = 0;
+    if (conn != NULL && !conn->is_client) rtt = conn->udp.rtt > 0 ? conn->udp.rtt : conn->ping_rtt;
+    MP_mutex_unlock(&MP_lock);
+
+    return rtt;
+}
+
+// Drops 'loss' (0 - 1) of outgoing datagrams and delays the rest by latency + up to jitter ms.
+// Only touches UDP, TCP is left alone. All zeros turns it off.
+void MP_set_udp_simulation(double loss, int latency_ms, int jitter_ms) {
+    MP_mutex_lock(&MP_lock);
+
+    if (_MP_sim_queue == NULL && (latency_ms > 0 || jitter_ms > 0)) {
+        _MP_sim_queue = malloc(sizeof(_MPSimDatagram) * MP_SIM_QUEUE_SIZE);
+    }
+
+    _MP_sim_loss = loss;
+    _MP_sim_latency = latency_ms / 1000.0;
+    _MP_sim_jitter = jitter_ms / 1000.0;
+
+    MP_mutex_unlock(&MP_lock);
+}
+
+// Sends every connection's pending datagrams, with sendmmsg() that's one call per socket.
+// Must be called with MP_lock held.
+void _MP_send_pending_datagrams() {
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        MPConnection *conn = &MP_connections[i];
+        if (conn->in_use && conn->udp_out_len > 0) _MP_finish_datagram(conn);
+    }
+
+#ifdef MP_HAVE_SENDMMSG
+    if (!_MP_simulating()) {
+        static struct mmsghdr msgs[MP_MAX_CONNECTIONS * MP_UDP_MAX_PENDING];
+        static struct iovec iovs[MP_MAX_CONNECTIONS * MP_UDP_MAX_PENDING];
+        SOCKET socks[2] = {MPServer_udp_socket, MPClient_udp_socket};
+
+        for (int s = 0; s < 2; s++) {
+            if (socks[s] == INVALID_SOCKET) continue;
+
+            int count = 0;
+            for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+                MPConnection *conn = &MP_connections[i];
+                if (!conn->in_use || conn->udp_out_count == 0) continue;
+                if ((conn->is_client ? MPClient_udp_socket : MPServer_udp_socket) != socks[s]) continue;
+
+                for (int j = 0; j < conn->udp_out_count; j++) {
+                    iovs[count].iov_base = conn->udp_out + j * MP_MAX_DATAGRAM;
+                    iovs[count].iov_len = conn->udp_out_lens[j];
+                    msgs[count] = (struct mmsghdr){0};
+                    msgs[count].msg_hdr.msg_name = &conn->udp.addr;
+                    msgs[count].msg_hdr.msg_namelen = sizeof(conn->udp.addr);
+                    msgs[count].msg_hdr.msg_iov = &iovs[count];
+                    msgs[count].msg_hdr.msg_iovlen = 1;
+                    count++;
+                }
+                conn->udp_out_count = 0;
             }
 
-            if (packet->len > MP_DEFAULT_BUFFER_SIZE) {
-                printf("Packet length bigger than 1024! \n");
-                commit_sudoku();
+            int done = 0;
+            while (done < count) {
+                int sent = sendmmsg(socks[s], msgs + done, count - done, 0);
+                _MP_io_stats.send_calls++;
+                if (sent <= 0) break; // socket buffer full, it's unreliable anyway
+
+                for (int i = done; i < done + sent; i++) _MP_io_stats.bytes_sent += msgs[i].msg_len;
+                done += sent;
             }
+        }
+        return;
+    }
+#endif
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        if (MP_connections[i].in_use) _MP_transmit_datagrams(&MP_connections[i]);
+    }
+}
+
+// See the top of the file. Batches nest, and each thread has its own: the tick thread's batch doesn't hold back the
+// I/O thread's sends or the other way around. A send from outside a batch takes whatever another thread's batch
+// queued on the same connection along with it, which only means that goes out early.
+void MP_begin_batch() {
+    _MP_batch_depth++;
+}
+
+void MP_end_batch() {
+    if (_MP_batch_depth == 0 || --_MP_batch_depth > 0) return;
+
+    MP_mutex_lock(&MP_lock);
+
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        MPConnection *conn = &MP_connections[i];
+        if (!conn->in_use || !conn->registered || conn->write_len == 0) continue;
+
+        // a dead connection gets noticed and cleaned up by the I/O thread
+        if (!_MP_flush(conn)) shutdown(conn->socket, SD_BOTH);
+    }
+    _MP_send_pending_datagrams();
+
+    MP_mutex_unlock(&MP_lock);
+}
 
-            data_ptr += sizeof(MPPacket) + packet->len;
+// From now on received packets are queued instead of handed to the callbacks on the I/O thread,
+// MP_dispatch_messages() calls them. Call it before connecting.
+void MP_queue_messages() {
+    if (_MP_queue_messages) return;
+
+    _MP_messages = MQ_new(MP_MESSAGE_QUEUE_SIZE, sizeof(MPMessage));
+    _MP_queue_messages = true;
+}
+
+// Calls the recv callbacks for everything queued so far, in the order it arrived. Only one thread may call this.
+// Returns how many packets were handled.
+int MP_dispatch_messages() {
+    if (!_MP_queue_messages) return 0;
+
+    int handled = 0;
+    MPMessage *message;
+
+    // only what's there now, so a callback that gets answered instantly can't keep us here
+    while (handled < MP_MESSAGE_QUEUE_SIZE && (message = MQ_front(&_MP_messages, NULL)) != NULL) {
+        if (message->for_client) {
+            if (_MP_client_handle_recv != NULL) _MP_client_handle_recv(message->packet, message->data);
+        } else {
+            if (_MP_server_handle_recv != NULL) _MP_server_handle_recv(message->socket, message->packet, message->data);
         }
 
-        
+        MQ_pop(&_MP_messages);
+        handled++;
+    }
+
+    return handled;
+}
+
+// Totals since MP_init(), diff two of these to get a rate. The queue depth is only right on the thread that
+// calls MP_dispatch_messages().
+MPIOStats MP_get_io_stats() {
+    MP_mutex_lock(&MP_lock);
+    MPIOStats stats = _MP_io_stats;
+    MP_mutex_unlock(&MP_lock);
+
+    stats.message_queue_depth = _MP_queue_messages ? MQ_count(&_MP_messages) : 0;
+
+    return stats;
+}
+
+// Fills 'out' with every open connection, returns how many.
+int MP_get_connection_stats(MPConnectionStats *out, int capacity) {
+    int count = 0;
+
+    MP_mutex_lock(&MP_lock);
+
+    for (int i = 0; i < MP_MAX_CONNECTIONS && count < capacity; i++) {
+        MPConnection *conn = &MP_connections[i];
+        if (!conn->in_use || !conn->registered) continue;
+
+        out[count++] = (MPConnectionStats){
+            .socket = conn->socket,
+            .is_client = conn->is_client,
+            .rtt = conn->ping_rtt,
+            .udp_rtt = conn->udp.rtt,
+            .write_queued = conn->write_len,
+            .packets_sent = conn->packets_sent,
+            .bytes_sent = conn->bytes_sent,
+            .packets_received = conn->packets_received,
+            .bytes_received = conn->bytes_received
+        };
     }
+
+    MP_mutex_unlock(&MP_lock);
+
+    return count;
+}
+
+void _MP_write_json_counts(FILE *file, long long packets, long long bytes) {
+    fprintf(file, "{\"packets\":%lld,\"bytes\":%lld}", packets, bytes);
+}
+
+// Appends one JSON object with everything above to 'file', on its own line. Totals, like MP_get_io_stats(), so
+// whatever reads it diffs lines for rates. 'type_names' names the packet types (NULL for numbers).
+void MP_write_stats_json(FILE *file, const char *const *type_names, int type_names_count) {
+    MPIOStats stats = MP_get_io_stats();
+
+    static MPConnectionStats connections[MP_MAX_CONNECTIONS];
+    int connections_amount = MP_get_connection_stats(connections, MP_MAX_CONNECTIONS);
+
+    fprintf(file, "{\"time\":%.3f,\"send_calls\":%lld,\"recv_calls\":%lld,\"sent\":", MP_time(), stats.send_calls, stats.recv_calls);
+    _MP_write_json_counts(file, stats.packets_sent, stats.bytes_sent);
+    fprintf(file, ",\"received\":");
+    _MP_write_json_counts(file, stats.packets_received, stats.bytes_received);
+
+    fprintf(file, ",\"queue_depth\":%d,\"dropped\":{\"queue_full\":%lld,\"stale\":%lld,\"codec\":%lld,"
+        "\"oversized\":%lld,\"corrupt\":%lld,\"backlog\":%lld}",
+        stats.message_queue_depth, stats.dropped_queue_full, stats.dropped_stale, stats.codec_errors,
+        stats.oversized, stats.corrupt_frames, stats.dropped_backlog);
+
+    fprintf(file, ",\"types\":{");
+    bool first = true;
+    for (int i = 0; i < MP_STATS_TYPES; i++) {
+        MPTypeStats *type = &stats.types[i];
+        if (type->packets_sent == 0 && type->packets_received == 0) continue;
+
+        if (i < type_names_count && type_names != NULL && type_names[i] != NULL) {
+            fprintf(file, "%s\"%s\":{\"sent\":", first ? "" : ",", type_names[i]);
+        } else {
+            fprintf(file, "%s\"%d\":{\"sent\":", first ? "" : ",", i);
+        }
+        _MP_write_json_counts(file, type->packets_sent, type->bytes_sent);
+        fprintf(file, ",\"received\":");
+        _MP_write_json_counts(file, type->packets_received, type->bytes_received);
+        fprintf(file, "}");
+        first = false;
+    }
+
+    fprintf(file, "},\"connections\":[");
+    for (int i = 0; i < connections_amount; i++) {
+        MPConnectionStats *conn = &connections[i];
+
+        fprintf(file, "%s{\"socket\":%lld,\"is_client\":%s,\"rtt_ms\":%.2f,\"udp_rtt_ms\":%.2f,\"write_queued\":%d,\"sent\":",
+            i == 0 ? "" : ",", (long long)conn->socket, conn->is_client ? "true" : "false",
+            conn->rtt * 1000, conn->udp_rtt * 1000, conn->write_queued);
+        _MP_write_json_counts(file, conn->packets_sent, conn->bytes_sent);
+        fprintf(file, ",\"received\":");
+        _MP_write_json_counts(file, conn->packets_received, conn->bytes_received);
+        fprintf(file, "}");
+    }
+
+    fprintf(file, "]}\n");
+    fflush(file);
+}
+
+// From any thread: shuts the client's socket down, the I/O thread sees it close and cleans up like for any disconnect.
+void MPServer_kick(SOCKET client) {
+    shutdown(client, SD_BOTH);
 }
 
 void _MPServer_disconnect_client(SOCKET client_socket) {
@@ -191,133 +1569,500 @@ void _MPServer_disconnect_client(SOCKET client_socket) {
         }
     }
 
+    if (idx == -1) return;
+
     SOCKET temp = MP_clients[idx];
     MP_clients[idx] = MP_clients[MP_clients_amount - 1];
     MP_clients[MP_clients_amount - 1] = temp;
     MP_clients_amount--;
 }
 
-DWORD WINAPI _MPServer_handle_client(void *data) {
-    SOCKET client_socket = (SOCKET)data;
+void _MP_close_connection(MPConnection *conn) {
+    MP_mutex_lock(&MP_lock);
+
+    SOCKET sock = conn->socket;
+    bool was_client = conn->is_client;
+    bool was_registered = conn->registered;
+
+    if (conn->registered) _MP_poller_remove(sock);
+    shutdown(sock, SD_BOTH);
+    closesocket(sock);
+
+    if (!was_client) _MPServer_disconnect_client(sock);
+
+    free(conn->write_buf);
+    conn->write_buf = NULL;
+    conn->write_cap = 0;
+    conn->write_len = 0;
+    RB_clear(&conn->read_ring);
+    conn->udp = (MPUdpState){0};
+    conn->udp_out_len = 0;
+    conn->udp_out_count = 0;
+    conn->in_use = false;
+    conn->registered = false;
+
+    MP_mutex_unlock(&MP_lock);
 
-    
-    MP_clients[MP_clients_amount++] = client_socket;
-   
-    
-    if (_MP_on_client_connected != NULL) {
-        _MP_on_client_connected(client_socket);
+    if (was_client) {
+        if (MP_running) {
+            fprintf(stderr, "Lost connection to the server. \n");
+            exit(-1);
+        }
+    } else if (was_registered && _MP_on_client_disconnected != NULL) {
+        _MP_on_client_disconnected(sock);
     }
+}
 
+#define MP_DEFRAME_CORRUPT -1
 
+// Hands every complete frame in 'rb' to on_frame, as pointers into the ring (nothing is copied unless a frame
+// wraps around the end). on_frame returns false to stop early, that frame stays in the ring.
+// Returns how many frames were handled, or MP_DEFRAME_CORRUPT if a header has an impossible length.
+int MP_deframe(RingBuffer *rb, bool (*on_frame)(MPPacket packet, void *data, void *ctx), void *ctx) {
+    int frames = 0;
 
-    while (TRUE) {
-        
-        char receive_buffer[MP_DEFAULT_BUFFER_SIZE] = {0};
-        
-        int bytes_received = MP_full_recv(client_socket, receive_buffer, MP_DEFAULT_BUFFER_SIZE);
+    while (RB_length(rb) > 0) {
+        int available = RB_length(rb) < MP_MAX_HEADER_SIZE ? RB_length(rb) : MP_MAX_HEADER_SIZE;
+        unsigned char *start = RB_peek(rb, available);
 
-        if (bytes_received <= 0) {
-            if (bytes_received == SOCKET_ERROR) {
-                printf("Received socket error. Attempting to disconnect client. \n");
-            } else {
-                printf("Client disconnected! \n");
-            }
-            _MPServer_disconnect_client(client_socket);
+        MPPacket packet;
+        int header_size = MP_decode_header(start, available, &packet);
 
-            if (_MP_on_client_disconnected != NULL) {
-                _MP_on_client_disconnected(client_socket);
-            }
+        if (header_size == 0) break; // header hasn't all arrived yet
+        if (header_size < 0) {
+            fprintf(stderr, "Corrupted packet header. \n");
+            return MP_DEFRAME_CORRUPT;
+        }
+
+        int size = header_size + packet.len;
+        if (RB_length(rb) < size) break; // rest of it hasn't arrived yet
+
+        char *frame = RB_peek(rb, size);
 
-            return 0;
+        if (!on_frame(packet, frame + header_size, ctx)) break;
+
+        RB_consume(rb, size);
+        frames++;
+    }
+
+    return frames;
+}
+
+bool _MP_on_frame(MPPacket packet, void *data, void *ctx) {
+    MPConnection *conn = ctx;
+
+    if (packet.type < 0) {
+        _MP_handle_internal_packet(conn, packet, data);
+        return conn->in_use;
+    }
+
+    // the game is behind, leave it in the ring and stop reading until MP_dispatch_messages() made room.
+    // The socket's buffer fills up and TCP slows the sender down for us
+    if (!_MP_has_queue_room()) {
+        conn->queue_stalled = true;
+        return false;
+    }
+
+    _MP_count_received(conn, packet);
+
+    double scratch[MP_DEFAULT_BUFFER_SIZE / sizeof(double)];
+    if (!_MP_decode(&packet, &data, scratch)) return true;
+
+    _MP_deliver(conn->is_client, conn->socket, packet, data);
+
+    return conn->in_use;
+}
+
+// Deframes what stalled connections have waiting once there's room again, and goes back to reading them.
+void _MP_resume_stalled() {
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        MPConnection *conn = &MP_connections[i];
+        if (!conn->in_use || !conn->queue_stalled || !_MP_has_queue_room()) continue;
+
+        conn->queue_stalled = false;
+
+        if (MP_deframe(&conn->read_ring, _MP_on_frame, conn) == MP_DEFRAME_CORRUPT) {
+            fprintf(stderr, "Dropping connection. \n");
+            _MP_count_drop(&_MP_io_stats.corrupt_frames);
+            _MP_close_connection(conn);
+            continue;
         }
+        if (conn->in_use) _MP_poller_update(conn);
+    }
+}
 
-        char *data_ptr = receive_buffer;
+// Returns false if the connection died.
+bool _MP_handle_readable(MPConnection *conn) {
+    while (_MP_wants_read(conn)) {
+        // recv straight into the ring
+        int space;
+        char *dst = RB_write_ptr(&conn->read_ring, &space);
 
-        while (data_ptr < receive_buffer + bytes_received) {
-            MPPacket *packet = data_ptr;
+        int received = recv(conn->socket, dst, space, 0);
 
-            // process packet from server...
-            if (_MP_client_handle_recv != NULL) {
-                _MP_server_handle_recv(client_socket, *packet, data_ptr + sizeof(MPPacket));
-            }
+        MP_mutex_lock(&MP_lock);
+        _MP_io_stats.recv_calls++;
+        if (received > 0) _MP_io_stats.bytes_received += received;
+        MP_mutex_unlock(&MP_lock);
+
+        if (received == 0) return false; // orderly shutdown
+        if (received == SOCKET_ERROR) {
+            if (MP_WOULD_BLOCK()) return true;
+            return false;
+        }
+
+        RB_commit_write(&conn->read_ring, received);
 
-            data_ptr += sizeof(MPPacket) + packet->len;
+        if (MP_deframe(&conn->read_ring, _MP_on_frame, conn) == MP_DEFRAME_CORRUPT) {
+            fprintf(stderr, "Dropping connection. \n");
+            _MP_count_drop(&_MP_io_stats.corrupt_frames);
+            return false;
         }
+        if (!conn->in_use) return true;
+        if (conn->queue_stalled) break;
+
+        if (received < space) return true; // drained the socket (or hit the end of the ring, the next loop gets the rest)
     }
+
+    _MP_poller_update(conn);
+    return true;
 }
 
-void MPServer_send(MPPacket packet, void *data) {
+void _MP_handle_accept() {
+    while (true) {
+        struct sockaddr_in client_addr;
+        MPSocklen client_addr_size = sizeof(client_addr);
 
-    if (packet.len > MP_DEFAULT_BUFFER_SIZE - sizeof(packet)) {
-        fprintf(stderr, "Packet too big to send! Packet size: %d \n", packet.len);
-        exit(-1);
+        SOCKET client_socket = accept(MPServer_socket, (struct sockaddr *)&client_addr, &client_addr_size);
+        if (client_socket == INVALID_SOCKET) return; // nothing more to accept (or an error, either way try again later)
+
+        _MP_set_nonblocking(client_socket);
+        _MP_set_nodelay(client_socket);
+
+        MP_mutex_lock(&MP_lock);
+
+        if (MP_clients_amount >= MP_MAX_CLIENTS) {
+            MP_mutex_unlock(&MP_lock);
+            printf("Server full, refusing client. \n");
+            closesocket(client_socket);
+            continue;
+        }
+
+        MPConnection *conn = _MP_alloc_connection(client_socket, false);
+        MP_clients[MP_clients_amount++] = client_socket;
+        conn->registered = true;
+        _MP_poller_add(client_socket, conn - MP_connections);
+
+        if (MPServer_udp_socket != INVALID_SOCKET) {
+            // not a secret, just tells datagrams apart. Can't be 0 and has to be unique
+            unsigned int token;
+            do {
+                token = _MP_random();
+            } while (token == 0 || _MP_find_udp_connection(token) != NULL);
+
+            conn->udp.token = token;
+
+            unsigned char token_data[4];
+            _MP_put_u32(token_data, token);
+            _MP_queue_packet(conn, (MPPacket){.type = MP_PACKET_UDP_TOKEN, .len = 4}, token_data);
+        }
+
+        MP_mutex_unlock(&MP_lock);
+
+        if (_MP_on_client_connected != NULL) {
+            _MP_on_client_connected(client_socket);
+        }
     }
-    if (packet.len < 0) {
-        fprintf(stderr, "Negative packet size! Packet size: %d \n", packet.len);
-        exit(-1);
+}
+
+#define _MP_LISTEN_DATA 0xFFFFFFFF
+#define _MP_SERVER_UDP_DATA 0xFFFFFFFE
+#define _MP_CLIENT_UDP_DATA 0xFFFFFFFD
+
+void _MP_poll_once() {
+#ifdef _WIN32
+    _MPFdSet read_set = {0}, write_set = {0}, error_set = {0};
+
+    MP_mutex_lock(&MP_lock);
+    if (MPServer_socket != INVALID_SOCKET) {
+        read_set.fd_array[read_set.fd_count++] = MPServer_socket;
+    }
+    if (MPServer_udp_socket != INVALID_SOCKET) {
+        read_set.fd_array[read_set.fd_count++] = MPServer_udp_socket;
+    }
+    if (MPClient_udp_socket != INVALID_SOCKET) {
+        read_set.fd_array[read_set.fd_count++] = MPClient_udp_socket;
     }
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        MPConnection *conn = &MP_connections[i];
+        if (!conn->in_use || !conn->registered) continue;
 
-    char buf[MP_DEFAULT_BUFFER_SIZE] = {0};
+        if (_MP_wants_read(conn)) read_set.fd_array[read_set.fd_count++] = conn->socket;
+        if (conn->write_len > 0) write_set.fd_array[write_set.fd_count++] = conn->socket;
+        error_set.fd_array[error_set.fd_count++] = conn->socket;
+    }
+    MP_mutex_unlock(&MP_lock);
+
+    if (read_set.fd_count + write_set.fd_count == 0) {
+        MP_sleep(MP_POLL_TIMEOUT_MS);
+        return;
+    }
 
-    memcpy(buf, &packet, sizeof(packet));
+    struct timeval timeout = {0, MP_POLL_TIMEOUT_MS * 1000};
+    int ready = select(0, (fd_set *)&read_set, (fd_set *)&write_set, (fd_set *)&error_set, &timeout);
+    if (ready <= 0) return;
 
-    memcpy(buf + sizeof(packet), data, packet.len);
+    MP_begin_batch(); // relays from the callbacks go out together
 
-    for (int i = 0; i < MP_clients_amount; i++) {
-        send(MP_clients[i], buf, packet.len + sizeof(MPPacket), 0);
+    // select() leaves only the ready sockets in each set
+    for (unsigned int i = 0; i < error_set.fd_count; i++) {
+        MPConnection *conn = _MP_find_connection(error_set.fd_array[i]);
+        if (conn != NULL) _MP_close_connection(conn);
+    }
+    for (unsigned int i = 0; i < write_set.fd_count; i++) {
+        MPConnection *conn = _MP_find_connection(write_set.fd_array[i]);
+        if (conn == NULL) continue;
+
+        MP_mutex_lock(&MP_lock);
+        bool alive = _MP_flush(conn);
+        MP_mutex_unlock(&MP_lock);
+
+        if (!alive) _MP_close_connection(conn);
+    }
+    for (unsigned int i = 0; i < read_set.fd_count; i++) {
+        SOCKET sock = read_set.fd_array[i];
+
+        if (sock == MPServer_socket) {
+            _MP_handle_accept();
+            continue;
+        }
+        if (sock == MPServer_udp_socket || sock == MPClient_udp_socket) {
+            _MP_handle_datagrams(sock);
+            continue;
+        }
+
+        MPConnection *conn = _MP_find_connection(sock);
+        if (conn == NULL) continue;
+
+        if (!_MP_handle_readable(conn) && conn->in_use) _MP_close_connection(conn);
+    }
+
+    MP_end_batch();
+#else
+    struct epoll_event events[64];
+
+    int ready = epoll_wait(_MP_epoll_fd, events, 64, MP_POLL_TIMEOUT_MS);
+    if (ready <= 0) return;
+
+    MP_begin_batch(); // relays from the callbacks go out together
+
+    for (int i = 0; i < ready; i++) {
+        if (events[i].data.u32 == _MP_LISTEN_DATA) {
+            _MP_handle_accept();
+            continue;
+        }
+        if (events[i].data.u32 == _MP_SERVER_UDP_DATA) {
+            _MP_handle_datagrams(MPServer_udp_socket);
+            continue;
+        }
+        if (events[i].data.u32 == _MP_CLIENT_UDP_DATA) {
+            _MP_handle_datagrams(MPClient_udp_socket);
+            continue;
+        }
+
+        MPConnection *conn = &MP_connections[events[i].data.u32];
+        if (!conn->in_use) continue;
+
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            // still read whatever is left, then close
+            _MP_handle_readable(conn);
+            if (conn->in_use) _MP_close_connection(conn);
+            continue;
+        }
+
+        if (events[i].events & EPOLLOUT) {
+            MP_mutex_lock(&MP_lock);
+            bool alive = _MP_flush(conn);
+            MP_mutex_unlock(&MP_lock);
+
+            if (!alive) {
+                _MP_close_connection(conn);
+                continue;
+            }
+        }
+
+        if (events[i].events & EPOLLIN) {
+            if (!_MP_handle_readable(conn) && conn->in_use) _MP_close_connection(conn);
+        }
     }
+
+    MP_end_batch();
+#endif
 }
 
-void MPServer_send_to(MPPacket packet, void *data, SOCKET target) {
-    char buf[MP_DEFAULT_BUFFER_SIZE] = {0};
+MP_THREAD_RETURN _MP_io_thread(void *data) {
+    while (MP_running) {
+        _MP_poll_once();
+        _MP_resume_stalled();
+        _MP_udp_tick();
+        _MP_ping_tick();
+    }
+
+    // MP_close() was called
+    for (int i = 0; i < MP_MAX_CONNECTIONS; i++) {
+        if (MP_connections[i].in_use) _MP_close_connection(&MP_connections[i]);
+    }
+    if (MPServer_socket != INVALID_SOCKET) {
+        closesocket(MPServer_socket);
+        MPServer_socket = INVALID_SOCKET;
+    }
+    if (MPServer_udp_socket != INVALID_SOCKET) {
+        closesocket(MPServer_udp_socket);
+        MPServer_udp_socket = INVALID_SOCKET;
+    }
+    if (MPClient_udp_socket != INVALID_SOCKET) {
+        closesocket(MPClient_udp_socket);
+        MPClient_udp_socket = INVALID_SOCKET;
+    }
+
+    return 0;
+}
+
+void _MP_start_io_thread() {
+    MP_mutex_lock(&MP_lock);
+
+    if (!_MP_io_thread_started) {
+        _MP_io_thread_started = true;
+        MP_running = true;
+        MP_thread_start(_MP_io_thread, NULL);
+    }
 
-    memcpy(buf, &packet, sizeof(packet));
+    MP_mutex_unlock(&MP_lock);
+}
 
-    memcpy(buf + sizeof(packet), data, packet.len);
+void MP_init(const int port) {
+    MP_SERVER_PORT = port;
+#ifdef _WIN32
+    WSADATA data;
+    WSAStartup(MAKEWORD(2, 2), &data);
+#else
+    _MP_epoll_fd = epoll_create1(0);
+#endif
+    MP_mutex_init(&MP_lock);
+}
 
-    send(target, buf, packet.len + sizeof(MPPacket), 0);
-    
+// Stops the I/O thread and closes every connection. Safe to call from a callback.
+void MP_close() {
+    MP_running = false;
 }
 
-DWORD WINAPI _MPServer(void *data) {
-    SOCKET client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    int client_addr_size = sizeof(client_addr);
+MP_THREAD_RETURN _MPClient(void *ip) {
+    MP_SERVER_IP = (char *)ip;
+
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in server_addr = {0};
+    server_addr.sin_port = htons(MP_SERVER_PORT);
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = inet_addr(MP_SERVER_IP);
+
+    // connecting is the one thing that still blocks, it's only done once
+    int res = connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr));
+
+    if (res != SOCKET_ERROR) {
+        printf("Client connected. \n");
+    } else {
+        printf("error %d \n", res);
+        exit(1);
+    }
+
+    _MP_set_nonblocking(sock);
+    _MP_set_nodelay(sock);
+
+    // the server hands out a token over TCP first, so this has to exist before we start reading
+    SOCKET udp_sock = _MP_open_udp_socket(0);
+    if (udp_sock == INVALID_SOCKET) {
+        fprintf(stderr, "Couldn't open a UDP socket, everything goes over TCP. \n");
+    }
+
+    MP_mutex_lock(&MP_lock);
+
+    MPClient_socket = sock;
+    MPClient_udp_socket = udp_sock;
+    _MP_server_udp_addr = server_addr;
+    if (udp_sock != INVALID_SOCKET) _MP_poller_add(udp_sock, _MP_CLIENT_UDP_DATA);
+
+    MPConnection *conn = _MP_client_connection();
+    conn->socket = sock;
+    conn->registered = true;
+    _MP_poller_add(sock, conn - MP_connections);
+    _MP_flush(conn); // whatever was sent while we were connecting
+
+    MP_mutex_unlock(&MP_lock);
+
+    _MP_start_io_thread();
+
+    return 0;
+}
+
+void MPClient(char *ip) {
+    MP_mutex_lock(&MP_lock);
+    _MP_alloc_connection(INVALID_SOCKET, true); // so sends before the connect finishes get buffered
+    MP_mutex_unlock(&MP_lock);
+
+    MP_thread_start(_MPClient, ip);
+}
+
+MP_THREAD_RETURN _MPServer(void *data) {
+    struct sockaddr_in server_addr = {0};
 
     SOCKET server_socket = socket(AF_INET, SOCK_STREAM, 0);
     printf("Socket created.\n");
 
+    int yes = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+
     // Prepare the sockaddr_in structure
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(MP_SERVER_PORT);
 
     // Bind
-    bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
+        fprintf(stderr, "Couldn't bind port %d. \n", MP_SERVER_PORT);
+        closesocket(server_socket);
+        return 0;
+    }
     printf("Bind done.\n");
 
     listen(server_socket, SOMAXCONN);
+    _MP_set_nonblocking(server_socket);
     printf("Listening on port %d. \n", MP_SERVER_PORT);
 
-    MP_is_server = true;
+    SOCKET udp_socket = _MP_open_udp_socket(MP_SERVER_PORT); // same port number, UDP has its own
+    if (udp_socket == INVALID_SOCKET) {
+        fprintf(stderr, "Couldn't bind UDP port %d, everything goes over TCP. \n", MP_SERVER_PORT);
+    } else {
+        MPServer_udp_socket = udp_socket;
+        _MP_poller_add(udp_socket, _MP_SERVER_UDP_DATA);
+    }
 
-    while (TRUE) {
-        SOCKET client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_addr_size);
+    MPServer_socket = server_socket;
+    _MP_poller_add(server_socket, _MP_LISTEN_DATA);
 
-        HANDLE h = CreateThread(NULL, 0, _MPServer_handle_client, (PVOID)client_socket, 0, NULL);
-        CloseHandle(h);
-    }
+    _MP_start_io_thread();
 
-    printf("how did you even get here? im out. \n");
+    MP_is_server = true;
+
+    return 0;
 }
 
 void MPServer() {
-    HANDLE h = CreateThread(NULL, 0, _MPServer, NULL, 0, NULL);
-    CloseHandle(h);
+    MP_thread_start(_MPServer, NULL);
 }
 
 void MP_set_port(int port) {
     MP_SERVER_PORT = port;
 }
 
-#endif
\ No newline at end of file
+#endif
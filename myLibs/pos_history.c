@@ -0,0 +1,108 @@
+#ifndef POS_HISTORY_C
+#define POS_HISTORY_C
+
+#include <math.h>
+#include <stdbool.h>
+#include "vec2.c"
+
+// Where something was over its last PH_SIZE updates, so the server can look at things the way a client saw them a
+// moment ago (see match_check_shot() in server.c). Every update that comes in is a sample with the sender's time,
+// and looking back moves the time onto the sender's clock and interpolates between the two samples around it, the
+// same way the shooter's InterpBuffer did when it drew the target. Sampling once per tick instead would hold each
+// update until the next one and be up to a whole send interval off for anything moving.
+//
+//     PH_push(&history, packet.time, MP_time(), pos, height);  // on every update
+//     PH_rewind(&history, MP_time() - seconds, &pos, &height); // where it was that long ago
+//
+// The clock offset is the one of the least delayed update, like the InterpBuffer's, so jitter doesn't make it
+// look like the target stopped and jumped. Looking back further than it goes gives the oldest sample, looking past
+// the newest gives the newest.
+
+#define PH_SIZE 64 // updates, a few seconds at the usual send rates
+#define PH_OFFSET_CREEP 0.01 // how fast the clock offset follows updates that arrive later than the best one
+#define PH_RESET_TIME 1.0 // a clock jump bigger than this starts over
+
+typedef struct PosSample {
+    double time; // sender's clock
+    float x, y, height; // floats are plenty for the size of a level, and half the memory
+} PosSample;
+
+typedef struct PosHistory {
+    PosSample samples[PH_SIZE];
+    int newest;
+    int count;
+    double clock_offset; // our clock - sender's clock for the fastest recent update
+} PosHistory;
+
+void PH_clear(PosHistory *history) {
+    history->count = 0;
+}
+
+const PosSample *_PH_get(const PosHistory *history, int age) {
+    return &history->samples[(history->newest - age + PH_SIZE) % PH_SIZE];
+}
+
+// Returns false if it was older than the newest one and got dropped.
+bool PH_push(PosHistory *history, double sender_time, double local_time, v2 pos, double height) {
+    double offset = local_time - sender_time;
+
+    if (history->count > 0) {
+        double newest_time = _PH_get(history, 0)->time;
+        if (sender_time <= newest_time) {
+            // out of order, unless the sender restarted its clock
+            if (newest_time - sender_time < PH_RESET_TIME) return false;
+            PH_clear(history);
+        } else if (fabs(offset - history->clock_offset) > PH_RESET_TIME) {
+            PH_clear(history);
+        }
+    }
+
+    if (history->count == 0) {
+        history->clock_offset = offset;
+    } else if (offset < history->clock_offset) {
+        history->clock_offset = offset;
+    } else {
+        history->clock_offset += (offset - history->clock_offset) * PH_OFFSET_CREEP;
+    }
+
+    history->newest = (history->newest + 1) % PH_SIZE;
+    history->samples[history->newest] = (PosSample){sender_time, pos.x, pos.y, height};
+    if (history->count < PH_SIZE) history->count++;
+
+    return true;
+}
+
+// Where it was at 'time' on our clock. False if nothing was pushed yet.
+bool PH_rewind(const PosHistory *history, double time, v2 *pos, double *height) {
+    if (history->count == 0) return false;
+
+    time -= history->clock_offset;
+
+    const PosSample *sample = _PH_get(history, 0);
+    if (!(time < sample->time)) { // NaN too
+        *pos = (v2){sample->x, sample->y};
+        *height = sample->height;
+        return true;
+    }
+
+    for (int age = 1; age < history->count; age++) {
+        const PosSample *older = _PH_get(history, age);
+        if (older->time > time) continue;
+
+        const PosSample *newer = _PH_get(history, age - 1);
+        double dt = newer->time - older->time;
+        double w = dt > 0 ? (time - older->time) / dt : 1;
+
+        *pos = (v2){older->x + (newer->x - older->x) * w, older->y + (newer->y - older->y) * w};
+        *height = older->height + (newer->height - older->height) * w;
+        return true;
+    }
+
+    // further back than it goes
+    sample = _PH_get(history, history->count - 1);
+    *pos = (v2){sample->x, sample->y};
+    *height = sample->height;
+    return true;
+}
+
+#endif
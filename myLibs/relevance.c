@@ -0,0 +1,254 @@
+#ifndef RELEVANCE_C
+#define RELEVANCE_C
+
+#include <stdbool.h>
+#include "multiplayer.c"
+#include "vec2.c"
+
+// Server side interest management: which client needs to hear about what, going by where its player is.
+//
+// A layout is a grid of cells, each belonging to an area (a room), plus which areas can see into each other.
+// Every match has its own, a viewer is judged by the one it was last given.
+// Something in an area the client can see and within the near distance is REL_NEAR and gets every update.
+// Visible but further away, or close but behind a wall, is REL_FAR and gets REL_FAR_RATE updates a second.
+// Anything else doesn't get sent to that client until it moves or the client does. Rel_decide() says when something
+// just dropped out of view, so the client can be told to hide its copy instead of keeping it where it was last seen.
+//
+//     Rel_init(near_distance);                                         // once
+//     Rel_set_grid(&layout, origin, cell_size, cols, rows);            // when the level loads, then
+//     Rel_set_cell_area(&layout, col, row, area);                      // for the layout
+//     Rel_connect_areas(&layout, a, b);
+//     Rel_set_viewer(socket, &layout, pos);                            // whenever a client says where it is
+//     if (Rel_should_send(socket, key, pos, MP_time())) ...            // per thing per client
+//     switch (Rel_decide(socket, key, pos, MP_time())) ...             // the same, plus REL_HIDE
+//
+// Without a grid (or a layout) everything counts as visible and only the distance matters. A client that hasn't said
+// where it is yet gets everything.
+
+#define REL_MAX_AREAS 64
+#define REL_MAX_CELLS 4096
+#define REL_FAR_RATE 4.0 // updates per second for REL_FAR things
+#define REL_MAX_TRACKED MP_MAX_CLIENTS // keys per viewer we remember sending, for the rate limit and REL_HIDE
+
+typedef enum RelLevel {
+    REL_NONE,
+    REL_FAR,
+    REL_NEAR
+} RelLevel;
+
+typedef enum RelAction {
+    REL_SKIP, // not this time
+    REL_SEND,
+    REL_HIDE // it just went out of view, tell the client to hide it. REL_SKIP after that until it's back
+} RelAction;
+
+typedef struct RelSent {
+    int key;
+    double time;
+    bool hidden;
+} RelSent;
+
+typedef struct RelLayout {
+    v2 origin;
+    v2 cell_size;
+    int cols, rows; // 0 = no grid
+    signed char cells[REL_MAX_CELLS]; // area per cell, -1 = none
+    bool visible[REL_MAX_AREAS][REL_MAX_AREAS];
+} RelLayout;
+
+typedef struct RelViewer {
+    SOCKET socket;
+    const RelLayout *layout;
+    bool has_pos;
+    v2 pos;
+    int area;
+    int sent_count;
+    RelSent sent[REL_MAX_TRACKED]; // when each key was last let through
+} RelViewer;
+
+typedef struct RelStats {
+    long long near, far, none; // Rel_level() results
+    long long sent, skipped; // Rel_should_send() results
+} RelStats;
+
+RelViewer rel_viewers[MP_MAX_CLIENTS];
+int rel_viewers_amount = 0;
+RelStats rel_stats = {0};
+MPMutex rel_lock; // disconnects come in on the network thread
+
+double rel_near_distance = 1000;
+
+void Rel_init(double near_distance) {
+    MP_mutex_init(&rel_lock);
+    rel_near_distance = near_distance;
+}
+
+// Clears the layout. Returns false if the grid is too big, then there's no grid at all.
+// Don't change a layout viewers are using from another thread.
+bool Rel_set_grid(RelLayout *layout, v2 origin, v2 cell_size, int cols, int rows) {
+    layout->cols = 0;
+    layout->rows = 0;
+
+    if (cols <= 0 || rows <= 0 || cols * rows > REL_MAX_CELLS || cell_size.x <= 0 || cell_size.y <= 0) {
+        printf("Rel_set_grid: %d x %d cells is too many \n", cols, rows);
+        return false;
+    }
+
+    layout->origin = origin;
+    layout->cell_size = cell_size;
+    layout->cols = cols;
+    layout->rows = rows;
+    memset(layout->cells, -1, sizeof(layout->cells));
+    memset(layout->visible, 0, sizeof(layout->visible));
+
+    return true;
+}
+
+void Rel_set_cell_area(RelLayout *layout, int col, int row, int area) {
+    if (col < 0 || row < 0 || col >= layout->cols || row >= layout->rows || area < -1 || area >= REL_MAX_AREAS) return;
+    layout->cells[row * layout->cols + col] = area;
+}
+
+// 'a' and 'b' can see into each other, like two rooms with a doorway between them.
+void Rel_connect_areas(RelLayout *layout, int a, int b) {
+    if (a < 0 || b < 0 || a >= REL_MAX_AREAS || b >= REL_MAX_AREAS) return;
+    layout->visible[a][b] = true;
+    layout->visible[b][a] = true;
+}
+
+// -1 if there's no layout, it's off the grid or in a cell with no area.
+int Rel_area_at(const RelLayout *layout, v2 pos) {
+    if (layout == NULL || layout->cols == 0) return -1;
+
+    int col = (int)floor((pos.x - layout->origin.x) / layout->cell_size.x);
+    int row = (int)floor((pos.y - layout->origin.y) / layout->cell_size.y);
+    if (col < 0 || row < 0 || col >= layout->cols || row >= layout->rows) return -1;
+
+    return layout->cells[row * layout->cols + col];
+}
+
+RelViewer *_Rel_find_viewer(SOCKET socket) {
+    for (int i = 0; i < rel_viewers_amount; i++) {
+        if (rel_viewers[i].socket == socket) return &rel_viewers[i];
+    }
+    return NULL;
+}
+
+// 'layout' is the level the viewer is in, NULL for none.
+void Rel_set_viewer(SOCKET socket, const RelLayout *layout, v2 pos) {
+    MP_mutex_lock(&rel_lock);
+
+    RelViewer *viewer = _Rel_find_viewer(socket);
+    if (viewer == NULL && rel_viewers_amount < MP_MAX_CLIENTS) {
+        viewer = &rel_viewers[rel_viewers_amount++];
+        viewer->socket = socket;
+        viewer->sent_count = 0;
+    }
+
+    if (viewer != NULL) {
+        viewer->layout = layout;
+        viewer->pos = pos;
+        viewer->area = Rel_area_at(layout, pos);
+        viewer->has_pos = true;
+    }
+
+    MP_mutex_unlock(&rel_lock);
+}
+
+void Rel_remove_viewer(SOCKET socket) {
+    MP_mutex_lock(&rel_lock);
+
+    for (int i = 0; i < rel_viewers_amount; i++) {
+        if (rel_viewers[i].socket != socket) continue;
+
+        rel_viewers[i] = rel_viewers[--rel_viewers_amount];
+        break;
+    }
+
+    MP_mutex_unlock(&rel_lock);
+}
+
+RelLevel _Rel_level(RelViewer *viewer, v2 pos) {
+    if (viewer == NULL || !viewer->has_pos) return REL_NEAR;
+
+    bool near = v2_distance_squared(viewer->pos, pos) <= rel_near_distance * rel_near_distance;
+
+    // off the grid (or no area) on either side isn't something to hide things behind
+    int area = Rel_area_at(viewer->layout, pos);
+    bool visible = area == -1 || viewer->area == -1 || area == viewer->area || viewer->layout->visible[viewer->area][area];
+
+    if (near && visible) return REL_NEAR;
+    if (near || visible) return REL_FAR;
+    return REL_NONE;
+}
+
+RelLevel _Rel_count(RelLevel level) {
+    if (level == REL_NEAR) rel_stats.near++;
+    else if (level == REL_FAR) rel_stats.far++;
+    else rel_stats.none++;
+    return level;
+}
+
+RelLevel Rel_level(SOCKET viewer_socket, v2 pos) {
+    MP_mutex_lock(&rel_lock);
+    RelLevel level = _Rel_count(_Rel_level(_Rel_find_viewer(viewer_socket), pos));
+    MP_mutex_unlock(&rel_lock);
+    return level;
+}
+
+RelSent *_Rel_track(RelViewer *viewer, int key) {
+    for (int i = 0; i < viewer->sent_count; i++) {
+        if (viewer->sent[i].key == key) return &viewer->sent[i];
+    }
+
+    RelSent *sent;
+    if (viewer->sent_count < REL_MAX_TRACKED) {
+        sent = &viewer->sent[viewer->sent_count++];
+    } else {
+        // full, take over the one that's been quiet longest. Worst case it gets hidden twice
+        sent = &viewer->sent[0];
+        for (int i = 1; i < viewer->sent_count; i++) {
+            if (viewer->sent[i].time < sent->time) sent = &viewer->sent[i];
+        }
+    }
+    // not hidden, for all we know the client got it some other way (like a newcomer getting everyone's last position)
+    *sent = (RelSent){key, -1e9, false};
+    return sent;
+}
+
+// Rel_level() plus the rate limit for REL_FAR: what to do with this update of 'key' (at 'pos') for that client now.
+RelAction Rel_decide(SOCKET viewer_socket, int key, v2 pos, double now) {
+    MP_mutex_lock(&rel_lock);
+
+    RelViewer *viewer = _Rel_find_viewer(viewer_socket);
+    RelLevel level = _Rel_count(_Rel_level(viewer, pos));
+    RelAction action = REL_SKIP;
+
+    if (viewer == NULL) {
+        action = REL_SEND; // nothing to go by
+    } else {
+        RelSent *sent = _Rel_track(viewer, key);
+
+        if (level == REL_NONE) {
+            if (!sent->hidden) action = REL_HIDE;
+            sent->hidden = true;
+        } else if (level == REL_NEAR || now - sent->time >= 1.0 / REL_FAR_RATE) {
+            action = REL_SEND;
+            sent->time = now;
+            sent->hidden = false;
+        }
+    }
+
+    if (action == REL_SEND) rel_stats.sent++;
+    else rel_stats.skipped++;
+
+    MP_mutex_unlock(&rel_lock);
+    return action;
+}
+
+// Rel_decide() for things that don't get hidden.
+bool Rel_should_send(SOCKET viewer_socket, int key, v2 pos, double now) {
+    return Rel_decide(viewer_socket, key, pos, now) == REL_SEND;
+}
+
+#endif
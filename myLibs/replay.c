@@ -0,0 +1,267 @@
+#ifndef REPLAY_C
+#define REPLAY_C
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "multiplayer.c"
+
+// Records a session to a file and plays it back: the random state it started with, then for every tick the time it
+// ran at, the packets that came in during it and the input events in between. Fed back through the same handlers
+// on the same build, the game does the same thing again, just without waiting for anything.
+//
+//     Replay_record(path, header);             // before the first tick
+//     Replay_record_tick(time, paused);        // at the start of every tick
+//     Replay_record_packet(packet, data);      // every packet the game gets, as its handler gets it
+//     Replay_record_input(input);              // every input event
+//     Replay_stop();                           // fills in the tick count and the dungeon seed
+//
+//     Replay_open(path, &header);
+//     while ((record = Replay_peek()) != NULL) {
+//         ...
+//         Replay_advance();
+//     }
+//     Replay_close();
+//
+// After the header every record is a kind byte and a few little-endian fields:
+//
+//     tick     time (8, a double), paused (1)
+//     packet   type (2), length (2), broadcast (1), the payload as the handler got it
+//     input    event (1), a (2), b (2)
+//
+// Payloads are the decoded structs, so a file only plays back right on the build that recorded it.
+
+#define REPLAY_MAGIC "HCRP"
+#define REPLAY_VERSION 1
+#define REPLAY_HEADER_SIZE 28
+#define REPLAY_WRITE_BUFFER (64 * 1024)
+
+typedef enum ReplayRecordKind {
+    REPLAY_TICK = 1,
+    REPLAY_PACKET,
+    REPLAY_INPUT
+} ReplayRecordKind;
+
+typedef struct ReplayHeader {
+    int tick_rate;
+    int tick_count; // 0 if the recording didn't get to Replay_stop()
+    long long dungeon_seed; // -1 if the session didn't get one
+    unsigned long long rng_state; // of the gameplay stream, when the recording started
+} ReplayHeader;
+
+typedef struct ReplayInput {
+    unsigned char event; // up to the game
+    short a, b;
+} ReplayInput;
+
+typedef struct ReplayRecord {
+    ReplayRecordKind kind;
+    double time; // REPLAY_TICK
+    bool paused;
+    MPPacket packet; // REPLAY_PACKET
+    ReplayInput input; // REPLAY_INPUT
+    char data[MP_DEFAULT_BUFFER_SIZE];
+} ReplayRecord;
+
+FILE *_Replay_out = NULL;
+ReplayHeader _Replay_out_header;
+
+FILE *_Replay_in = NULL;
+ReplayRecord _Replay_next;
+bool _Replay_has_next = false;
+
+void _Replay_put(unsigned long long value, int bytes) {
+    for (int i = 0; i < bytes; i++) fputc((value >> (i * 8)) & 0xFF, _Replay_out);
+}
+
+// false at the end of the file
+bool _Replay_get(unsigned long long *value, int bytes) {
+    *value = 0;
+    for (int i = 0; i < bytes; i++) {
+        int c = fgetc(_Replay_in);
+        if (c == EOF) return false;
+        *value |= (unsigned long long)c << (i * 8);
+    }
+    return true;
+}
+
+void _Replay_write_header(ReplayHeader header) {
+    fwrite(REPLAY_MAGIC, 1, 4, _Replay_out);
+    _Replay_put(REPLAY_VERSION, 2);
+    _Replay_put(header.tick_rate, 2);
+    _Replay_put(header.tick_count, 4);
+    _Replay_put(header.dungeon_seed, 8);
+    _Replay_put(header.rng_state, 8);
+}
+
+bool Replay_is_recording() {
+    return _Replay_out != NULL;
+}
+
+bool Replay_record(const char *path, ReplayHeader header) {
+    if (_Replay_out != NULL) return false;
+
+    _Replay_out = fopen(path, "wb");
+    if (_Replay_out == NULL) {
+        fprintf(stderr, "Couldn't open %s for recording \n", path);
+        return false;
+    }
+    setvbuf(_Replay_out, NULL, _IOFBF, REPLAY_WRITE_BUFFER);
+
+    header.tick_count = 0;
+    _Replay_out_header = header;
+    _Replay_write_header(header);
+
+    return true;
+}
+
+// Goes in the header when the recording stops.
+void Replay_set_dungeon_seed(long long seed) {
+    _Replay_out_header.dungeon_seed = seed;
+}
+
+void Replay_record_tick(double time, bool paused) {
+    if (_Replay_out == NULL) return;
+
+    unsigned long long bits;
+    memcpy(&bits, &time, sizeof(bits));
+
+    fputc(REPLAY_TICK, _Replay_out);
+    _Replay_put(bits, 8);
+    fputc(paused, _Replay_out);
+
+    _Replay_out_header.tick_count++;
+}
+
+void Replay_record_packet(MPPacket packet, const void *data) {
+    if (_Replay_out == NULL) return;
+    if (packet.len < 0 || packet.len > MP_DEFAULT_BUFFER_SIZE) return;
+
+    fputc(REPLAY_PACKET, _Replay_out);
+    _Replay_put((unsigned short)packet.type, 2);
+    _Replay_put(packet.len, 2);
+    fputc(packet.is_broadcast, _Replay_out);
+    if (packet.len > 0) fwrite(data, 1, packet.len, _Replay_out);
+}
+
+void Replay_record_input(ReplayInput input) {
+    if (_Replay_out == NULL) return;
+
+    fputc(REPLAY_INPUT, _Replay_out);
+    fputc(input.event, _Replay_out);
+    _Replay_put((unsigned short)input.a, 2);
+    _Replay_put((unsigned short)input.b, 2);
+}
+
+void Replay_stop() {
+    if (_Replay_out == NULL) return;
+
+    fseek(_Replay_out, 0, SEEK_SET);
+    _Replay_write_header(_Replay_out_header);
+
+    fclose(_Replay_out);
+    _Replay_out = NULL;
+}
+
+// Reads the record after the current one into _Replay_next.
+void _Replay_read_next() {
+    _Replay_has_next = false;
+
+    int kind = fgetc(_Replay_in);
+    if (kind == EOF) return;
+
+    ReplayRecord *record = &_Replay_next;
+    record->kind = kind;
+    unsigned long long value;
+
+    switch (kind) {
+        case REPLAY_TICK:
+            if (!_Replay_get(&value, 8)) break;
+            memcpy(&record->time, &value, sizeof(value));
+            if (!_Replay_get(&value, 1)) break;
+            record->paused = value;
+            _Replay_has_next = true;
+            break;
+
+        case REPLAY_PACKET:
+            if (!_Replay_get(&value, 2)) break;
+            record->packet.type = (short)value;
+            if (!_Replay_get(&value, 2) || value > MP_DEFAULT_BUFFER_SIZE) break;
+            record->packet.len = value;
+            if (!_Replay_get(&value, 1)) break;
+            record->packet.is_broadcast = value;
+            if (fread(record->data, 1, record->packet.len, _Replay_in) != (size_t)record->packet.len) break;
+            _Replay_has_next = true;
+            break;
+
+        case REPLAY_INPUT:
+            if (!_Replay_get(&value, 1)) break;
+            record->input.event = value;
+            if (!_Replay_get(&value, 2)) break;
+            record->input.a = (short)value;
+            if (!_Replay_get(&value, 2)) break;
+            record->input.b = (short)value;
+            _Replay_has_next = true;
+            break;
+    }
+
+    if (!_Replay_has_next) fprintf(stderr, "Replay ends in a broken record, stopping there \n");
+}
+
+bool Replay_open(const char *path, ReplayHeader *header) {
+    if (_Replay_in != NULL) return false;
+
+    _Replay_in = fopen(path, "rb");
+    if (_Replay_in == NULL) {
+        fprintf(stderr, "Couldn't open %s \n", path);
+        return false;
+    }
+
+    char magic[4];
+    unsigned long long version, tick_rate, tick_count, dungeon_seed, rng_state;
+
+    if (fread(magic, 1, 4, _Replay_in) != 4 || memcmp(magic, REPLAY_MAGIC, 4) != 0
+        || !_Replay_get(&version, 2) || !_Replay_get(&tick_rate, 2) || !_Replay_get(&tick_count, 4)
+        || !_Replay_get(&dungeon_seed, 8) || !_Replay_get(&rng_state, 8)) {
+        fprintf(stderr, "%s isn't a replay \n", path);
+        fclose(_Replay_in);
+        _Replay_in = NULL;
+        return false;
+    }
+
+    if (version != REPLAY_VERSION) {
+        fprintf(stderr, "%s is replay version %d, this build reads %d \n", path, (int)version, REPLAY_VERSION);
+        fclose(_Replay_in);
+        _Replay_in = NULL;
+        return false;
+    }
+
+    *header = (ReplayHeader){
+        .tick_rate = tick_rate,
+        .tick_count = tick_count,
+        .dungeon_seed = (long long)dungeon_seed,
+        .rng_state = rng_state
+    };
+
+    _Replay_read_next();
+    return true;
+}
+
+// The next record, NULL at the end. Stays valid until Replay_advance().
+const ReplayRecord *Replay_peek() {
+    return _Replay_has_next ? &_Replay_next : NULL;
+}
+
+void Replay_advance() {
+    if (_Replay_in != NULL && _Replay_has_next) _Replay_read_next();
+}
+
+void Replay_close() {
+    if (_Replay_in == NULL) return;
+
+    fclose(_Replay_in);
+    _Replay_in = NULL;
+    _Replay_has_next = false;
+}
+
+#endif
@@ -7,6 +7,9 @@ typedef struct Thread {
     SDL_Thread *thread;
     void (*task)(void *);
     void *task_data;
+    SDL_sem *task_ready; // posted when a task is handed over, the thread sleeps on it
+    SDL_sem *task_done;
+    bool busy;
 } Thread;
 
 void _RT_kill(void *data) {
@@ -15,27 +18,33 @@ void _RT_kill(void *data) {
     // you should kill yourself, NOW
 }
 
-void _RT_Thread(void *data) {
+int _RT_Thread(void *data) {
     Thread *thread = data;
     while (true) {
-        if (thread->task != NULL) {
+        SDL_SemWait(thread->task_ready);
 
-            if (thread->task == _RT_kill) {
-                thread->task = NULL;
-                thread->task_data = NULL;
-                break;
-            }
-
-            thread->task(thread->task_data);
+        if (thread->task == _RT_kill) {
             thread->task = NULL;
             thread->task_data = NULL;
+            break;
         }
+
+        thread->task(thread->task_data);
+        thread->task = NULL;
+        thread->task_data = NULL;
+        SDL_SemPost(thread->task_done);
     }
+
+    return 0;
 }
 
 Thread *RT_alloc_thread() {
     Thread *thread = malloc(sizeof(Thread));
     thread->task = NULL;
+    thread->task_data = NULL;
+    thread->busy = false;
+    thread->task_ready = SDL_CreateSemaphore(0);
+    thread->task_done = SDL_CreateSemaphore(0);
     thread->thread = SDL_CreateThread(_RT_Thread, "RT thread", thread);
 
     return thread;
@@ -44,18 +53,24 @@ Thread *RT_alloc_thread() {
 void RT_activate_thread(Thread *thread, void (*task)(void *), void *task_data) {
     thread->task_data = task_data;
     thread->task = task;
+    thread->busy = task != _RT_kill;
+    SDL_SemPost(thread->task_ready);
 }
 
 void RT_wait_thread(Thread *thread) {
-    while (thread->task != NULL) {
-        //    wait 
-        //     :)
-    }
+    if (!thread->busy) return;
+
+    SDL_SemWait(thread->task_done);
+    thread->busy = false;
 }
 
 void RT_free_thread(Thread *thread) {
-    RT_activate_thread(thread->thread, _RT_kill, NULL);
-    SDL_DetachThread(thread->thread);
+    RT_wait_thread(thread);
+    RT_activate_thread(thread, _RT_kill, NULL);
+    SDL_WaitThread(thread->thread, NULL);
+
+    SDL_DestroySemaphore(thread->task_ready);
+    SDL_DestroySemaphore(thread->task_done);
 
     free(thread);
     
@@ -0,0 +1,102 @@
+#ifndef RINGBUFFER_C
+#define RINGBUFFER_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// Byte ring buffer for stream reassembly.
+// There's 'max_peek' bytes of slack after the end of the ring, when something you peek at wraps around
+// the wrapped part gets copied there so you always get one contiguous pointer back.
+
+typedef struct RingBuffer {
+    char *data;
+    int capacity;
+    int max_peek;
+    int read_pos;
+    int length;
+} RingBuffer;
+
+RingBuffer RB_new(int capacity, int max_peek) {
+    RingBuffer rb = {0};
+    rb.data = malloc(capacity + max_peek);
+    rb.capacity = capacity;
+    rb.max_peek = max_peek;
+    return rb;
+}
+
+void RB_free(RingBuffer *rb) {
+    free(rb->data);
+    rb->data = NULL;
+    rb->length = 0;
+}
+
+void RB_clear(RingBuffer *rb) {
+    rb->read_pos = 0;
+    rb->length = 0;
+}
+
+int RB_length(RingBuffer *rb) {
+    return rb->length;
+}
+
+int RB_space(RingBuffer *rb) {
+    return rb->capacity - rb->length;
+}
+
+// Where the next bytes should be written, and how many fit there before wrapping.
+// Lets recv() write straight into the ring: RB_write_ptr, recv, RB_commit_write.
+char *RB_write_ptr(RingBuffer *rb, int *contiguous) {
+    int write_pos = (rb->read_pos + rb->length) % rb->capacity;
+    int until_end = rb->capacity - write_pos;
+    int space = RB_space(rb);
+
+    *contiguous = until_end < space ? until_end : space;
+    return rb->data + write_pos;
+}
+
+void RB_commit_write(RingBuffer *rb, int amount) {
+    rb->length += amount;
+}
+
+// Copies in as much as fits, returns how much that was.
+int RB_write(RingBuffer *rb, const void *src, int amount) {
+    int written = 0;
+
+    while (written < amount && RB_space(rb) > 0) {
+        int contiguous;
+        char *dst = RB_write_ptr(rb, &contiguous);
+
+        int chunk = amount - written < contiguous ? amount - written : contiguous;
+        memcpy(dst, (const char *)src + written, chunk);
+        RB_commit_write(rb, chunk);
+        written += chunk;
+    }
+
+    return written;
+}
+
+// Pointer to the next 'amount' bytes, valid until the next write/consume. NULL if there isn't that much.
+void *RB_peek(RingBuffer *rb, int amount) {
+    if (amount > rb->length || amount > rb->max_peek) return NULL;
+
+    int until_end = rb->capacity - rb->read_pos;
+    if (amount > until_end) {
+        // fill the slack with the wrapped part, no one writes there otherwise
+        memcpy(rb->data + rb->capacity, rb->data, amount - until_end);
+    }
+
+    return rb->data + rb->read_pos;
+}
+
+void RB_consume(RingBuffer *rb, int amount) {
+    if (amount > rb->length) amount = rb->length;
+
+    rb->read_pos = (rb->read_pos + amount) % rb->capacity;
+    rb->length -= amount;
+
+    if (rb->length == 0) rb->read_pos = 0; // keeps things from wrapping when they don't need to
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef RNG_C
+#define RNG_C
+
+// Random streams that don't share state with each other or with rand(), so one system drawing more numbers doesn't
+// change what another one gets, and a stream's state can be saved and put back (see replay.c).
+//
+//     RNG_seed(&rng_dungeon, seed);
+//     RNG *previous = RNG_use(&rng_dungeon);   // randi_range(), randf() and friends draw from it now
+//     ...
+//     RNG_use(previous);
+//
+// Every thread has its own current stream, so the level build (handcannon_multiplayer.c, build_level()) can draw from
+// its dungeon stream while the tick draws from rng_game. A stream itself belongs to one thread at a time.
+
+typedef struct RNG {
+    unsigned long long state;
+} RNG;
+
+RNG rng_game = {0x9E3779B97F4A7C15ULL}; // gameplay, seeded from the clock by randomize()
+RNG rng_dungeon = {0}; // the level, seeded with the dungeon seed so every client builds the same one
+
+_Thread_local RNG *rng_current = &rng_game;
+
+void RNG_seed(RNG *rng, unsigned long long seed) {
+    rng->state = seed;
+}
+
+// splitmix64, the top 32 bits
+unsigned int RNG_next(RNG *rng) {
+    unsigned long long z = (rng->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (unsigned int)(z >> 32);
+}
+
+// 0 to 1, inclusive
+double RNG_float(RNG *rng) {
+    return (double)RNG_next(rng) / 0xFFFFFFFFu;
+}
+
+// Makes 'rng' the one the global helpers draw from, returns the one they used before.
+RNG *RNG_use(RNG *rng) {
+    RNG *previous = rng_current;
+    rng_current = rng;
+    return previous;
+}
+
+#endif
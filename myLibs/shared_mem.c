@@ -0,0 +1,243 @@
+#ifndef SHARED_MEM_C
+#define SHARED_MEM_C
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// Named blocks of memory shared by the game instances on one machine (run2instances.bat). The first one to ask for
+// a name builds what's in it, the others map it read only and wait until it's published, instead of building the
+// same thing again into memory of their own.
+//
+//     SharedMem shm;
+//     if (Shm_open(&shm, "handcannon_world_1234", size)) {
+//         if (shm.owner) {
+//             ... fill shm.data ...
+//             Shm_publish(&shm);
+//         }
+//         ... read shm.data ...
+//     } else {
+//         ... not shared, build it yourself ...
+//     }
+//     Shm_close(&shm);
+//
+// A block only works for the build that made it, anything else gets false from Shm_open(). On Windows it's gone
+// once nobody has it open, elsewhere (shm_open) when the owner closes it or a later build finds it.
+
+#define SHM_MAX_NAME 64
+#define SHM_WAIT_TIMEOUT 60.0 // seconds to wait for the owner to publish, it might be baking a level
+#define SHM_WAIT_STEP 10 // ms
+#define _SHM_HEADER_SIZE 64 // keeps the data cache line aligned
+
+#define _SHM_BUILD __DATE__ " " __TIME__
+
+typedef struct _ShmHeader {
+    char build[24];
+    unsigned long long size;
+    long long owner_pid;
+    atomic_int ready;
+} _ShmHeader;
+
+_Static_assert(sizeof(_ShmHeader) <= _SHM_HEADER_SIZE, "SharedMem header doesn't fit");
+
+typedef struct SharedMem {
+    void *data; // NULL if it's not open
+    size_t size;
+    bool owner; // we made it: data is writable and the others wait for Shm_publish()
+    char name[SHM_MAX_NAME];
+
+    _ShmHeader *_header;
+    size_t _mapped;
+#ifdef _WIN32
+    HANDLE _mapping;
+#else
+    int _fd;
+#endif
+} SharedMem;
+
+void _Shm_sleep(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec duration = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&duration, NULL);
+#endif
+}
+
+long long _Shm_pid() {
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return getpid();
+#endif
+}
+
+bool _Shm_alive(long long pid) {
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (process == NULL) return false;
+
+    bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill(pid, 0) == 0;
+#endif
+}
+
+void _Shm_unmap(SharedMem *shm) {
+    if (shm->_header == NULL) return;
+#ifdef _WIN32
+    UnmapViewOfFile(shm->_header);
+    CloseHandle(shm->_mapping);
+#else
+    munmap(shm->_header, shm->_mapped);
+    close(shm->_fd);
+#endif
+    shm->_header = NULL;
+    shm->data = NULL;
+}
+
+// Maps the block, making it if nobody has yet. Sets shm->owner if we did.
+bool _Shm_map(SharedMem *shm, size_t total) {
+#ifdef _WIN32
+    char full_name[SHM_MAX_NAME + 8];
+    snprintf(full_name, sizeof(full_name), "Local\\%s", shm->name);
+
+    shm->_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        (DWORD)((unsigned long long)total >> 32), (DWORD)(total & 0xFFFFFFFF), full_name);
+    if (shm->_mapping == NULL) return false;
+
+    shm->owner = GetLastError() != ERROR_ALREADY_EXISTS;
+    shm->_header = MapViewOfFile(shm->_mapping, shm->owner ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+    if (shm->_header == NULL) {
+        CloseHandle(shm->_mapping);
+        return false;
+    }
+
+    MEMORY_BASIC_INFORMATION info;
+    shm->_mapped = VirtualQuery(shm->_header, &info, sizeof(info)) != 0 ? info.RegionSize : 0;
+    if (shm->_mapped < total) {
+        _Shm_unmap(shm);
+        return false;
+    }
+#else
+    char full_name[SHM_MAX_NAME + 2];
+    snprintf(full_name, sizeof(full_name), "/%s", shm->name);
+
+    shm->_fd = shm_open(full_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    shm->owner = shm->_fd != -1;
+
+    if (shm->owner) {
+        if (ftruncate(shm->_fd, total) != 0) {
+            close(shm->_fd);
+            shm_unlink(full_name);
+            return false;
+        }
+    } else {
+        shm->_fd = shm_open(full_name, O_RDONLY, 0);
+        if (shm->_fd == -1) return false;
+
+        // the owner might not have sized it yet, and touching past the end is a SIGBUS
+        struct stat info;
+        double waited = 0;
+        while (fstat(shm->_fd, &info) == 0 && (size_t)info.st_size < total && waited < 1) {
+            _Shm_sleep(SHM_WAIT_STEP);
+            waited += SHM_WAIT_STEP / 1000.0;
+        }
+        if ((size_t)info.st_size != total) {
+            close(shm->_fd);
+            return false;
+        }
+    }
+
+    shm->_mapped = total;
+    shm->_header = mmap(NULL, total, shm->owner ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, shm->_fd, 0);
+    if (shm->_header == MAP_FAILED) {
+        shm->_header = NULL;
+        close(shm->_fd);
+        if (shm->owner) shm_unlink(full_name);
+        return false;
+    }
+#endif
+    return true;
+}
+
+void _Shm_remove(SharedMem *shm) {
+#ifndef _WIN32
+    char full_name[SHM_MAX_NAME + 2];
+    snprintf(full_name, sizeof(full_name), "/%s", shm->name);
+    shm_unlink(full_name);
+#endif
+}
+
+// Opens the block called 'name' with 'size' bytes of data. As the owner shm->data is ours to fill (zeroed), otherwise
+// it waits for the owner's Shm_publish() and shm->data is read only. False if the block can't be shared: the owner
+// died or took too long, it's from another build, or the OS said no.
+bool Shm_open(SharedMem *shm, const char *name, size_t size) {
+    *shm = (SharedMem){.size = size};
+    snprintf(shm->name, sizeof(shm->name), "%s", name);
+
+    if (!_Shm_map(shm, _SHM_HEADER_SIZE + size)) return false;
+
+    _ShmHeader *header = shm->_header;
+
+    if (shm->owner) {
+        snprintf(header->build, sizeof(header->build), "%s", _SHM_BUILD);
+        header->size = size;
+        header->owner_pid = _Shm_pid();
+        atomic_store(&header->ready, 0);
+    } else {
+        double waited = 0;
+
+        while (!atomic_load(&header->ready)) {
+            long long owner_pid = header->owner_pid; // 0 until the owner got that far
+            if (waited > SHM_WAIT_TIMEOUT || (owner_pid != 0 && !_Shm_alive(owner_pid))) {
+                fprintf(stderr, "Nobody's filling shared memory '%s', doing it ourselves \n", name);
+                if (owner_pid != 0 && !_Shm_alive(owner_pid)) _Shm_remove(shm);
+                _Shm_unmap(shm);
+                return false;
+            }
+
+            _Shm_sleep(SHM_WAIT_STEP);
+            waited += SHM_WAIT_STEP / 1000.0;
+        }
+
+        if (strncmp(header->build, _SHM_BUILD, sizeof(header->build)) != 0 || header->size != size) {
+            fprintf(stderr, "Shared memory '%s' is from another build \n", name);
+            _Shm_remove(shm); // so the next one gets a fresh one
+            _Shm_unmap(shm);
+            return false;
+        }
+    }
+
+    shm->data = (char *)shm->_header + _SHM_HEADER_SIZE;
+    return true;
+}
+
+// The data's all there, lets the others that are waiting in Shm_open() read it.
+void Shm_publish(SharedMem *shm) {
+    if (shm->data == NULL || !shm->owner) return;
+    atomic_store(&shm->_header->ready, 1);
+}
+
+void Shm_close(SharedMem *shm) {
+    if (shm->data == NULL) return;
+
+    if (shm->owner) _Shm_remove(shm); // whoever has it mapped keeps it
+    _Shm_unmap(shm);
+}
+
+#endif
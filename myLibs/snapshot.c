@@ -0,0 +1,493 @@
+#ifndef SNAPSHOT_C
+#define SNAPSHOT_C
+
+#include <stdlib.h>
+#include <string.h>
+#include "multiplayer.c"
+#include "bitpack.c"
+#include "wire.c"
+
+// Delta snapshots of moving things (projectiles) from the server to each client.
+//
+// Every tick the server hands over the state of everything, Snap_send_to() compares it with what that client
+// acknowledged last (its baseline) moved forward the same way the client simulates it. Things whose extrapolation is
+// still within tolerance are left out, the rest only send the fields that changed, and it all goes out as one
+// datagram per client (more if it doesn't fit). A snapshot only becomes the baseline once its datagram gets acked,
+// so a lost one just means the next tick diffs against something older.
+//
+// Datagrams can arrive out of order, so every message carries the server time it was made at and the client keeps,
+// per thing, the stamp of the last update it applied. An update older than that is skipped (Snap_is_newer()), and the
+// server only ever moves a baseline forward in time, so an acked late message never becomes the baseline of
+// something the client already has newer state for.
+//
+// Server: Snap_init() once, _MP_on_datagram_acked = Snap_on_acked, Snap_remove_client() on disconnect,
+// Snap_seed_all() (or Snap_seed_to()) when something gets created with a state everyone already knows.
+// Client: Snap_read() the packet and apply the fields in each update's mask, to the things it's newer for.
+//
+// Snap_relevance, if set, lets the server care less about some things for some clients (far away, behind walls):
+// their tolerances and refresh time get multiplied by what it returns, or they're left out for SNAP_SKIP.
+
+#define SNAP_MAX_ENTITIES 1024 // per client
+#define SNAP_MAX_PER_MESSAGE 64
+#define SNAP_HISTORY 32 // sent and not acked yet, per client. Must divide 65536
+#define SNAP_MAX_ENTITY_BYTES 48 // worst case size of one entity on the wire
+#define SNAP_HEADER_SIZE 6 // entity count, stamp
+
+// how far off the client's extrapolation can get before we send a correction
+#define SNAP_POS_TOLERANCE 1.0
+#define SNAP_VEL_TOLERANCE 0.02
+#define SNAP_HEIGHT_TOLERANCE 200.0
+#define SNAP_H_VEL_TOLERANCE 5.0
+#define SNAP_REFRESH_TIME 1.0 // everything gets resent this often, for whatever the client got wrong on its own
+#define SNAP_SKIP 0.0 // from Snap_relevance, don't send it at all. The baseline stays for when it matters again
+
+typedef enum SnapField {
+    SNAP_POS = 1,
+    SNAP_VEL = 2,
+    SNAP_HEIGHT = 4,
+    SNAP_H_VEL = 8,
+    SNAP_ALL = 15
+} SnapField;
+
+typedef struct SnapState {
+    int id; // sync id
+    int fields; // SnapField mask, which of the below are set. Only used by updates
+    v2 pos, vel;
+    double height, h_vel;
+    v2 accel; // not sent, both sides know these from the projectile type
+    double h_accel;
+} SnapState;
+
+typedef struct SnapBaseline {
+    SnapState state;
+    double time;
+} SnapBaseline;
+
+typedef struct SnapSent {
+    int seq; // -1 = free slot
+    int count;
+    double time;
+    SnapState states[SNAP_MAX_PER_MESSAGE]; // what the client has after applying it
+} SnapSent;
+
+typedef struct SnapClient {
+    SOCKET socket;
+    int baseline_count;
+    SnapBaseline baselines[SNAP_MAX_ENTITIES]; // sorted by id
+    SnapSent history[SNAP_HISTORY];
+    SnapSent pending; // the last Snap_encode(), until Snap_commit() knows its seq
+} SnapClient;
+
+typedef struct SnapStats {
+    long long entities; // that were considered
+    long long entities_sent;
+    long long entities_skipped; // by Snap_relevance
+    long long messages;
+    long long bytes;
+} SnapStats;
+
+SnapClient *snap_clients[MP_MAX_CLIENTS];
+int snap_clients_amount = 0;
+SnapStats snap_stats = {0};
+MPMutex snap_lock; // acks come in on the network thread
+
+double snap_step = 1.0 / 144; // fixed tick the client simulates with
+double snap_time_scale = 1; // velocities are per 1 / snap_time_scale seconds
+
+double (*Snap_relevance)(SOCKET socket, const SnapState *state) = NULL; // see the top, NULL = everything is 1
+
+void Snap_init(double step, double time_scale) {
+    MP_mutex_init(&snap_lock);
+    snap_step = step;
+    snap_time_scale = time_scale;
+}
+
+// The stamp a snapshot made at 'time' carries, milliseconds. Wraps after ~50 days, compare with Snap_is_newer().
+unsigned int Snap_stamp(double time) {
+    return (unsigned int)(long long)(time * 1000);
+}
+
+bool Snap_is_newer(unsigned int stamp, unsigned int than) {
+    return (int)(stamp - than) > 0;
+}
+
+SnapClient *Snap_client_new(SOCKET socket) {
+    SnapClient *client = malloc(sizeof(SnapClient));
+    if (client == NULL) {
+        printf("Snap_client_new: couldn't allocate memory! \n");
+        return NULL;
+    }
+
+    client->socket = socket;
+    client->baseline_count = 0;
+    client->pending.count = 0;
+    for (int i = 0; i < SNAP_HISTORY; i++) client->history[i].seq = -1;
+
+    return client;
+}
+
+// Where the client's copy of 's' is 'dt' seconds later. Same integration as Projectile_tick(), in closed form:
+// n fixed steps, velocity first then position.
+SnapState Snap_extrapolate(SnapState s, double dt) {
+    if (dt <= 0) return s;
+
+    double n = dt / snap_step;
+    double h = snap_step * snap_time_scale;
+    double triangle = n * (n + 1) / 2;
+
+    s.pos.x += h * (n * s.vel.x + s.accel.x * h * triangle);
+    s.pos.y += h * (n * s.vel.y + s.accel.y * h * triangle);
+    s.vel.x += n * h * s.accel.x;
+    s.vel.y += n * h * s.accel.y;
+
+    s.height += h * (n * s.h_vel + s.h_accel * snap_step * triangle);
+    s.h_vel += n * snap_step * s.h_accel;
+
+    return s;
+}
+
+int _Snap_compare_ids(const void *a, const void *b) {
+    int ia = ((const SnapState *)a)->id, ib = ((const SnapState *)b)->id;
+    return (ia > ib) - (ia < ib);
+}
+
+// Snap_encode() wants its states in id order.
+void Snap_sort(SnapState *states, int count) {
+    qsort(states, count, sizeof(SnapState), _Snap_compare_ids);
+}
+
+SnapBaseline *_Snap_find_baseline(SnapClient *client, int id) {
+    int lo = 0, hi = client->baseline_count - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int mid_id = client->baselines[mid].state.id;
+
+        if (mid_id == id) return &client->baselines[mid];
+        if (mid_id < id) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return NULL;
+}
+
+void _Snap_set_baseline(SnapClient *client, SnapState state, double time) {
+    SnapBaseline *existing = _Snap_find_baseline(client, state.id);
+
+    if (existing != NULL) {
+        if (existing->time >= time) return; // already have something newer acked
+        existing->state = state;
+        existing->time = time;
+        return;
+    }
+
+    if (client->baseline_count >= SNAP_MAX_ENTITIES) return; // it just keeps getting sent in full
+
+    int i = client->baseline_count;
+    while (i > 0 && client->baselines[i - 1].state.id > state.id) {
+        client->baselines[i] = client->baselines[i - 1];
+        i--;
+    }
+    client->baselines[i] = (SnapBaseline){state, time};
+    client->baseline_count++;
+}
+
+// Drops baselines of things that aren't in 'states' (sorted) anymore.
+void Snap_prune(SnapClient *client, const SnapState *states, int count) {
+    int kept = 0, j = 0;
+
+    for (int i = 0; i < client->baseline_count; i++) {
+        int id = client->baselines[i].state.id;
+
+        while (j < count && states[j].id < id) j++;
+        if (j < count && states[j].id == id) client->baselines[kept++] = client->baselines[i];
+    }
+    client->baseline_count = kept;
+}
+
+// Which fields 'state' needs to send given what the client should have ('predicted'), with the tolerances times 'scale'.
+// A moving thing sends position and velocity together, otherwise the one left out keeps pulling it off again.
+int _Snap_dirty_fields(SnapState state, SnapState predicted, double scale) {
+    v2 pos_error = v2_sub(state.pos, predicted.pos);
+    v2 vel_error = v2_sub(state.vel, predicted.vel);
+    double height_error = fabs(state.height - predicted.height);
+    double h_vel_error = fabs(state.h_vel - predicted.h_vel);
+
+    int fields = 0;
+
+    if (fmax(fabs(pos_error.x), fabs(pos_error.y)) > SNAP_POS_TOLERANCE * scale || fmax(fabs(vel_error.x), fabs(vel_error.y)) > SNAP_VEL_TOLERANCE * scale) {
+        fields |= SNAP_POS;
+        // unchanged velocity (a thing rolling along) doesn't need to go again
+        if (fmax(fabs(vel_error.x), fabs(vel_error.y)) > 0.5 / WIRE_FIXED_SCALE) fields |= SNAP_VEL;
+    }
+    if (height_error > SNAP_HEIGHT_TOLERANCE * scale || h_vel_error > SNAP_H_VEL_TOLERANCE * scale) {
+        fields |= SNAP_HEIGHT;
+        if (h_vel_error > 0.5 / WIRE_FIXED_SCALE) fields |= SNAP_H_VEL;
+    }
+
+    return fields;
+}
+
+void _Snap_write_state(BitWriter *bw, SnapState state, int fields) {
+    BW_write_bits(bw, fields, 4);
+
+    if (fields & SNAP_POS) {
+        BW_write_quantized(bw, state.pos.x, wire_world_min.x, wire_world_max.x, WIRE_POS_BITS);
+        BW_write_quantized(bw, state.pos.y, wire_world_min.y, wire_world_max.y, WIRE_POS_BITS);
+    }
+    if (fields & SNAP_VEL) {
+        BW_write_fixed(bw, state.vel.x, WIRE_FIXED_SCALE);
+        BW_write_fixed(bw, state.vel.y, WIRE_FIXED_SCALE);
+    }
+    if (fields & SNAP_HEIGHT) BW_write_fixed(bw, state.height, WIRE_HEIGHT_SCALE);
+    if (fields & SNAP_H_VEL) BW_write_fixed(bw, state.h_vel, WIRE_FIXED_SCALE);
+}
+
+// Encodes the states (sorted by id) from *cursor on that the client needs, as many as fit in 'capacity'.
+// *cursor is left at the first one it didn't get to, call again while it's < count. Returns the size, 0 if there was
+// nothing to send. The result has to be Snap_commit()ed before encoding the next one.
+int Snap_encode(SnapClient *client, const SnapState *states, int count, int *cursor, double time, void *out, int capacity) {
+    unsigned char *bytes = out;
+    BitWriter bw = BW_new(bytes + SNAP_HEADER_SIZE, capacity - SNAP_HEADER_SIZE); // count goes in front once we know it
+
+    SnapSent *pending = &client->pending;
+    pending->count = 0;
+    pending->time = time;
+
+    int last_id = 0;
+
+    for (; *cursor < count; (*cursor)++) {
+        if (pending->count >= SNAP_MAX_PER_MESSAGE) break;
+        if (pending->count > 0 && BW_bytes(&bw) + SNAP_MAX_ENTITY_BYTES > bw.capacity) break;
+
+        SnapState state = states[*cursor];
+        snap_stats.entities++;
+
+        double scale = Snap_relevance != NULL ? Snap_relevance(client->socket, &state) : 1;
+        if (scale == SNAP_SKIP) {
+            snap_stats.entities_skipped++;
+            continue;
+        }
+
+        SnapBaseline *baseline = _Snap_find_baseline(client, state.id);
+
+        int fields = SNAP_ALL;
+        SnapState predicted = state;
+
+        if (baseline != NULL && time - baseline->time < SNAP_REFRESH_TIME * scale) {
+            predicted = Snap_extrapolate(baseline->state, time - baseline->time);
+            predicted.accel = state.accel;
+            predicted.h_accel = state.h_accel;
+            fields = _Snap_dirty_fields(state, predicted, scale);
+        }
+
+        if (fields == 0) continue;
+
+        BitWriter before = bw;
+        BW_write_svarint(&bw, (long long)state.id - last_id);
+        _Snap_write_state(&bw, state, fields);
+
+        if (bw.overflow) {
+            // take it back out, it goes first in the next message. One that doesn't fit on its own never will
+            bw = before;
+            if (bw.bit_pos & 7) bw.data[bw.bit_pos >> 3] &= (1u << (bw.bit_pos & 7)) - 1;
+            if (pending->count == 0) {
+                printf("Snap_encode: %d doesn't fit in %d bytes! \n", state.id, capacity);
+                continue;
+            }
+            snap_stats.entities--; // it gets looked at again
+            break;
+        }
+        last_id = state.id;
+
+        // what the client ends up with: the fields we sent, its own extrapolation for the rest
+        if (fields & SNAP_POS) predicted.pos = state.pos;
+        if (fields & SNAP_VEL) predicted.vel = state.vel;
+        if (fields & SNAP_HEIGHT) predicted.height = state.height;
+        if (fields & SNAP_H_VEL) predicted.h_vel = state.h_vel;
+        predicted.fields = 0;
+
+        pending->states[pending->count++] = predicted;
+    }
+
+    if (pending->count == 0) return 0;
+
+    unsigned int stamp = Snap_stamp(time);
+    bytes[0] = pending->count & 0xFF;
+    bytes[1] = pending->count >> 8;
+    for (int i = 0; i < 4; i++) bytes[2 + i] = (stamp >> (i * 8)) & 0xFF;
+
+    snap_stats.entities_sent += pending->count;
+    snap_stats.messages++;
+    snap_stats.bytes += BW_bytes(&bw) + SNAP_HEADER_SIZE;
+
+    return BW_bytes(&bw) + SNAP_HEADER_SIZE;
+}
+
+void _Snap_promote(SnapClient *client, SnapSent *sent) {
+    for (int i = 0; i < sent->count; i++) _Snap_set_baseline(client, sent->states[i], sent->time);
+}
+
+// 'seq' is what the unreliable send returned, -1 if it went over TCP and is as good as acked.
+void Snap_commit(SnapClient *client, int seq) {
+    if (client->pending.count == 0) return;
+
+    if (seq == -1) {
+        _Snap_promote(client, &client->pending);
+    } else {
+        SnapSent *slot = &client->history[seq % SNAP_HISTORY];
+        *slot = client->pending;
+        slot->seq = seq;
+    }
+    client->pending.count = 0;
+}
+
+void Snap_ack(SnapClient *client, unsigned short seq) {
+    SnapSent *slot = &client->history[seq % SNAP_HISTORY];
+    if (slot->seq != seq) return; // not a snapshot, or so old its slot got reused
+
+    _Snap_promote(client, slot);
+    slot->seq = -1;
+}
+
+// For something the client got the state of some other way, like the reliable packet that created it.
+// Saves sending it in full the first time.
+void Snap_seed(SnapClient *client, SnapState state, double time) {
+    state.fields = 0;
+    _Snap_set_baseline(client, state, time);
+}
+
+SnapClient *_Snap_find_client(SOCKET socket) {
+    for (int i = 0; i < snap_clients_amount; i++) {
+        if (snap_clients[i]->socket == socket) return snap_clients[i];
+    }
+    return NULL;
+}
+
+// _MP_on_datagram_acked
+void Snap_on_acked(SOCKET socket, unsigned short seq) {
+    MP_mutex_lock(&snap_lock);
+
+    SnapClient *client = _Snap_find_client(socket);
+    if (client != NULL) Snap_ack(client, seq);
+
+    MP_mutex_unlock(&snap_lock);
+}
+
+// Snap_seed() for one client, if it has had a snapshot yet. Lets a server running several matches seed only the
+// clients in the right one.
+void Snap_seed_to(SOCKET socket, SnapState state) {
+    MP_mutex_lock(&snap_lock);
+
+    SnapClient *client = _Snap_find_client(socket);
+    if (client != NULL) Snap_seed(client, state, MP_time());
+
+    MP_mutex_unlock(&snap_lock);
+}
+
+// Snap_seed() for every client.
+void Snap_seed_all(SnapState state) {
+    MP_mutex_lock(&snap_lock);
+
+    double now = MP_time();
+    for (int i = 0; i < snap_clients_amount; i++) Snap_seed(snap_clients[i], state, now);
+
+    MP_mutex_unlock(&snap_lock);
+}
+
+void Snap_remove_client(SOCKET socket) {
+    MP_mutex_lock(&snap_lock);
+
+    for (int i = 0; i < snap_clients_amount; i++) {
+        if (snap_clients[i]->socket != socket) continue;
+
+        free(snap_clients[i]);
+        snap_clients[i] = snap_clients[--snap_clients_amount];
+        break;
+    }
+
+    MP_mutex_unlock(&snap_lock);
+}
+
+// Sends this tick's snapshot of 'states' (sorted by id) to one client as 'packet_type' packets.
+void Snap_send_to(SOCKET socket, int packet_type, const SnapState *states, int count) {
+    MP_mutex_lock(&snap_lock);
+
+    SnapClient *client = _Snap_find_client(socket);
+    if (client == NULL && snap_clients_amount < MP_MAX_CLIENTS) {
+        client = Snap_client_new(socket);
+        if (client != NULL) snap_clients[snap_clients_amount++] = client;
+    }
+    if (client == NULL) {
+        MP_mutex_unlock(&snap_lock);
+        return;
+    }
+
+    Snap_prune(client, states, count);
+
+    double now = MP_time();
+    int cursor = 0;
+    unsigned char data[MP_UDP_BATCH_SIZE - MP_DATAGRAM_HEADER_SIZE - MP_MAX_HEADER_SIZE]; // one datagram, under the MTU
+
+    while (cursor < count) {
+        int len = Snap_encode(client, states, count, &cursor, now, data, sizeof(data));
+        if (len == 0) continue;
+
+        // holding snap_lock through the send so the ack can't beat the commit
+        int seq = MPServer_send_unreliable_to((MPPacket){.type = packet_type, .len = len, .is_broadcast = true}, data, socket);
+        Snap_commit(client, seq);
+    }
+
+    MP_mutex_unlock(&snap_lock);
+}
+
+// Snap_send_to() every connected client.
+void Snap_send_to_all(int packet_type, const SnapState *states, int count) {
+    SOCKET clients[MP_MAX_CLIENTS];
+
+    MP_mutex_lock(&MP_lock);
+    int clients_amount = MP_clients_amount;
+    memcpy(clients, MP_clients, clients_amount * sizeof(SOCKET));
+    MP_mutex_unlock(&MP_lock);
+
+    for (int i = 0; i < clients_amount; i++) Snap_send_to(clients[i], packet_type, states, count);
+}
+
+// Client side, fills 'updates' from a snapshot packet and 'stamp' with when the server made it. Returns how many,
+// or -1 if it was malformed. Skip the updates to things that already had a newer one applied.
+int Snap_read(const void *data, int len, unsigned int *stamp, SnapState *updates, int capacity) {
+    if (len < SNAP_HEADER_SIZE) return -1;
+
+    const unsigned char *bytes = data;
+    int count = bytes[0] | (bytes[1] << 8);
+    if (count > capacity) return -1;
+
+    *stamp = 0;
+    for (int i = 0; i < 4; i++) *stamp |= (unsigned int)bytes[2 + i] << (i * 8);
+
+    BitReader br = BR_new(bytes + SNAP_HEADER_SIZE, len - SNAP_HEADER_SIZE);
+    int id = 0;
+
+    for (int i = 0; i < count; i++) {
+        SnapState *u = &updates[i];
+        memset(u, 0, sizeof(SnapState));
+
+        id += (int)BR_read_svarint(&br);
+        u->id = id;
+        u->fields = BR_read_bits(&br, 4);
+
+        if (u->fields & SNAP_POS) {
+            u->pos.x = BR_read_quantized(&br, wire_world_min.x, wire_world_max.x, WIRE_POS_BITS);
+            u->pos.y = BR_read_quantized(&br, wire_world_min.y, wire_world_max.y, WIRE_POS_BITS);
+        }
+        if (u->fields & SNAP_VEL) {
+            u->vel.x = BR_read_fixed(&br, WIRE_FIXED_SCALE);
+            u->vel.y = BR_read_fixed(&br, WIRE_FIXED_SCALE);
+        }
+        if (u->fields & SNAP_HEIGHT) u->height = BR_read_fixed(&br, WIRE_HEIGHT_SCALE);
+        if (u->fields & SNAP_H_VEL) u->h_vel = BR_read_fixed(&br, WIRE_FIXED_SCALE);
+    }
+
+    return br.overflow ? -1 : count;
+}
+
+#endif
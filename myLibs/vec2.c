@@ -256,6 +256,20 @@ v2 v2_reflect(v2 vector, v2 normal) {
     return v2_sub(vector, v2_mul(to_vec(2 * v2_dot(vector, normal)), normal));
 }
 
+// How far along the ray ('dir' normalized) it goes into the circle, in 'distance'.
+// 0 if it misses, points away or starts inside.
+int v2_ray_circle(v2 ray_pos, v2 ray_dir, v2 center, double radius, double *distance) {
+    if (v2_distance(ray_pos, center) <= radius || v2_dot(ray_dir, v2_dir(ray_pos, center)) < 0) return 0;
+
+    v2 ray_to_circle = v2_sub(center, ray_pos);
+    double a = v2_dot(ray_to_circle, ray_dir);
+    double b_squared = v2_length_squared(ray_to_circle) - a * a; // pythagoras
+    if (radius * radius - b_squared < 0) return 0; // no imaginary numbers pls
+
+    *distance = a - sqrt(radius * radius - b_squared); // more pythagoras
+    return 1;
+}
+
 // #END
 
 #endif // VEC2
\ No newline at end of file
@@ -0,0 +1,166 @@
+#ifndef WIRE_C
+#define WIRE_C
+
+#include <stddef.h>
+#include <string.h>
+#include "bitpack.c"
+#include "vec2.c"
+
+// Schema driven packet encoding. A schema lists the fields of a packet struct and how each one goes on the wire,
+// Wire_encode() and Wire_decode() walk it. Nothing is copied as raw memory, so padding and byte order don't matter.
+//
+//     WireSchema schema = WIRE_SCHEMA(struct thing, WIRE_FIELD(struct thing, pos, WIRE_POS), ...);
+
+#define WIRE_MAX_FIELDS 16
+#define WIRE_POS_BITS 20 // per axis, spread over the world bounds
+#define WIRE_DIR_BITS 12
+#define WIRE_FIXED_SCALE 1024.0 // steps per unit for velocities and such
+#define WIRE_HEIGHT_SCALE 64.0
+
+typedef enum WireFieldKind {
+    WIRE_INT, // int, svarint
+    WIRE_LONG, // long, svarint
+    WIRE_BOOL, // bool, 1 bit
+    WIRE_RGBA, // 4 bytes (SDL_Color), 8 bits each
+    WIRE_POS, // v2 inside the world bounds, WIRE_POS_BITS per axis. Outside gets clamped
+    WIRE_DIR, // v2 unit vector, sent as a WIRE_DIR_BITS angle. The length is lost
+    WIRE_FIXED, // double, svarint of 1 / WIRE_FIXED_SCALE steps
+    WIRE_FIXED_V2, // v2, same per axis
+    WIRE_HEIGHT // double, svarint of 1 / WIRE_HEIGHT_SCALE steps
+} WireFieldKind;
+
+typedef struct WireField {
+    WireFieldKind kind;
+    int offset;
+} WireField;
+
+typedef struct WireSchema {
+    int size; // sizeof the struct, 0 = no schema
+    int field_count;
+    WireField fields[WIRE_MAX_FIELDS];
+} WireSchema;
+
+#define WIRE_FIELD(type, member, kind) {kind, offsetof(type, member)}
+#define WIRE_SCHEMA(type, ...) {sizeof(type), sizeof((WireField[]){__VA_ARGS__}) / sizeof(WireField), {__VA_ARGS__}}
+
+// Both ends have to agree on these, set them once at startup.
+v2 wire_world_min = {-4096, -4096};
+v2 wire_world_max = {4096, 4096};
+
+void Wire_set_world_bounds(v2 min, v2 max) {
+    wire_world_min = min;
+    wire_world_max = max;
+}
+
+// Worst case error of a WIRE_POS axis.
+double Wire_pos_precision() {
+    double range = fmax(wire_world_max.x - wire_world_min.x, wire_world_max.y - wire_world_min.y);
+    return range / ((1u << WIRE_POS_BITS) - 1) / 2;
+}
+
+// Returns the encoded size, or -1 if it didn't fit in 'capacity'.
+int Wire_encode(const WireSchema *schema, const void *src, void *out, int capacity) {
+    BitWriter bw = BW_new(out, capacity);
+    const char *base = src;
+
+    for (int i = 0; i < schema->field_count; i++) {
+        const void *field = base + schema->fields[i].offset;
+
+        switch (schema->fields[i].kind) {
+            case WIRE_INT:
+                BW_write_svarint(&bw, *(const int *)field);
+                break;
+            case WIRE_LONG:
+                BW_write_svarint(&bw, *(const long *)field);
+                break;
+            case WIRE_BOOL:
+                BW_write_bool(&bw, *(const bool *)field);
+                break;
+            case WIRE_RGBA:
+                for (int c = 0; c < 4; c++) BW_write_bits(&bw, ((const unsigned char *)field)[c], 8);
+                break;
+            case WIRE_POS: {
+                v2 pos = *(const v2 *)field;
+                BW_write_quantized(&bw, pos.x, wire_world_min.x, wire_world_max.x, WIRE_POS_BITS);
+                BW_write_quantized(&bw, pos.y, wire_world_min.y, wire_world_max.y, WIRE_POS_BITS);
+                break;
+            }
+            case WIRE_DIR: {
+                v2 dir = *(const v2 *)field;
+                BW_write_quantized(&bw, atan2(dir.y, dir.x), -PI, PI, WIRE_DIR_BITS);
+                break;
+            }
+            case WIRE_FIXED:
+                BW_write_fixed(&bw, *(const double *)field, WIRE_FIXED_SCALE);
+                break;
+            case WIRE_FIXED_V2: {
+                v2 v = *(const v2 *)field;
+                BW_write_fixed(&bw, v.x, WIRE_FIXED_SCALE);
+                BW_write_fixed(&bw, v.y, WIRE_FIXED_SCALE);
+                break;
+            }
+            case WIRE_HEIGHT:
+                BW_write_fixed(&bw, *(const double *)field, WIRE_HEIGHT_SCALE);
+                break;
+        }
+    }
+
+    return bw.overflow ? -1 : BW_bytes(&bw);
+}
+
+// Fills 'dst' (schema->size bytes) back in, anything not in the schema is zeroed.
+// Returns schema->size, or -1 if 'len' bytes weren't enough.
+int Wire_decode(const WireSchema *schema, const void *in, int len, void *dst) {
+    BitReader br = BR_new(in, len);
+    char *base = dst;
+
+    memset(dst, 0, schema->size);
+
+    for (int i = 0; i < schema->field_count; i++) {
+        void *field = base + schema->fields[i].offset;
+
+        switch (schema->fields[i].kind) {
+            case WIRE_INT:
+                *(int *)field = (int)BR_read_svarint(&br);
+                break;
+            case WIRE_LONG:
+                *(long *)field = (long)BR_read_svarint(&br);
+                break;
+            case WIRE_BOOL:
+                *(bool *)field = BR_read_bool(&br);
+                break;
+            case WIRE_RGBA:
+                for (int c = 0; c < 4; c++) ((unsigned char *)field)[c] = BR_read_bits(&br, 8);
+                break;
+            case WIRE_POS: {
+                v2 pos;
+                pos.x = BR_read_quantized(&br, wire_world_min.x, wire_world_max.x, WIRE_POS_BITS);
+                pos.y = BR_read_quantized(&br, wire_world_min.y, wire_world_max.y, WIRE_POS_BITS);
+                *(v2 *)field = pos;
+                break;
+            }
+            case WIRE_DIR: {
+                double angle = BR_read_quantized(&br, -PI, PI, WIRE_DIR_BITS);
+                *(v2 *)field = (v2){cos(angle), sin(angle)};
+                break;
+            }
+            case WIRE_FIXED:
+                *(double *)field = BR_read_fixed(&br, WIRE_FIXED_SCALE);
+                break;
+            case WIRE_FIXED_V2: {
+                v2 v;
+                v.x = BR_read_fixed(&br, WIRE_FIXED_SCALE);
+                v.y = BR_read_fixed(&br, WIRE_FIXED_SCALE);
+                *(v2 *)field = v;
+                break;
+            }
+            case WIRE_HEIGHT:
+                *(double *)field = BR_read_fixed(&br, WIRE_HEIGHT_SCALE);
+                break;
+        }
+    }
+
+    return br.overflow ? -1 : schema->size;
+}
+
+#endif
@@ -0,0 +1,339 @@
+#ifndef PACKETS_H
+#define PACKETS_H
+
+#include <SDL.h>
+#include "vec2.c"
+#include "wire.c"
+
+// Game packets and how they go on the wire. The structs are what the game sends and receives,
+// packet_schemas says how each field gets encoded (see wire.c). A type without a schema is sent as is.
+
+enum PacketTypes {
+    PACKET_UPDATE_PLAYER_ID,
+    PACKET_PLAYER_POS,
+    PACKET_PLAYER_JOINED,
+    PACKET_DUNGEON_SEED,
+    PACKET_REQUEST_DUNGEON_SEED,
+    PACKET_ABILITY_SHOOT,
+    PACKET_HOST_LEFT,
+    PACKET_PLAYER_LEFT,
+    PACKET_PLAYER_TOOK_DAMAGE,
+    PACKET_REQUEST_CREATE_NODE,
+    PACKET_REQUEST_SYNC_IDS,
+    PACKET_SYNC_ID_LEASE,
+    PACKET_SYNC_PROJECTILE,
+
+    PACKETS_TO_SYNC,
+
+        PACKET_ABILITY_BOMB,
+        PACKET_ABILITY_FORCEFIELD,
+        PACKET_ABILITY_SWITCHSHOT,
+
+    PACKETS_TO_SYNC_END,
+    PACKET_SWITCH_POSITIONS,
+    PACKET_PROJECTILE_SNAPSHOT, // no schema, snapshot.c packs it itself
+    PACKET_JOIN_MATCH, // client -> server, first thing after connecting
+    PACKET_REQUEST_JOIN_STATE, // server -> a player already in the match, when someone joins
+    PACKET_JOIN_STATE, // no schema, a join_state_packet, passed on to the newcomer
+    PACKET_PLAYER_HIDDEN, // server -> client, a player went out of its view
+    PACKETS_END
+};
+
+#define JOIN_STATE_VERSION 1 // bump when what goes in a join state changes
+#define JOIN_STATE_CHUNK_SIZE 1024
+#define JOIN_STATE_MAX_CHUNKS 32
+
+struct update_player_id_packet {
+    int id;
+};
+
+struct switch_positions_packet {
+    int id1;
+    v2 pos1;
+    double h1;
+    int id2;
+    v2 pos2;
+    double h2;
+};
+
+struct ability_switchshot_packet {
+    int sync_id;
+    v2 pos;
+    double height;
+    v2 vel;
+    double h_vel;
+    int sender_id;
+};
+
+struct ability_forcefield_packet {
+    int sync_id;
+    v2 pos;
+    double height;
+    v2 vel;
+    double h_vel;
+    int sender_id;
+};
+
+struct sync_projectile_packet {
+    v2 pos, vel;
+    double height, h_vel;
+    int sync_id;
+};
+
+// sync ids first .. first + count - 1 are the receiver's to give out
+struct sync_id_lease_packet {
+    int first;
+    int count;
+};
+
+struct ability_bomb_packet {
+    int sync_id;
+    v2 pos;
+    double height;
+    v2 vel;
+    double height_vel;
+    int sender_id;
+};
+
+struct player_left_packet {
+    int id;
+};
+
+// 'time' is that of the position the receiver didn't get, only a newer one brings the player back
+struct player_hidden_packet {
+    int id;
+    double time;
+};
+
+// hit_id is -1 for a miss. The server checks hits against where the target was when the shooter saw it
+// ('view_delay' plus the round trip ago) and sets it to -1 if the ray from 'origin' along 'dir' doesn't get there.
+struct ability_shoot_packet {
+    int shooter_id;
+    int hit_id;
+    v2 hit_pos;
+    double hit_height;
+    v2 origin;
+    v2 dir;
+    double view_delay; // seconds the shooter was seeing the target behind by, its interpolation delay
+};
+
+struct dungeon_seed_packet {
+    long seed;
+};
+
+struct player_pos_packet {
+    double time; // sender's clock, for the receiver's InterpBuffer
+    SDL_Color color;
+    v2 pos;
+    double height;
+    v2 dir;
+    int id;
+    bool crouching;
+};
+
+// 0 (MATCH_ANY) for any match with room, otherwise the match to join or open
+struct join_match_packet {
+    int match_id;
+};
+
+struct player_joined_packet {
+    int id;
+    // ... more stuff later, maybe?
+};
+
+// describe the match to this newcomer with join_state_packets
+struct request_join_state_packet {
+    int for_id;
+};
+
+// One chunk of a join state: what a player that's been in the match a while knows that a newcomer wouldn't get
+// until it changes. Goes as is, only up to 'len' bytes of 'bytes', see JOIN_STATE_HEADER_SIZE.
+// The chunks put together are join_projectile_state records, each a length byte and the encoded record.
+struct join_state_packet {
+    int for_id; // the newcomer's player id, the server sends it there
+    int snapshot_id; // chunks with another one are from a different snapshot
+    unsigned short version; // JOIN_STATE_VERSION
+    unsigned char chunk, chunks;
+    unsigned short len;
+    unsigned char bytes[JOIN_STATE_CHUNK_SIZE];
+};
+
+#define JOIN_STATE_HEADER_SIZE ((int)offsetof(struct join_state_packet, bytes))
+
+// a live synced projectile. 'kind' is the ability packet that creates it
+struct join_projectile_state {
+    int kind;
+    int sync_id;
+    int shooter_id;
+    v2 pos;
+    double height;
+    v2 vel;
+    double h_vel;
+    double life_left; // seconds
+};
+
+// for stats and logs
+const char *packet_names[PACKETS_END] = {
+    [PACKET_UPDATE_PLAYER_ID] = "UPDATE_PLAYER_ID",
+    [PACKET_PLAYER_POS] = "PLAYER_POS",
+    [PACKET_PLAYER_JOINED] = "PLAYER_JOINED",
+    [PACKET_DUNGEON_SEED] = "DUNGEON_SEED",
+    [PACKET_REQUEST_DUNGEON_SEED] = "REQUEST_DUNGEON_SEED",
+    [PACKET_ABILITY_SHOOT] = "ABILITY_SHOOT",
+    [PACKET_HOST_LEFT] = "HOST_LEFT",
+    [PACKET_PLAYER_LEFT] = "PLAYER_LEFT",
+    [PACKET_PLAYER_TOOK_DAMAGE] = "PLAYER_TOOK_DAMAGE",
+    [PACKET_REQUEST_CREATE_NODE] = "REQUEST_CREATE_NODE",
+    [PACKET_REQUEST_SYNC_IDS] = "REQUEST_SYNC_IDS",
+    [PACKET_SYNC_ID_LEASE] = "SYNC_ID_LEASE",
+    [PACKET_SYNC_PROJECTILE] = "SYNC_PROJECTILE",
+    [PACKET_ABILITY_BOMB] = "ABILITY_BOMB",
+    [PACKET_ABILITY_FORCEFIELD] = "ABILITY_FORCEFIELD",
+    [PACKET_ABILITY_SWITCHSHOT] = "ABILITY_SWITCHSHOT",
+    [PACKET_SWITCH_POSITIONS] = "SWITCH_POSITIONS",
+    [PACKET_PROJECTILE_SNAPSHOT] = "PROJECTILE_SNAPSHOT",
+    [PACKET_JOIN_MATCH] = "JOIN_MATCH",
+    [PACKET_REQUEST_JOIN_STATE] = "REQUEST_JOIN_STATE",
+    [PACKET_JOIN_STATE] = "JOIN_STATE",
+    [PACKET_PLAYER_HIDDEN] = "PLAYER_HIDDEN",
+};
+
+#define _PACKET_SCHEMA(packet_type, type, ...) [packet_type] = WIRE_SCHEMA(type, __VA_ARGS__)
+
+const WireSchema packet_schemas[PACKETS_END] = {
+    _PACKET_SCHEMA(PACKET_UPDATE_PLAYER_ID, struct update_player_id_packet,
+        WIRE_FIELD(struct update_player_id_packet, id, WIRE_INT)
+    ),
+    _PACKET_SCHEMA(PACKET_PLAYER_POS, struct player_pos_packet,
+        WIRE_FIELD(struct player_pos_packet, time, WIRE_FIXED),
+        WIRE_FIELD(struct player_pos_packet, color, WIRE_RGBA),
+        WIRE_FIELD(struct player_pos_packet, pos, WIRE_POS),
+        WIRE_FIELD(struct player_pos_packet, height, WIRE_HEIGHT),
+        WIRE_FIELD(struct player_pos_packet, dir, WIRE_DIR),
+        WIRE_FIELD(struct player_pos_packet, id, WIRE_INT),
+        WIRE_FIELD(struct player_pos_packet, crouching, WIRE_BOOL)
+    ),
+    _PACKET_SCHEMA(PACKET_PLAYER_JOINED, struct player_joined_packet,
+        WIRE_FIELD(struct player_joined_packet, id, WIRE_INT)
+    ),
+    _PACKET_SCHEMA(PACKET_DUNGEON_SEED, struct dungeon_seed_packet,
+        WIRE_FIELD(struct dungeon_seed_packet, seed, WIRE_LONG)
+    ),
+    _PACKET_SCHEMA(PACKET_ABILITY_SHOOT, struct ability_shoot_packet,
+        WIRE_FIELD(struct ability_shoot_packet, shooter_id, WIRE_INT),
+        WIRE_FIELD(struct ability_shoot_packet, hit_id, WIRE_INT),
+        WIRE_FIELD(struct ability_shoot_packet, hit_pos, WIRE_POS),
+        WIRE_FIELD(struct ability_shoot_packet, hit_height, WIRE_HEIGHT),
+        WIRE_FIELD(struct ability_shoot_packet, origin, WIRE_POS),
+        WIRE_FIELD(struct ability_shoot_packet, dir, WIRE_DIR),
+        WIRE_FIELD(struct ability_shoot_packet, view_delay, WIRE_FIXED)
+    ),
+    _PACKET_SCHEMA(PACKET_PLAYER_LEFT, struct player_left_packet,
+        WIRE_FIELD(struct player_left_packet, id, WIRE_INT)
+    ),
+    _PACKET_SCHEMA(PACKET_SYNC_ID_LEASE, struct sync_id_lease_packet,
+        WIRE_FIELD(struct sync_id_lease_packet, first, WIRE_INT),
+        WIRE_FIELD(struct sync_id_lease_packet, count, WIRE_INT)
+    ),
+    _PACKET_SCHEMA(PACKET_SYNC_PROJECTILE, struct sync_projectile_packet,
+        WIRE_FIELD(struct sync_projectile_packet, pos, WIRE_POS),
+        WIRE_FIELD(struct sync_projectile_packet, vel, WIRE_FIXED_V2),
+        WIRE_FIELD(struct sync_projectile_packet, height, WIRE_HEIGHT),
+        WIRE_FIELD(struct sync_projectile_packet, h_vel, WIRE_FIXED),
+        WIRE_FIELD(struct sync_projectile_packet, sync_id, WIRE_INT)
+    ),
+    // the sender picks the sync id from its lease, see take_sync_id()
+    _PACKET_SCHEMA(PACKET_ABILITY_BOMB, struct ability_bomb_packet,
+        WIRE_FIELD(struct ability_bomb_packet, sync_id, WIRE_INT),
+        WIRE_FIELD(struct ability_bomb_packet, pos, WIRE_POS),
+        WIRE_FIELD(struct ability_bomb_packet, height, WIRE_HEIGHT),
+        WIRE_FIELD(struct ability_bomb_packet, vel, WIRE_FIXED_V2),
+        WIRE_FIELD(struct ability_bomb_packet, height_vel, WIRE_FIXED),
+        WIRE_FIELD(struct ability_bomb_packet, sender_id, WIRE_INT)
+    ),
+    _PACKET_SCHEMA(PACKET_ABILITY_FORCEFIELD, struct ability_forcefield_packet,
+        WIRE_FIELD(struct ability_forcefield_packet, sync_id, WIRE_INT),
+        WIRE_FIELD(struct ability_forcefield_packet, pos, WIRE_POS),
+        WIRE_FIELD(struct ability_forcefield_packet, height, WIRE_HEIGHT),
+        WIRE_FIELD(struct ability_forcefield_packet, vel, WIRE_FIXED_V2),
+        WIRE_FIELD(struct ability_forcefield_packet, h_vel, WIRE_FIXED),
+        WIRE_FIELD(struct ability_forcefield_packet, sender_id, WIRE_INT)
+    ),
+    _PACKET_SCHEMA(PACKET_ABILITY_SWITCHSHOT, struct ability_switchshot_packet,
+        WIRE_FIELD(struct ability_switchshot_packet, sync_id, WIRE_INT),
+        WIRE_FIELD(struct ability_switchshot_packet, pos, WIRE_POS),
+        WIRE_FIELD(struct ability_switchshot_packet, height, WIRE_HEIGHT),
+        WIRE_FIELD(struct ability_switchshot_packet, vel, WIRE_FIXED_V2),
+        WIRE_FIELD(struct ability_switchshot_packet, h_vel, WIRE_FIXED),
+        WIRE_FIELD(struct ability_switchshot_packet, sender_id, WIRE_INT)
+    ),
+    _PACKET_SCHEMA(PACKET_SWITCH_POSITIONS, struct switch_positions_packet,
+        WIRE_FIELD(struct switch_positions_packet, id1, WIRE_INT),
+        WIRE_FIELD(struct switch_positions_packet, pos1, WIRE_POS),
+        WIRE_FIELD(struct switch_positions_packet, h1, WIRE_HEIGHT),
+        WIRE_FIELD(struct switch_positions_packet, id2, WIRE_INT),
+        WIRE_FIELD(struct switch_positions_packet, pos2, WIRE_POS),
+        WIRE_FIELD(struct switch_positions_packet, h2, WIRE_HEIGHT)
+    ),
+    _PACKET_SCHEMA(PACKET_JOIN_MATCH, struct join_match_packet,
+        WIRE_FIELD(struct join_match_packet, match_id, WIRE_INT)
+    ),
+    _PACKET_SCHEMA(PACKET_REQUEST_JOIN_STATE, struct request_join_state_packet,
+        WIRE_FIELD(struct request_join_state_packet, for_id, WIRE_INT)
+    ),
+    _PACKET_SCHEMA(PACKET_PLAYER_HIDDEN, struct player_hidden_packet,
+        WIRE_FIELD(struct player_hidden_packet, id, WIRE_INT),
+        WIRE_FIELD(struct player_hidden_packet, time, WIRE_FIXED)
+    ),
+};
+
+const WireSchema join_projectile_schema = WIRE_SCHEMA(struct join_projectile_state,
+    WIRE_FIELD(struct join_projectile_state, kind, WIRE_INT),
+    WIRE_FIELD(struct join_projectile_state, sync_id, WIRE_INT),
+    WIRE_FIELD(struct join_projectile_state, shooter_id, WIRE_INT),
+    WIRE_FIELD(struct join_projectile_state, pos, WIRE_POS),
+    WIRE_FIELD(struct join_projectile_state, height, WIRE_HEIGHT),
+    WIRE_FIELD(struct join_projectile_state, vel, WIRE_FIXED_V2),
+    WIRE_FIELD(struct join_projectile_state, h_vel, WIRE_FIXED),
+    WIRE_FIELD(struct join_projectile_state, life_left, WIRE_FIXED)
+);
+
+const WireSchema *get_packet_schema(int type) {
+    if (type < 0 || type >= PACKETS_END || packet_schemas[type].size == 0) return NULL;
+    return &packet_schemas[type];
+}
+
+// _MP_encode_payload
+int encode_packet_payload(int type, const void *data, int len, void *out, int capacity) {
+    const WireSchema *schema = get_packet_schema(type);
+
+    if (schema == NULL) {
+        if (len > capacity) return -1;
+        if (len > 0) memcpy(out, data, len);
+        return len;
+    }
+
+    if (len != schema->size) {
+        printf("Packet type %d is %d bytes, its schema says %d \n", type, len, schema->size);
+        return -1;
+    }
+
+    return Wire_encode(schema, data, out, capacity);
+}
+
+// _MP_decode_payload
+int decode_packet_payload(int type, const void *data, int len, void *out, int capacity) {
+    const WireSchema *schema = get_packet_schema(type);
+
+    if (schema == NULL) {
+        if (len > capacity) return -1;
+        if (len > 0) memcpy(out, data, len);
+        return len;
+    }
+
+    if (schema->size > capacity) return -1;
+
+    return Wire_decode(schema, data, len, out);
+}
+
+#endif
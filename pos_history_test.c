@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pos_history.c"
+
+// A target flies sideways past a shooter for a while, sending its position SEND_RATE times a second the way the
+// game does, on its own clock, and the server gets each one a latency and some jitter later, on the next of its
+// ticks. Looking back into the history has to give where the target really was at that time, in between updates
+// too, and a shot aimed where the shooter saw it has to hit the rewound target at any point between two updates
+// and miss the one that's moved on since.
+
+#define TPS 60
+#define SEND_RATE 10 // player_pos_send_rate
+#define SPEED 200.0 // units per second, airborne
+#define RADIUS 8.0 // PLAYER_COLLIDER_RADIUS
+#define CLOCK_OFFSET 1000.0 // the server's clock is this far ahead of the sender's
+#define LATENCY 0.03 // seconds, sender to server
+#define JITTER 0.02 // seconds on top, at most
+#define SECONDS 10
+#define EPSILON 0.01 // the samples are floats
+#define SHOT_EPSILON 1.0 // units, the clock offset is only as good as the fastest update and the tick it's handled on
+
+v2 target_at(double sender_time) {
+    return (v2){200 + sender_time * SPEED, 600};
+}
+
+double height_at(double sender_time) {
+    return 11000 - sender_time * 180;
+}
+
+// Rewinding where the clock offset is exact: every update takes LATENCY, and is handled the moment it arrives.
+int check_rewind() {
+    PosHistory history = {0};
+    v2 pos;
+    double height;
+    int failures = 0;
+
+    if (PH_rewind(&history, 0, &pos, &height)) {
+        printf("Empty history gave a position \n");
+        failures++;
+    }
+
+    int updates = SECONDS * SEND_RATE;
+    for (int i = 0; i < updates; i++) {
+        double sent = (double)i / SEND_RATE;
+        PH_push(&history, sent, sent + CLOCK_OFFSET + LATENCY, target_at(sent), height_at(sent));
+
+        // before the buffer is full and after it wrapped around
+        if (i != 20 && i != updates - 1) continue;
+
+        double oldest = i < PH_SIZE ? 0 : (double)(i - PH_SIZE + 1) / SEND_RATE;
+        for (double back = 0; back <= 3; back += 0.013) {
+            double sender_time = fmax(sent - back, oldest);
+            PH_rewind(&history, sent - back + CLOCK_OFFSET + LATENCY, &pos, &height);
+
+            if (v2_distance(pos, target_at(sender_time)) > EPSILON || fabs(height - height_at(sender_time)) > EPSILON) {
+                printf("After update %d, %.3f s back: (%.2f, %.2f) instead of (%.2f, %.2f) \n",
+                    i, back, pos.x, pos.y, target_at(sender_time).x, target_at(sender_time).y);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    double newest = (double)(updates - 1) / SEND_RATE;
+
+    if (PH_push(&history, newest - 0.05, newest + CLOCK_OFFSET + LATENCY + 0.01, target_at(0), height_at(0))) {
+        printf("An update older than the newest one was taken \n");
+        failures++;
+    }
+
+    PH_rewind(&history, newest + CLOCK_OFFSET + 5, &pos, &height);
+    if (v2_distance(pos, target_at(newest)) > EPSILON) {
+        printf("Past the newest update didn't give the newest one \n");
+        failures++;
+    }
+
+    return failures;
+}
+
+typedef struct InFlight {
+    double sent, arrives;
+} InFlight;
+
+// The way the server sees it: updates at the send rate with jitter, each one pushed on the first tick after it
+// arrived. The shooter saw the target some way back, at any point between two of its updates.
+int check_shot() {
+    PosHistory history = {0};
+    InFlight in_flight[SEND_RATE];
+    int in_flight_amount = 0;
+    double next_send = 0;
+    double newest_sent = 0;
+    double now = CLOCK_OFFSET;
+    srand(7);
+
+    for (int tick = 0; tick < SECONDS * TPS; tick++) {
+        now = CLOCK_OFFSET + (double)tick / TPS;
+
+        while (next_send + CLOCK_OFFSET <= now) {
+            double jitter = JITTER * rand() / RAND_MAX;
+            in_flight[in_flight_amount++] = (InFlight){next_send, next_send + CLOCK_OFFSET + LATENCY + jitter};
+            next_send += 1.0 / SEND_RATE;
+        }
+
+        // never more than one apart by more than the jitter, so they arrive in order
+        while (in_flight_amount > 0 && in_flight[0].arrives <= now) {
+            double sent = in_flight[0].sent;
+            PH_push(&history, sent, now, target_at(sent), height_at(sent));
+            newest_sent = sent;
+            for (int i = 1; i < in_flight_amount; i++) in_flight[i - 1] = in_flight[i];
+            in_flight_amount--;
+        }
+    }
+
+    int failures = 0;
+    double worst = 0;
+    v2 shooter = {400, 200};
+
+    // 100 ms of round trip and 100 to 200 of interpolation, every phase of a send interval
+    for (double view_delay = 0.1; view_delay <= 0.2; view_delay += 0.005) {
+        double seen_time = newest_sent - 0.1 - view_delay;
+        v2 seen = target_at(seen_time);
+        v2 dir = v2_dir(shooter, seen);
+
+        v2 rewound;
+        double height, distance;
+        PH_rewind(&history, seen_time + CLOCK_OFFSET + LATENCY, &rewound, &height);
+        worst = fmax(worst, v2_distance(rewound, seen));
+
+        if (v2_distance(rewound, seen) > SHOT_EPSILON) {
+            printf("%.3f s back the target was rewound to (%.2f, %.2f), it was at (%.2f, %.2f) \n",
+                view_delay, rewound.x, rewound.y, seen.x, seen.y);
+            failures++;
+            break;
+        }
+
+        if (!v2_ray_circle(shooter, dir, rewound, RADIUS, &distance)) {
+            printf("Shot at where the target was seen %.3f s back missed the rewound target \n", view_delay);
+            failures++;
+            break;
+        }
+
+        if (v2_ray_circle(shooter, dir, target_at(newest_sent), RADIUS, &distance)) {
+            printf("Shot hit the target where it is now, the test doesn't show anything \n");
+            failures++;
+            break;
+        }
+
+        // pointing away, and starting inside
+        if (v2_ray_circle(shooter, v2_mul(dir, to_vec(-1)), rewound, RADIUS, &distance)
+            || v2_ray_circle(rewound, dir, rewound, RADIUS, &distance)) {
+            printf("Ray hit a circle behind it or around its start \n");
+            failures++;
+            break;
+        }
+    }
+
+    printf("Rewound at most %.2f units from where the target was seen \n", worst);
+    return failures;
+}
+
+int main() {
+    int failures = check_rewind();
+    failures += check_shot();
+
+    if (failures > 0) {
+        printf("FAILED \n");
+        return 1;
+    }
+
+    printf("%d bytes per player \n", (int)sizeof(PosHistory));
+    printf("OK \n");
+    return 0;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "vec2.c"
+#include "camera.c"
+
+// Checks Camera_project/Camera_project_batch/Camera_ray_dir against the old trig based worldToScreen.
+
+#define WINDOW_WIDTH 1024
+#define WINDOW_HEIGHT 580
+#define WALL_HEIGHT 30
+#define WALL_HEIGHT_MULTIPLIER 2
+#define COLUMNS 720
+#define OUT_OF_SCREEN_POS \
+    (v2) { WINDOW_WIDTH * 100, WINDOW_HEIGHT * 100 }
+#define in_range(a, min, max) (a <= max && a >= min)
+
+#define TEST_CASES 200000
+#define TOLERANCE 1e-6 // relative, in pixels for anything close to the screen
+
+// stand-ins for the game's globals
+v2 player_pos;
+double player_angle;
+double player_height;
+double pitch;
+v2 cameraOffset;
+v2 playerForward;
+double fov;
+double tanHalfFOV;
+double tanHalfStartFOV;
+
+double rad_to_deg(double radians) {
+    return radians * (180 / PI);
+}
+
+double deg_to_rad(double degrees) {
+    return degrees * (PI / 180);
+}
+
+double randf(double min, double max) {
+    return min + ((double)rand() / RAND_MAX) * (max - min);
+}
+
+double get_max_height() {
+    double fov_factor = tanHalfStartFOV / tanHalfFOV;
+    return (WALL_HEIGHT * WALL_HEIGHT_MULTIPLIER * WINDOW_HEIGHT) * fov_factor;
+}
+
+// copy of worldToScreen before the camera refactor
+v2 legacy_worldToScreen(v2 pos, double height, bool allow_out_of_screen) {
+
+    if (v2_equal(pos, player_pos)) {
+        return (v2){WINDOW_WIDTH / 2, WINDOW_HEIGHT};
+    }
+
+    double signed_angle_to_forward = v2_signed_angle_between(playerForward, v2_sub(pos, player_pos));
+
+    double signed_angle_degrees = rad_to_deg(signed_angle_to_forward);
+
+    if (!allow_out_of_screen && !in_range(signed_angle_degrees, -0.5 * fov, 0.5 * fov)) {
+        return OUT_OF_SCREEN_POS;
+    } else {
+        if (!in_range(signed_angle_degrees, -90, 90)) {
+            double dist_to_viewplane = abs(v2_distance(pos, player_pos) * v2_cos_angle_between(playerForward, v2_sub(pos, player_pos)));
+
+            pos = v2_add(pos, v2_mul(playerForward, to_vec(dist_to_viewplane + 2)));
+
+            signed_angle_to_forward = v2_signed_angle_between(playerForward, v2_sub(pos, player_pos));
+        }
+    }
+
+    double cos_angle_to_forward = v2_cos_angle_between(playerForward, v2_sub(pos, player_pos));
+
+    double dist_to_player = v2_distance(pos, player_pos);
+
+    double dist_to_viewplane = dist_to_player * cos_angle_to_forward;
+
+    if (dist_to_viewplane == 0) dist_to_viewplane = 0.001;
+
+    double fov_width_at_texture = 2 * dist_to_viewplane * tanHalfFOV;
+
+    double angle = acos(cos_angle_to_forward);
+
+    double texture_thing_width = dist_to_player * sin(angle);
+
+    double x_pos_sign = signed_angle_to_forward >= 0 ? 1 : -1;
+    double ratio = fov_width_at_texture == 0? 0 : texture_thing_width / fov_width_at_texture;
+    double x_pos = WINDOW_WIDTH / 2 + (ratio * WINDOW_WIDTH) * x_pos_sign;
+
+    double fov_factor = tanHalfStartFOV / tanHalfFOV;
+    double wallSize = WALL_HEIGHT * WALL_HEIGHT_MULTIPLIER * WINDOW_HEIGHT / dist_to_viewplane * fov_factor;
+    double y_pos = WINDOW_HEIGHT / 2 + wallSize / 2 - ((height - player_height + get_max_height() / 2) + WINDOW_HEIGHT / 2) / dist_to_viewplane;
+
+    x_pos += cameraOffset.x;
+    y_pos += -pitch + cameraOffset.y;
+
+    return (v2){x_pos, y_pos};
+}
+
+v2 legacy_world_to_screen_size(v2 size, v2 pos) {
+    double cos_angle_to_forward = v2_cos_angle_between(playerForward, v2_sub(pos, player_pos));
+
+    double dist = v2_distance(player_pos, pos);
+
+    double dist_from_viewplane = dist * cos_angle_to_forward;
+
+    double fov_factor = tanHalfFOV / tanHalfStartFOV;
+
+    return v2_div(size, to_vec(dist_from_viewplane * fov_factor));
+}
+
+v2 legacy_getRayDirByIdx(int i) {
+    double x = tanHalfFOV;
+    double idx = -x + ((double)(i + 1)) / COLUMNS * (2 * x);
+
+    v2 temp = v2_normalize((v2){1, idx});
+
+    return v2_dir((v2){0, 0}, v2_rotate(temp, deg_to_rad(player_angle)));
+}
+
+double max_error = 0;
+int failures = 0;
+
+void check(const char *what, v2 expected, v2 got, int test) {
+    // near the camera plane things are thousands of pixels off screen and the old trig loses digits,
+    // so compare relative to the magnitude
+    double scale = fmax(1, fmax(fabs(expected.x), fabs(expected.y)));
+    double error = fmax(fabs(expected.x - got.x), fabs(expected.y - got.y)) / scale;
+
+    if (error > max_error) max_error = error;
+
+    if (error > TOLERANCE) {
+        if (failures < 10) {
+            printf("%s mismatch (case %d): expected (%f, %f) got (%f, %f) \n", what, test, expected.x, expected.y, got.x, got.y);
+        }
+        failures++;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    srand(1234);
+
+    Camera camera = Camera_new(COLUMNS);
+
+    for (int test = 0; test < TEST_CASES; test++) {
+        player_pos = (v2){randf(0, 2000), randf(0, 2000)};
+        player_angle = randf(-720, 720);
+        player_height = randf(0, 100);
+        pitch = randf(-300, 300);
+        cameraOffset = (v2){randf(-10, 10), randf(-10, 10)};
+        fov = randf(60, 120);
+        tanHalfFOV = tan(deg_to_rad(fov / 2));
+        tanHalfStartFOV = tan(deg_to_rad(100.0 / 2));
+        playerForward = v2_rotate_to((v2){1, 0}, deg_to_rad(player_angle));
+
+        Camera_update(&camera, player_pos, player_angle, tanHalfFOV, tanHalfStartFOV, player_height, pitch, cameraOffset, V2(WINDOW_WIDTH, WINDOW_HEIGHT), COLUMNS);
+
+        v2 pos = v2_add(player_pos, v2_rotate_to((v2){randf(1, 800), 0}, randf(0, 2 * PI)));
+        double height = randf(-200, 200);
+        bool allow_out_of_screen = rand() % 2;
+
+        // skip points sitting on the fov edge or the camera plane, the two versions may round them differently
+        double edge_angle = fabs(rad_to_deg(v2_signed_angle_between(playerForward, v2_sub(pos, player_pos))));
+        if (fabs(edge_angle - fov / 2) < 1e-6 || fabs(edge_angle - 90) < 1e-3) continue;
+        if (fabs(Camera_depth(&camera, pos) - round(Camera_depth(&camera, pos))) < 1e-6) continue; // truncation boundary
+
+        v2 expected = legacy_worldToScreen(pos, height, allow_out_of_screen);
+        v2 got;
+        if (!Camera_project(&camera, pos, height, allow_out_of_screen, &got)) got = OUT_OF_SCREEN_POS;
+
+        check("Camera_project", expected, got, test);
+
+        Camera_project_batch(&camera, &pos, &height, &got, 1);
+        check("Camera_project_batch", legacy_worldToScreen(pos, height, true), got, test);
+
+        v2 size = {randf(1, 200), randf(1, 200)};
+        if (Camera_depth(&camera, pos) > 1) {
+            check("Camera_project_size", legacy_world_to_screen_size(size, pos), Camera_project_size(&camera, size, pos), test);
+        }
+
+        int column = rand() % COLUMNS;
+        check("Camera_ray_dir", legacy_getRayDirByIdx(column), Camera_ray_dir(&camera, column), test);
+    }
+
+    Camera_free(&camera);
+
+    printf("max relative error: %g \n", max_error);
+
+    if (failures > 0) {
+        printf("FAILED: %d mismatches \n", failures);
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}
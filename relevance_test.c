@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "relevance.c"
+
+// Players wander around a dungeon of rooms sending their position 10 times a second, the server relays each one to
+// whoever Rel_should_send() says. Counts the relayed packets against relaying everything to everyone, for lobbies
+// from 4 to 64 players with the dungeon growing along (about 2 players per room). Also checks the basic rules:
+// same room nearby always goes through, far away behind walls never does, REL_FAR gets rate limited, and something
+// going out of view gets hidden once.
+
+#define ROOM_W 1020.0 // ROOM_WIDTH * tileSize in the game
+#define ROOM_H 680.0
+#define SEND_RATE 10
+#define SECONDS 20
+#define SPEED 250.0
+#define PLAYERS_PER_ROOM 2
+
+typedef struct TestPlayer {
+    v2 pos, vel;
+} TestPlayer;
+
+int failures = 0;
+RelLayout layout;
+
+double randf(double min, double max) {
+    return min + ((double)rand() / RAND_MAX) * (max - min);
+}
+
+void make_dungeon(int size) {
+    Rel_set_grid(&layout, (v2){0, 0}, (v2){ROOM_W, ROOM_H}, size, size);
+
+    for (int r = 0; r < size; r++) {
+        for (int c = 0; c < size; c++) {
+            int area = r * size + c;
+            Rel_set_cell_area(&layout, c, r, area);
+
+            // a corridor row along the top so it's all connected, random doors elsewhere
+            if (c + 1 < size && (r == 0 || rand() % 2)) Rel_connect_areas(&layout, area, area + 1);
+            if (r + 1 < size && rand() % 2) Rel_connect_areas(&layout, area, area + size);
+        }
+    }
+}
+
+// relayed packets per second, per player
+double run(int player_count) {
+    int size = (int)ceil(sqrt((double)player_count / PLAYERS_PER_ROOM));
+    make_dungeon(size);
+    v2 world = {size * ROOM_W, size * ROOM_H};
+
+    TestPlayer players[64];
+    for (int i = 0; i < player_count; i++) {
+        double angle = randf(-PI, PI);
+        players[i] = (TestPlayer){{randf(0, world.x), randf(0, world.y)}, {cos(angle) * SPEED, sin(angle) * SPEED}};
+    }
+
+    long long relayed = 0;
+    double dt = 1.0 / SEND_RATE;
+
+    for (int step = 0; step < SECONDS * SEND_RATE; step++) {
+        double now = step * dt;
+
+        for (int i = 0; i < player_count; i++) {
+            TestPlayer *p = &players[i];
+            p->pos = v2_add(p->pos, v2_mul(p->vel, to_vec(dt)));
+            if (p->pos.x < 0 || p->pos.x > world.x) p->vel.x *= -1;
+            if (p->pos.y < 0 || p->pos.y > world.y) p->vel.y *= -1;
+
+            // player i's update, on_server_recv -> relay_player_pos()
+            SOCKET sender = (SOCKET)(i + 1);
+            Rel_set_viewer(sender, &layout, p->pos);
+
+            for (int j = 0; j < player_count; j++) {
+                if (j == i) continue;
+                if (Rel_should_send((SOCKET)(j + 1), i, p->pos, now)) relayed++;
+            }
+        }
+    }
+
+    for (int i = 0; i < player_count; i++) Rel_remove_viewer((SOCKET)(i + 1));
+
+    return (double)relayed / SECONDS / player_count;
+}
+
+void check(bool ok, const char *what) {
+    if (ok) return;
+    printf("%s \n", what);
+    failures++;
+}
+
+int main(int argc, char *argv[]) {
+    srand(argc > 1 ? atoi(argv[1]) : 42);
+    Rel_init(ROOM_W);
+
+    int counts[] = {4, 8, 16, 32, 64};
+    double per_player[5];
+
+    for (int i = 0; i < 5; i++) {
+        per_player[i] = run(counts[i]);
+        double everyone = (counts[i] - 1) * SEND_RATE;
+
+        printf("%2d players: %5.1f packets/s relayed to each, %5.1f if everyone got everything (%.0f%%) \n",
+            counts[i], per_player[i], everyone, 100 * per_player[i] / everyone);
+    }
+
+    // with the dungeon growing along, what each client gets should level off instead of growing with the lobby
+    check(per_player[4] < per_player[2] * 2, "Per player traffic grows with the lobby");
+    check(per_player[4] < (counts[4] - 1) * SEND_RATE * 0.25, "Not filtering enough in a big lobby");
+
+    // the rules, in a 3 x 1 dungeon where only the first two rooms are connected
+    Rel_set_grid(&layout, (v2){0, 0}, (v2){ROOM_W, ROOM_H}, 3, 1);
+    for (int c = 0; c < 3; c++) Rel_set_cell_area(&layout, c, 0, c);
+    Rel_connect_areas(&layout, 0, 1);
+
+    SOCKET viewer = 100;
+    check(Rel_level(viewer, (v2){ROOM_W * 2.5, 100}) == REL_NEAR, "Viewer without a position didn't get everything");
+
+    Rel_set_viewer(viewer, &layout, (v2){ROOM_W * 0.5, ROOM_H * 0.5});
+    check(Rel_level(viewer, (v2){ROOM_W * 0.6, ROOM_H * 0.5}) == REL_NEAR, "Same room, close by isn't REL_NEAR");
+    check(Rel_level(viewer, (v2){ROOM_W * 1.9, ROOM_H * 0.5}) == REL_FAR, "Connected room, far isn't REL_FAR");
+    check(Rel_level(viewer, (v2){ROOM_W * 2.5, ROOM_H * 0.5}) == REL_NONE, "Unconnected room, far isn't REL_NONE");
+
+    Rel_set_viewer(viewer, &layout, (v2){ROOM_W * 1.9, ROOM_H * 0.5});
+    check(Rel_level(viewer, (v2){ROOM_W * 2.1, ROOM_H * 0.5}) == REL_FAR, "Behind a wall but close isn't REL_FAR");
+
+    int sent = 0;
+    for (int i = 0; i < 100; i++) sent += Rel_should_send(viewer, 7, (v2){ROOM_W * 0.5, ROOM_H * 0.5}, i * 0.01);
+    check(sent == (int)ceil(REL_FAR_RATE), "REL_FAR updates not rate limited");
+
+    // walks from the viewer's room into the one it can't see and back
+    Rel_set_viewer(viewer, &layout, (v2){ROOM_W * 0.5, ROOM_H * 0.5});
+    v2 unseen = {ROOM_W * 2.5, ROOM_H * 0.5}, seen = {ROOM_W * 0.6, ROOM_H * 0.5};
+    check(Rel_decide(viewer, 8, seen, 10) == REL_SEND, "Visible update not sent");
+    check(Rel_decide(viewer, 8, unseen, 10.1) == REL_HIDE, "Going out of view didn't hide it");
+    check(Rel_decide(viewer, 8, unseen, 10.2) == REL_SKIP, "Hidden twice");
+    check(Rel_decide(viewer, 8, seen, 10.3) == REL_SEND, "Coming back into view not sent");
+    check(Rel_decide(viewer, 8, unseen, 10.4) == REL_HIDE, "Going out of view again didn't hide it");
+    check(Rel_decide(viewer, 9, unseen, 10.5) == REL_HIDE, "Something never sent but out of view didn't get hidden");
+
+    if (failures > 0) {
+        printf("FAILED: %d \n", failures);
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "core_utils.c"
+#include "replay.c"
+
+// Records a made up session (ticks, packets of every size, input) to a file and reads it back, everything has to
+// come out the same and in the same order. Then the RNG streams: a seed always gives the same numbers, and drawing
+// from one stream doesn't change what another one gives.
+
+#define TICKS 5000
+#define PATH "replay_test.hcrp"
+
+typedef struct Expected {
+    ReplayRecordKind kind;
+    double time;
+    bool paused;
+    MPPacket packet;
+    ReplayInput input;
+    char data[MP_DEFAULT_BUFFER_SIZE];
+} Expected;
+
+int expected_amount = 0;
+Expected *expected;
+
+double randf(double min, double max) {
+    return min + ((double)rand() / RAND_MAX) * (max - min);
+}
+
+void record_session() {
+    ReplayHeader header = {.tick_rate = 60, .dungeon_seed = -1, .rng_state = 0x0123456789ABCDEFULL};
+    if (!Replay_record(PATH, header)) exit(1);
+
+    double time = 12345.678;
+
+    for (int t = 0; t < TICKS; t++) {
+        time += randf(0.015, 0.018);
+
+        Expected *tick = &expected[expected_amount++];
+        *tick = (Expected){.kind = REPLAY_TICK, .time = time, .paused = rand() % 50 == 0};
+        Replay_record_tick(tick->time, tick->paused);
+
+        int packets = rand() % 4;
+        for (int i = 0; i < packets; i++) {
+            Expected *packet = &expected[expected_amount++];
+            int len = rand() % 10 == 0 ? MP_DEFAULT_BUFFER_SIZE : rand() % 64;
+            packet->kind = REPLAY_PACKET;
+            packet->packet = (MPPacket){.len = len, .type = rand() % 40, .is_broadcast = rand() % 2};
+            for (int b = 0; b < len; b++) packet->data[b] = rand();
+            Replay_record_packet(packet->packet, packet->data);
+        }
+
+        int inputs = rand() % 3;
+        for (int i = 0; i < inputs; i++) {
+            Expected *input = &expected[expected_amount++];
+            input->kind = REPLAY_INPUT;
+            input->input = (ReplayInput){rand() % 5, rand() % 600 - 300, rand() % 600 - 300};
+            Replay_record_input(input->input);
+        }
+    }
+
+    Replay_set_dungeon_seed(987654321);
+    Replay_stop();
+}
+
+int check_session() {
+    ReplayHeader header;
+    if (!Replay_open(PATH, &header)) return 1;
+
+    int failures = 0;
+    if (header.tick_rate != 60 || header.tick_count != TICKS || header.dungeon_seed != 987654321
+        || header.rng_state != 0x0123456789ABCDEFULL) {
+        printf("Header came back wrong: %d TPS, %d ticks, seed %lld \n", header.tick_rate, header.tick_count, header.dungeon_seed);
+        failures++;
+    }
+
+    const ReplayRecord *record;
+    int i = 0;
+    for (; (record = Replay_peek()) != NULL && i < expected_amount; i++, Replay_advance()) {
+        Expected *want = &expected[i];
+        bool same = record->kind == want->kind;
+
+        if (same && want->kind == REPLAY_TICK) {
+            same = record->time == want->time && record->paused == want->paused;
+        } else if (same && want->kind == REPLAY_PACKET) {
+            same = record->packet.type == want->packet.type && record->packet.len == want->packet.len
+                && record->packet.is_broadcast == want->packet.is_broadcast
+                && memcmp(record->data, want->data, want->packet.len) == 0;
+        } else if (same) {
+            same = record->input.event == want->input.event && record->input.a == want->input.a
+                && record->input.b == want->input.b;
+        }
+
+        if (!same) {
+            printf("Record %d (kind %d) came back different \n", i, want->kind);
+            failures++;
+            break;
+        }
+    }
+
+    if (failures == 0 && (i != expected_amount || Replay_peek() != NULL)) {
+        printf("Read %d records, wrote %d \n", i, expected_amount);
+        failures++;
+    }
+
+    Replay_close();
+    return failures;
+}
+
+// Cut off mid-record, the way a crash leaves it: everything before the cut still reads.
+int check_truncated() {
+    FILE *file = fopen(PATH, "rb");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *bytes = malloc(size);
+    fread(bytes, 1, size, file);
+    fclose(file);
+
+    file = fopen(PATH, "wb");
+    fwrite(bytes, 1, size - 3, file);
+    fclose(file);
+    free(bytes);
+
+    ReplayHeader header;
+    if (!Replay_open(PATH, &header)) return 1;
+
+    int records = 0;
+    while (Replay_peek() != NULL) {
+        records++;
+        Replay_advance();
+    }
+    Replay_close();
+
+    if (records != expected_amount - 1) {
+        printf("Truncated file gave %d records, expected %d \n", records, expected_amount - 1);
+        return 1;
+    }
+    return 0;
+}
+
+int check_rng() {
+    int failures = 0;
+    unsigned int first[100];
+
+    RNG_seed(&rng_dungeon, 42);
+    RNG *previous = RNG_use(&rng_dungeon);
+    for (int i = 0; i < 100; i++) first[i] = RNG_next(rng_current);
+
+    // same seed, with the game stream drawn from in between
+    RNG_seed(&rng_dungeon, 42);
+    for (int i = 0; i < 100; i++) {
+        RNG_use(&rng_game);
+        randi_range(0, 10);
+        RNG_use(&rng_dungeon);
+        if (RNG_next(rng_current) != first[i]) {
+            printf("Stream 42 gave something else at %d \n", i);
+            failures++;
+            break;
+        }
+    }
+    RNG_use(previous);
+
+    // ranges stay in range and hit both ends
+    int counts[7] = {0};
+    for (int i = 0; i < 70000; i++) {
+        int n = randi_range(-3, 3);
+        if (n < -3 || n > 3) {
+            printf("randi_range(-3, 3) gave %d \n", n);
+            failures++;
+            break;
+        }
+        counts[n + 3]++;
+    }
+    for (int i = 0; i < 7; i++) {
+        if (counts[i] < 9000 || counts[i] > 11000) {
+            printf("randi_range(-3, 3) gave %d %d times out of 70000 \n", i - 3, counts[i]);
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    srand(argc > 1 ? atoi(argv[1]) : 42);
+
+    expected = malloc(TICKS * 6 * sizeof(Expected));
+
+    record_session();
+
+    int failures = check_session();
+    failures += check_truncated();
+    failures += check_rng();
+
+    remove(PATH);
+    free(expected);
+
+    if (failures > 0) {
+        printf("FAILED \n");
+        return 1;
+    }
+
+    printf("%d records \n", expected_amount);
+    printf("OK \n");
+    return 0;
+}
@@ -0,0 +1,737 @@
+#ifndef SERVER_C
+#define SERVER_C
+
+#include <stdatomic.h>
+#include "core_utils.c"
+#include "globals.h"
+#include "multiplayer.c"
+#include "snapshot.c"
+#include "relevance.c"
+#include "pos_history.c"
+#include "packets.h"
+#include "dungeon.c"
+
+// The server side of the game: handing out ids and the dungeon seed, relaying packets, projectile snapshots.
+// A host runs this next to its own client, the dedicated server (dedicated_server.c) runs nothing else.
+//
+//     server_init(tick_delta);                     // once, before MPServer()
+//     server_start_workers(count);                 // optional, ticks matches on other threads
+//     server_tick(tick_delta, collect);            // every tick, after MP_dispatch_messages()
+//
+// Someone joining a match that's going gets the last position of every player in it straight away, and one of the
+// players already in there is asked for the rest (PACKET_REQUEST_JOIN_STATE), which goes to the newcomer as
+// PACKET_JOIN_STATE chunks. The server doesn't simulate anything, so it's the clients that know what's flying around.
+//
+// Hits are the shooter's call, but the server checks them first (match_check_shot()). Every player's position goes
+// into a PosHistory each tick, and a shot is checked against where its target was when the shooter saw it: its
+// round trip plus its interpolation delay ago. So a lower update rate makes for more interpolation delay, not misses.
+//
+// Everything about a game lives in a Match: its players, ids, seed, relevance layout. One process can run many.
+// A client says which one it wants with PACKET_JOIN_MATCH right after connecting (MATCH_ANY for whatever has room),
+// from then on all its packets go to that match and everything the match sends only goes to its own players.
+//
+// Needs MP_queue_messages(): on_server_recv() runs on the thread calling MP_dispatch_messages() and only routes
+// packets into each match's inbox. server_tick() then ticks every match, on the workers if there are any. A match
+// is only ever touched by one thread at a time, so nothing in it needs a lock.
+
+#define SERVER_TICK_RATE 40
+#define FAR_PROJECTILE_TOLERANCE_SCALE 8.0 // snapshot tolerances for projectiles a client only sees from afar
+#define SYNC_ID_LEASE_SIZE 64 // sync ids per block the server hands a client
+#define MATCH_MAX_LEASES 4 // blocks a player can hold at once, asking for more gets ignored until it uses them
+#define SERVER_MAX_MATCHES 64
+#define SERVER_MAX_WORKERS 16
+#define MATCH_INBOX_SIZE 256 // routed packets waiting for the match's next tick
+#define MATCH_ANY 0
+#define MATCH_EVENT_JOINED -100 // inbox only, never on the wire
+#define MATCH_EVENT_LEFT -101
+#define LAG_COMP_MAX_REWIND 0.5 // seconds, a shot from further behind is checked against where things were then
+#define LAG_COMP_HIT_TOLERANCE 4.0 // world units on top of the collider, for quantized directions and interpolation
+#define LAG_COMP_ORIGIN_TOLERANCE (3 * TILE_SIZE) // how far from where it last said it was a shot can start
+
+typedef struct MatchStats {
+    double cpu_time; // seconds, on whichever threads ticked it
+    long long packets_in, packets_out; // packets out counts one per recipient
+    long long hits_rejected; // shots whose hit didn't hold up, see match_check_shot()
+} MatchStats;
+
+typedef struct SyncIdRange {
+    int first, end;
+} SyncIdRange;
+
+typedef struct Match {
+    int id; // 0 = free slot
+    long dungeon_seed;
+    int next_player_id;
+    int next_sync_id;
+
+    int players_amount;
+    SOCKET players[MP_MAX_CLIENTS];
+    int player_ids[MP_MAX_CLIENTS];
+    struct player_pos_packet last_pos[MP_MAX_CLIENTS]; // what each one last said, for newcomers
+    bool has_pos[MP_MAX_CLIENTS];
+    PosHistory history[MP_MAX_CLIENTS]; // every position each one sent, for checking hits
+    SyncIdRange leases[MP_MAX_CLIENTS][MATCH_MAX_LEASES]; // handed out and not moved past yet, oldest first
+    int leases_amount[MP_MAX_CLIENTS];
+
+    RelLayout layout;
+    MPSCQueue inbox; // MPMessages, pushed by the routing thread
+    double snapshot_timer;
+    bool sent_snapshots;
+    MatchStats stats;
+} Match;
+
+typedef struct MatchRoute {
+    SOCKET socket;
+    Match *match; // NULL = turned away
+} MatchRoute;
+
+// seed of the first match, the ones after count up from it. -1 for random ones
+long server_dungeon_seed = -1;
+
+int server_max_matches = 1; // a host only runs its own
+int server_players_per_match = MP_MAX_CLIENTS;
+
+Match server_matches[SERVER_MAX_MATCHES];
+int server_matches_opened = 0;
+int server_next_match_id = 1;
+
+// only the routing thread touches these
+MatchRoute server_routes[MP_MAX_CONNECTIONS];
+int server_routes_amount = 0;
+
+// sockets that disconnected, from the I/O thread. Grows instead of ever making that thread wait on the routing one
+MPMutex server_departures_lock;
+SOCKET *server_departures = NULL;
+int server_departures_amount = 0;
+int server_departures_capacity = 0;
+
+int server_workers_amount = 0;
+MPSemaphore _server_round_start; // one post per worker to start a round of match ticks
+MPSemaphore _server_round_done; // posted by the last worker out
+atomic_int _server_next_match = 0; // next slot a worker claims
+atomic_int _server_busy = 0; // workers still in the round
+double _server_round_delta = 0;
+int (*_server_round_collect)(SnapState *states, int capacity) = NULL;
+
+bool is_sync_id_valid(int sync_id) {
+    if (sync_id < 42) return false;
+    // if (MP_is_server) {
+    //     if (sync_id > server_next_sync_id) return false;
+    // } else {
+    //     if (sync_id > client_last_seen_sync_id + 100) return false; // 100 so it's only violated by
+    // }
+
+
+    return true;
+}
+
+// The rooms are the relevance areas, a room sees into the ones it has a path carved to, and on through every room
+// after that in a straight line. The server doesn't load the room files so it can't tell if the doors line up,
+// a straight run of doors counts as seeing all the way along it. Too much is only some extra updates, too little
+// leaves players hidden that are in plain sight.
+void set_relevance_layout(RelLayout *layout, Room rooms[DUNGEON_SIZE][DUNGEON_SIZE]) {
+    if (!Rel_set_grid(layout, V2_ZERO, (v2){ROOM_WIDTH * TILE_SIZE, ROOM_HEIGHT * TILE_SIZE}, DUNGEON_SIZE, DUNGEON_SIZE)) return;
+
+    for (int r = 0; r < DUNGEON_SIZE; r++) {
+        for (int c = 0; c < DUNGEON_SIZE; c++) {
+            int area = r * DUNGEON_SIZE + c;
+            Rel_set_cell_area(layout, c, r, area);
+
+            for (int k = c; k + 1 < DUNGEON_SIZE && rooms[r][k].right != NULL; k++) Rel_connect_areas(layout, area, r * DUNGEON_SIZE + k + 1);
+            for (int k = r; k + 1 < DUNGEON_SIZE && rooms[k][c].down != NULL; k++) Rel_connect_areas(layout, area, (k + 1) * DUNGEON_SIZE + c);
+        }
+    }
+}
+
+// #MATCH
+
+// Roughly what a match costs: itself, its inbox, and what relevance and snapshots keep per player.
+size_t match_memory_usage(const Match *match) {
+    size_t per_player = sizeof(RelViewer) + (match->sent_snapshots ? sizeof(SnapClient) : 0);
+    return sizeof(Match) + (match->inbox.mask + 1) * match->inbox.slot_stride + match->players_amount * per_player;
+}
+
+void match_send_to(Match *match, MPPacket packet, void *data, SOCKET socket) {
+    MPServer_send_to(packet, data, socket);
+    match->stats.packets_out++;
+}
+
+// To every player in the match, the sender included like MPServer_send() did.
+void match_send_all(Match *match, MPPacket packet, void *data) {
+    MPServer_send_to_group(packet, data, match->players, match->players_amount);
+    match->stats.packets_out += match->players_amount;
+}
+
+void match_send_unreliable_all(Match *match, MPPacket packet, void *data) {
+    MPServer_send_unreliable_to_group(packet, data, match->players, match->players_amount);
+    match->stats.packets_out += match->players_amount;
+}
+
+// Its id, everyone already in here, the seed, where everyone is, then asks someone for the rest (see the top).
+void match_add_player(Match *match, SOCKET player_socket) {
+    if (match->players_amount >= MP_MAX_CLIENTS) return;
+
+    int player_id = match->next_player_id++;
+
+    match->players[match->players_amount] = player_socket;
+    match->player_ids[match->players_amount] = player_id;
+    match->has_pos[match->players_amount] = false;
+    PH_clear(&match->history[match->players_amount]);
+    match->leases_amount[match->players_amount] = 0;
+    match->players_amount++;
+
+    struct update_player_id_packet id_packet_data = {.id = player_id};
+
+    MPPacket packet = {
+        .is_broadcast = false,
+        .len = sizeof(id_packet_data),
+        .type = PACKET_UPDATE_PLAYER_ID
+    };
+
+    match_send_to(match, packet, &id_packet_data, player_socket);
+
+    match_send_all(match,
+        (MPPacket){.type = PACKET_PLAYER_JOINED, .len = sizeof(struct player_joined_packet), .is_broadcast = true},
+        &player_id
+    );
+
+    for (int i = 0; i < match->players_amount; i++) {
+        struct player_joined_packet packet_data = {.id = match->player_ids[i]};
+
+        MPPacket packet = {.type = PACKET_PLAYER_JOINED, .len = sizeof(struct player_joined_packet), .is_broadcast = false};
+
+        match_send_to(match, packet, &packet_data, player_socket);
+    }
+
+
+    MPPacket seed_packet = {
+        .is_broadcast = false,
+        .len = sizeof(struct dungeon_seed_packet),
+        .type = PACKET_DUNGEON_SEED
+    };
+
+    struct dungeon_seed_packet seed_packet_data = {
+        .seed = match->dungeon_seed
+    };
+
+    match_send_to(match, seed_packet, &seed_packet_data, player_socket);
+
+    // reliable, the ones that don't move wouldn't get sent again
+    for (int i = 0; i < match->players_amount; i++) {
+        if (!match->has_pos[i]) continue;
+
+        MPPacket pos_packet = {.type = PACKET_PLAYER_POS, .len = sizeof(struct player_pos_packet), .is_broadcast = false};
+        match_send_to(match, pos_packet, &match->last_pos[i], player_socket);
+    }
+
+    if (match->players_amount > 1) {
+        struct request_join_state_packet request = {.for_id = player_id};
+        MPPacket request_packet = {.type = PACKET_REQUEST_JOIN_STATE, .len = sizeof(request), .is_broadcast = false};
+
+        match_send_to(match, request_packet, &request, match->players[0]);
+    }
+
+    printf("Match %d: player %d joined \n", match->id, player_id);
+}
+
+void match_remove_player(Match *match, SOCKET player_socket) {
+    for (int i = 0; i < match->players_amount; i++) {
+        if (match->players[i] != player_socket) continue;
+
+        match->players_amount--;
+        match->players[i] = match->players[match->players_amount];
+        match->player_ids[i] = match->player_ids[match->players_amount];
+        match->last_pos[i] = match->last_pos[match->players_amount];
+        match->has_pos[i] = match->has_pos[match->players_amount];
+        match->history[i] = match->history[match->players_amount];
+        memcpy(match->leases[i], match->leases[match->players_amount], sizeof(match->leases[i]));
+        match->leases_amount[i] = match->leases_amount[match->players_amount];
+        break;
+    }
+}
+
+int match_player_index(Match *match, SOCKET socket) {
+    for (int i = 0; i < match->players_amount; i++) {
+        if (match->players[i] == socket) return i;
+    }
+    return -1;
+}
+
+// Hands a player the next block of sync ids, unless it's sitting on MATCH_MAX_LEASES already.
+void match_grant_sync_ids(Match *match, SOCKET socket) {
+    int i = match_player_index(match, socket);
+    if (i == -1) return;
+
+    if (match->leases_amount[i] >= MATCH_MAX_LEASES) {
+        printf("Match %d: player %d asked for sync ids with %d blocks to go \n", match->id, match->player_ids[i], MATCH_MAX_LEASES);
+        return;
+    }
+
+    SyncIdRange *lease = &match->leases[i][match->leases_amount[i]++];
+    *lease = (SyncIdRange){match->next_sync_id, match->next_sync_id + SYNC_ID_LEASE_SIZE};
+    match->next_sync_id = lease->end;
+
+    struct sync_id_lease_packet packet_data = {.first = lease->first, .count = SYNC_ID_LEASE_SIZE};
+    match_send_to(match, (MPPacket){.type = PACKET_SYNC_ID_LEASE, .len = sizeof(packet_data), .is_broadcast = false}, &packet_data, socket);
+}
+
+// Whether 'sync_id' is from one of the blocks this player was handed. Clients go through their blocks in the order
+// they got them, so using one means the blocks before it are done with, and those ids stop being accepted.
+bool match_use_sync_id(Match *match, SOCKET socket, int sync_id) {
+    int i = match_player_index(match, socket);
+    if (i == -1) return false;
+
+    for (int l = 0; l < match->leases_amount[i]; l++) {
+        SyncIdRange lease = match->leases[i][l];
+        if (sync_id < lease.first || sync_id >= lease.end) continue;
+
+        match->leases_amount[i] -= l;
+        memmove(match->leases[i], match->leases[i] + l, match->leases_amount[i] * sizeof(SyncIdRange));
+        return true;
+    }
+    return false;
+}
+
+// Snap_relevance: projectiles a client can only see from afar get corrected less, ones it can't see not at all.
+double projectile_relevance(SOCKET socket, const SnapState *state) {
+    switch (Rel_level(socket, state->pos)) {
+        case REL_NEAR: return 1;
+        case REL_FAR: return FAR_PROJECTILE_TOLERANCE_SCALE;
+        default: return SNAP_SKIP;
+    }
+}
+
+// Passes a player's position on to the players in the match it's relevant to, instead of everyone. The ones it just
+// went out of view for get told to hide it, otherwise they'd keep it (and shoot at it) where they last saw it.
+void relay_player_pos(Match *match, SOCKET sender, MPPacket packet, struct player_pos_packet *packet_data) {
+    Rel_set_viewer(sender, &match->layout, packet_data->pos);
+
+    for (int i = 0; i < match->players_amount; i++) {
+        if (match->players[i] != sender) continue;
+
+        // UDP, an older one can show up after a newer one
+        if (!match->has_pos[i] || packet_data->time >= match->last_pos[i].time) match->last_pos[i] = *packet_data;
+        match->has_pos[i] = true;
+        PH_push(&match->history[i], packet_data->time, MP_time(), packet_data->pos, packet_data->height);
+        break;
+    }
+
+    double now = MP_time();
+
+    for (int i = 0; i < match->players_amount; i++) {
+        SOCKET client = match->players[i];
+        if (client == sender) continue; // they know where they are
+
+        RelAction action = Rel_decide(client, packet_data->id, packet_data->pos, now);
+
+        if (action == REL_SEND) {
+            MPServer_send_unreliable_to(packet, packet_data, client);
+            match->stats.packets_out++;
+        } else if (action == REL_HIDE) {
+            struct player_hidden_packet hidden = {.id = packet_data->id, .time = packet_data->time};
+            match_send_to(match, (MPPacket){.type = PACKET_PLAYER_HIDDEN, .len = sizeof(hidden), .is_broadcast = false}, &hidden, client);
+        }
+    }
+}
+
+// Whether the hit a shot claims holds up when everyone is put back where the shooter saw them. Misses always do.
+bool match_check_shot(Match *match, SOCKET shooter, const struct ability_shoot_packet *shot) {
+    if (shot->hit_id == -1) return true;
+
+    int shooter_idx = -1, target_idx = -1;
+    for (int i = 0; i < match->players_amount; i++) {
+        if (match->players[i] == shooter) shooter_idx = i;
+        if (match->player_ids[i] == shot->hit_id) target_idx = i;
+    }
+    if (shooter_idx == -1 || target_idx == -1 || target_idx == shooter_idx) return false;
+    if (!match->has_pos[shooter_idx] || v2_length(shot->dir) < 0.5) return false;
+    if (v2_distance(shot->origin, match->last_pos[shooter_idx].pos) > LAG_COMP_ORIGIN_TOLERANCE) return false;
+
+    double rewind = fmin(MPServer_rtt(shooter) + fmax(shot->view_delay, 0), LAG_COMP_MAX_REWIND);
+
+    v2 target_pos;
+    double target_height;
+    if (!PH_rewind(&match->history[target_idx], MP_time() - rewind, &target_pos, &target_height)) return false;
+
+    double distance;
+    return v2_ray_circle(shot->origin, v2_normalize(shot->dir), target_pos, PLAYER_COLLIDER_RADIUS + LAG_COMP_HIT_TOLERANCE, &distance);
+}
+
+// Resent every few ticks anyway, so these go over UDP and a newer one replaces a lost one.
+bool is_snapshot_packet(int type) {
+    return type == PACKET_PLAYER_POS || type == PACKET_SYNC_PROJECTILE || type == PACKET_PROJECTILE_SNAPSHOT;
+}
+
+// #SERVER RECV
+// A packet from one of the match's players, on whichever thread is ticking the match.
+void match_handle_packet(Match *match, SOCKET socket, MPPacket packet, void *data) {
+    match->stats.packets_in++;
+
+    if (packet.type == MATCH_EVENT_JOINED) {
+        match_add_player(match, socket);
+        return;
+    }
+    if (packet.type == MATCH_EVENT_LEFT) {
+        match_remove_player(match, socket);
+        return;
+    }
+    if (packet.type == PACKET_REQUEST_DUNGEON_SEED) {
+        struct dungeon_seed_packet packet_data = {.seed = match->dungeon_seed};
+        MPPacket seed_packet = {.type = PACKET_DUNGEON_SEED, .len = sizeof(packet_data), .is_broadcast = false};
+
+        match_send_to(match, seed_packet, &packet_data, socket);
+        return;
+    }
+    if (packet.type == PACKET_JOIN_STATE) {
+        struct join_state_packet *chunk = data;
+        if (packet.len < JOIN_STATE_HEADER_SIZE) return;
+
+        for (int i = 0; i < match->players_amount; i++) {
+            if (match->player_ids[i] == chunk->for_id) match_send_to(match, packet, data, match->players[i]);
+        }
+        return;
+    }
+    if (packet.type == PACKET_REQUEST_JOIN_STATE) return; // only we ask for those
+    if (packet.type == PACKET_REQUEST_SYNC_IDS) {
+        match_grant_sync_ids(match, socket);
+        return;
+    }
+    if (packet.type > PACKETS_TO_SYNC && packet.type < PACKETS_TO_SYNC_END) {
+        // the ability packets all start the same way, sync id first
+        struct ability_bomb_packet *ability = data;
+        int sync_id = ability->sync_id;
+
+        if (sync_id != -1 && !match_use_sync_id(match, socket, sync_id)) {
+            printf("Got sync id %d that wasn't handed to its sender \n", sync_id);
+            return;
+        }
+
+        // everyone but the sender creates it from this packet, so snapshots only have to send what changes after
+        if (sync_id != -1) {
+            SnapState state = {
+                .id = sync_id,
+                .pos = ability->pos,
+                .height = ability->height,
+                .vel = ability->vel,
+                .h_vel = ability->height_vel
+            };
+            for (int i = 0; i < match->players_amount; i++) Snap_seed_to(match->players[i], state);
+        }
+    }
+
+    if (packet.type == PACKET_ABILITY_SHOOT && !match_check_shot(match, socket, data)) {
+        struct ability_shoot_packet *shot = data;
+        printf("Match %d: player %d's hit on %d didn't hold up \n", match->id, shot->shooter_id, shot->hit_id);
+
+        shot->hit_id = -1; // still a shot, everyone sees it, it just doesn't hurt
+        match->stats.hits_rejected++;
+    }
+
+    if (packet.type == PACKET_PLAYER_POS) {
+        relay_player_pos(match, socket, packet, data);
+    } else if (is_snapshot_packet(packet.type)) {
+        match_send_unreliable_all(match, packet, data);
+    } else {
+        match_send_all(match, packet, data);
+    }
+}
+
+// Handles what got routed to the match since last time, then every 1 / SERVER_TICK_RATE asks 'collect_projectiles'
+// for the state of every synced projectile (up to 'capacity') and sends each player a snapshot of what it needs.
+void match_tick(Match *match, double delta, int (*collect_projectiles)(SnapState *states, int capacity)) {
+    double cpu_started = MP_thread_cpu_time();
+
+    MPMessage *message;
+    while ((message = MQ_front(&match->inbox, NULL)) != NULL) {
+        match_handle_packet(match, message->socket, message->packet, message->data);
+        MQ_pop(&match->inbox);
+    }
+
+    match->snapshot_timer -= delta;
+    if (match->snapshot_timer <= 0 && collect_projectiles != NULL) {
+        match->snapshot_timer = 1.0 / SERVER_TICK_RATE;
+
+        static _Thread_local SnapState projectile_states[SNAP_MAX_ENTITIES];
+        int projectile_count = collect_projectiles(projectile_states, SNAP_MAX_ENTITIES);
+
+        // only what each client can't extrapolate on its own, all in one packet.
+        // straight to everyone, no need to go through our own client like the other packets
+        Snap_sort(projectile_states, projectile_count);
+        for (int i = 0; i < match->players_amount; i++) {
+            Snap_send_to(match->players[i], PACKET_PROJECTILE_SNAPSHOT, projectile_states, projectile_count);
+        }
+        match->sent_snapshots = true;
+    } else if (match->snapshot_timer <= 0) {
+        match->snapshot_timer = 1.0 / SERVER_TICK_RATE;
+    }
+
+    match->stats.cpu_time += MP_thread_cpu_time() - cpu_started;
+}
+
+// #ROUTING
+// Everything from here to server_tick() runs on the thread that calls MP_dispatch_messages().
+
+Match *server_find_match(int id) {
+    for (int i = 0; i < SERVER_MAX_MATCHES; i++) {
+        if (server_matches[i].id == id) return &server_matches[i];
+    }
+    return NULL;
+}
+
+int server_matches_amount() {
+    int amount = 0;
+    for (int i = 0; i < SERVER_MAX_MATCHES; i++) amount += server_matches[i].id != 0;
+    return amount;
+}
+
+// Players in it plus the ones routed to it that it hasn't seen join yet.
+int _server_match_load(Match *match) {
+    int load = 0;
+    for (int i = 0; i < server_routes_amount; i++) load += server_routes[i].match == match;
+    return load;
+}
+
+// Takes a free slot, NULL if there's none or we're at server_max_matches. 'id' 0 picks one.
+Match *_server_open_match(int id) {
+    if (server_matches_amount() >= server_max_matches) return NULL;
+
+    Match *match = NULL;
+    for (int i = 0; i < SERVER_MAX_MATCHES && match == NULL; i++) {
+        if (server_matches[i].id == 0) match = &server_matches[i];
+    }
+    if (match == NULL) return NULL;
+
+    while (id == 0 || server_find_match(id) != NULL) id = server_next_match_id++;
+
+    MPSCQueue inbox = match->inbox; // slots keep theirs
+    if (inbox.slots == NULL) {
+        inbox = MQ_new(MATCH_INBOX_SIZE, sizeof(MPMessage));
+        if (inbox.slots == NULL) return NULL;
+    }
+    while (MQ_front(&inbox, NULL) != NULL) MQ_pop(&inbox); // left over from the last match in this slot
+
+    *match = (Match){
+        .id = id,
+        .dungeon_seed = server_dungeon_seed == -1 ? rand() : server_dungeon_seed + server_matches_opened,
+        .next_player_id = 1234,
+        .next_sync_id = 42,
+        .inbox = inbox,
+        .snapshot_timer = 1.0 / SERVER_TICK_RATE
+    };
+    server_matches_opened++;
+
+    // the same layout every client builds from the seed, for relevance. Its own rooms and stream, the host's level
+    // build may be generating one on another thread
+    Room layout_rooms[DUNGEON_SIZE][DUNGEON_SIZE];
+    RNG layout_rng;
+    generate_dungeon(layout_rooms, &layout_rng, match->dungeon_seed);
+    set_relevance_layout(&match->layout, layout_rooms);
+
+    printf("Opened match %d, seed %ld \n", match->id, match->dungeon_seed);
+    return match;
+}
+
+// Matches everyone left, between rounds so no worker has it.
+void _server_close_empty_matches() {
+    for (int i = 0; i < SERVER_MAX_MATCHES; i++) {
+        Match *match = &server_matches[i];
+        if (match->id == 0 || match->players_amount > 0 || _server_match_load(match) > 0) continue;
+        if (MQ_front(&match->inbox, NULL) != NULL) continue;
+
+        printf("Closed match %d \n", match->id);
+        match->id = 0;
+    }
+}
+
+MatchRoute *_server_find_route(SOCKET socket) {
+    for (int i = 0; i < server_routes_amount; i++) {
+        if (server_routes[i].socket == socket) return &server_routes[i];
+    }
+    return NULL;
+}
+
+void _server_post(Match *match, SOCKET socket, MPPacket packet, void *data) {
+    MPMessage message;
+    message.socket = socket;
+    message.for_client = false;
+    message.packet = packet;
+    if (packet.len > 0) memcpy(message.data, data, packet.len);
+
+    if (!MQ_push(&match->inbox, &message, offsetof(MPMessage, data) + packet.len)) {
+        fprintf(stderr, "Match %d inbox full, dropped a packet of type %d. \n", match->id, packet.type);
+    }
+}
+
+// The lobby handshake: picks the match for a socket that hasn't got one. NULL if it got turned away.
+Match *_server_route_new_client(SOCKET socket, int wanted_id) {
+    Match *match = NULL;
+
+    if (wanted_id != MATCH_ANY) {
+        match = server_find_match(wanted_id);
+        if (match == NULL) match = _server_open_match(wanted_id);
+    } else {
+        // fill up what's running before opening more
+        for (int i = 0; i < SERVER_MAX_MATCHES && match == NULL; i++) {
+            Match *candidate = &server_matches[i];
+            if (candidate->id != 0 && _server_match_load(candidate) < server_players_per_match) match = candidate;
+        }
+        if (match == NULL) match = _server_open_match(0);
+    }
+
+    if (match != NULL && _server_match_load(match) >= server_players_per_match) match = NULL;
+
+    if (server_routes_amount >= MP_MAX_CONNECTIONS) {
+        // can't remember that it was turned away, so it would keep asking with every packet
+        printf("No route left for a player, kicking it \n");
+        MPServer_send_to((MPPacket){.type = PACKET_HOST_LEFT, .len = 0, .is_broadcast = false}, NULL, socket);
+        MPServer_kick(socket);
+        return NULL;
+    }
+    server_routes[server_routes_amount++] = (MatchRoute){socket, match};
+
+    if (match == NULL) {
+        printf("No room for a player asking for match %d \n", wanted_id);
+        MPServer_send_to((MPPacket){.type = PACKET_HOST_LEFT, .len = 0, .is_broadcast = false}, NULL, socket);
+        return NULL;
+    }
+
+    _server_post(match, socket, (MPPacket){.type = MATCH_EVENT_JOINED, .len = 0}, NULL);
+    return match;
+}
+
+// Disconnects reach the routing thread through server_departures, so a match only hears about it in its inbox.
+void _server_handle_departures() {
+    MP_mutex_lock(&server_departures_lock);
+
+    for (int i = 0; i < server_departures_amount; i++) {
+        MatchRoute *route = _server_find_route(server_departures[i]);
+
+        if (route != NULL) {
+            if (route->match != NULL) _server_post(route->match, server_departures[i], (MPPacket){.type = MATCH_EVENT_LEFT, .len = 0}, NULL);
+            *route = server_routes[--server_routes_amount];
+        }
+    }
+    server_departures_amount = 0;
+
+    MP_mutex_unlock(&server_departures_lock);
+}
+
+void on_server_recv(SOCKET socket, MPPacket packet, void *data) {
+
+    if (packet.len > MP_DEFAULT_BUFFER_SIZE) {
+        printf("corrupted on_server_recv \n");
+        commit_sudoku();
+    }
+
+    // a disconnect that came in before this packet frees up its socket number first
+    _server_handle_departures();
+
+    MatchRoute *route = _server_find_route(socket);
+
+    if (route == NULL) {
+        int wanted_id = MATCH_ANY;
+        if (packet.type == PACKET_JOIN_MATCH) wanted_id = ((struct join_match_packet *)data)->match_id;
+
+        Match *match = _server_route_new_client(socket, wanted_id);
+        if (match != NULL && packet.type != PACKET_JOIN_MATCH) _server_post(match, socket, packet, data);
+        return;
+    }
+
+    if (route->match == NULL || packet.type == PACKET_JOIN_MATCH) return; // turned away, or asking twice
+
+    _server_post(route->match, socket, packet, data);
+}
+
+// I/O thread
+void on_player_disconnect(SOCKET player_socket) {
+    Snap_remove_client(player_socket);
+    Rel_remove_viewer(player_socket);
+
+    MP_mutex_lock(&server_departures_lock);
+
+    if (server_departures_amount == server_departures_capacity) {
+        int capacity = server_departures_capacity == 0 ? MP_MAX_CONNECTIONS : server_departures_capacity * 2;
+        SOCKET *grown = realloc(server_departures, capacity * sizeof(SOCKET));
+        if (grown == NULL) {
+            fprintf(stderr, "Out of memory, lost the departure of socket %d. \n", (int)player_socket);
+            MP_mutex_unlock(&server_departures_lock);
+            return;
+        }
+        server_departures = grown;
+        server_departures_capacity = capacity;
+    }
+    server_departures[server_departures_amount++] = player_socket;
+
+    MP_mutex_unlock(&server_departures_lock);
+}
+
+// #WORKERS
+
+void _server_run_matches() {
+    int i;
+    while ((i = atomic_fetch_add(&_server_next_match, 1)) < SERVER_MAX_MATCHES) {
+        if (server_matches[i].id != 0) match_tick(&server_matches[i], _server_round_delta, _server_round_collect);
+    }
+}
+
+MP_THREAD_RETURN _server_worker(void *data) {
+    while (true) {
+        MP_semaphore_wait(&_server_round_start);
+
+        MP_begin_batch(); // batches are per thread, the caller's doesn't cover us
+        _server_run_matches();
+        MP_end_batch();
+        if (atomic_fetch_sub(&_server_busy, 1) == 1) MP_semaphore_post(&_server_round_done, 1);
+    }
+
+    return 0;
+}
+
+// Worker threads that tick matches next to the one calling server_tick(). 0 ticks them all on that thread.
+void server_start_workers(int count) {
+    if (server_workers_amount > 0) return;
+
+    server_workers_amount = count < SERVER_MAX_WORKERS ? count : SERVER_MAX_WORKERS;
+    MP_semaphore_init(&_server_round_start, 0);
+    MP_semaphore_init(&_server_round_done, 0);
+    for (int i = 0; i < server_workers_amount; i++) MP_thread_start(_server_worker, NULL);
+}
+
+// Hooks the server side up to multiplayer.c. 'tick_delta' is the fixed step clients simulate projectiles with.
+void server_init(double tick_delta) {
+    _MP_on_client_disconnected = on_player_disconnect;
+    _MP_server_handle_recv = on_server_recv;
+    _MP_on_datagram_acked = Snap_on_acked;
+
+    MP_mutex_init(&server_departures_lock);
+
+    Snap_init(tick_delta, REFERENCE_TPS);
+    Snap_relevance = projectile_relevance;
+    Rel_init(ROOM_WIDTH * TILE_SIZE); // about a room away
+}
+
+// Ticks every match once, see match_tick(). 'collect_projectiles' is NULL if this server doesn't simulate projectiles,
+// a host passes its own, which only makes sense with the one match it runs.
+void server_tick(double delta, int (*collect_projectiles)(SnapState *states, int capacity)) {
+    _server_handle_departures();
+
+    if (server_workers_amount == 0) {
+        for (int i = 0; i < SERVER_MAX_MATCHES; i++) {
+            if (server_matches[i].id != 0) match_tick(&server_matches[i], delta, collect_projectiles);
+        }
+    } else {
+        _server_round_delta = delta;
+        _server_round_collect = collect_projectiles;
+        atomic_store(&_server_next_match, 0);
+        atomic_store(&_server_busy, server_workers_amount);
+        MP_semaphore_post(&_server_round_start, server_workers_amount);
+
+        _server_run_matches(); // help out instead of just waiting
+
+        MP_semaphore_wait(&_server_round_done);
+    }
+
+    _server_close_empty_matches();
+}
+
+#endif
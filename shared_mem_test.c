@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shared_mem.c"
+
+// Two processes open the same block: this one makes it and fills it a bit late, the second one (this program
+// started again with "child") has to wait for it, then read exactly what was written. Then a block of the wrong
+// size has to come back unshared instead of half mapped.
+
+#define SIZE (8 * 1024 * 1024 + 123)
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+unsigned char pattern(size_t i) {
+    return (unsigned char)(i * 2654435761u >> 13);
+}
+
+int run_child(const char *name) {
+    SharedMem shm;
+    if (!Shm_open(&shm, name, SIZE)) {
+        printf("child couldn't open it \n");
+        return 1;
+    }
+    if (shm.owner) {
+        printf("child made its own instead of opening ours \n");
+        Shm_close(&shm);
+        return 1;
+    }
+
+    const unsigned char *data = shm.data;
+    for (size_t i = 0; i < SIZE; i++) {
+        if (data[i] != pattern(i)) {
+            printf("child read %d at %zu, expected %d \n", data[i], i, pattern(i));
+            Shm_close(&shm);
+            return 1;
+        }
+    }
+
+    Shm_close(&shm);
+    printf("child ok \n");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[1], "child") == 0) return run_child(argv[2]);
+
+    char name[SHM_MAX_NAME];
+    snprintf(name, sizeof(name), "shared_mem_test_%lld", _Shm_pid());
+
+    int failures = 0;
+    SharedMem shm;
+
+    if (!Shm_open(&shm, name, SIZE) || !shm.owner) {
+        printf("Couldn't make '%s' \n", name);
+        printf("FAILED \n");
+        return 1;
+    }
+
+    char command[512];
+    snprintf(command, sizeof(command), "\"%s\" child %s", argv[0], name);
+    FILE *child = popen(command, "r");
+
+    _Shm_sleep(200); // the child should be waiting by now
+
+    unsigned char *data = shm.data;
+    for (size_t i = 0; i < SIZE; i++) data[i] = pattern(i);
+    Shm_publish(&shm);
+
+    char line[128] = "";
+    bool child_ok = false;
+    while (child != NULL && fgets(line, sizeof(line), child) != NULL) {
+        if (strncmp(line, "child ok", 8) == 0) child_ok = true;
+        else printf("%s", line);
+    }
+    if (child == NULL || pclose(child) != 0 || !child_ok) {
+        printf("The other process didn't read it right \n");
+        failures++;
+    }
+
+    SharedMem wrong_size;
+    if (Shm_open(&wrong_size, name, SIZE / 2)) {
+        printf("Opened it as half the size \n");
+        Shm_close(&wrong_size);
+        failures++;
+    }
+
+    Shm_close(&shm);
+
+    if (failures > 0) {
+        printf("FAILED \n");
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "snapshot.c"
+#include "packets.h"
+
+// Keeps a bunch of bombs in the air and shoves them around now and then, sends delta snapshots of them to a simulated
+// client over a lossy channel that reorders and delays, with delayed acks, and checks the client's copy stays close
+// to the server's while sending a lot less than a full sync_projectile_packet per projectile per tick did.
+
+#define PROJECTILES 80
+#define SECONDS 20
+#define TPS 144
+#define REFERENCE_TPS 144
+#define SERVER_TICK_RATE 40
+#define LOSS 0.2
+#define LATENCY_TICKS 6 // ~40 ms each way
+#define JITTER_TICKS 12 // on top of that, way more than a server tick so datagrams overtake each other
+#define SETTLE_TICKS 72 // half a second after a shove, the client should have it by then
+#define MAX_HEIGHT 34800 // get_max_height() in the game
+#define SIZE 8000 // bomb size
+#define GRAVITY (-2000 * 0.6)
+#define KICK_ONE_IN 300 // per projectile per tick
+
+#define TILEMAP_SIZE 2040
+
+#define DATAGRAM_SIZE (MP_UDP_BATCH_SIZE - MP_DATAGRAM_HEADER_SIZE - MP_MAX_HEADER_SIZE) // under the MTU
+
+typedef struct PendingAck {
+    int tick;
+    unsigned short seq;
+} PendingAck;
+
+typedef struct InFlight {
+    int tick; // when it arrives
+    unsigned short seq;
+    int len;
+    unsigned char data[DATAGRAM_SIZE];
+} InFlight;
+
+SnapState server[PROJECTILES];
+SnapState client[PROJECTILES];
+unsigned int client_stamps[PROJECTILES]; // Projectile.snap_stamp
+int disturbed_tick[PROJECTILES]; // last shove or respawn
+int next_id = 42;
+
+double randf(double min, double max) {
+    return min + ((double)rand() / RAND_MAX) * (max - min);
+}
+
+SnapState new_bomb() {
+    SnapState s = {0};
+    s.id = next_id++;
+    s.pos = (v2){randf(100, TILEMAP_SIZE - 100), randf(100, TILEMAP_SIZE * 2.0 / 3 - 100)};
+    s.vel = (v2){randf(-3, 3), randf(-3, 3)};
+    s.height = randf(SIZE, MAX_HEIGHT / 2);
+    s.h_vel = randf(-20, 40);
+    s.h_accel = GRAVITY;
+    return s;
+}
+
+// Projectile_tick() minus the node stuff. Returns false when it hits the floor and blows up
+bool step(SnapState *s, double delta) {
+    s->vel = v2_add(s->vel, v2_mul(s->accel, to_vec(delta * REFERENCE_TPS)));
+    s->h_vel += s->h_accel * delta;
+
+    s->pos = v2_add(s->pos, v2_mul(s->vel, to_vec(delta * REFERENCE_TPS)));
+    s->height += s->h_vel * delta * REFERENCE_TPS;
+
+    if (s->height - SIZE / 2 <= 0) return false;
+
+    if (s->height + SIZE / 2 >= MAX_HEIGHT) {
+        s->h_vel *= -1;
+        s->height = MAX_HEIGHT - SIZE / 2;
+    }
+    return true;
+}
+
+int find_client_copy(int id) {
+    for (int i = 0; i < PROJECTILES; i++) {
+        if (client[i].id == id) return i;
+    }
+    return -1;
+}
+
+// What client_handle_projectile_snapshot() does, plus moving what it got forward by how long it was in flight so the
+// errors below are about what got sent, not about the latency. Returns false if it didn't decode right
+bool client_receive(const unsigned char *data, int len, double now) {
+    SnapState updates[SNAP_MAX_PER_MESSAGE];
+    unsigned int stamp;
+
+    if (Snap_read(data, len - 1, &stamp, updates, SNAP_MAX_PER_MESSAGE) != -1) return false; // truncated
+    int count = Snap_read(data, len, &stamp, updates, SNAP_MAX_PER_MESSAGE);
+    if (count < 0) return false;
+
+    for (int i = 0; i < count; i++) {
+        int index = find_client_copy(updates[i].id);
+        if (index == -1) continue;
+
+        if (client_stamps[index] != 0 && !Snap_is_newer(stamp, client_stamps[index])) continue;
+        client_stamps[index] = stamp;
+
+        SnapState *copy = &client[index];
+        SnapState got = *copy;
+        if (updates[i].fields & SNAP_POS) got.pos = updates[i].pos;
+        if (updates[i].fields & SNAP_VEL) got.vel = updates[i].vel;
+        if (updates[i].fields & SNAP_HEIGHT) got.height = updates[i].height;
+        if (updates[i].fields & SNAP_H_VEL) got.h_vel = updates[i].h_vel;
+
+        got = Snap_extrapolate(got, now - stamp / 1000.0);
+        if (updates[i].fields & SNAP_POS) copy->pos = got.pos;
+        if (updates[i].fields & SNAP_VEL) copy->vel = got.vel;
+        if (updates[i].fields & SNAP_HEIGHT) copy->height = got.height;
+        if (updates[i].fields & SNAP_H_VEL) copy->h_vel = got.h_vel;
+    }
+    return true;
+}
+
+// Two snapshots of one shoved bomb, the second overtakes the first and the acks come back the wrong way around too.
+// The client has to keep the newer state, and the server has to keep it as the baseline.
+bool overtaken_check() {
+    SnapClient *snap = Snap_client_new(1);
+    SnapState bomb = new_bomb();
+    client[0] = bomb;
+    Snap_seed(snap, bomb, 0);
+
+    unsigned char first[DATAGRAM_SIZE], second[DATAGRAM_SIZE];
+    int cursor = 0;
+
+    bomb.h_vel = -GRAVITY * 0.2;
+    int first_len = Snap_encode(snap, &bomb, 1, &cursor, 0.025, first, sizeof(first));
+    Snap_commit(snap, 0);
+
+    bomb.h_vel = GRAVITY * 0.2;
+    cursor = 0;
+    int second_len = Snap_encode(snap, &bomb, 1, &cursor, 0.05, second, sizeof(second));
+    Snap_commit(snap, 1);
+
+    bool ok = first_len > 0 && second_len > 0;
+    ok = ok && client_receive(second, second_len, 0.05) && client_receive(first, first_len, 0.05);
+    ok = ok && client[0].h_vel == bomb.h_vel;
+
+    Snap_ack(snap, 1);
+    Snap_ack(snap, 0);
+    SnapBaseline *baseline = _Snap_find_baseline(snap, bomb.id);
+    ok = ok && baseline != NULL && baseline->time == 0.05 && baseline->state.h_vel == bomb.h_vel;
+
+    free(snap);
+    client[0] = (SnapState){0};
+    client_stamps[0] = 0;
+    snap_stats = (SnapStats){0};
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    srand(argc > 1 ? atoi(argv[1]) : 42);
+
+    v2 world_size = {TILEMAP_SIZE, TILEMAP_SIZE * 2.0 / 3};
+    Wire_set_world_bounds(v2_mul(world_size, to_vec(-0.5)), v2_mul(world_size, to_vec(1.5)));
+    Snap_init(1.0 / TPS, REFERENCE_TPS);
+
+    if (!overtaken_check()) {
+        printf("A snapshot that got overtaken undid the newer one \n");
+        printf("FAILED \n");
+        return 1;
+    }
+
+    SnapClient *snap = Snap_client_new(1);
+
+    for (int i = 0; i < PROJECTILES; i++) {
+        server[i] = new_bomb();
+        client[i] = server[i]; // the ability packet that created it
+        Snap_seed(snap, server[i], 0);
+    }
+
+    static PendingAck acks[SECONDS * TPS];
+    int ack_count = 0;
+    static InFlight in_flight[SECONDS * TPS];
+    int in_flight_count = 0;
+    unsigned short seq = 0;
+    int last_delivered_seq = -1;
+
+    long long full_bytes = 0;
+    int samples = 0, off_samples = 0, respawns = 0, kicks = 0, reordered = 0;
+    double worst_pos = 0, worst_height = 0, settled_pos = 0, settled_height = 0;
+    double tick_timer = 0;
+
+    for (int tick = 0; tick < SECONDS * TPS; tick++) {
+        double now = (double)tick / TPS;
+
+        // the client's copy blowing up on its own is fine, the server's decides when a new one gets thrown
+        for (int i = 0; i < PROJECTILES; i++) {
+            step(&client[i], 1.0 / TPS);
+
+            // a forcefield shoving it around, which the client only hears about through the snapshots
+            if (rand() % KICK_ONE_IN == 0) {
+                server[i].vel = v2_add(server[i].vel, (v2){randf(-1, 1), randf(-1, 1)});
+                server[i].h_vel = -GRAVITY * 0.2;
+                disturbed_tick[i] = tick;
+                kicks++;
+            }
+
+            if (!step(&server[i], 1.0 / TPS)) {
+                server[i] = new_bomb();
+                client[i] = server[i];
+                client_stamps[i] = 0;
+                disturbed_tick[i] = tick;
+                Snap_seed(snap, server[i], now);
+                respawns++;
+            }
+        }
+
+        // in the order they arrive, not the order they were sent
+        for (int i = 0; i < in_flight_count; i++) {
+            if (in_flight[i].tick > tick) continue;
+
+            if (!client_receive(in_flight[i].data, in_flight[i].len, now)) {
+                printf("Snapshot of %d bytes didn't decode right \n", in_flight[i].len);
+                return 1;
+            }
+            if ((short)(in_flight[i].seq - last_delivered_seq) < 0) reordered++;
+            else last_delivered_seq = in_flight[i].seq;
+
+            // the ack rides back on the client's next datagram, which can get lost too
+            if (randf(0, 1) >= LOSS) acks[ack_count++] = (PendingAck){tick + LATENCY_TICKS + rand() % JITTER_TICKS, in_flight[i].seq};
+
+            in_flight[i--] = in_flight[--in_flight_count];
+        }
+
+        for (int i = 0; i < ack_count; i++) {
+            if (acks[i].tick > tick) continue;
+            Snap_ack(snap, acks[i].seq);
+            acks[i--] = acks[--ack_count];
+        }
+
+        tick_timer -= 1.0 / TPS;
+        if (tick_timer <= 0) {
+            tick_timer = 1.0 / SERVER_TICK_RATE;
+
+            SnapState sorted[PROJECTILES];
+            memcpy(sorted, server, sizeof(server));
+            Snap_sort(sorted, PROJECTILES);
+            Snap_prune(snap, sorted, PROJECTILES);
+
+            int cursor = 0;
+            while (cursor < PROJECTILES) {
+                InFlight *datagram = &in_flight[in_flight_count];
+                int len = Snap_encode(snap, sorted, PROJECTILES, &cursor, now, datagram->data, DATAGRAM_SIZE);
+                if (len == 0) continue;
+
+                Snap_commit(snap, seq);
+
+                if (randf(0, 1) >= LOSS) {
+                    datagram->tick = tick + LATENCY_TICKS + rand() % JITTER_TICKS;
+                    datagram->seq = seq;
+                    datagram->len = len;
+                    in_flight_count++;
+                }
+                seq++;
+            }
+
+            // what the old per projectile sync cost
+            struct sync_projectile_packet full;
+            unsigned char wire[MP_MAX_PAYLOAD], header[MP_MAX_HEADER_SIZE];
+            for (int i = 0; i < PROJECTILES; i++) {
+                full = (struct sync_projectile_packet){server[i].pos, server[i].vel, server[i].height, server[i].h_vel, server[i].id};
+                int len = encode_packet_payload(PACKET_SYNC_PROJECTILE, &full, sizeof(full), wire, sizeof(wire));
+                full_bytes += MP_encode_header((MPPacket){.type = PACKET_SYNC_PROJECTILE, .len = len, .is_broadcast = true}, header) + len;
+            }
+        }
+
+        for (int i = 0; i < PROJECTILES; i++) {
+            double pos_error = v2_distance(server[i].pos, client[i].pos);
+            double height_error = fabs(server[i].height - client[i].height);
+
+            worst_pos = fmax(worst_pos, pos_error);
+            worst_height = fmax(worst_height, height_error);
+            if (tick - disturbed_tick[i] > SETTLE_TICKS) {
+                settled_pos = fmax(settled_pos, pos_error);
+                settled_height = fmax(settled_height, height_error);
+            }
+
+            // nothing the client can do before the correction had time to get there
+            if (tick - disturbed_tick[i] <= LATENCY_TICKS + JITTER_TICKS) continue;
+            samples++;
+            if (pos_error > SNAP_POS_TOLERANCE * 2 || height_error > SNAP_HEIGHT_TOLERANCE * 2) off_samples++;
+        }
+    }
+
+    double ratio = (double)snap_stats.bytes / full_bytes;
+
+    printf("%d projectiles, %d respawns, %d kicks, %d%% loss \n", PROJECTILES, respawns, kicks, (int)(LOSS * 100));
+    printf("full sync: %lld bytes, snapshots: %lld bytes in %lld messages (%.1f%%) \n", full_bytes, snap_stats.bytes, snap_stats.messages, ratio * 100);
+    printf("sent %lld of %lld projectile states \n", snap_stats.entities_sent, snap_stats.entities);
+    printf("%d datagrams arrived out of order \n", reordered);
+    printf("worst error: pos %.2f, height %.1f, %.2f%% of samples past twice the tolerance \n", worst_pos, worst_height, 100.0 * off_samples / samples);
+    printf("worst error once settled: pos %.2f, height %.1f \n", settled_pos, settled_height);
+
+    int failures = 0;
+
+    if (ratio > 0.25) {
+        printf("Snapshots aren't saving enough \n");
+        failures++;
+    }
+    // a shove isn't seen until the next server tick (or the one after if it's lost), full syncs had that too
+    if ((double)off_samples / samples > 0.02) {
+        printf("Client drifted too often \n");
+        failures++;
+    }
+    // right after a shove the error only depends on how many corrections in a row got lost, but once things settle
+    // a late datagram or a baseline the client never had would leave it off for up to SNAP_REFRESH_TIME
+    if (settled_pos > SNAP_POS_TOLERANCE || settled_height > SNAP_HEIGHT_TOLERANCE) {
+        printf("Client stayed off after settling \n");
+        failures++;
+    }
+    if (reordered == 0) {
+        printf("Nothing got reordered \n");
+        failures++;
+    }
+
+    if (failures > 0) {
+        printf("FAILED \n");
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}
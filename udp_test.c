@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "multiplayer.c"
+
+// Runs a server and a client in this process over loopback with the UDP shim dropping and delaying datagrams,
+// and checks that unreliable snapshots arrive at most once each, in whatever order, that exactly the ones that
+// arrived get acked, and that the reliable packets sent alongside them all arrive in order.
+
+#define PORT 21155
+#define SNAPSHOTS 800
+#define EVENT_EVERY 10
+#define LOSS 0.2
+#define LATENCY_MS 30
+#define JITTER_MS 20
+#define FALLBACK_SNAPSHOTS 20
+
+enum {
+    TEST_SNAPSHOT,
+    TEST_EVENT
+};
+
+SOCKET server_side_client = INVALID_SOCKET;
+
+volatile int server_snapshots = 0;
+volatile int server_last_snapshot = -1;
+volatile int client_snapshots = 0;
+volatile int client_last_snapshot = -1;
+volatile int events = 0;
+volatile int out_of_order = 0; // of the reliable ones, or snapshots delivered twice
+volatile int reordered = 0; // snapshots that came after a newer one, fine as long as they come once
+bool server_got[SNAPSHOTS + FALLBACK_SNAPSHOTS];
+bool client_got[SNAPSHOTS];
+
+volatile int client_acks = 0;
+volatile int duplicate_acks = 0;
+bool acked_seqs[65536];
+
+void on_connect(SOCKET socket) {
+    server_side_client = socket;
+}
+
+void on_server_recv(SOCKET socket, MPPacket packet, void *data) {
+    int counter = *(int *)data;
+
+    if (packet.type == TEST_SNAPSHOT) {
+        if (server_got[counter]) {
+            printf("Server got snapshot %d twice \n", counter);
+            out_of_order++;
+        }
+        server_got[counter] = true;
+        if (counter < server_last_snapshot) reordered++;
+        else server_last_snapshot = counter;
+        server_snapshots++;
+    } else if (packet.type == TEST_EVENT) {
+        if (counter != events) {
+            printf("Event %d arrived, expected %d \n", counter, events);
+            out_of_order++;
+        }
+        events++;
+    }
+}
+
+void on_client_recv(MPPacket packet, void *data) {
+    int counter = *(int *)data;
+
+    if (packet.type != TEST_SNAPSHOT) return;
+
+    if (client_got[counter]) {
+        printf("Client got snapshot %d twice \n", counter);
+        out_of_order++;
+    }
+    client_got[counter] = true;
+    if (counter < client_last_snapshot) reordered++;
+    else client_last_snapshot = counter;
+    client_snapshots++;
+}
+
+void on_acked(SOCKET socket, unsigned short seq) {
+    if (socket != MPClient_socket) return;
+
+    if (acked_seqs[seq]) duplicate_acks++;
+    acked_seqs[seq] = true;
+    client_acks++;
+}
+
+bool wait_for(volatile bool *flag, int timeout_ms) {
+    for (int waited = 0; waited < timeout_ms && !*flag; waited += 5) MP_sleep(5);
+    return *flag;
+}
+
+int main(int argc, char *argv[]) {
+    MP_init(PORT);
+    _MP_client_handle_recv = on_client_recv;
+    _MP_server_handle_recv = on_server_recv;
+    _MP_on_client_connected = on_connect;
+    _MP_on_datagram_acked = on_acked;
+
+    MP_set_udp_simulation(LOSS, LATENCY_MS, JITTER_MS);
+
+    MPServer();
+    if (!wait_for(&MP_is_server, 2000)) {
+        printf("Server didn't start \n");
+        return 1;
+    }
+
+    MPClient("127.0.0.1");
+
+    int waited = 0;
+    while (!MPClient_udp_ready() && waited < 3000) {
+        MP_sleep(5);
+        waited += 5;
+    }
+    if (!MPClient_udp_ready()) {
+        printf("UDP channel never came up \n");
+        return 1;
+    }
+    printf("UDP channel up after %d ms \n", waited);
+
+    int first_seq = -1, last_seq = -1, event_counter = 0;
+
+    for (int i = 0; i < SNAPSHOTS; i++) {
+        MPPacket snapshot = {.type = TEST_SNAPSHOT, .len = sizeof(int)};
+
+        int seq = MPClient_send_unreliable(snapshot, &i);
+        if (seq == -1) {
+            printf("Snapshot %d went over TCP \n", i);
+            return 1;
+        }
+        if (first_seq == -1) first_seq = seq;
+        last_seq = seq;
+
+        MPServer_send_unreliable_to(snapshot, &i, server_side_client); // so the client's acks have a ride back
+
+        if (i % EVENT_EVERY == 0) {
+            MPClient_send((MPPacket){.type = TEST_EVENT, .len = sizeof(int)}, &event_counter);
+            event_counter++;
+        }
+
+        MP_sleep(5);
+    }
+
+    MP_sleep(500); // let the shim drain
+
+    int sent = last_seq - first_seq + 1;
+    printf("Client sent %d snapshots, server got %d, client got %d from the server \n", sent, server_snapshots, client_snapshots);
+    printf("Acked %d, %d came after a newer one, rtt %.1f ms \n", client_acks, reordered, MPClient_rtt() * 1000);
+
+    int failures = out_of_order;
+
+    // jitter is bigger than the send interval so plenty arrive late, they're delivered anyway: only the loss is gone
+    if (server_snapshots < SNAPSHOTS * (1 - LOSS) * 0.9 || server_snapshots >= SNAPSHOTS) {
+        printf("Server got an unlikely amount of snapshots \n");
+        failures++;
+    }
+    if (reordered == 0) {
+        printf("Nothing came out of order, the shim's jitter isn't doing anything \n");
+        failures++;
+    }
+    // never more than what arrived, and at most the last few acks lost on the way back
+    if (client_acks > server_snapshots || client_acks < server_snapshots - 32) {
+        printf("Acks don't match what arrived \n");
+        failures++;
+    }
+    if (duplicate_acks > 0) {
+        printf("%d seqs acked twice \n", duplicate_acks);
+        failures++;
+    }
+    if (MPClient_rtt() < LATENCY_MS * 2 / 1000.0 || MPClient_rtt() > 0.5) {
+        printf("Rtt doesn't match the simulated latency \n");
+        failures++;
+    }
+    if (events != event_counter) {
+        printf("Got %d/%d reliable packets \n", events, event_counter);
+        failures++;
+    }
+
+    // with the channel turned off everything goes over TCP and nothing is lost
+    MP_udp_enabled = false;
+    int before = server_snapshots;
+    for (int i = SNAPSHOTS; i < SNAPSHOTS + FALLBACK_SNAPSHOTS; i++) {
+        if (MPClient_send_unreliable((MPPacket){.type = TEST_SNAPSHOT, .len = sizeof(int)}, &i) != -1) {
+            printf("Sent over UDP with the channel disabled \n");
+            failures++;
+        }
+    }
+    MP_sleep(200);
+
+    if (server_snapshots - before != FALLBACK_SNAPSHOTS) {
+        printf("Got %d/%d snapshots over TCP \n", server_snapshots - before, FALLBACK_SNAPSHOTS);
+        failures++;
+    }
+
+    if (failures > 0) {
+        printf("FAILED \n");
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "multiplayer.c"
+#include "packets.h"
+
+// Round-trips random packets of every type through the wire encoding and checks each field comes back
+// within its precision bound, and prints how much smaller things got.
+
+#define ITERATIONS 20000
+#define TILEMAP_SIZE 2040 // TILEMAP_WIDTH * tileSize in the game
+
+// max error per field kind
+#define POS_TOLERANCE (Wire_pos_precision() + 1e-9)
+#define FIXED_TOLERANCE (0.5 / WIRE_FIXED_SCALE + 1e-9)
+#define HEIGHT_TOLERANCE (0.5 / WIRE_HEIGHT_SCALE + 1e-9)
+#define DIR_TOLERANCE (PI / ((1 << WIRE_DIR_BITS) - 1) + 1e-9) // radians
+
+int failures = 0;
+
+double randf(double min, double max) {
+    return min + ((double)rand() / RAND_MAX) * (max - min);
+}
+
+void fill_random(const WireSchema *schema, void *data) {
+    char *base = data;
+    memset(data, 0, schema->size);
+
+    for (int i = 0; i < schema->field_count; i++) {
+        void *field = base + schema->fields[i].offset;
+
+        switch (schema->fields[i].kind) {
+            case WIRE_INT: *(int *)field = rand() % 3 == 0 ? rand() - RAND_MAX / 2 : rand() % 100; break;
+            case WIRE_LONG: *(long *)field = rand(); break;
+            case WIRE_BOOL: *(bool *)field = rand() % 2; break;
+            case WIRE_RGBA: for (int c = 0; c < 4; c++) ((unsigned char *)field)[c] = rand() % 256; break;
+            case WIRE_POS: *(v2 *)field = (v2){randf(0, TILEMAP_SIZE), randf(0, TILEMAP_SIZE * 2.0 / 3)}; break;
+            case WIRE_DIR: {
+                double angle = randf(-PI, PI);
+                *(v2 *)field = (v2){cos(angle), sin(angle)};
+                break;
+            }
+            case WIRE_FIXED: *(double *)field = randf(-5000, 5000); break;
+            case WIRE_FIXED_V2: *(v2 *)field = (v2){randf(-50, 50), randf(-50, 50)}; break;
+            case WIRE_HEIGHT: *(double *)field = randf(-20000, 20000); break;
+        }
+    }
+}
+
+void check(bool ok, int type, int field, const char *what, double error) {
+    if (ok) return;
+    if (failures < 20) printf("Type %d field %d (%s) off by %g \n", type, field, what, error);
+    failures++;
+}
+
+void compare(const WireSchema *schema, int type, const void *a, const void *b) {
+    for (int i = 0; i < schema->field_count; i++) {
+        const void *fa = (const char *)a + schema->fields[i].offset;
+        const void *fb = (const char *)b + schema->fields[i].offset;
+
+        switch (schema->fields[i].kind) {
+            case WIRE_INT: check(*(int *)fa == *(int *)fb, type, i, "int", *(int *)fa - *(int *)fb); break;
+            case WIRE_LONG: check(*(long *)fa == *(long *)fb, type, i, "long", *(long *)fa - *(long *)fb); break;
+            case WIRE_BOOL: check(*(bool *)fa == *(bool *)fb, type, i, "bool", 1); break;
+            case WIRE_RGBA: check(memcmp(fa, fb, 4) == 0, type, i, "rgba", 1); break;
+            case WIRE_POS: {
+                v2 pa = *(v2 *)fa, pb = *(v2 *)fb;
+                double error = fmax(fabs(pa.x - pb.x), fabs(pa.y - pb.y));
+                check(error <= POS_TOLERANCE, type, i, "pos", error);
+                break;
+            }
+            case WIRE_DIR: {
+                v2 da = *(v2 *)fa, db = *(v2 *)fb;
+                double error = fabs(atan2(da.x * db.y - da.y * db.x, da.x * db.x + da.y * db.y));
+                check(error <= DIR_TOLERANCE, type, i, "dir", error);
+                check(fabs(db.x * db.x + db.y * db.y - 1) < 1e-9, type, i, "dir length", db.x * db.x + db.y * db.y);
+                break;
+            }
+            case WIRE_FIXED: {
+                double error = fabs(*(double *)fa - *(double *)fb);
+                check(error <= FIXED_TOLERANCE, type, i, "fixed", error);
+                break;
+            }
+            case WIRE_FIXED_V2: {
+                v2 va = *(v2 *)fa, vb = *(v2 *)fb;
+                double error = fmax(fabs(va.x - vb.x), fabs(va.y - vb.y));
+                check(error <= FIXED_TOLERANCE, type, i, "fixed v2", error);
+                break;
+            }
+            case WIRE_HEIGHT: {
+                double error = fabs(*(double *)fa - *(double *)fb);
+                check(error <= HEIGHT_TOLERANCE, type, i, "height", error);
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    srand(argc > 1 ? atoi(argv[1]) : 42);
+
+    v2 world_size = {TILEMAP_SIZE, TILEMAP_SIZE * 2.0 / 3};
+    Wire_set_world_bounds(v2_mul(world_size, to_vec(-0.5)), v2_mul(world_size, to_vec(1.5)));
+
+    printf("pos precision: %g \n", Wire_pos_precision());
+
+    for (int type = 0; type < PACKETS_END; type++) {
+        const WireSchema *schema = get_packet_schema(type);
+        if (schema == NULL) continue;
+
+        long long raw_bytes = 0, wire_bytes = 0;
+
+        for (int iter = 0; iter < ITERATIONS; iter++) {
+            double original[MP_DEFAULT_BUFFER_SIZE / sizeof(double)];
+            double decoded[MP_DEFAULT_BUFFER_SIZE / sizeof(double)];
+            unsigned char wire[MP_MAX_PAYLOAD];
+
+            fill_random(schema, original);
+
+            int len = encode_packet_payload(type, original, schema->size, wire, sizeof(wire));
+            if (len < 0) {
+                check(false, type, -1, "encode", len);
+                continue;
+            }
+
+            // the decoder has to cope with anything short
+            if (decode_packet_payload(type, wire, len - 1, decoded, sizeof(decoded)) != -1 && len > 0) {
+                check(false, type, -1, "truncated decode", len);
+            }
+
+            if (decode_packet_payload(type, wire, len, decoded, sizeof(decoded)) != schema->size) {
+                check(false, type, -1, "decode", len);
+                continue;
+            }
+
+            compare(schema, type, original, decoded);
+
+            unsigned char header[MP_MAX_HEADER_SIZE];
+            raw_bytes += sizeof(MPPacket) + schema->size;
+            wire_bytes += MP_encode_header((MPPacket){.type = type, .len = len, .is_broadcast = true}, header) + len;
+        }
+
+        printf("type %2d: %5.1f -> %4.1f bytes per packet \n", type, (double)raw_bytes / ITERATIONS, (double)wire_bytes / ITERATIONS);
+    }
+
+    // things past the world bounds get clamped instead of wrapping around
+    struct sync_projectile_packet far = {.pos = {1e9, -1e9}};
+    struct sync_projectile_packet far_decoded;
+    unsigned char wire[MP_MAX_PAYLOAD];
+    int len = encode_packet_payload(PACKET_SYNC_PROJECTILE, &far, sizeof(far), wire, sizeof(wire));
+    decode_packet_payload(PACKET_SYNC_PROJECTILE, wire, len, &far_decoded, sizeof(far_decoded));
+    if (far_decoded.pos.x != wire_world_max.x || far_decoded.pos.y != wire_world_min.y) {
+        printf("Out of bounds position came back as (%f, %f) \n", far_decoded.pos.x, far_decoded.pos.y);
+        failures++;
+    }
+
+    if (failures > 0) {
+        printf("FAILED: %d \n", failures);
+        return 1;
+    }
+
+    printf("OK \n");
+    return 0;
+}